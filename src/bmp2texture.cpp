@@ -1,5 +1,14 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <immintrin.h>
+
 #include "./slim/platforms/win32_bitmap.h"
 #include "./slim/serialization/texture.h"
+#include "./slim/core/parallel.h"
+
+#define BMP2TEXTURE_MAX_PATH 260
 
 
 struct PixelQuad {
@@ -26,11 +35,15 @@ struct TextureMipLoader {
     Pixel *texels;
     PixelQuad *texel_quads;
 
-    void init(u32 Width, u32 Height) {
+    static u64 getSizeInBytes(u32 Width, u32 Height) {
+        return sizeof(Pixel) * Width * Height + sizeof(PixelQuad) * (Width + 1) * (Height + 1);
+    }
+
+    void init(u32 Width, u32 Height, memory::MonotonicAllocator &memory) {
         width = Width;
         height = Height;
-        texels = new Pixel[width * height];
-        texel_quads = new PixelQuad[(width + 1) * (height + 1)];
+        texels = (Pixel*)memory.allocate(sizeof(Pixel) * width * height);
+        texel_quads = (PixelQuad*)memory.allocate(sizeof(PixelQuad) * (width + 1) * (height + 1));
     }
 
     void load(bool wrap,
@@ -97,7 +110,7 @@ struct TextureMipLoader {
         if (cube_map_loader_mode) {
             u32 h = height;
             u32 w = h;
-            u32 quad_w = (w + 1) * 4;
+            u32 quad_w = w + 1;
             u32 s = w * h;
             u32 last        = w - 1;
             u32 last_row    = w * last;
@@ -113,17 +126,17 @@ struct TextureMipLoader {
                         top_line[1 + Lo].TL = top_line[Lo].TR = top_face_texels[w * i];
                         top_line[1 + Fo].TL = top_line[Fo].TR = top_face_texels[last_row + i];
                         top_line[1 + Ro].TL = top_line[Ro].TR = top_face_texels[last_texel - (w * i)];
-                        top_line[1 + Bo].TL = top_line[Bo].TR = top_face_texels[w - i];
+                        top_line[1 + Bo].TL = top_line[Bo].TR = top_face_texels[last - i];
 
                         bottom_line[1 + Lo].BL = bottom_line[Lo].BR = bottom_face_texels[w * (last - i)];
                         bottom_line[1 + Fo].BL = bottom_line[Fo].BR = bottom_face_texels[i];
                         bottom_line[1 + Ro].BL = bottom_line[Ro].BR = bottom_face_texels[w * i + last];
-                        bottom_line[1 + Bo].BL = bottom_line[Bo].BR = bottom_face_texels[last_row + (w - i)];
+                        bottom_line[1 + Bo].BL = bottom_line[Bo].BR = bottom_face_texels[last_row + (last - i)];
                     }
                     top_line[            0].TL = top_face_texels[0].lerpTo(texels[width - 1], 0.5f);
-                    top_line[   quad_w - 1].TR = top_face_texels[0].lerpTo(texels[0        ], 0.5f);
+                    top_line[        width].TR = top_face_texels[0].lerpTo(texels[0        ], 0.5f);
                     bottom_line[         0].BL = bottom_face_texels[last_row].lerpTo(texels[width * last], 0.5f);
-                    bottom_line[quad_w - 1].BR = bottom_face_texels[last_row].lerpTo(texels[0           ], 0.5f);
+                    bottom_line[     width].BR = bottom_face_texels[last_row].lerpTo(texels[0           ], 0.5f);
                 } break;
                 case CubeMapLoaderMode_Top: {
                     Pixel *left_face_top_texel  = main_faces_texels + Lo;
@@ -141,7 +154,6 @@ struct TextureMipLoader {
                     PixelQuad *left_column  = texel_quads;
                     PixelQuad *right_column = texel_quads + w;
 
-                    quad_w = w + 1;
                     for (u32 i = 0; i < h; i++,
                         left_column += quad_w,
                         right_column += quad_w,
@@ -178,7 +190,6 @@ struct TextureMipLoader {
                     PixelQuad *left_column  = texel_quads;
                     PixelQuad *right_column = texel_quads + w;
 
-                    quad_w = w + 1;
                     for (u32 i = 0; i < h; i++,
                         left_column += quad_w,
                         right_column += quad_w,
@@ -198,63 +209,248 @@ struct TextureMipLoader {
     }
 };
 
-void loadMips(Texture &texture, TextureMipLoader *mips) {
-    TextureMipLoader *current_mip = mips;
-    TextureMipLoader *next_mip = current_mip + 1;
+INLINE u32 getTexelIndex(i32 index, u32 size, bool wrap) {
+    if (index < 0) return wrap ? (u32)(index + (i32)size) : 0;
+    if (index >= (i32)size) return wrap ? (u32)(index - (i32)size) : size - 1;
+    return (u32)index;
+}
 
-    u32 mip_width  = texture.width;
-    u32 mip_height = texture.height;
+enum MipFilter {
+    MipFilter_Box,
+    MipFilter_Lanczos,
+    MipFilter_Kaiser
+};
 
-    PixelQuad *colors_quad;
-    u32 stride, offset, start;
+// The windowed-sinc mip filters reach this many texels of the smaller mip to either side of a texel, so 4 times as many
+// texels of the larger mip. Every texel is centered between 2 larger texels, so all texels share the same weights:
+#define MIP_FILTER_RADIUS 3
+#define MIP_FILTER_TAPS (MIP_FILTER_RADIUS * 4)
+#define MIP_FILTER_KAISER_BETA 4.0f
 
-    while (mip_width > 4 && mip_height > 4) {
-        start = mip_width + 1;
-        stride = start * 2;
+f32 sinc(f32 x) {
+    if (x == 0.0f) return 1.0f;
+    x *= pi;
+    return sinf(x) / x;
+}
 
-        mip_width  /= 2;
-        mip_height /= 2;
+// Modified Bessel function of the first kind and order 0 (power series):
+f32 besselI0(f32 x) {
+    f32 sum = 1.0f;
+    f32 term = 1.0f;
+    x *= 0.5f;
+    for (u32 k = 1; k < 16; k++) {
+        term *= x / (f32)k;
+        sum += term * term;
+    }
+    return sum;
+}
 
-        next_mip->init(mip_width, mip_height);
+void getMipFilterWeights(MipFilter filter, f32 *weights) {
+    f32 sum = 0.0f;
+    for (u32 k = 0; k < MIP_FILTER_TAPS; k++) {
+        // Distance from the texel's center, in texels of the smaller mip:
+        f32 t = ((f32)k - (f32)(MIP_FILTER_TAPS - 1) * 0.5f) * 0.5f;
+        f32 w = t / (f32)MIP_FILTER_RADIUS;
+        f32 window = filter == MipFilter_Kaiser ?
+                     besselI0(MIP_FILTER_KAISER_BETA * sqrtf(1.0f - w * w)) / besselI0(MIP_FILTER_KAISER_BETA) :
+                     sinc(w);
+        weights[k] = sinc(t) * window;
+        sum += weights[k];
+    }
+    for (u32 k = 0; k < MIP_FILTER_TAPS; k++) weights[k] /= sum;
+}
 
-        for (u32 y = 0; y < mip_height; y++) {
-            offset = start + 1;
+// Converts the bitmap's components into linear texels, splitting the rows across threads.
+// Gamma is looked up per component (normal maps still go through componentsToPixel() to get renormalized):
+void loadTexels(u8 *components, ImageInfo &info, Pixel *texels, u32 thread_count) {
+    f32 to_linear[256];
+    for (u32 i = 0; i < 256; i++) {
+        f32 component = (f32)i * COLOR_COMPONENT_TO_FLOAT;
+        to_linear[i] = info.flags.linear ? component : powf(component, 2.2f);
+    }
 
-            for (u32 x = 0; x < mip_width; x++) {
-                colors_quad = current_mip->texel_quads + offset;
-                next_mip->texels[mip_width * y + x].color = colors_quad->getAverageColor();
-                offset += 2;
+    u32 component_count = info.flags.alpha ? 4 : 3;
+    parallelFor(info.height, thread_count, [&](u32 first_row, u32 end_row) {
+        u8 *component = components + (u64)component_count * info.width * first_row;
+        Pixel *texel = texels + (u64)info.width * first_row;
+        u32 count = info.width * (end_row - first_row);
+        if (info.flags.normal)
+            for (u32 i = 0; i < count; i++, texel++)
+                component = componentsToPixel(component, texel, info);
+        else
+            for (u32 i = 0; i < count; i++, texel++, component += component_count) {
+                texel->color.b = to_linear[component[0]];
+                texel->color.g = to_linear[component[1]];
+                texel->color.r = to_linear[component[2]];
+                texel->opacity = info.flags.alpha ? (f32)component[3] * COLOR_COMPONENT_TO_FLOAT : 0.0f;
             }
+    });
+}
 
-            start += stride;
+// Averages every 2x2 texels into a texel of the next mip (summed in the same order as PixelQuad::getAverageColor()):
+void downsampleBox(const Pixel *texels, u32 width, Pixel *mip_texels, u32 mip_width, u32 mip_height, u32 thread_count) {
+    parallelFor(mip_height, thread_count, [=](u32 first_row, u32 end_row) {
+        const __m128 quarter = _mm_set1_ps(0.25f);
+        for (u32 y = first_row; y < end_row; y++) {
+            const f32 *top = (const f32*)(texels + (u64)width * y * 2);
+            const f32 *bottom = top + width * 4;
+            f32 *mip_texel = (f32*)(mip_texels + (u64)mip_width * y);
+            for (u32 x = 0; x < mip_width; x++, top += 8, bottom += 8, mip_texel += 4) {
+                __m128 sum = _mm_add_ps(_mm_loadu_ps(top), _mm_loadu_ps(top + 4));
+                sum = _mm_add_ps(_mm_add_ps(sum, _mm_loadu_ps(bottom)), _mm_loadu_ps(bottom + 4));
+                _mm_storeu_ps(mip_texel, _mm_mul_ps(sum, quarter));
+            }
         }
+    });
+}
 
-        next_mip->load(texture.flags.wrap);
+// Filters texels into the next mip with a separable windowed-sinc filter, first horizontally into filtered_rows
+// (of the mip's width and the texels' height) then vertically. Taps past the edges wrap around or get clamped.
+// Results are clamped to [0, 1], as the negative lobes overshoot around sharp edges:
+void downsampleWindowedSinc(const Pixel *texels, u32 width, u32 height, Pixel *filtered_rows,
+                            Pixel *mip_texels, u32 mip_width, u32 mip_height,
+                            const f32 *weights, bool wrap, u32 thread_count) {
+    parallelFor(height, thread_count, [=](u32 first_row, u32 end_row) {
+        __m128 tap_weights[MIP_FILTER_TAPS];
+        for (u32 k = 0; k < MIP_FILTER_TAPS; k++) tap_weights[k] = _mm_set1_ps(weights[k]);
+
+        for (u32 y = first_row; y < end_row; y++) {
+            const f32 *row = (const f32*)(texels + (u64)width * y);
+            f32 *filtered = (f32*)(filtered_rows + (u64)mip_width * y);
+            for (u32 x = 0; x < mip_width; x++, filtered += 4) {
+                i32 first_tap = (i32)(x * 2 + 1) - MIP_FILTER_TAPS / 2;
+                __m128 sum = _mm_setzero_ps();
+                for (u32 k = 0; k < MIP_FILTER_TAPS; k++)
+                    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(row + 4 * getTexelIndex(first_tap + (i32)k, width, wrap)), tap_weights[k]));
+                _mm_storeu_ps(filtered, sum);
+            }
+        }
+    });
+
+    parallelFor(mip_height, thread_count, [=](u32 first_row, u32 end_row) {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        __m128 tap_weights[MIP_FILTER_TAPS];
+        for (u32 k = 0; k < MIP_FILTER_TAPS; k++) tap_weights[k] = _mm_set1_ps(weights[k]);
+
+        const f32 *rows[MIP_FILTER_TAPS];
+        for (u32 y = first_row; y < end_row; y++) {
+            i32 first_tap = (i32)(y * 2 + 1) - MIP_FILTER_TAPS / 2;
+            for (u32 k = 0; k < MIP_FILTER_TAPS; k++)
+                rows[k] = (const f32*)(filtered_rows + (u64)mip_width * getTexelIndex(first_tap + (i32)k, height, wrap));
+
+            f32 *mip_texel = (f32*)(mip_texels + (u64)mip_width * y);
+            for (u32 x = 0; x < mip_width; x++, mip_texel += 4) {
+                __m128 sum = _mm_setzero_ps();
+                for (u32 k = 0; k < MIP_FILTER_TAPS; k++)
+                    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[k] + 4 * x), tap_weights[k]));
+                _mm_storeu_ps(mip_texel, _mm_min_ps(_mm_max_ps(sum, zero), one));
+            }
+        }
+    });
+}
 
-        current_mip++;
-        next_mip++;
-    }
+// Converts texels to 8-bit components (truncating, as before), 4 texels at a time:
+void quantizeTexels(const Pixel *texels, u32 count, BlockTexel *quantized_texels, u32 thread_count) {
+    parallelFor(count / 4, thread_count, [=](u32 first, u32 end) {
+        const __m128 scale = _mm_set1_ps(FLOAT_TO_COLOR_COMPONENT);
+        const __m128i rgb_mask = _mm_set1_epi32(0x00FFFFFF);
+        const f32 *texel = (const f32*)(texels + first * 4);
+        __m128i *quantized = (__m128i*)(quantized_texels + first * 4);
+        for (u32 i = first; i < end; i++, texel += 16, quantized++) {
+            __m128i t0 = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(texel +  0), scale));
+            __m128i t1 = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(texel +  4), scale));
+            __m128i t2 = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(texel +  8), scale));
+            __m128i t3 = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(texel + 12), scale));
+            __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(t0, t1), _mm_packs_epi32(t2, t3));
+            _mm_storeu_si128(quantized, _mm_and_si128(bytes, rgb_mask));
+        }
+    });
+
+    for (u32 i = count & ~3u; i < count; i++)
+        quantized_texels[i] = {
+                (u8)(texels[i].color.r * FLOAT_TO_COLOR_COMPONENT),
+                (u8)(texels[i].color.g * FLOAT_TO_COLOR_COMPONENT),
+                (u8)(texels[i].color.b * FLOAT_TO_COLOR_COMPONENT),
+                0
+        };
 }
 
-int main(int argc, char *argv[]) {
-    Texture texture;
+// Stores 4 RGBX texels (top left, top right, bottom left, bottom right) as a texel quad,
+// transposing them into the 4 corners of R, then of G, then of B:
+INLINE void storeTexelQuad(__m128i texels, TexelQuad &texel_quad) {
+    __m128i interleaved = _mm_unpacklo_epi8(texels, _mm_srli_si128(texels, 8));
+    __m128i transposed = _mm_unpacklo_epi8(interleaved, _mm_srli_si128(interleaved, 8));
+    _mm_storel_epi64((__m128i*)&texel_quad, transposed);
 
-    char* bitmap_file_path = argv[1];
-    char* texture_file_path = argv[2];
-    for (u8 i = 3; i < (u8)argc; i++) {
-        if (     argv[i][0] == '-' && argv[i][1] == 'f') texture.flags.flip = true;
-        else if (argv[i][0] == '-' && argv[i][1] == 'l') texture.flags.linear = true;
-        else if (argv[i][0] == '-' && argv[i][1] == 't') texture.flags.tile = true;
-        else if (argv[i][0] == '-' && argv[i][1] == 'm') texture.flags.mipmap = true;
-        else if (argv[i][0] == '-' && argv[i][1] == 'w') texture.flags.wrap = true;
-        else if (argv[i][0] == '-' && argv[i][1] == 'n') texture.flags.normal = true;
-        else if (argv[i][0] == '-' && argv[i][1] == 'c') texture.flags.cubemap = true;
-        else return 0;
-    }
+    int blue = _mm_cvtsi128_si32(_mm_srli_si128(transposed, 8));
+    memcpy(&texel_quad.B, &blue, sizeof(int));
+}
+
+INLINE __m128i gatherTexels(const BlockTexel &TL, const BlockTexel &TR, const BlockTexel &BL, const BlockTexel &BR) {
+    int texels[4];
+    memcpy(texels + 0, &TL, sizeof(int));
+    memcpy(texels + 1, &TR, sizeof(int));
+    memcpy(texels + 2, &BL, sizeof(int));
+    memcpy(texels + 3, &BR, sizeof(int));
+    return _mm_loadu_si128((const __m128i*)texels);
+}
+
+// Expands a mip's quantized texels into its texel quads. Quad (x, y) has texels (x - 1, y - 1) to (x, y) as its
+// corners, wrapping around or clamping to the edges (same as TextureMipLoader::load() does without a cube map):
+void expandTexelQuads(const BlockTexel *texels, u32 width, u32 height, bool wrap, TexelQuad *texel_quads, u32 thread_count) {
+    parallelFor(height + 1, thread_count, [=](u32 first_row, u32 end_row) {
+        u32 left  = getTexelIndex(-1, width, wrap);
+        u32 right = getTexelIndex((i32)width, width, wrap);
+        for (u32 y = first_row; y < end_row; y++) {
+            const BlockTexel *top    = texels + (u64)width * getTexelIndex((i32)y - 1, height, wrap);
+            const BlockTexel *bottom = texels + (u64)width * getTexelIndex((i32)y, height, wrap);
+            TexelQuad *texel_quad = texel_quads + (u64)(width + 1) * y;
+
+            storeTexelQuad(gatherTexels(top[left], top[0], bottom[left], bottom[0]), texel_quad[0]);
+            for (u32 x = 1; x < width; x++)
+                storeTexelQuad(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(top + x - 1)),
+                                                  _mm_loadl_epi64((const __m128i*)(bottom + x - 1))), texel_quad[x]);
+            storeTexelQuad(gatherTexels(top[width - 1], top[right], bottom[width - 1], bottom[right]), texel_quad[width]);
+        }
+    });
+}
+
+// Converts the float texel quads of a cube map's loader to 8-bit components (truncating, as before):
+void quantizeTexelQuads(const PixelQuad *pixel_quads, u32 count, TexelQuad *texel_quads, u32 thread_count) {
+    parallelFor(count, thread_count, [=](u32 first, u32 end) {
+        const __m128 scale = _mm_set1_ps(FLOAT_TO_COLOR_COMPONENT);
+        for (u32 i = first; i < end; i++) {
+            const f32 *corners = (const f32*)(pixel_quads + i);
+            __m128i TL = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(corners +  0), scale));
+            __m128i TR = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(corners +  4), scale));
+            __m128i BL = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(corners +  8), scale));
+            __m128i BR = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(corners + 12), scale));
+            storeTexelQuad(_mm_packus_epi16(_mm_packs_epi32(TL, TR), _mm_packs_epi32(BL, BR)), texel_quads[i]);
+        }
+    });
+}
+
+struct ConversionSettings {
+    ImageFlags flags;
+    MipFilter mip_filter = MipFilter_Box;
+    bool compress = false;
+    bool tiled = false;
+    bool blocked = false;
+};
+
+bool convertBitmap(char *bitmap_file_path, char *texture_file_path, const ConversionSettings &settings, u32 thread_count) {
+    Texture texture;
+    texture.flags = settings.flags;
 
-    u8* components = loadBitmap(bitmap_file_path, texture);
-    TextureMipLoader *loader_mips = nullptr;
+    if (!loadBitmapHeader(bitmap_file_path, texture)) return false;
+    ImageFlags bitmap_flags = texture.flags;
 
+    // Dimensions of every mip, to size all the memory needed up-front:
+    u32 mip_widths[32], mip_heights[32];
+    mip_widths[0]  = texture.width;
+    mip_heights[0] = texture.height;
+    texture.mip_count = 1;
     texture.flags.channel = false;
     if (texture.flags.cubemap) {
         texture.flags.wrap = false;
@@ -262,19 +458,65 @@ int main(int argc, char *argv[]) {
         texture.flags.mipmap = false;
         texture.flags.tile = false;
         texture.mip_count = 3;
+        mip_widths[0] = texture.height * 4;
+        mip_widths[1] = mip_widths[2] = mip_heights[1] = mip_heights[2] = texture.height;
+    } else if (texture.flags.mipmap)
+        while (mip_widths[texture.mip_count - 1] > 4 && mip_heights[texture.mip_count - 1] > 4) {
+            mip_widths[ texture.mip_count] = mip_widths[ texture.mip_count - 1] / 2;
+            mip_heights[texture.mip_count] = mip_heights[texture.mip_count - 1] / 2;
+            texture.mip_count++;
+        }
 
+    bool blocked = settings.blocked && !settings.tiled;
+    u64 texel_count = (u64)texture.width * texture.height;
+    u64 memory_size = sizeof(TextureMip) * texture.mip_count + sizeof(Pixel) * texel_count;
+    for (u16 i = 0; i < texture.mip_count; i++) {
+        memory_size += sizeof(TexelQuad) * (mip_widths[i] + 1) * (mip_heights[i] + 1);
+        if (blocked) memory_size += sizeof(TexelBlock) * getTexelBlockCount(mip_widths[i], mip_heights[i]);
+    }
+    if (texture.flags.cubemap)
+        for (u16 i = 0; i < texture.mip_count; i++)
+            memory_size += TextureMipLoader::getSizeInBytes(mip_widths[i], mip_heights[i]);
+    else {
+        // The next mip (ping-ponging with the texels), the rows filtered horizontally and the quantized texels:
+        u32 half_width = texture.width / 2;
+        memory_size += sizeof(Pixel) * half_width * (texture.height / 2);
+        if (settings.mip_filter != MipFilter_Box) memory_size += sizeof(Pixel) * half_width * texture.height;
+        memory_size += sizeof(BlockTexel) * texel_count;
+    }
+    memory_size += getBitmapLoadingSize(texture);
+
+    // Everything is transient (the texture is saved before returning), so it all comes from this thread's scratch arena:
+    memory::MonotonicAllocator &memory = memory::getScratchArena(memory_size);
+    memory::ScratchScope scratch_scope{memory};
+    if (memory.capacity - memory.occupied < memory_size) return false;
+
+    // Loaded with the flags as they were given, before the ones that do not apply to the output got cleared:
+    ImageFlags texture_flags = texture.flags;
+    texture.flags = bitmap_flags;
+    u8* components = loadBitmap(bitmap_file_path, texture, &memory);
+    texture.flags = texture_flags;
+    if (!components) return false;
+
+    texture.mips = (TextureMip*)memory.allocate(sizeof(TextureMip) * texture.mip_count);
+    for (u16 i = 0; i < texture.mip_count; i++) {
+        TextureMip &mip = texture.mips[i];
+        mip.width  = mip_widths[i];
+        mip.height = mip_heights[i];
+        mip.texel_quads = (TexelQuad*)memory.allocate(sizeof(TexelQuad) * (mip.width + 1) * (mip.height + 1));
+    }
+
+    Pixel *texels = (Pixel*)memory.allocate(sizeof(Pixel) * texel_count);
+    loadTexels(components, texture, texels, thread_count);
+
+    if (texture.flags.cubemap) {
         u32 face_width = texture.height;
         u32 main_width = face_width * 4;
 
-        loader_mips = new TextureMipLoader[3];
-        loader_mips[0].init(main_width, texture.height);
-        loader_mips[1].init(face_width, texture.height);
-        loader_mips[2].init(face_width, texture.height);
+        TextureMipLoader loader_mips[3];
+        for (u16 i = 0; i < 3; i++) loader_mips[i].init(mip_widths[i], mip_heights[i], memory);
 
-        Pixel *all_texels = new Pixel[texture.width * texture.height];
-        componentsToPixels(components, texture, all_texels);
-
-        Pixel *texel = all_texels;
+        Pixel *texel = texels;
         for (u32 y = 0; y < texture.height; y++)
             for (u32 x = 0; x < texture.width; x++, texel++)
                 if (x < main_width)
@@ -284,63 +526,149 @@ int main(int argc, char *argv[]) {
                 else
                     loader_mips[2].texels[(texture.height * y) + (x - (main_width + face_width))] = *texel;
 
-        delete[] all_texels;
         loader_mips[0].load(texture.flags.wrap, CubeMapLoaderMode_Main, nullptr, loader_mips[1].texels, loader_mips[2].texels);
         loader_mips[1].load(texture.flags.wrap, CubeMapLoaderMode_Top, loader_mips[0].texels);
         loader_mips[2].load(texture.flags.wrap, CubeMapLoaderMode_Bottom, loader_mips[0].texels);
+
+        for (u16 i = 0; i < 3; i++)
+            quantizeTexelQuads(loader_mips[i].texel_quads, (mip_widths[i] + 1) * (mip_heights[i] + 1),
+                               texture.mips[i].texel_quads, thread_count);
     } else {
-        texture.mip_count = 1;
-        if (texture.flags.mipmap) {
-            u32 mip_width  = texture.width;
-            u32 mip_height = texture.height;
-            while (mip_width > 4 && mip_height > 4) {
-                mip_width /= 2;
-                mip_height /= 2;
-                texture.mip_count++;
-            }
+        Pixel *mip_texels = (Pixel*)memory.allocate(sizeof(Pixel) * (texture.width / 2) * (texture.height / 2));
+        Pixel *filtered_rows = settings.mip_filter == MipFilter_Box ? nullptr :
+                               (Pixel*)memory.allocate(sizeof(Pixel) * (texture.width / 2) * texture.height);
+        BlockTexel *quantized_texels = (BlockTexel*)memory.allocate(sizeof(BlockTexel) * texel_count);
+
+        f32 weights[MIP_FILTER_TAPS];
+        if (filtered_rows) getMipFilterWeights(settings.mip_filter, weights);
+
+        // Each mip is quantized and expanded into texel quads before being filtered into the next one,
+        // whose texels then take the place of the current mip's:
+        for (u16 i = 0; i < texture.mip_count; i++) {
+            const TextureMip &mip = texture.mips[i];
+            quantizeTexels(texels, mip.width * mip.height, quantized_texels, thread_count);
+            expandTexelQuads(quantized_texels, mip.width, mip.height, texture.flags.wrap, mip.texel_quads, thread_count);
+            if (i + 1 == texture.mip_count) break;
+
+            const TextureMip &next_mip = texture.mips[i + 1];
+            if (filtered_rows)
+                downsampleWindowedSinc(texels, mip.width, mip.height, filtered_rows,
+                                       mip_texels, next_mip.width, next_mip.height,
+                                       weights, texture.flags.wrap, thread_count);
+            else
+                downsampleBox(texels, mip.width, mip_texels, next_mip.width, next_mip.height, thread_count);
+
+            Pixel *next_texels = mip_texels;
+            mip_texels = texels;
+            texels = next_texels;
         }
+    }
 
-        auto *mips = new TextureMipLoader[texture.mip_count];
-        mips->init(texture.width, texture.height);
-        componentsToPixels(components, texture, mips->texels);
-
-        mips->load(texture.flags.wrap);
-        if (texture.flags.mipmap) loadMips(texture, mips);
+    if (blocked) {
+        bool converted[32];
+        for (u16 i = 0; i < texture.mip_count; i++) {
+            TextureMip &mip = texture.mips[i];
+            mip.texel_blocks = (TexelBlock*)memory.allocate(sizeof(TexelBlock) * getTexelBlockCount(mip.width, mip.height));
+        }
+        parallelFor(texture.mip_count, thread_count, [&](u32 first, u32 end) {
+            for (u32 i = first; i < end; i++) converted[i] = convertTexelQuadsToBlocks(texture.mips[i], texture.mips[i].texel_blocks);
+        });
+
+        texture.flags.blocked = true;
+        for (u16 i = 0; i < texture.mip_count; i++)
+            if (!converted[i]) {
+                printf("Texel quads do not share their edges, keeping them as they are\n");
+                texture.flags.blocked = false;
+                break;
+            }
     }
 
-    // Create final mips with 8-bit per channel from the float channels in the mip loaders:
-    texture.mips = new TextureMip[texture.mip_count];
-    TextureMip *mip = texture.mips;
-    TextureMipLoader *loader_mip = loader_mips;
-    for (u16 i = 0; i < texture.mip_count; i++, mip++, loader_mip++) {
-        mip->width  = loader_mip->width;
-        mip->height = loader_mip->height;
-        mip->texel_quads = new TexelQuad[(mip->width + 1) * (mip->height + 1)];
-
-        TexelQuad *texel_quad = mip->texel_quads;
-        PixelQuad *loader_texel_quad = loader_mip->texel_quads;
-        u32 texel_quads_count = (u32)(mip->width + 1) * (u32)(mip->height + 1);
-        for (u32 t = 0; t < texel_quads_count; t++, texel_quad++, loader_texel_quad++) {
-            texel_quad->R.TL = (u8)(loader_texel_quad->TL.color.r * FLOAT_TO_COLOR_COMPONENT);
-            texel_quad->G.TL = (u8)(loader_texel_quad->TL.color.g * FLOAT_TO_COLOR_COMPONENT);
-            texel_quad->B.TL = (u8)(loader_texel_quad->TL.color.b * FLOAT_TO_COLOR_COMPONENT);
-
-            texel_quad->R.TR = (u8)(loader_texel_quad->TR.color.r * FLOAT_TO_COLOR_COMPONENT);
-            texel_quad->G.TR = (u8)(loader_texel_quad->TR.color.g * FLOAT_TO_COLOR_COMPONENT);
-            texel_quad->B.TR = (u8)(loader_texel_quad->TR.color.b * FLOAT_TO_COLOR_COMPONENT);
-
-            texel_quad->R.BL = (u8)(loader_texel_quad->BL.color.r * FLOAT_TO_COLOR_COMPONENT);
-            texel_quad->G.BL = (u8)(loader_texel_quad->BL.color.g * FLOAT_TO_COLOR_COMPONENT);
-            texel_quad->B.BL = (u8)(loader_texel_quad->BL.color.b * FLOAT_TO_COLOR_COMPONENT);
-
-            texel_quad->R.BR = (u8)(loader_texel_quad->BR.color.r * FLOAT_TO_COLOR_COMPONENT);
-            texel_quad->G.BR = (u8)(loader_texel_quad->BR.color.g * FLOAT_TO_COLOR_COMPONENT);
-            texel_quad->B.BR = (u8)(loader_texel_quad->BR.color.b * FLOAT_TO_COLOR_COMPONENT);
+    bool saved;
+    if (settings.tiled)         saved = saveTiled(texture, texture_file_path);
+    else if (settings.compress) saved = saveCompressed(texture, texture_file_path);
+    else                        saved = save(texture, texture_file_path);
 
+    return saved;
+}
+
+struct BitmapFiles {
+    char (*names)[BMP2TEXTURE_MAX_PATH] = nullptr;
+    u32 count = 0;
+};
+
+// Counts the bitmaps on a first pass (while names is null) then stores their names on a second one:
+void addBitmapFile(const char *file_name, void *data) {
+    BitmapFiles &files = *(BitmapFiles*)data;
+    if (files.names) snprintf(files.names[files.count], BMP2TEXTURE_MAX_PATH, "%s", file_name);
+    files.count++;
+}
+
+// Converts every bitmap of a directory into a texture of the same name in another directory.
+// Bitmaps are picked up by threads as they become free, each one converting a whole bitmap on its own:
+bool convertBitmaps(char *bitmaps_directory_path, char *textures_directory_path, const ConversionSettings &settings, u32 thread_count) {
+    BitmapFiles files;
+    if (!os::forEachFileInDirectory(bitmaps_directory_path, "*.bmp", addBitmapFile, &files)) return false;
+    if (!files.count) return true;
+
+    memory::MonotonicAllocator memory{sizeof(files.names[0]) * files.count};
+    files.names = (char (*)[BMP2TEXTURE_MAX_PATH])memory.allocate(sizeof(files.names[0]) * files.count);
+    if (!files.names) return false;
+    u32 file_count = files.count;
+    files.count = 0;
+    os::forEachFileInDirectory(bitmaps_directory_path, "*.bmp", addBitmapFile, &files);
+    files.count = Min(files.count, file_count);
+
+    std::atomic<u32> next_file{0};
+    std::atomic<u32> failed_file_count{0};
+    parallelFor(thread_count, thread_count, [&](u32, u32) {
+        char bitmap_file_path[BMP2TEXTURE_MAX_PATH * 2];
+        char texture_file_path[BMP2TEXTURE_MAX_PATH * 2];
+        for (u32 i = next_file++; i < files.count; i = next_file++) {
+            const char *name = files.names[i];
+            const char *extension = strrchr(name, '.');
+            int name_length = extension ? (int)(extension - name) : (int)strlen(name);
+            snprintf(bitmap_file_path, sizeof(bitmap_file_path), "%s\\%s", bitmaps_directory_path, name);
+            snprintf(texture_file_path, sizeof(texture_file_path), "%s\\%.*s.texture", textures_directory_path, name_length, name);
+            if (!convertBitmap(bitmap_file_path, texture_file_path, settings, 1)) {
+                printf("Failed to convert %s\n", bitmap_file_path);
+                failed_file_count++;
+            }
         }
+    });
+
+    printf("Converted %u of %u bitmaps\n", (unsigned int)(files.count - failed_file_count), (unsigned int)files.count);
+    memory.releaseMemory();
+    return failed_file_count == 0;
+}
+
+int main(int argc, char *argv[]) {
+    char* bitmap_file_path = argv[1];
+    char* texture_file_path = argv[2];
+    ConversionSettings settings;
+    bool batch = false;
+    u32 thread_count = getThreadCount();
+    for (u8 i = 3; i < (u8)argc; i++) {
+        if (     argv[i][0] == '-' && argv[i][1] == 'f') settings.flags.flip = true;
+        else if (argv[i][0] == '-' && argv[i][1] == 'l') settings.flags.linear = true;
+        else if (argv[i][0] == '-' && argv[i][1] == 't') settings.flags.tile = true;
+        else if (argv[i][0] == '-' && argv[i][1] == 'm') settings.flags.mipmap = true;
+        else if (argv[i][0] == '-' && argv[i][1] == 'w') settings.flags.wrap = true;
+        else if (argv[i][0] == '-' && argv[i][1] == 'n') settings.flags.normal = true;
+        else if (argv[i][0] == '-' && argv[i][1] == 'c') settings.flags.cubemap = true;
+        else if (argv[i][0] == '-' && argv[i][1] == 'z') settings.compress = true;
+        else if (argv[i][0] == '-' && argv[i][1] == 's') settings.tiled = true;
+        else if (argv[i][0] == '-' && argv[i][1] == 'b') settings.blocked = true;
+        else if (argv[i][0] == '-' && argv[i][1] == 'q') settings.mip_filter = MipFilter_Lanczos;
+        else if (argv[i][0] == '-' && argv[i][1] == 'k') settings.mip_filter = MipFilter_Kaiser;
+        else if (argv[i][0] == '-' && argv[i][1] == 'd') batch = true;
+        else if (argv[i][0] == '-' && argv[i][1] == 'j') thread_count = (u32)atoi(argv[i] + 2);
+        else return 0;
     }
+    thread_count = Max(Min(thread_count, (u32)PARALLEL_MAX_THREADS), 1u);
 
-    save(texture, texture_file_path);
+    bool converted = batch ?
+        convertBitmaps(bitmap_file_path, texture_file_path, settings, thread_count) :
+        convertBitmap(bitmap_file_path, texture_file_path, settings, thread_count);
 
-    return 0;
-}
\ No newline at end of file
+    return converted ? 0 : 1;
+}
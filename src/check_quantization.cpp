@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "./slim/scene/vertex_quantization.h"
+
+// Or using the single-header file:
+// #include "../slim.h"
+
+// Round-trips random vertices through the encodings of compact GPU vertices (see scene/vertex_quantization.h) and
+// fails when any decoded attribute strays further than these bounds:
+#define CHECK_QUANTIZATION_DEFAULT_VERTEX_COUNT 1000000
+
+// Positions: half a step of the 16 bits across the extent (plus a little for f32 rounding):
+#define CHECK_QUANTIZATION_MAX_POSITION_ERROR (0.5f / 65535.0f + 1e-6f)
+
+// Normals and tangents: The angle (in degrees) between the direction and its decoding:
+#define CHECK_QUANTIZATION_MAX_DIRECTION_ERROR 0.7f
+
+// Uvs: Half a step of the 10 bit mantissa of half floats, relative to the value (below the smallest normal half,
+// the steps are of a fixed size instead):
+#define CHECK_QUANTIZATION_MAX_UV_ERROR (1.0f / 2048.0f)
+#define CHECK_QUANTIZATION_MAX_UV_DENORMAL_ERROR (1.0f / 33554432.0f)
+#define CHECK_QUANTIZATION_UV_RANGE 16.0f
+
+// xorshift32:
+INLINE f32 nextRandom(unsigned int &state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (f32)(state >> 8) * (1.0f / 16777216.0f);
+}
+
+INLINE vec3 randomDirection(unsigned int &state) {
+    vec3 direction;
+    f32 length_squared;
+    do {
+        direction.x = nextRandom(state) * 2.0f - 1.0f;
+        direction.y = nextRandom(state) * 2.0f - 1.0f;
+        direction.z = nextRandom(state) * 2.0f - 1.0f;
+        length_squared = direction.squaredLength();
+    } while (length_squared > 1.0f || length_squared < 1e-6f);
+
+    return direction / sqrtf(length_squared);
+}
+
+INLINE f32 getDirectionError(const vec3 &direction, const i8 *quantized) {
+    f32 dot = dequantizeOctahedral(quantized).dot(direction);
+    dot = dot > 1 ? 1 : (dot < -1 ? -1 : dot);
+    return acosf(dot) * (180.0f / 3.14159265f);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int vertex_count = argc > 1 ? (unsigned int)atoi(argv[1]) : CHECK_QUANTIZATION_DEFAULT_VERTEX_COUNT;
+    unsigned int state = 0x9E3779B9;
+
+    f32 max_position_error = 0;
+    f32 max_direction_error = 0;
+    f32 max_uv_error = 0;
+    f32 max_uv_denormal_error = 0;
+    for (unsigned int v = 0; v < vertex_count; v++) {
+        // Positions as fractions of the bounds (the part that gets quantized):
+        for (u8 axis = 0; axis < 3; axis++) {
+            f32 fraction = nextRandom(state);
+            f32 error = fabsf(dequantizeUnorm16(quantizeUnorm16(fraction)) - fraction);
+            if (error > max_position_error) max_position_error = error;
+        }
+
+        i8 quantized[2];
+        vec3 direction = randomDirection(state);
+        quantizeOctahedral(direction, quantized);
+        f32 error = getDirectionError(direction, quantized);
+        if (error > max_direction_error) max_direction_error = error;
+
+        // Uvs spread over the exponents, down to denormal ones:
+        for (u8 i = 0; i < 2; i++) {
+            f32 uv = (nextRandom(state) * 2.0f - 1.0f) * CHECK_QUANTIZATION_UV_RANGE;
+            uv *= powf(2.0f, -30.0f * nextRandom(state));
+            error = fabsf(dequantizeHalf(quantizeHalf(uv)) - uv);
+            if (fabsf(uv) < 1.0f / 16384.0f) {
+                if (error > max_uv_denormal_error) max_uv_denormal_error = error;
+            } else if (uv != 0) {
+                error /= fabsf(uv);
+                if (error > max_uv_error) max_uv_error = error;
+            }
+        }
+    }
+
+    // The poles and the folds of the octahedron:
+    vec3 edge_directions[] = {
+        {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1},
+        {1, 1, 0}, {-1, 1, 0}, {1, -1, 0}, {-1, -1, 0}
+    };
+    for (u8 i = 0; i < 10; i++) {
+        i8 quantized[2];
+        vec3 direction = edge_directions[i].normalized();
+        quantizeOctahedral(direction, quantized);
+        f32 error = getDirectionError(direction, quantized);
+        if (error > max_direction_error) max_direction_error = error;
+    }
+
+    // Meshes made in code have no AABB set, so positions get quantized by the bounds of the vertices:
+    Mesh meshes[2];
+    meshes[0].loadTriangle();
+    meshes[1].loadCube();
+    for (u8 m = 0; m < 2; m++) {
+        const Mesh &mesh = meshes[m];
+        AABB bounds = getVertexBounds(mesh);
+        vec3 scale = bounds.max - bounds.min;
+        f32 extent = scale.maximum();
+        for (u32 v = 0; v < mesh.vertex_count; v++) {
+            u16 quantized[3];
+            const vec3 &position = mesh.vertex_positions[v];
+            quantizePosition(position, bounds.min, scale, quantized);
+            vec3 decoded = dequantizePosition(quantized, bounds.min, scale);
+            f32 error = Max(fabsf(decoded.x - position.x), Max(fabsf(decoded.y - position.y), fabsf(decoded.z - position.z)));
+            error = extent > 0 ? error / extent : error;
+            if (error > max_position_error) max_position_error = error;
+        }
+    }
+
+    bool position_passed = max_position_error <= CHECK_QUANTIZATION_MAX_POSITION_ERROR;
+    bool direction_passed = max_direction_error <= CHECK_QUANTIZATION_MAX_DIRECTION_ERROR;
+    bool uv_passed = max_uv_error <= CHECK_QUANTIZATION_MAX_UV_ERROR &&
+                     max_uv_denormal_error <= CHECK_QUANTIZATION_MAX_UV_DENORMAL_ERROR;
+
+    printf("Round-tripped %u vertices\n", vertex_count);
+    printf("Position error: %g of the extent (max: %g) %s\n", max_position_error, CHECK_QUANTIZATION_MAX_POSITION_ERROR,
+           position_passed ? "ok" : "FAILED");
+    printf("Normal/tangent error: %g degrees (max: %g) %s\n", max_direction_error, CHECK_QUANTIZATION_MAX_DIRECTION_ERROR,
+           direction_passed ? "ok" : "FAILED");
+    printf("Uv error: %g relative, %g below normal halfs (max: %g, %g) %s\n", max_uv_error, max_uv_denormal_error,
+           CHECK_QUANTIZATION_MAX_UV_ERROR, CHECK_QUANTIZATION_MAX_UV_DENORMAL_ERROR, uv_passed ? "ok" : "FAILED");
+
+    return position_passed && direction_passed && uv_passed ? 0 : 1;
+}
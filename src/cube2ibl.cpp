@@ -0,0 +1,501 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "./slim/platforms/win32_base.h"
+#include "./slim/serialization/image.h"
+#include "./slim/serialization/texture.h"
+#include "./slim/math/spherical_harmonics.h"
+#include "./slim/core/parallel.h"
+
+// Prefilters a colour cube map (6 raw_image faces) for image based lighting:
+// - An irradiance map, from the spherical harmonics projection of the cube map.
+// - A radiance mip chain, with each mip prefiltered for the GGX distribution of an increasing roughness
+//   (from the first mip's roughness up to 1), sampled as the split-sum approximation does (N = V = R).
+// Each map is written as 6 raw_image faces (as the rasterizer's cube map samplers take them), and as a cube map texture
+// (as the ray tracer's Texture::sampleCube() takes them). The radiance textures have the first mip of the chain.
+// Stored components are linear, as both samplers read them.
+
+#define CUBE2IBL_DEFAULT_IRRADIANCE_SIZE 128
+#define CUBE2IBL_DEFAULT_RADIANCE_SIZE 256
+#define CUBE2IBL_DEFAULT_RADIANCE_MIP_COUNT 6
+#define CUBE2IBL_DEFAULT_SAMPLE_COUNT 256
+#define CUBE2IBL_SH_PROJECTION_SIZE 128
+#define CUBE2IBL_MAX_MIP_COUNT 16
+#define CUBE2IBL_MAX_PATH 512
+
+const char *cube_face_names[6]{"px", "nx", "py", "ny", "pz", "nz"};
+
+// Direction of (s, t) on a face, s and t being in [-1, 1] along the face's axes, as cube map samplers lay out faces:
+INLINE vec3 getCubeFaceDirection(u32 face, f32 s, f32 t) {
+    switch (face) {
+        case 0:  return { 1.0f,    -t,    -s};
+        case 1:  return {-1.0f,    -t,     s};
+        case 2:  return {    s,  1.0f,     t};
+        case 3:  return {    s, -1.0f,    -t};
+        case 4:  return {    s,    -t,  1.0f};
+        default: return {   -s,    -t, -1.0f};
+    }
+}
+
+INLINE u32 getCubeFace(const vec3 &direction, f32 &s, f32 &t) {
+    f32 ax = fabsf(direction.x);
+    f32 ay = fabsf(direction.y);
+    f32 az = fabsf(direction.z);
+    f32 rcp;
+    if (ax >= ay && ax >= az) {
+        rcp = 1.0f / ax;
+        s = (direction.x > 0.0f ? -direction.z : direction.z) * rcp;
+        t = -direction.y * rcp;
+        return direction.x > 0.0f ? 0 : 1;
+    }
+    if (ay >= az) {
+        rcp = 1.0f / ay;
+        s = direction.x * rcp;
+        t = (direction.y > 0.0f ? direction.z : -direction.z) * rcp;
+        return direction.y > 0.0f ? 2 : 3;
+    }
+    rcp = 1.0f / az;
+    s = (direction.z > 0.0f ? direction.x : -direction.x) * rcp;
+    t = -direction.y * rcp;
+    return direction.z > 0.0f ? 4 : 5;
+}
+
+// Float faces of a cube map, with a box-filtered mip chain down to faces of 1 texel:
+struct CubeMap {
+    Color *faces[CUBE2IBL_MAX_MIP_COUNT][6];
+    u32 sizes[CUBE2IBL_MAX_MIP_COUNT];
+    u32 mip_count;
+
+    static u64 getSizeInBytes(u32 size, u32 mip_count) {
+        u64 size_in_bytes = 0;
+        for (u32 i = 0; i < mip_count; i++, size /= 2) size_in_bytes += sizeof(Color) * 6 * size * size;
+        return size_in_bytes;
+    }
+
+    static u32 getMipCount(u32 size) {
+        u32 mip_count = 1;
+        while (size > 1 && mip_count < CUBE2IBL_MAX_MIP_COUNT) {
+            size /= 2;
+            mip_count++;
+        }
+        return mip_count;
+    }
+
+    void init(u32 size, u32 Mip_count, memory::MonotonicAllocator &memory) {
+        mip_count = Mip_count;
+        for (u32 mip = 0; mip < mip_count; mip++, size /= 2) {
+            sizes[mip] = size;
+            for (u32 face = 0; face < 6; face++)
+                faces[mip][face] = (Color*)memory.allocate(sizeof(Color) * size * size);
+        }
+    }
+
+    void downsample(u32 thread_count) {
+        for (u32 mip = 1; mip < mip_count; mip++) {
+            u32 size = sizes[mip];
+            u32 source_size = sizes[mip - 1];
+            parallelFor(6 * size, thread_count, [&](u32 first_row, u32 end_row) {
+                for (u32 row = first_row; row < end_row; row++) {
+                    u32 face = row / size;
+                    u32 y = row % size;
+                    const Color *top = faces[mip - 1][face] + source_size * y * 2;
+                    const Color *bottom = top + source_size;
+                    Color *texel = faces[mip][face] + size * y;
+                    for (u32 x = 0; x < size; x++, top += 2, bottom += 2, texel++)
+                        *texel = (top[0] + top[1] + bottom[0] + bottom[1]) * 0.25f;
+                }
+            });
+        }
+    }
+
+    Color sample(u32 face, f32 s, f32 t, u32 mip) const {
+        u32 size = sizes[mip];
+        f32 x = clampedValue((s + 1.0f) * 0.5f * (f32)size - 0.5f, 0.0f, (f32)(size - 1));
+        f32 y = clampedValue((t + 1.0f) * 0.5f * (f32)size - 0.5f, 0.0f, (f32)(size - 1));
+        u32 x0 = (u32)x;
+        u32 y0 = (u32)y;
+        u32 x1 = Min(x0 + 1, size - 1);
+        u32 y1 = Min(y0 + 1, size - 1);
+        f32 fx = x - (f32)x0;
+        f32 fy = y - (f32)y0;
+
+        const Color *texels = faces[mip][face];
+        Color top    = texels[size * y0 + x0].lerpTo(texels[size * y0 + x1], fx);
+        Color bottom = texels[size * y1 + x0].lerpTo(texels[size * y1 + x1], fx);
+        return top.lerpTo(bottom, fy);
+    }
+
+    // Trilinear sample along a direction (not necessarily normalized) at a fractional mip level:
+    Color sample(const vec3 &direction, f32 level = 0.0f) const {
+        f32 s, t;
+        u32 face = getCubeFace(direction, s, t);
+        level = clampedValue(level, 0.0f, (f32)(mip_count - 1));
+        u32 mip = (u32)level;
+        Color color = sample(face, s, t, mip);
+        f32 blend = level - (f32)mip;
+        if (blend > 0.0f && mip + 1 < mip_count) color = color.lerpTo(sample(face, s, t, mip + 1), blend);
+        return color;
+    }
+};
+
+// Calls back with the direction of every texel of a cube map's faces, splitting the rows of all faces across threads:
+template <typename Function>
+void forEachCubeTexel(u32 size, u32 thread_count, const Function &function) {
+    parallelFor(6 * size, thread_count, [&](u32 first_row, u32 end_row) {
+        f32 texel_size = 2.0f / (f32)size;
+        for (u32 row = first_row; row < end_row; row++) {
+            u32 face = row / size;
+            u32 y = row % size;
+            f32 t = ((f32)y + 0.5f) * texel_size - 1.0f;
+            for (u32 x = 0; x < size; x++) {
+                f32 s = ((f32)x + 0.5f) * texel_size - 1.0f;
+                function(face, x, y, getCubeFaceDirection(face, s, t), s, t);
+            }
+        }
+    });
+}
+
+bool loadCubeMap(const char *faces_path, CubeMap &cube_map, memory::MonotonicAllocator &memory, u32 thread_count) {
+    char path[CUBE2IBL_MAX_PATH];
+    RawImage faces[6];
+    u64 memory_size = 0;
+    for (u32 face = 0; face < 6; face++) {
+        snprintf(path, CUBE2IBL_MAX_PATH, "%s_%s.raw_image", faces_path, cube_face_names[face]);
+        if (!loadHeader(faces[face], path)) {
+            printf("Could not open %s\n", path);
+            return false;
+        }
+        if (faces[face].width != faces[face].height || faces[face].width != faces[0].width || !faces[face].flags.channel) {
+            printf("%s is not a square face of 8-bit channels, as big as the others\n", path);
+            return false;
+        }
+        memory_size += getSizeInBytes(faces[face]);
+    }
+
+    u32 size = faces[0].width;
+    u32 mip_count = CubeMap::getMipCount(size);
+    memory = memory::MonotonicAllocator{memory_size + CubeMap::getSizeInBytes(size, mip_count)};
+    if (!memory.address) return false;
+
+    for (u32 face = 0; face < 6; face++) {
+        snprintf(path, CUBE2IBL_MAX_PATH, "%s_%s.raw_image", faces_path, cube_face_names[face]);
+        if (!load(faces[face], path, &memory)) return false;
+    }
+
+    cube_map.init(size, mip_count, memory);
+    parallelFor(6 * size, thread_count, [&](u32 first_row, u32 end_row) {
+        for (u32 row = first_row; row < end_row; row++) {
+            const RawImage &face = faces[row / size];
+            u32 component_count = face.flags.alpha ? 4 : 3;
+            const u8 *component = face.content + (u64)component_count * size * (row % size);
+            Color *texel = cube_map.faces[0][row / size] + (u64)size * (row % size);
+            for (u32 x = 0; x < size; x++, texel++, component += component_count)
+                *texel = Color{component[0], component[1], component[2]};
+        }
+    });
+    cube_map.downsample(thread_count);
+
+    return true;
+}
+
+// Projects the cube map onto spherical harmonics (as projectCubeTexture() does for textures).
+// Low bands barely change with resolution, so this goes over the first mip no larger than CUBE2IBL_SH_PROJECTION_SIZE.
+// Directions land on the centers of that mip's texels, so sampling along them reads the texels as they are:
+SphericalHarmonics projectCubeMap(const CubeMap &cube_map) {
+    u32 mip = 0;
+    while (mip + 1 < cube_map.mip_count && cube_map.sizes[mip] > CUBE2IBL_SH_PROJECTION_SIZE) mip++;
+
+    SphericalHarmonics projection;
+    projectCubeFaces(cube_map.sizes[mip], projection, [&](u32, u32, u32, const vec3 &direction) {
+        return cube_map.sample(direction, (f32)mip);
+    });
+    return projection;
+}
+
+struct GGXSample {
+    vec3 direction; // In tangent space, around +Z
+    f32 weight;     // NdotL
+    f32 level;      // Source mip level covering the sample's solid angle
+};
+
+INLINE f32 radicalInverse(u32 bits) {
+    bits &= 0xFFFFFFFF;
+    bits = ((bits << 16) | (bits >> 16)) & 0xFFFFFFFF;
+    bits = ((bits & 0x55555555) << 1) | ((bits & 0xAAAAAAAA) >> 1);
+    bits = ((bits & 0x33333333) << 2) | ((bits & 0xCCCCCCCC) >> 2);
+    bits = ((bits & 0x0F0F0F0F) << 4) | ((bits & 0xF0F0F0F0) >> 4);
+    bits = ((bits & 0x00FF00FF) << 8) | ((bits & 0xFF00FF00) >> 8);
+    return (f32)(bits & 0xFFFFFFFF) * 2.3283064365386963e-10f;
+}
+
+// Importance samples the GGX distribution (of roughness squared, as the shaders do) with a Hammersley sequence.
+// With N = V, every texel takes the same samples around its own direction, so they are computed once per mip.
+// Each sample reads from the source mip whose texels cover the sample's share of the lobe (filtered importance
+// sampling), which takes far fewer samples to converge. Returns the number of samples above the surface:
+u32 getGGXSamples(f32 roughness, u32 sample_count, u32 source_size, GGXSample *samples) {
+    f32 a = roughness * roughness;
+    f32 a2 = a * a;
+    f32 texel_solid_angle = 4.0f * pi / (6.0f * (f32)source_size * (f32)source_size);
+    u32 count = 0;
+    for (u32 i = 0; i < sample_count; i++) {
+        f32 u = (f32)i / (f32)sample_count;
+        f32 v = radicalInverse(i);
+        f32 phi = TAU * u;
+        f32 cos_theta = sqrtf((1.0f - v) / (1.0f + (a2 - 1.0f) * v));
+        f32 sin_theta = sqrtf(1.0f - cos_theta * cos_theta);
+        vec3 H{sin_theta * cosf(phi), sin_theta * sinf(phi), cos_theta};
+        vec3 L{H.x * 2.0f * cos_theta, H.y * 2.0f * cos_theta, 2.0f * cos_theta * cos_theta - 1.0f};
+        if (L.z <= 0.0f) continue;
+
+        // pdf(L) = D(H) * NdotH / (4 * VdotH), which is D(H) / 4 when N = V:
+        f32 d = cos_theta * cos_theta * (a2 - 1.0f) + 1.0f;
+        f32 D = a2 / (pi * d * d);
+        f32 sample_solid_angle = 1.0f / ((f32)sample_count * D * 0.25f + 0.0001f);
+        samples[count].direction = L;
+        samples[count].weight = L.z;
+        samples[count].level = Max(0.5f * log2f(sample_solid_angle / texel_solid_angle), 0.0f);
+        count++;
+    }
+    return count;
+}
+
+void prefilterRadiance(const CubeMap &cube_map, f32 roughness, u32 sample_count, CubeMap &radiance, u32 mip,
+                       GGXSample *samples, u32 thread_count) {
+    u32 size = radiance.sizes[mip];
+    if (roughness == 0.0f) {
+        // A mirror only needs the source at the mip's resolution:
+        f32 level = log2f((f32)cube_map.sizes[0] / (f32)size);
+        forEachCubeTexel(size, thread_count, [&](u32 face, u32 x, u32 y, const vec3 &direction, f32, f32) {
+            radiance.faces[mip][face][size * y + x] = cube_map.sample(direction, level);
+        });
+        return;
+    }
+
+    u32 count = getGGXSamples(roughness, sample_count, cube_map.sizes[0], samples);
+    forEachCubeTexel(size, thread_count, [&](u32 face, u32 x, u32 y, const vec3 &direction, f32, f32) {
+        vec3 N{direction.normalized()};
+        vec3 up{fabsf(N.z) < 0.999f ? vec3{0.0f, 0.0f, 1.0f} : vec3{1.0f, 0.0f, 0.0f}};
+        vec3 T{up.cross(N).normalized()};
+        vec3 B{N.cross(T)};
+
+        Color color;
+        f32 total_weight = 0.0f;
+        for (u32 i = 0; i < count; i++) {
+            const GGXSample &sample = samples[i];
+            vec3 L{T * sample.direction.x + B * sample.direction.y + N * sample.direction.z};
+            color = cube_map.sample(L, sample.level).scaleAdd(sample.weight, color);
+            total_weight += sample.weight;
+        }
+        radiance.faces[mip][face][size * y + x] = total_weight > 0.0f ? color / total_weight : Color{};
+    });
+}
+
+INLINE u8 toComponent(f32 value) {
+    return (u8)(clampedValue(value, 0.0f, 1.0f) * FLOAT_TO_COLOR_COMPONENT + 0.5f);
+}
+
+bool saveFaces(const CubeMap &cube_map, u32 mip, const char *path, memory::MonotonicAllocator &memory) {
+    u32 size = cube_map.sizes[mip];
+    RawImage image;
+    image.updateDimensions(size, size);
+    image.flags.channel = true;
+    image.content = (u8*)memory.allocate(3 * size * size);
+    if (!image.content) return false;
+
+    char face_path[CUBE2IBL_MAX_PATH];
+    for (u32 face = 0; face < 6; face++) {
+        const Color *texel = cube_map.faces[mip][face];
+        u8 *component = image.content;
+        for (u32 i = 0; i < size * size; i++, texel++) {
+            *(component++) = toComponent(texel->r);
+            *(component++) = toComponent(texel->g);
+            *(component++) = toComponent(texel->b);
+        }
+
+        snprintf(face_path, CUBE2IBL_MAX_PATH, "%s_%s.raw_image", path, cube_face_names[face]);
+        if (!save(image, face_path)) {
+            printf("Could not write %s\n", face_path);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Direction of a texel of a cube map texture, inverting what Texture::sampleCube() does:
+// The first mip has the left, front, right and back faces side by side, the other 2 mips are the top and bottom faces.
+// Texels past the edges get the direction of where their face's plane extends to, so the texel quads along the edges
+// blend with the neighbouring faces:
+INLINE vec3 getCubeTextureDirection(u32 mip, i32 x, i32 y, u32 face_size) {
+    f32 v = ((f32)y + 0.5f) / (f32)face_size;
+    if (mip) {
+        f32 u = ((f32)x + 0.5f) / (f32)face_size;
+        return mip == 1 ?
+            vec3{2.0f * u - 1.0f,  1.0f, 2.0f * v - 1.0f} :
+            vec3{2.0f * u - 1.0f, -1.0f, 1.0f - 2.0f * v};
+    }
+
+    f32 u = ((f32)x + 0.5f) / (f32)(face_size * 4);
+    switch (clampedValue(x, 0, (i32)face_size * 4 - 1) / (i32)face_size) {
+        case 0:  return {-1.0f, 1.0f - 2.0f * v, 8.0f * u - 1.0f};
+        case 1:  return {8.0f * u - 3.0f, 1.0f - 2.0f * v, 1.0f};
+        case 2:  return {1.0f, 1.0f - 2.0f * v, 5.0f - 8.0f * u};
+        default: return {7.0f - 8.0f * u, 1.0f - 2.0f * v, -1.0f};
+    }
+}
+
+bool saveCubeTexture(const CubeMap &cube_map, u32 mip, const char *path, memory::MonotonicAllocator &memory, u32 thread_count) {
+    u32 face_size = cube_map.sizes[mip];
+    Texture texture;
+    texture.updateDimensions(face_size * 6, face_size);
+    texture.flags.cubemap = true;
+    texture.flags.linear = true;
+    texture.mip_count = 3;
+    texture.mips = (TextureMip*)memory.allocate(sizeof(TextureMip) * 3);
+    if (!texture.mips) return false;
+
+    for (u32 i = 0; i < 3; i++) {
+        TextureMip &texture_mip = texture.mips[i];
+        texture_mip.width = i ? face_size : face_size * 4;
+        texture_mip.height = face_size;
+        texture_mip.tiles = nullptr;
+        texture_mip.texel_blocks = nullptr;
+        texture_mip.texel_quads = (TexelQuad*)memory.allocate(sizeof(TexelQuad) * (texture_mip.width + 1) * (texture_mip.height + 1));
+        BlockTexel *texels = (BlockTexel*)memory.allocate(sizeof(BlockTexel) * (texture_mip.width + 2) * (texture_mip.height + 2));
+        if (!texture_mip.texel_quads || !texels) return false;
+
+        // Texels over the grid the quads span (padded by a texel on every side), then the quads of every 2x2 of them:
+        u32 stride = texture_mip.width + 2;
+        parallelFor(texture_mip.height + 2, thread_count, [&](u32 first_row, u32 end_row) {
+            for (u32 y = first_row; y < end_row; y++)
+                for (u32 x = 0; x < stride; x++) {
+                    Color color = cube_map.sample(getCubeTextureDirection(i, (i32)x - 1, (i32)y - 1, face_size), (f32)mip);
+                    texels[stride * y + x] = {toComponent(color.r), toComponent(color.g), toComponent(color.b), 0};
+                }
+        });
+
+        TexelQuad *texel_quad = texture_mip.texel_quads;
+        for (u32 y = 0; y <= texture_mip.height; y++)
+            for (u32 x = 0; x <= texture_mip.width; x++, texel_quad++) {
+                const BlockTexel &TL = texels[stride * y + x];
+                const BlockTexel &TR = texels[stride * y + x + 1];
+                const BlockTexel &BL = texels[stride * (y + 1) + x];
+                const BlockTexel &BR = texels[stride * (y + 1) + x + 1];
+                texel_quad->R = {TL.R, TR.R, BL.R, BR.R};
+                texel_quad->G = {TL.G, TR.G, BL.G, BR.G};
+                texel_quad->B = {TL.B, TR.B, BL.B, BR.B};
+            }
+    }
+
+    if (!save(texture, (char*)path)) {
+        printf("Could not write %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+f64 getMilliseconds(u64 ticks_since) {
+    return (f64)(timers::getTicks() - ticks_since) * timers::milliseconds_per_tick;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("Usage: cube2ibl <color faces path> <output path> [-i<irradiance size>] [-r<radiance size>] "
+               "[-m<radiance mip count>] [-g<first radiance mip roughness>] [-s<sample count>] [-j<thread count>]\n");
+        return 1;
+    }
+
+    char* color_faces_path = argv[1];
+    char* output_path = argv[2];
+    u32 irradiance_size = CUBE2IBL_DEFAULT_IRRADIANCE_SIZE;
+    u32 radiance_size = CUBE2IBL_DEFAULT_RADIANCE_SIZE;
+    u32 radiance_mip_count = CUBE2IBL_DEFAULT_RADIANCE_MIP_COUNT;
+    u32 sample_count = CUBE2IBL_DEFAULT_SAMPLE_COUNT;
+    u32 thread_count = getThreadCount();
+    f32 first_roughness = 0.0f;
+    for (u8 i = 3; i < (u8)argc; i++) {
+        if (     argv[i][0] == '-' && argv[i][1] == 'i') irradiance_size = (u32)atoi(argv[i] + 2);
+        else if (argv[i][0] == '-' && argv[i][1] == 'r') radiance_size = (u32)atoi(argv[i] + 2);
+        else if (argv[i][0] == '-' && argv[i][1] == 'm') radiance_mip_count = (u32)atoi(argv[i] + 2);
+        else if (argv[i][0] == '-' && argv[i][1] == 'g') first_roughness = (f32)atof(argv[i] + 2);
+        else if (argv[i][0] == '-' && argv[i][1] == 's') sample_count = (u32)atoi(argv[i] + 2);
+        else if (argv[i][0] == '-' && argv[i][1] == 'j') thread_count = (u32)atoi(argv[i] + 2);
+        else return 1;
+    }
+    irradiance_size = Max(irradiance_size, 1u);
+    radiance_size = Max(radiance_size, 1u);
+    radiance_mip_count = clampedValue(radiance_mip_count, (u32)1, CubeMap::getMipCount(radiance_size));
+    sample_count = Max(sample_count, 1u);
+    thread_count = clampedValue(thread_count, (u32)1, (u32)PARALLEL_MAX_THREADS);
+    first_roughness = clampedValue(first_roughness, 0.0f, 1.0f);
+
+    LARGE_INTEGER performance_frequency;
+    QueryPerformanceFrequency(&performance_frequency);
+    timers::ticks_per_second = (u64)performance_frequency.QuadPart;
+    timers::seconds_per_tick = 1.0 / (f64)(timers::ticks_per_second);
+    timers::milliseconds_per_tick = 1000.0 * timers::seconds_per_tick;
+
+    u64 start = timers::getTicks();
+    u64 stage_start = start;
+
+    CubeMap color;
+    memory::MonotonicAllocator color_memory;
+    if (!loadCubeMap(color_faces_path, color, color_memory, thread_count)) return 1;
+    printf("Loaded %ux%u faces and their mips in %.1f ms\n", (unsigned int)color.sizes[0], (unsigned int)color.sizes[0], getMilliseconds(stage_start));
+
+    u64 output_faces_size = CubeMap::getSizeInBytes(irradiance_size, 1) + CubeMap::getSizeInBytes(radiance_size, radiance_mip_count);
+    u64 scratch_size = sizeof(GGXSample) * sample_count + 3 * radiance_size * radiance_size +
+                       Max(irradiance_size, radiance_size) * 4 * (Max(irradiance_size, radiance_size) + 2) * 3 * (sizeof(TexelQuad) + sizeof(BlockTexel)) +
+                       sizeof(TextureMip) * 3;
+    memory::MonotonicAllocator memory{output_faces_size + scratch_size};
+    if (!memory.address) return 1;
+
+    char path[CUBE2IBL_MAX_PATH];
+
+    // Irradiance:
+    stage_start = timers::getTicks();
+    SphericalHarmonics irradiance_sh = projectCubeMap(color);
+    irradiance_sh.convolveWithCosineLobe();
+
+    CubeMap irradiance;
+    irradiance.init(irradiance_size, 1, memory);
+    forEachCubeTexel(irradiance_size, thread_count, [&](u32 face, u32 x, u32 y, const vec3 &direction, f32, f32) {
+        irradiance.faces[0][face][irradiance_size * y + x] = irradiance_sh.evaluate(direction.normalized());
+    });
+    printf("Irradiance (%ux%u) in %.1f ms\n", (unsigned int)irradiance_size, (unsigned int)irradiance_size, getMilliseconds(stage_start));
+
+    u64 scratch_marker = memory.push();
+    snprintf(path, CUBE2IBL_MAX_PATH, "%s_irradiance", output_path);
+    if (!saveFaces(irradiance, 0, path, memory)) return 1;
+    snprintf(path, CUBE2IBL_MAX_PATH, "%s_irradiance.texture", output_path);
+    if (!saveCubeTexture(irradiance, 0, path, memory, thread_count)) return 1;
+    memory.pop(scratch_marker);
+
+    // Radiance:
+    CubeMap radiance;
+    radiance.init(radiance_size, radiance_mip_count, memory);
+    GGXSample *samples = (GGXSample*)memory.allocate(sizeof(GGXSample) * sample_count);
+    scratch_marker = memory.push();
+    for (u32 mip = 0; mip < radiance_mip_count; mip++) {
+        stage_start = timers::getTicks();
+        f32 roughness = radiance_mip_count == 1 ? first_roughness :
+                        first_roughness + (1.0f - first_roughness) * (f32)mip / (f32)(radiance_mip_count - 1);
+        prefilterRadiance(color, roughness, sample_count, radiance, mip, samples, thread_count);
+        printf("Radiance mip %u (%ux%u, roughness %.2f) in %.1f ms\n", (unsigned int)mip,
+               (unsigned int)radiance.sizes[mip], (unsigned int)radiance.sizes[mip], roughness, getMilliseconds(stage_start));
+
+        if (mip) snprintf(path, CUBE2IBL_MAX_PATH, "%s_radiance_%u", output_path, (unsigned int)mip);
+        else     snprintf(path, CUBE2IBL_MAX_PATH, "%s_radiance", output_path);
+        if (!saveFaces(radiance, mip, path, memory)) return 1;
+        memory.pop(scratch_marker);
+    }
+    snprintf(path, CUBE2IBL_MAX_PATH, "%s_radiance.texture", output_path);
+    if (!saveCubeTexture(radiance, 0, path, memory, thread_count)) return 1;
+
+    printf("Done in %.1f ms on %u threads with %u samples per texel\n",
+           getMilliseconds(start), (unsigned int)thread_count, (unsigned int)sample_count);
+
+    memory.releaseMemory();
+    color_memory.releaseMemory();
+    return 0;
+}
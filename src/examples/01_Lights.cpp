@@ -165,9 +165,13 @@ struct ExampleVulkanApp : SlimApp {
 
     void OnInit() override {
         triangle_mesh.loadTriangle();
-        triangle_gpu_mesh.create(triangle_mesh);
-        floor_gpu_mesh.create(floor_mesh);
-        mesh_group.create(mesh_files, MeshCount - 1);
+        if (!triangle_gpu_mesh.create(triangle_mesh) ||
+            !floor_gpu_mesh.create(floor_mesh) ||
+            !mesh_group.create(mesh_files, MeshCount - 1)) {
+            SLIM_LOG_ERROR("Failed to create the GPU meshes")
+            is_running = false;
+            return;
+        }
 
         scene.counts.meshes = MeshCount;
         scene.updateAABBs();
@@ -195,6 +199,7 @@ struct ExampleVulkanApp : SlimApp {
 
         if (!mouse::is_captured) selection.manipulate(viewport);
         if (!controls::is_pressed::alt) viewport.updateNavigation(delta_time);
+        scene.updateLODs(camera, viewport.dimensions.f_height);
 
         raster_render_pipeline::update(scene, viewport, IBL_intensity);
     }
@@ -203,22 +208,17 @@ struct ExampleVulkanApp : SlimApp {
         GraphicsCommandBuffer &command_buffer{*gpu::graphics_command_buffer};
 
         directional_shadhow_maps[present::current_frame].beginWrite(command_buffer);
-        mesh_group.vertex_buffer.bind(command_buffer);
+        mesh_group.bind(command_buffer);
         for (u32 g = 0; g < scene.counts.geometries; g++) {
-            shadow_pass::setModel(command_buffer, Mat4(geometries[g].transform) * scene.directional_lights[0].shadowMapMatrix());
+            const VertexQuantization &quantization = g == Floor ? floor_gpu_mesh.quantization : mesh_group.mesh_quantizations[geometries[g].id];
+            shadow_pass::setModel(command_buffer, Mat4(quantization.transform()) * Mat4(geometries[g].transform) * scene.directional_lights[0].shadowMapMatrix());
             if (g == Floor) {
-                floor_gpu_mesh.vertex_buffer.bind(command_buffer);
-                floor_gpu_mesh.vertex_buffer.draw(command_buffer);
+                floor_gpu_mesh.bind(command_buffer);
+                floor_gpu_mesh.draw(command_buffer);
             } 
             else {
                 if (g == Dog) default_material::bindTextures(command_buffer, 1);
-                for (u32 m = 0, first_index = 0; m < (MeshCount - 1); m++) {
-                    u32 vertex_count = mesh_group.mesh_triangle_counts[m] * 3;
-                    if (m == geometries[g].id) {
-                        mesh_group.vertex_buffer.draw(command_buffer, vertex_count, (i32)first_index);
-                        break;
-                    } else first_index += vertex_count;
-                }
+                mesh_group.draw(command_buffer, geometries[g].id);
             }
         }
         directional_shadhow_maps[present::current_frame].endWrite(command_buffer);
@@ -247,24 +247,19 @@ struct ExampleVulkanApp : SlimApp {
             return;
         }
 
-        mesh_group.vertex_buffer.bind(command_buffer);
+        mesh_group.bind(command_buffer);
         for (u32 g = 0; g < scene.counts.geometries; g++) {
             default_material::setModel(command_buffer, geometries[g].transform,
                 material_params[g],
-                (material_params[g].flags & debug_maps) | debug_flags);
+                (material_params[g].flags & debug_maps) | debug_flags,
+                g == Floor ? floor_gpu_mesh.quantization : mesh_group.mesh_quantizations[geometries[g].id]);
             if (g == Floor) {
                 default_material::bindTextures(command_buffer, 0);
-                floor_gpu_mesh.vertex_buffer.bind(command_buffer);
-                floor_gpu_mesh.vertex_buffer.draw(command_buffer);
+                floor_gpu_mesh.bind(command_buffer);
+                floor_gpu_mesh.draw(command_buffer);
             } else {
                 if (g == Dog) default_material::bindTextures(command_buffer, 1);
-                for (u32 m = 0, first_index = 0; m < (MeshCount - 1); m++) {
-                    u32 vertex_count = mesh_group.mesh_triangle_counts[m] * 3;
-                    if (m == geometries[g].id) {
-                        mesh_group.vertex_buffer.draw(command_buffer, vertex_count, (i32)first_index);
-                        break;
-                    } else first_index += vertex_count;
-                }
+                mesh_group.drawMesh(command_buffer, geometries[g].id, geometries[g].transform, camera.position, geometries[g].lod);
             }
         }
 
@@ -350,8 +345,7 @@ struct ExampleVulkanApp : SlimApp {
         default_material::destroy();
         line_rendering::destroy();
         raster_render_pipeline::destroy();
-        mesh_group.vertex_buffer.destroy();
-        mesh_group.edge_buffer.destroy();
+        mesh_group.destroy();
         floor_gpu_mesh.destroy();
         triangle_gpu_mesh.destroy();
 
@@ -17,6 +17,7 @@ struct ExampleApp : SlimApp {
     bool skybox_swapped = false;
     bool draw_BVH = false;
     bool cutout = false;
+    bool trilinear = false;
 
     // HUD:
     HUDLine FPS {"FPS : "};
@@ -24,8 +25,9 @@ struct ExampleApp : SlimApp {
     HUDLine AA  {"AA  : ", "Off","On", &antialias};
     HUDLine BVH {"BVH : ", "Off","On", &draw_BVH};
     HUDLine Cut {"Cut : ", "Off","On", &cutout};
+    HUDLine Tri {"Tri : ", "Off","On", &trilinear};
     HUDLine Mode{"Mode: ", "Beauty"};
-    HUD hud{{6}, &FPS};
+    HUD hud{{7}, &FPS};
 
     // Viewport:
     Camera camera{{-25 * DEG_TO_RAD, 0, 0}, {-4, 15, -17}}, *cameras{&camera};
@@ -113,6 +115,10 @@ struct ExampleApp : SlimApp {
             if (key == controls::key_map::tab) hud.enabled = !hud.enabled;
             if (key == 'G' && USE_GPU_BY_DEFAULT) use_gpu = !use_gpu;
             if (key == 'B') draw_BVH = !draw_BVH;
+            if (key == 'T') {
+                trilinear = !trilinear;
+                renderer.settings.texture_filter = trilinear ? TextureFilter_Trilinear : TextureFilter_Bilinear;
+            }
             if (key == 'V') {
                 antialias = !antialias;
                 canvas.antialias = antialias ? SSAA : NoAA;
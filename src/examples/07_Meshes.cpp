@@ -2,6 +2,7 @@
 
 #include "../slim/scene/selection.h"
 #include "../slim/draw/hud.h"
+#include "../slim/core/arena_report.h"
 #include "../slim/draw/bvh.h"
 #include "../slim/draw/selection.h"
 #include "../slim/renderer/renderer.h"
@@ -17,6 +18,7 @@ struct ExampleApp : SlimApp {
     bool skybox_swapped = false;
     bool draw_BVH = false;
     bool cutout = false;
+    bool show_arenas = false;
 
     // HUD:
     HUDLine FPS {"FPS : "};
@@ -29,6 +31,7 @@ struct ExampleApp : SlimApp {
     HUDLine Roughness{"Roughness: "};
     HUDLine Bounces{  "Bounces  : "};
     HUD hud{{9}, &FPS};
+    ArenaHUD arena_hud{10, 220};
 
     // Viewport:
     Camera camera{{-25 * DEG_TO_RAD, 0, 0}, {0, 7, -11}}, *cameras{&camera};
@@ -141,6 +144,10 @@ struct ExampleApp : SlimApp {
         if (draw_BVH) drawSceneBVH();
         if (controls::is_pressed::alt) drawSelection(selection, viewport, scene);
         if (hud.enabled) drawHUD(hud, canvas);
+        if (show_arenas) {
+            arena_hud.update();
+            drawHUD(arena_hud.hud, canvas);
+        }
         canvas.drawToWindow();
     }
 
@@ -191,6 +198,10 @@ struct ExampleApp : SlimApp {
             if (key == controls::key_map::tab) hud.enabled = !hud.enabled;
             if (key == 'G' && USE_GPU_BY_DEFAULT) use_gpu = !use_gpu;
             if (key == 'B') draw_BVH = !draw_BVH;
+            if (key == 'H') {
+                show_arenas = !show_arenas;
+                if (show_arenas) memory::printArenaReport();
+            }
             if (key == 'V') {
                 antialias = !antialias;
                 canvas.antialias = antialias ? SSAA : NoAA;
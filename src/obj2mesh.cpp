@@ -9,35 +9,491 @@
 
 #include <stdio.h>
 #include <string.h>
-#include <unordered_set>
+#include <vector>
 
 #include "./slim/platforms/win32_base.h"
 #include "./slim/scene/bvh_builder.h"
+#include "./slim/scene/mesh_optimizer.h"
+#include "./slim/scene/mesh_clusters.h"
+#include "./slim/scene/mesh_simplifier.h"
 #include "./slim/serialization/mesh.h"
+#include "./slim/core/parallel.h"
 
 // Or using the single-header file:
 // #include "../slim.h"
 
-enum VertexAttributes {
-    VertexAttributes_None,
-    VertexAttributes_Positions,
-    VertexAttributes_PositionsAndUVs,
-    VertexAttributes_PositionsUVsAndNormals
+// The mapped file gets split into chunks (ending on line breaks) that threads parse on their own.
+// There are a few per thread for them to even out, but not so many that they get tiny:
+#define OBJ2MESH_CHUNKS_PER_THREAD 8
+#define OBJ2MESH_MIN_CHUNK_SIZE Megabytes(1)
+
+// Edges get deduplicated in this many buckets (by hash) in parallel. The count is fixed so that the order edges
+// come out in only depends on the file:
+#define OBJ2MESH_EDGE_BUCKET_BITS 6
+#define OBJ2MESH_EDGE_BUCKET_COUNT (1 << OBJ2MESH_EDGE_BUCKET_BITS)
+#define OBJ2MESH_EMPTY_EDGE 0xFFFFFFFFFFFFFFFFULL
+
+// Triangle corners get welded into vertices in buckets the same way (corners are numbered 3 per triangle):
+#define OBJ2MESH_WELD_BUCKET_BITS 6
+#define OBJ2MESH_WELD_BUCKET_COUNT (1 << OBJ2MESH_WELD_BUCKET_BITS)
+#define OBJ2MESH_EMPTY_CORNER 0xFFFFFFFF
+
+// Every LOD aims for this fraction of the triangles of the one before it, within a max error (as a fraction of the
+// diagonal of the mesh's bounding box). The chain ends at the max LOD count, at the min triangle count, or once
+// simplifying stops getting at least down to the min reduction (of the previous count) within the max error:
+#define OBJ2MESH_LOD_RATIO 0.5f
+#define OBJ2MESH_LOD_MAX_ERROR 0.02f
+#define OBJ2MESH_LOD_MIN_TRIANGLE_COUNT 64
+#define OBJ2MESH_LOD_MIN_REDUCTION 0.9f
+
+// Hand-written scanners for the text of an OBJ file (sscanf is much slower, and locale dependent).
+// They never read at or past the given end, and return where they stopped:
+INLINE bool isDigit(char character) { return (u8)(character - '0') < 10; }
+
+INLINE const char* skipSpaces(const char *text, const char *end) {
+    while (text < end && (*text == ' ' || *text == '\t')) text++;
+    return text;
+}
+
+INLINE const char* skipLine(const char *text, const char *end) {
+    while (text < end && *text != '\n') text++;
+    return text < end ? text + 1 : end;
+}
+
+const char* scanInteger(const char *text, const char *end, i32 &value) {
+    bool negative = text < end && *text == '-';
+    if (negative || (text < end && *text == '+')) text++;
+
+    i32 number = 0;
+    while (text < end && isDigit(*text)) number = number * 10 + (*text++ - '0');
+    value = negative ? -number : number;
+    return text;
+}
+
+// Gathers up to 19 significant digits, to then scale them by their power of 10 in double precision:
+const char* scanFloat(const char *text, const char *end, f32 &value) {
+    static const f64 powers_of_10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const u64 max_mantissa = 1000000000000000000ULL;
+
+    text = skipSpaces(text, end);
+    bool negative = text < end && *text == '-';
+    if (negative || (text < end && *text == '+')) text++;
+
+    u64 mantissa = 0;
+    i32 exponent = 0;
+    for (; text < end && isDigit(*text); text++)
+        if (mantissa < max_mantissa) mantissa = mantissa * 10 + (*text - '0');
+        else exponent++;
+
+    if (text < end && *text == '.')
+        for (text++; text < end && isDigit(*text); text++)
+            if (mantissa < max_mantissa) {
+                mantissa = mantissa * 10 + (*text - '0');
+                exponent--;
+            }
+
+    if (text < end && (*text == 'e' || *text == 'E')) {
+        i32 explicit_exponent;
+        text = scanInteger(text + 1, end, explicit_exponent);
+        exponent += explicit_exponent;
+    }
+
+    f64 number = (f64)mantissa;
+    if (mantissa) {
+        for (; exponent > 22; exponent -= 22) number *= 1e22;
+        for (; exponent < -22; exponent += 22) number /= 1e22;
+        number = exponent < 0 ? number / powers_of_10[-exponent] : number * powers_of_10[exponent];
+    }
+    value = (f32)(negative ? -number : number);
+    return text;
+}
+
+INLINE u64 hashKey(u64 key) {
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    key *= 0xC4CEB9FE1A85EC53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+// Negative (relative) ids are resolved against the elements of their chunk, as the ones of the chunks before it are
+// not counted yet. Those get flagged (per attribute, per corner) to be offset once they are:
+#define OBJ2MESH_RELATIVE_POSITION 1
+#define OBJ2MESH_RELATIVE_UV 2
+#define OBJ2MESH_RELATIVE_NORMAL 4
+
+struct ObjTriangle {
+    TriangleVertexIndices position, uv, normal;
+    u16 relative_ids; // 3 bits per corner
+};
+
+struct ObjCorner {
+    u32 position, uv, normal;
+    u8 relative;
 };
 
-int obj2mesh(char* obj_file_path, char* mesh_file_path, bool invert_winding_order = false, f32 scale = 1, float rotY = 0) {
-    const u8 v1_id = 0;
-    const u8 v2_id = invert_winding_order ? 2 : 1;
-    const u8 v3_id = invert_winding_order ? 1 : 2;
+// What a thread parsed out of its chunk of the file, to be merged at the offsets of the chunks before it.
+// Edges are keyed by their (smaller, larger) vertex indices and sorted into buckets once the ids are resolved:
+struct ObjChunk {
+    const char *start, *end;
+    std::vector<vec3> positions, normals;
+    std::vector<vec2> uvs;
+    std::vector<ObjTriangle> triangles;
+    std::vector<u64> edges[OBJ2MESH_EDGE_BUCKET_COUNT];
+    bool all_faces_have_uvs = true;
+    bool all_faces_have_normals = true;
+    bool has_invalid_ids = false;
+    u32 first_position, first_normal, first_uv, first_triangle;
+
+    void addEdge(u32 from, u32 to) {
+        u64 key = from < to ? (u64)from | ((u64)to << 32) : (u64)to | ((u64)from << 32);
+        edges[hashKey(key) >> (64 - OBJ2MESH_EDGE_BUCKET_BITS)].push_back(key);
+    }
+
+    void addTriangle(const ObjCorner &c1, const ObjCorner &c2, const ObjCorner &c3) {
+        triangles.push_back({
+            {c1.position, c2.position, c3.position},
+            {c1.uv,       c2.uv,       c3.uv},
+            {c1.normal,   c2.normal,   c3.normal},
+            (u16)(c1.relative | (c2.relative << 3) | (c3.relative << 6))
+        });
+    }
+
+    // Ids are 1-based, or relative to the end of what was parsed so far when negative (0 is not an id):
+    INLINE u32 toIndex(i32 id, u64 count, u8 relative_flag, u8 &relative) {
+        if (id > 0) return (u32)(id - 1);
+        if (!id) has_invalid_ids = true;
+
+        relative |= relative_flag;
+        return (u32)count + (u32)id;
+    }
+
+    // Faces of more than 3 vertices get split into a fan of triangles:
+    const char* parseFace(const char *text, bool invert_winding_order) {
+        ObjCorner first{}, previous{}, corner;
+        bool has_uvs = true;
+        bool has_normals = true;
+        i32 id;
+        for (u32 corner_count = 0;; corner_count++) {
+            text = skipSpaces(text, end);
+            if (text == end || !(isDigit(*text) || *text == '-')) break;
+
+            corner = {};
+            text = scanInteger(text, end, id);
+            corner.position = toIndex(id, positions.size(), OBJ2MESH_RELATIVE_POSITION, corner.relative);
+            bool has_uv = false;
+            bool has_normal = false;
+            if (text < end && *text == '/') {
+                text++;
+                if (text < end && *text != '/') {
+                    text = scanInteger(text, end, id);
+                    corner.uv = toIndex(id, uvs.size(), OBJ2MESH_RELATIVE_UV, corner.relative);
+                    has_uv = true;
+                }
+                if (text < end && *text == '/') {
+                    text = scanInteger(text + 1, end, id);
+                    corner.normal = toIndex(id, normals.size(), OBJ2MESH_RELATIVE_NORMAL, corner.relative);
+                    has_normal = true;
+                }
+            }
+            has_uvs = has_uvs && has_uv;
+            has_normals = has_normals && has_normal;
+
+            if (corner_count == 0) first = corner;
+            else if (corner_count >= 2) {
+                if (invert_winding_order) addTriangle(first, corner, previous);
+                else                      addTriangle(first, previous, corner);
+            }
+            previous = corner;
+        }
+        all_faces_have_uvs = all_faces_have_uvs && has_uvs;
+        all_faces_have_normals = all_faces_have_normals && has_normals;
+        return text;
+    }
+
+    void parse(bool invert_winding_order) {
+        vec3 v;
+        vec2 uv;
+        for (const char *text = start; text < end; text = skipLine(text, end)) {
+            text = skipSpaces(text, end);
+            if (end - text < 2) continue;
+
+            if (text[0] == 'v' && (text[1] == ' ' || text[1] == '\t')) {
+                text = scanFloat(text + 1, end, v.x);
+                text = scanFloat(text, end, v.y);
+                text = scanFloat(text, end, v.z);
+                positions.push_back(v);
+            } else if (text[0] == 'v' && text[1] == 'n') {
+                text = scanFloat(text + 2, end, v.x);
+                text = scanFloat(text, end, v.y);
+                text = scanFloat(text, end, v.z);
+                normals.push_back(v);
+            } else if (text[0] == 'v' && text[1] == 't') {
+                text = scanFloat(text + 2, end, uv.x);
+                text = scanFloat(text, end, uv.y);
+                uvs.push_back(uv);
+            } else if (text[0] == 'f' && (text[1] == ' ' || text[1] == '\t'))
+                text = parseFace(text + 1, invert_winding_order);
+        }
+    }
 
-    int vertex_indices[3];
-    int normal_indices[3];
-    int uvs_indices[3];
+    // Offsets relative ids by the elements of the chunks before this one, then checks that all ids are in range
+    // (only of the attributes the mesh keeps) and collects the edges:
+    void resolve(u32 position_count, u32 uv_count, u32 normal_count) {
+        for (ObjTriangle &triangle : triangles) {
+            for (u32 i = 0; i < 3; i++) {
+                u32 relative = triangle.relative_ids >> (i * 3);
+                if (relative & OBJ2MESH_RELATIVE_POSITION) triangle.position.ids[i] += first_position;
+                if (relative & OBJ2MESH_RELATIVE_UV)       triangle.uv.ids[i]       += first_uv;
+                if (relative & OBJ2MESH_RELATIVE_NORMAL)   triangle.normal.ids[i]   += first_normal;
+                if (triangle.position.ids[i] >= position_count ||
+                    (uv_count && triangle.uv.ids[i] >= uv_count) ||
+                    (normal_count && triangle.normal.ids[i] >= normal_count))
+                    has_invalid_ids = true;
+            }
+            addEdge(triangle.position.ids[0], triangle.position.ids[1]);
+            addEdge(triangle.position.ids[1], triangle.position.ids[2]);
+            addEdge(triangle.position.ids[2], triangle.position.ids[0]);
+        }
+    }
+};
 
-    u32 f, t;
+// Splits the file into chunks that end on line breaks (so no line gets split between threads):
+u32 splitIntoChunks(const char *text, u64 size, u32 thread_count, std::vector<ObjChunk> &chunks) {
+    u64 chunk_count = Min((u64)thread_count * OBJ2MESH_CHUNKS_PER_THREAD, size / OBJ2MESH_MIN_CHUNK_SIZE);
+    if (!chunk_count) chunk_count = 1;
+    chunks.resize(chunk_count);
+
+    const char *end = text + size;
+    const char *start = text;
+    for (u64 i = 0; i < chunk_count; i++) {
+        const char *chunk_end = i + 1 == chunk_count ? end : text + size * (i + 1) / chunk_count;
+        if (chunk_end < start) chunk_end = start;
+        while (chunk_end < end && chunk_end[-1] != '\n') chunk_end++;
+        chunks[i].start = start;
+        chunks[i].end = chunk_end;
+        start = chunk_end;
+    }
+    return (u32)chunk_count;
+}
 
-    std::unordered_set<u64> edge_hashes;
+// Every bucket dedups its edges in its own open-addressing hash table, visiting the chunks in order:
+struct EdgeBucket {
+    std::vector<u64> table;
+    u32 edge_count = 0;
+    u32 first_edge = 0;
+
+    void collect(const std::vector<ObjChunk> &chunks, u32 bucket) {
+        u64 occurrences = 0;
+        for (const ObjChunk &chunk : chunks) occurrences += chunk.edges[bucket].size();
+
+        u64 capacity = 1;
+        while (capacity <= occurrences) capacity <<= 1;
+        table.assign(capacity, OBJ2MESH_EMPTY_EDGE);
+
+        u64 mask = capacity - 1;
+        for (const ObjChunk &chunk : chunks)
+            for (u64 key : chunk.edges[bucket])
+                for (u64 slot = hashKey(key) & mask;; slot = (slot + 1) & mask) {
+                    if (table[slot] == key) break;
+                    if (table[slot] == OBJ2MESH_EMPTY_EDGE) {
+                        table[slot] = key;
+                        edge_count++;
+                        break;
+                    }
+                }
+    }
 
+    void write(EdgeVertexIndices *edges) const {
+        edges += first_edge;
+        for (u64 key : table)
+            if (key != OBJ2MESH_EMPTY_EDGE)
+                *edges++ = {(u32)(key & 0xFFFFFFFF), (u32)(key >> 32)};
+    }
+};
+
+// Welds the corners of the triangles into unique vertices, each corner becoming a vertex index.
+// Corners are the same vertex when they share their position, uv and normal, as well as the handedness of the
+// tangent basis of their triangle (so that mirrored uv islands never share, and average, tangents).
+// Vertices are numbered by their first use, and tangents are averaged over the triangles sharing the vertex
+// (weighted by their area) then made orthogonal to its normal:
+struct VertexWelder {
+    struct Key {
+        u32 position, uv, normal, mirrored;
+
+        INLINE bool operator==(const Key &other) const {
+            return position == other.position && uv == other.uv && normal == other.normal && mirrored == other.mirrored;
+        }
+    };
+
+    const Mesh &mesh;
+    u32 thread_count;
+    u32 vertex_count = 0;
+    std::vector<u8> mirrored;            // Per triangle
+    std::vector<vec3> face_tangents;     // Per triangle (scaled by its area)
+    std::vector<u32> corner_vertices;    // Per corner (the corner it got merged into, until getting numbered)
+    std::vector<u32> vertex_corners;     // Per vertex (the first corner that used it)
+    std::vector<u32> buckets[OBJ2MESH_WELD_BUCKET_COUNT];
+
+    VertexWelder(const Mesh &mesh, u32 thread_count) : mesh{mesh}, thread_count{thread_count} {}
+
+    INLINE Key getKey(u32 corner) const {
+        u32 t = corner / 3;
+        u32 i = corner % 3;
+        return {
+            mesh.vertex_position_indices[t].ids[i],
+            mesh.uvs_count     ? mesh.vertex_uvs_indices[t].ids[i]    : 0,
+            mesh.normals_count ? mesh.vertex_normal_indices[t].ids[i] : 0,
+            mirrored[t]
+        };
+    }
+
+    INLINE u64 hash(const Key &key) const {
+        return hashKey((u64)key.position | ((u64)key.uv << 32)) ^ hashKey(((u64)key.normal << 1) | key.mirrored);
+    }
+
+    void computeFaceTangents() {
+        mirrored.assign(mesh.triangle_count, 0);
+        face_tangents.assign(mesh.triangle_count, vec3{0.0f});
+        if (!mesh.uvs_count) return;
+
+        parallelFor(mesh.triangle_count, thread_count, [&](u32 first, u32 end) {
+            for (u32 t = first; t < end; t++) {
+                const TriangleVertexIndices &p = mesh.vertex_position_indices[t];
+                const TriangleVertexIndices &uv = mesh.vertex_uvs_indices[t];
+                vec3 edge1 = mesh.vertex_positions[p.v2] - mesh.vertex_positions[p.v1];
+                vec3 edge2 = mesh.vertex_positions[p.v3] - mesh.vertex_positions[p.v1];
+                vec2 deltaUV1 = mesh.vertex_uvs[uv.v2] - mesh.vertex_uvs[uv.v1];
+                vec2 deltaUV2 = mesh.vertex_uvs[uv.v3] - mesh.vertex_uvs[uv.v1];
+                f32 determinant = deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y;
+                if (determinant == 0) continue;
+
+                // The tangent and bitangent scaled by the determinant (whose sign then flips them both):
+                vec3 T = edge1 * deltaUV2.y - edge2 * deltaUV1.y;
+                vec3 B = edge2 * deltaUV1.x - edge1 * deltaUV2.x;
+                vec3 N = edge1.cross(edge2);
+                f32 length = T.length();
+                if (length == 0) continue;
+
+                mirrored[t] = N.cross(T).dot(B) < 0;
+                face_tangents[t] = T * (N.length() / (determinant < 0 ? -length : length));
+            }
+        });
+    }
+
+    // Every bucket dedups its corners in its own open-addressing hash table of representative corners.
+    // Corners get sorted into buckets in chunks of triangles, visited in order, so representatives are first uses:
+    void findRepresentatives() {
+        u32 corner_count = mesh.triangle_count * 3;
+        corner_vertices.resize(corner_count);
+
+        u32 chunk_count = Min(thread_count * OBJ2MESH_CHUNKS_PER_THREAD, mesh.triangle_count);
+        std::vector<std::vector<u32>> chunk_buckets(chunk_count * OBJ2MESH_WELD_BUCKET_COUNT);
+        parallelFor(chunk_count, thread_count, [&](u32 first, u32 end) {
+            for (u32 chunk = first; chunk < end; chunk++) {
+                std::vector<u32> *chunk_bucket = chunk_buckets.data() + chunk * OBJ2MESH_WELD_BUCKET_COUNT;
+                u32 first_corner = (u32)((u64)corner_count / 3 * chunk / chunk_count) * 3;
+                u32 end_corner = (u32)((u64)corner_count / 3 * (chunk + 1) / chunk_count) * 3;
+                for (u32 corner = first_corner; corner < end_corner; corner++)
+                    chunk_bucket[hash(getKey(corner)) >> (64 - OBJ2MESH_WELD_BUCKET_BITS)].push_back(corner);
+            }
+        }, 1);
+
+        parallelFor(OBJ2MESH_WELD_BUCKET_COUNT, thread_count, [&](u32 first, u32 end) {
+            for (u32 bucket = first; bucket < end; bucket++) {
+                u64 occurrences = 0;
+                for (u32 chunk = 0; chunk < chunk_count; chunk++)
+                    occurrences += chunk_buckets[chunk * OBJ2MESH_WELD_BUCKET_COUNT + bucket].size();
+
+                u64 capacity = 1;
+                while (capacity <= occurrences) capacity <<= 1;
+                std::vector<u32> table(capacity, OBJ2MESH_EMPTY_CORNER);
+
+                u64 mask = capacity - 1;
+                for (u32 chunk = 0; chunk < chunk_count; chunk++)
+                    for (u32 corner : chunk_buckets[chunk * OBJ2MESH_WELD_BUCKET_COUNT + bucket]) {
+                        Key key = getKey(corner);
+                        for (u64 slot = hash(key) & mask;; slot = (slot + 1) & mask) {
+                            if (table[slot] == OBJ2MESH_EMPTY_CORNER) {
+                                table[slot] = corner;
+                                corner_vertices[corner] = corner;
+                                break;
+                            }
+                            if (getKey(table[slot]) == key) {
+                                corner_vertices[corner] = table[slot];
+                                break;
+                            }
+                        }
+                    }
+            }
+        }, 1);
+    }
+
+    // Representatives come before the corners merged into them, so one pass in order numbers them all:
+    void numberVertices() {
+        vertex_corners.clear();
+        u32 corner_count = mesh.triangle_count * 3;
+        for (u32 corner = 0; corner < corner_count; corner++) {
+            u32 representative = corner_vertices[corner];
+            if (representative == corner) {
+                corner_vertices[corner] = (u32)vertex_corners.size();
+                vertex_corners.push_back(corner);
+            } else
+                corner_vertices[corner] = corner_vertices[representative];
+        }
+        vertex_count = (u32)vertex_corners.size();
+    }
+
+    u32 weld() {
+        computeFaceTangents();
+        findRepresentatives();
+        numberVertices();
+        return vertex_count;
+    }
+
+    void writeVertices(MeshVertex *vertices, TriangleVertexIndices *vertex_indices) {
+        memcpy(vertex_indices, corner_vertices.data(), sizeof(u32) * 3 * mesh.triangle_count);
+
+        std::vector<vec3> tangent_sums(vertex_count, vec3{0.0f});
+        if (mesh.uvs_count)
+            for (u32 corner = 0; corner < mesh.triangle_count * 3; corner++)
+                tangent_sums[corner_vertices[corner]] += face_tangents[corner / 3];
+
+        parallelFor(vertex_count, thread_count, [&](u32 first, u32 end) {
+            for (u32 v = first; v < end; v++) {
+                Key key = getKey(vertex_corners[v]);
+                MeshVertex &vertex = vertices[v];
+                vertex.position = mesh.vertex_positions[key.position];
+                vertex.normal   = mesh.normals_count ? mesh.vertex_normals[key.normal].normalized() : vec3{0.0f};
+                vertex.uv       = mesh.uvs_count ? mesh.vertex_uvs[key.uv] : vec2{0.0f};
+
+                vec3 tangent = tangent_sums[v];
+                if (mesh.normals_count) tangent -= vertex.normal * vertex.normal.dot(tangent);
+                f32 length = tangent.length();
+                vertex.tangent = length > 0 ? tangent / length : vec3{0.0f};
+            }
+        });
+    }
+};
+
+int obj2mesh(char* obj_file_path, char* mesh_file_path, bool invert_winding_order = false, f32 scale = 1, float rotY = 0, bool compress = false, bool sort_for_overdraw = true, bool generate_lods = true) {
+    u64 file_size = 0;
+    const char *file = (const char*)os::mapFileForReading(obj_file_path, &file_size);
+    if (!file) return 1;
+
+    u32 thread_count = getThreadCount();
+    std::vector<ObjChunk> chunks;
+    u32 chunk_count = splitIntoChunks(file, file_size, thread_count, chunks);
+    parallelFor(chunk_count, thread_count, [&](u32 first, u32 end) {
+        for (u32 i = first; i < end; i++) chunks[i].parse(invert_winding_order);
+    }, 1);
+    os::unmapFile(file);
+
+    // Chunks go where the ones before them end:
     Mesh mesh;
     mesh.triangle_count = 0;
     mesh.normals_count = 0;
@@ -51,81 +507,47 @@ int obj2mesh(char* obj_file_path, char* mesh_file_path, bool invert_winding_orde
     mesh.vertex_uvs              = nullptr;
     mesh.vertex_uvs_indices      = nullptr;
 
-    FILE* obj_file;
-
-    obj_file = fopen(obj_file_path, "r");
-    char line[1024];
-
-    enum VertexAttributes vertex_attributes = VertexAttributes_None;
-    while (fgets(line, 1024, obj_file)) {
-        if (strncmp(line, (char*)"vn ", 2) == 0) mesh.normals_count++;
-        if (strncmp(line, (char*)"vt ", 2) == 0) mesh.uvs_count++;
-        if (strncmp(line, (char*)"v ", 2) == 0) mesh.vertex_count++;
-        if (strncmp(line, (char*)"f ", 2) == 0) {
-            mesh.triangle_count++;
-            if (vertex_attributes == VertexAttributes_None) {
-                int forward_slash_count = 0;
-                char *character = line;
-                while (*character) {
-                    if ((*character) == '/') forward_slash_count++;
-                    character++;
-                }
-                switch (forward_slash_count) {
-                    case 0: vertex_attributes = VertexAttributes_Positions; break;
-                    case 3: vertex_attributes = VertexAttributes_PositionsAndUVs; break;
-                    case 6: vertex_attributes = VertexAttributes_PositionsUVsAndNormals; break;
-                    default: break;
-                }
-            }
-
-            switch (vertex_attributes) {
-                case VertexAttributes_Positions:
-                    sscanf(
-                            line, (char*)"f %d %d %d",
-                            &vertex_indices[v1_id],
-                            &vertex_indices[v2_id],
-                            &vertex_indices[v3_id]
-                    );
-                    break;
-                case VertexAttributes_PositionsAndUVs:
-                    sscanf(
-                            line, (char*)"f %d/%d %d/%d %d/%d",
-                            &vertex_indices[v1_id], &uvs_indices[v1_id],
-                            &vertex_indices[v2_id], &uvs_indices[v2_id],
-                            &vertex_indices[v3_id], &uvs_indices[v3_id]
-                    );
-                    break;
-                case VertexAttributes_PositionsUVsAndNormals:
-                    sscanf(
-                            line, (char*)"f %d/%d/%d %d/%d/%d %d/%d/%d",
-                            &vertex_indices[v1_id], &uvs_indices[v1_id], &normal_indices[v1_id],
-                            &vertex_indices[v2_id], &uvs_indices[v2_id], &normal_indices[v2_id],
-                            &vertex_indices[v3_id], &uvs_indices[v3_id], &normal_indices[v3_id]
-                    );
-                    break;
-                default:
-                    return 1;
-            }
-
-            for (u8 i = 0; i < 3; i++) vertex_indices[i]--;
-
-            u64 edge_hash1, edge_hash2;
-            for (u8 from = 0, to = 1; from < 3; from++, to = (to + 1) % 3) {
-                f = vertex_indices[from];
-                t = vertex_indices[to];
-                edge_hash1 = (u64)f + ((u64)t << 32);
-                edge_hash2 = (u64)t + ((u64)f << 32);
-                if (edge_hashes.find(edge_hash1) == edge_hashes.end() &&
-                    edge_hashes.find(edge_hash2) == edge_hashes.end()) {
-                    edge_hashes.insert(edge_hash1);
-                    mesh.edge_count++;
-                }
-            }
+    bool has_uvs = true;
+    bool has_normals = true;
+    for (ObjChunk &chunk : chunks) {
+        chunk.first_position = mesh.vertex_count;
+        chunk.first_normal   = mesh.normals_count;
+        chunk.first_uv       = mesh.uvs_count;
+        chunk.first_triangle = mesh.triangle_count;
+        mesh.vertex_count   += (u32)chunk.positions.size();
+        mesh.normals_count  += (u32)chunk.normals.size();
+        mesh.uvs_count      += (u32)chunk.uvs.size();
+        mesh.triangle_count += (u32)chunk.triangles.size();
+        has_uvs = has_uvs && chunk.all_faces_have_uvs;
+        has_normals = has_normals && chunk.all_faces_have_normals;
+    }
+    if (!mesh.triangle_count || !mesh.vertex_count) return 1;
+
+    // Faces that do not reference uvs (or normals) leave the mesh without any:
+    if (!has_uvs) mesh.uvs_count = 0;
+    if (!has_normals) mesh.normals_count = 0;
+
+    parallelFor(chunk_count, thread_count, [&](u32 first, u32 end) {
+        for (u32 i = first; i < end; i++) chunks[i].resolve(mesh.vertex_count, mesh.uvs_count, mesh.normals_count);
+    }, 1);
+    for (const ObjChunk &chunk : chunks)
+        if (chunk.has_invalid_ids) {
+            printf("Faces reference vertices, uvs or normals that are not in the file\n");
+            return 1;
         }
+
+    EdgeBucket edge_buckets[OBJ2MESH_EDGE_BUCKET_COUNT];
+    parallelFor(OBJ2MESH_EDGE_BUCKET_COUNT, thread_count, [&](u32 first, u32 end) {
+        for (u32 i = first; i < end; i++) edge_buckets[i].collect(chunks, i);
+    }, 1);
+    for (EdgeBucket &bucket : edge_buckets) {
+        bucket.first_edge = mesh.edge_count;
+        mesh.edge_count += bucket.edge_count;
     }
-    fclose(obj_file);
 
-    mesh.tangents_count = mesh.triangle_count * 3;
+    // Tangents are per welded vertex, so they get counted (and the welded vertices allocated) once welding is done:
+    mesh.tangents_count = 0;
+    mesh.welded_vertex_count = 0;
     mesh.bvh.node_count = mesh.triangle_count * 2;
     mesh.bvh.height = (u8)mesh.triangle_count;
 
@@ -135,104 +557,29 @@ int obj2mesh(char* obj_file_path, char* mesh_file_path, bool invert_winding_orde
     allocateMemory(mesh, &memory_allocator);
     BVHBuilder builder{mesh.triangle_count * 2, &memory_allocator};
 
-    vec3 *vertex_position = mesh.vertex_positions;
-    vec3 *vertex_normal = mesh.vertex_normals;
-    vec2 *vertex_uvs = mesh.vertex_uvs;
-    TriangleVertexIndices *vertex_position_indices = mesh.vertex_position_indices;
-    TriangleVertexIndices *vertex_normal_indices = mesh.vertex_normal_indices;
-    TriangleVertexIndices *vertex_tangent_indices = mesh.vertex_tangent_indices;
-    TriangleVertexIndices *vertex_uvs_indices = mesh.vertex_uvs_indices;
-
-    obj_file = fopen(obj_file_path, (char*)"r");
-    while (fgets(line, 1024, obj_file)) {
-        // Vertex information
-        if (strncmp(line, (char*)"v ", 2) == 0) {
-            sscanf(line, (char*)"v %f %f %f", &vertex_position->x, &vertex_position->y, &vertex_position->z);
-            vertex_position++;
-        } else if (strncmp(line, (char*)"vn ", 2) == 0) {
-            sscanf(line, (char*)"vn %f %f %f", &vertex_normal->x, &vertex_normal->y, &vertex_normal->z);
-            vertex_normal++;
-        } else if (strncmp(line, (char*)"vt ", 2) == 0) {
-            sscanf(line, (char*)"vt %f %f", &vertex_uvs->x, &vertex_uvs->y);
-            vertex_uvs++;
-        } else if (strncmp(line, (char*)"f ", 2) == 0) {
-            switch (vertex_attributes) {
-                case VertexAttributes_Positions:
-                    sscanf(
-                            line, (char*)"f %d %d %d",
-                            &vertex_indices[v1_id],
-                            &vertex_indices[v2_id],
-                            &vertex_indices[v3_id]
-                    );
-                    break;
-                case VertexAttributes_PositionsAndUVs:
-                    sscanf(
-                            line, (char*)"f %d/%d %d/%d %d/%d",
-                            &vertex_indices[v1_id], &uvs_indices[v1_id],
-                            &vertex_indices[v2_id], &uvs_indices[v2_id],
-                            &vertex_indices[v3_id], &uvs_indices[v3_id]
-                    );
-                    vertex_uvs_indices->ids[0] = uvs_indices[0] - 1;
-                    vertex_uvs_indices->ids[1] = uvs_indices[1] - 1;
-                    vertex_uvs_indices->ids[2] = uvs_indices[2] - 1;
-                    vertex_uvs_indices++;
-                    break;
-                case VertexAttributes_PositionsUVsAndNormals:
-                    sscanf(
-                            line, (char*)"f %d/%d/%d %d/%d/%d %d/%d/%d",
-                            &vertex_indices[v1_id], &uvs_indices[v1_id], &normal_indices[v1_id],
-                            &vertex_indices[v2_id], &uvs_indices[v2_id], &normal_indices[v2_id],
-                            &vertex_indices[v3_id], &uvs_indices[v3_id], &normal_indices[v3_id]
-                    );
-                    vertex_uvs_indices->ids[0] = uvs_indices[0] - 1;
-                    vertex_uvs_indices->ids[1] = uvs_indices[1] - 1;
-                    vertex_uvs_indices->ids[2] = uvs_indices[2] - 1;
-                    vertex_normal_indices->ids[0] = normal_indices[0] - 1;
-                    vertex_normal_indices->ids[1] = normal_indices[1] - 1;
-                    vertex_normal_indices->ids[2] = normal_indices[2] - 1;
-                    vertex_normal_indices++;
-                    vertex_uvs_indices++;
-                    break;
-                default:
-                    return 1;
+    parallelFor(chunk_count, thread_count, [&](u32 first, u32 end) {
+        for (u32 i = first; i < end; i++) {
+            ObjChunk &chunk = chunks[i];
+            if (!chunk.positions.empty())
+                memcpy(mesh.vertex_positions + chunk.first_position, chunk.positions.data(), sizeof(vec3) * chunk.positions.size());
+            if (mesh.normals_count && !chunk.normals.empty())
+                memcpy(mesh.vertex_normals + chunk.first_normal, chunk.normals.data(), sizeof(vec3) * chunk.normals.size());
+            if (mesh.uvs_count && !chunk.uvs.empty())
+                memcpy(mesh.vertex_uvs + chunk.first_uv, chunk.uvs.data(), sizeof(vec2) * chunk.uvs.size());
+
+            u32 t = chunk.first_triangle;
+            for (const ObjTriangle &triangle : chunk.triangles) {
+                mesh.vertex_position_indices[t] = triangle.position;
+                if (mesh.uvs_count)     mesh.vertex_uvs_indices[t]    = triangle.uv;
+                if (mesh.normals_count) mesh.vertex_normal_indices[t] = triangle.normal;
+                t++;
             }
-            vertex_position_indices->ids[0] = vertex_indices[0] - 1;
-            vertex_position_indices->ids[1] = vertex_indices[1] - 1;
-            vertex_position_indices->ids[2] = vertex_indices[2] - 1;
-            vertex_position_indices++;
         }
-    }
-    fclose(obj_file);
-
-    f = 0;
-    for (u64 edge_hash : edge_hashes) mesh.edge_vertex_indices[f++] = {(u32)edge_hash, (u32)(edge_hash >> 32)};
-
-    vec3 *tangent = mesh.vertex_tangents;
-    vec2 uv[3];
-    vec3 pos[3];
-    for (f = 0; f < mesh.triangle_count; f++) {
-        for (u8 i = 0; i < 3; i++) {
-            uv[i] = mesh.vertex_uvs[mesh.vertex_uvs_indices[f].ids[i]];
-            pos[i] = mesh.vertex_positions[mesh.vertex_position_indices[f].ids[i]];
-        }
-        for (u8 i = 0; i < 3; i++, tangent++) {
-            u8 i1 = i;
-            u8 i2 = (i + 1) % 3;
-            u8 i3 = (i + 2) % 3;
-            vec3 edge1 = pos[i2] - pos[i1];
-            vec3 edge2 = pos[i3] - pos[i1];
-            vec2 deltaUV1 = uv[i2] - uv[i1];
-            vec2 deltaUV2 = uv[i3] - uv[i1];
-
-            *tangent = vec3{
-                (deltaUV2.y * edge1.x - deltaUV1.y * edge2.x),
-                (deltaUV2.y * edge1.y - deltaUV1.y * edge2.y),
-                (deltaUV2.y * edge1.z - deltaUV1.y * edge2.z)
-            } / (deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y);
-
-            mesh.vertex_tangent_indices[f].ids[i] = f * 3 + i;
-        }
-    }
+    }, 1);
+    parallelFor(OBJ2MESH_EDGE_BUCKET_COUNT, thread_count, [&](u32 first, u32 end) {
+        for (u32 i = first; i < end; i++) edge_buckets[i].write(mesh.edge_vertex_indices);
+    }, 1);
+    chunks.clear();
 
     mat3 rot;
     if (rotY) {
@@ -261,8 +608,97 @@ int obj2mesh(char* obj_file_path, char* mesh_file_path, bool invert_winding_orde
             mesh.vertex_positions[i] -= centroid;
     }
 
+    VertexWelder welder{mesh, thread_count};
+    u32 welded_vertex_count = welder.weld();
+    u64 welded_memory_capacity = memory::getAlignedSize(sizeof(MeshVertex) * welded_vertex_count);
+    welded_memory_capacity += memory::getAlignedSize(sizeof(TriangleVertexIndices) * mesh.triangle_count);
+    memory::MonotonicAllocator welded_memory_allocator{welded_memory_capacity};
+    mesh.welded_vertex_count = welded_vertex_count;
+    mesh.vertices       = (MeshVertex*           )welded_memory_allocator.allocateAligned(sizeof(MeshVertex)            * welded_vertex_count);
+    mesh.vertex_indices = (TriangleVertexIndices*)welded_memory_allocator.allocateAligned(sizeof(TriangleVertexIndices) * mesh.triangle_count);
+    welder.writeVertices(mesh.vertices, mesh.vertex_indices);
+    printf("Welded %u triangle corners into %u vertices\n", (unsigned int)(mesh.triangle_count * 3), (unsigned int)welded_vertex_count);
+
+    MeshOptimizationReport report = optimizeMesh(mesh, sort_for_overdraw);
+    printf("ACMR: %.3f -> %.3f", report.acmr_before, report.acmr_after);
+    if (sort_for_overdraw) printf(" (%u clusters sorted for overdraw)", (unsigned int)report.cluster_count);
+    printf("\n");
+
+    // Tangents are stored with the welded vertices (files only store those), the tangent stream gets derived on load:
+    if (mesh.uvs_count) mesh.tangents_count = mesh.welded_vertex_count;
+
+    // Clusters go over the final index order:
+    std::vector<u32> cluster_stamps(mesh.welded_vertex_count);
+    mesh.cluster_count = countClusters(mesh, cluster_stamps.data());
+    memory::MonotonicAllocator cluster_memory_allocator{memory::getAlignedSize(sizeof(MeshCluster) * mesh.cluster_count)};
+    mesh.clusters = (MeshCluster*)cluster_memory_allocator.allocateAligned(sizeof(MeshCluster) * mesh.cluster_count);
+    buildClusters(mesh, cluster_stamps.data());
+    printf("Built %u clusters\n", (unsigned int)mesh.cluster_count);
+
     builder.buildMesh(mesh);
-    save(mesh, mesh_file_path);
+
+    // LODs index the welded vertices, so their tracer triangles and BVHs get built off of those:
+    std::vector<TriangleVertexIndices> lod_indices[MESH_MAX_LOD_COUNT];
+    std::vector<Triangle> lod_triangles[MESH_MAX_LOD_COUNT];
+    std::vector<BVHNode> lod_nodes[MESH_MAX_LOD_COUNT];
+    if (generate_lods) {
+        std::vector<vec3> positions(mesh.welded_vertex_count);
+        std::vector<vec3> normals(mesh.welded_vertex_count);
+        std::vector<vec2> uvs(mesh.welded_vertex_count);
+        for (u32 v = 0; v < mesh.welded_vertex_count; v++) {
+            positions[v] = mesh.vertices[v].position;
+            normals[v] = mesh.vertices[v].normal;
+            uvs[v] = mesh.vertices[v].uv;
+        }
+
+        const TriangleVertexIndices *indices = mesh.vertex_indices;
+        u32 triangle_count = mesh.triangle_count;
+        f32 error = 0;
+        f32 max_error = OBJ2MESH_LOD_MAX_ERROR * (mesh.aabb.max - mesh.aabb.min).length();
+        while (mesh.lod_count < MESH_MAX_LOD_COUNT && triangle_count > OBJ2MESH_LOD_MIN_TRIANGLE_COUNT) {
+            u32 l = mesh.lod_count;
+            lod_indices[l].assign(indices, indices + triangle_count);
+
+            f32 step_error;
+            u32 target_triangle_count = Max((u32)((f32)triangle_count * OBJ2MESH_LOD_RATIO), (u32)OBJ2MESH_LOD_MIN_TRIANGLE_COUNT);
+            u32 lod_triangle_count = simplify(mesh.vertices, mesh.welded_vertex_count, lod_indices[l].data(), triangle_count, target_triangle_count, max_error - error, &step_error);
+            if (lod_triangle_count > (u32)((f32)triangle_count * OBJ2MESH_LOD_MIN_REDUCTION)) break;
+
+            // Errors of the steps add up, as every LOD gets simplified from the one before it:
+            error += step_error;
+            lod_indices[l].resize(lod_triangle_count);
+            optimizeVertexCache(lod_indices[l].data(), lod_triangle_count, mesh.welded_vertex_count);
+            lod_triangles[l].resize(lod_triangle_count);
+            lod_nodes[l].resize(lod_triangle_count * 2);
+
+            Mesh lod_mesh;
+            lod_mesh.triangle_count = lod_triangle_count;
+            lod_mesh.vertex_count = mesh.welded_vertex_count;
+            lod_mesh.normals_count = mesh.normals_count ? mesh.welded_vertex_count : 0;
+            lod_mesh.uvs_count = mesh.uvs_count ? mesh.welded_vertex_count : 0;
+            lod_mesh.vertex_positions = positions.data();
+            lod_mesh.vertex_normals = normals.data();
+            lod_mesh.vertex_uvs = uvs.data();
+            lod_mesh.vertex_position_indices = lod_mesh.vertex_normal_indices = lod_mesh.vertex_uvs_indices = lod_indices[l].data();
+            lod_mesh.triangles = lod_triangles[l].data();
+            lod_mesh.bvh.nodes = lod_nodes[l].data();
+            builder.buildMesh(lod_mesh);
+
+            MeshLOD &lod = mesh.lods[mesh.lod_count++];
+            lod.triangle_count = lod_triangle_count;
+            lod.error = error;
+            lod.vertex_indices = lod_indices[l].data();
+            lod.triangles = lod_triangles[l].data();
+            lod.bvh = lod_mesh.bvh;
+            printf("LOD %u: %u triangles (error: %g)\n", (unsigned int)mesh.lod_count, (unsigned int)lod_triangle_count, error);
+
+            indices = lod.vertex_indices;
+            triangle_count = lod_triangle_count;
+        }
+    }
+
+    if (compress) saveCompressed(mesh, mesh_file_path);
+    else          save(mesh, mesh_file_path);
 
     return 0;
 }
@@ -273,24 +709,39 @@ int main(int argc, char *argv[]) {
                        "An '.obj' file (input) then a '.mesh' file (output), "
                        "an optional flag '-invert_winding_order' for inverting winding order"
                        "an optional flag 'scale:<float>' for scaling the mesh,"
-                       "an optional flag 'rotY:<float> for rotating the mesh around Y"
+                       "an optional flag 'rotY:<float> for rotating the mesh around Y,"
+                       "an optional flag '-compress' for writing block-compressed content,"
+                       "an optional flag '-no_overdraw_sort' for ordering triangles for the vertex cache only,"
+                       "an optional flag '-no_lods' for not generating simplified versions of the mesh"
                        ));
         return 0;
     } else if (argc == 3 || // 2 arguments
                argc == 4 || // 3 arguments
                argc == 5 || // 4 arguments
-               argc == 6    // 5 arguments
+               argc == 6 || // 5 arguments
+               argc == 7 || // 6 arguments
+               argc == 8 || // 7 arguments
+               argc == 9    // 8 arguments
             ) {
         char *obj_file_path = argv[1];
         char *mesh_file_path = argv[2];
         if (argc == 3) return obj2mesh(obj_file_path, mesh_file_path);
 
         bool invert_winding_order = false;
+        bool compress = false;
+        bool sort_for_overdraw = true;
+        bool generate_lods = true;
         float scale{1}, rotY{0};
         for (u32 i = 3; i < (u32)argc; i++) {
             char *arg = argv[i];
             if (strcmp(arg, (char *) "-invert_winding_order") == 0)
                 invert_winding_order = true;
+            else if (strcmp(arg, (char *) "-compress") == 0)
+                compress = true;
+            else if (strcmp(arg, (char *) "-no_overdraw_sort") == 0)
+                sort_for_overdraw = false;
+            else if (strcmp(arg, (char *) "-no_lods") == 0)
+                generate_lods = false;
             else {
                 char *scale_arg_prefix = (char *) "scale:";
                 bool is_scale_arg = true;
@@ -313,7 +764,7 @@ int main(int argc, char *argv[]) {
                 }
             }
         }
-        return obj2mesh(obj_file_path, mesh_file_path, invert_winding_order, scale, rotY);
+        return obj2mesh(obj_file_path, mesh_file_path, invert_winding_order, scale, rotY, compress, sort_for_overdraw, generate_lods);
     }
 
     printf((char*)("Exactly 2 file paths need to be provided: "
@@ -52,6 +52,7 @@ struct SlimApp {
     INLINE void _resize(u16 width, u16 height) {
         gpu::present::resize(width, height);
         OnWindowResize(width, height);
+        memory::frame_arena.reset();
         OnWindowRedraw();
     }
 
@@ -59,10 +60,12 @@ struct SlimApp {
         if (suspend_when_minimized && is_minimized)
             return;
 
+        memory::frame_arena.reset();
         OnWindowRedraw();
     }
 
     INLINE void _init() {
+        memory::frame_arena = memory::MonotonicAllocator{"Frame", FRAME_ARENA_SIZE};
         gpu::initGPU();
         OnInit();
     }
@@ -77,6 +80,7 @@ struct SlimApp {
         gpu::waitForGPU();
         OnShutdown();
         gpu::shutdownGPU();
+        memory::frame_arena.releaseMemory();
     }
     INLINE void _keyChanged(u8 key, bool pressed) { OnKeyChanged(key, pressed); }
 };
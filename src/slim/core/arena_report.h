@@ -0,0 +1,97 @@
+#pragma once
+
+#include "./hud.h"
+
+// Reports on the named arenas (see memory::registerArena()), a line per arena (names are expected to be short):
+// "Scene: 51234 / 65536 KB, peak 60012 KB (91%), 1043 allocations, 2 failed"
+#define ARENA_REPORT_LINE_LENGTH 192
+
+// Arenas whose high-water mark got past this share of their capacity get flagged as about to overflow:
+#define ARENA_REPORT_WARNING_OCCUPANCY 0.9f
+
+namespace memory {
+    char* writeArenaReportText(char *text, const char *source) {
+        while (*source) *text++ = *source++;
+        return text;
+    }
+
+    char* writeArenaReportNumber(char *text, u64 number) {
+        char digits[20];
+        u8 digit_count = 0;
+        do {
+            digits[digit_count++] = (char)('0' + number % 10);
+            number /= 10;
+        } while (number);
+        while (digit_count) *text++ = digits[--digit_count];
+        return text;
+    }
+
+    INLINE u64 getKilobytes(u64 size) { return (size + 1023) / 1024; }
+
+    // Writes the report line of an arena (null-terminated, without a line break). Returns its length:
+    u32 writeArenaReportLine(const ArenaStats &arena, char *line) {
+        char *text = writeArenaReportText(line, arena.name);
+        text = writeArenaReportText(text, ": ");
+        text = writeArenaReportNumber(text, getKilobytes(arena.occupied));
+        text = writeArenaReportText(text, " / ");
+        text = writeArenaReportNumber(text, getKilobytes(arena.capacity));
+        text = writeArenaReportText(text, " KB, peak ");
+        text = writeArenaReportNumber(text, getKilobytes(arena.high_water_mark));
+        if (arena.capacity) {
+            text = writeArenaReportText(text, " KB (");
+            text = writeArenaReportNumber(text, arena.high_water_mark * 100 / arena.capacity);
+            text = writeArenaReportText(text, "%), ");
+        } else
+            text = writeArenaReportText(text, " KB (released), ");
+        text = writeArenaReportNumber(text, arena.allocation_count);
+        text = writeArenaReportText(text, " allocations");
+        if (arena.failed_allocation_count) {
+            text = writeArenaReportText(text, ", ");
+            text = writeArenaReportNumber(text, arena.failed_allocation_count);
+            text = writeArenaReportText(text, " failed");
+        }
+        *text = 0;
+        return (u32)(text - line);
+    }
+
+    INLINE bool isArenaNearlyFull(const ArenaStats &arena) {
+        return (f32)arena.high_water_mark > ARENA_REPORT_WARNING_OCCUPANCY * (f32)arena.capacity;
+    }
+
+    // Dumps the report of every arena to the console.
+    // Arenas that had to fail an allocation are reported as errors, ones that got nearly full as warnings:
+    void printArenaReport() {
+        char line[ARENA_REPORT_LINE_LENGTH + 2];
+        for (u32 i = 0; i < arena_count; i++) {
+            const ArenaStats &arena = arenas[i];
+            u32 length = writeArenaReportLine(arena, line);
+            line[length] = '\n';
+            line[length + 1] = 0;
+            if (arena.failed_allocation_count) os::printError(line, 1);
+            else os::print(line, isArenaNearlyFull(arena) ? 2 : 3);
+        }
+    }
+}
+
+// A HUD with the report line of every arena, colored by how it is doing
+// (call update() before drawing it with drawHUD() every frame, to pick up the latest numbers).
+// The texts of the lines are only good for the frame, as they are written to the frame arena:
+struct ArenaHUD {
+    HUDLine lines[MEMORY_MAX_ARENA_COUNT];
+    HUD hud;
+
+    explicit ArenaHUD(i32 left = 10, i32 top = 10) : hud{{0}, lines, left, top} {}
+
+    void update() {
+        char *texts = (char*)memory::frame_arena.allocate(memory::arena_count * ARENA_REPORT_LINE_LENGTH);
+        hud.settings.line_count = texts ? memory::arena_count : 0;
+        for (u32 i = 0; i < hud.settings.line_count; i++) {
+            const memory::ArenaStats &arena = memory::arenas[i];
+            HUDLine &line = lines[i];
+            char *text = texts + i * ARENA_REPORT_LINE_LENGTH;
+            line.title = String{text, memory::writeArenaReportLine(arena, text)};
+            line.title_color = arena.failed_allocation_count ? Red : (memory::isArenaNearlyFull(arena) ? Yellow : Green);
+            line.value.string = "";
+        }
+    }
+};
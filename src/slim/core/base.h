@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cmath>
+#include <atomic>
 
 #if defined(__clang__)
     #define COMPILER_CLANG 1
@@ -122,6 +123,7 @@ typedef unsigned char      u8;
 typedef unsigned short     u16;
 typedef unsigned long int  u32;
 typedef unsigned long long u64;
+typedef signed   char      i8;
 typedef signed   short     i16;
 typedef signed   long int  i32;
 
@@ -189,6 +191,16 @@ typedef double f64;
 
 #define MEMORY_SIZE Gigabytes(1)
 #define MEMORY_BASE Terabytes(2)
+#define FRAME_ARENA_SIZE Megabytes(16)
+#define SCRATCH_ARENA_MIN_SIZE Megabytes(16)
+
+// Alignments for memory that gets loaded with SIMD, gets shared across threads or gets paged:
+#define MEMORY_SIMD_ALIGNMENT 32
+#define MEMORY_CACHE_LINE_SIZE 64
+#define MEMORY_PAGE_SIZE Kilobytes(4)
+#define MEMORY_LARGE_PAGE_SIZE Megabytes(2)
+
+#define MEMORY_MAX_ARENA_COUNT 32
 
 #define MAX_WIDTH 3840
 #define MAX_HEIGHT 2160
@@ -1340,6 +1352,9 @@ union ImageFlags {
         unsigned int wrap:1;
         unsigned int normal:1;
         unsigned int cubemap:1;
+        unsigned int compressed:1;
+        unsigned int blocked:1;
+        unsigned int streamed:1; // Mips are stored as tiles to stream in through a tile cache (see saveTiled())
     };
     u32 flags = 0;
 };
@@ -1448,7 +1463,8 @@ namespace controls {
 }
 
 namespace os {
-    void* getMemory(u64 size, u64 base = 0);
+    // Large pages need the privilege to lock memory, so it falls back to regular pages when that fails:
+    void* getMemory(u64 size, u64 base = 0, bool large_pages = false);
     void freeMemory(void* memory);
     void setWindowTitle(char* str);
     void setWindowCapture(bool on);
@@ -1463,6 +1479,13 @@ namespace os {
     long long int getFileSizeWithoutOpening(const char* path);
     long long int getFileSize(void *handle);
     void* readEntireFile(const char* file_path, u64 *out_size);
+
+    // Maps a whole file into memory (read-only), to be paged in as it gets read. Null when that fails (or it's empty):
+    const void* mapFileForReading(const char* file_path, u64 *out_size);
+    void unmapFile(const void *address);
+    bool setFilePosition(void *handle, u64 position);
+    u64 getFilePosition(void *handle);
+    bool forEachFileInDirectory(const char* directory_path, const char* pattern, void (*callback)(const char* file_name, void *data), void *data);
 }
 
 namespace timers {
@@ -1612,35 +1635,165 @@ namespace memory {
 
     typedef void* (*AllocateMemory)(u64 size);
 
+    // How full the named arenas are and ever got, and how many allocations they served or had to fail, for right-sizing
+    // arenas and catching ones that overflow (see core/arena_report.h for the HUD and the dump).
+    // All the arenas of a name add up into their entry (from any thread), so counts only ever move by amounts:
+    struct ArenaStats {
+        const char *name;
+        std::atomic<u64> capacity, occupied, high_water_mark;
+        std::atomic<u64> allocation_count, failed_allocation_count;
+
+        void onAllocation(u64 size) {
+            u64 new_occupied = occupied.fetch_add(size, std::memory_order_relaxed) + size;
+            u64 mark = high_water_mark.load(std::memory_order_relaxed);
+            while (mark < new_occupied && !high_water_mark.compare_exchange_weak(mark, new_occupied, std::memory_order_relaxed));
+            allocation_count.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void onRelease(u64 released_capacity, u64 released_occupied) {
+            capacity.fetch_sub(released_capacity, std::memory_order_relaxed);
+            occupied.fetch_sub(released_occupied, std::memory_order_relaxed);
+        }
+    };
+
+    bool isSameName(const char *name, const char *other_name) {
+        while (*name && *name == *other_name) { name++; other_name++; }
+        return *name == *other_name;
+    }
+
+    ArenaStats arenas[MEMORY_MAX_ARENA_COUNT];
+    u32 arena_count{0};
+    std::atomic_flag arenas_lock = ATOMIC_FLAG_INIT;
+
+    // Arenas are registered by name, and all the ones of a name share an entry whether they are alive at the same time
+    // or not (so arenas that get made per thread, file, scene, tracer or build add up to a single line).
+    // Returns null once the registry is full, leaving the arena untracked:
+    ArenaStats* registerArena(const char *name, u64 capacity) {
+        while (arenas_lock.test_and_set(std::memory_order_acquire));
+
+        ArenaStats *arena = nullptr;
+        for (u32 i = 0; i < arena_count; i++)
+            if (isSameName(arenas[i].name, name)) {
+                arena = arenas + i;
+                break;
+            }
+        if (!arena && arena_count < MEMORY_MAX_ARENA_COUNT) {
+            arena = arenas + arena_count;
+            arena->name = name;
+            arena_count++;
+        }
+        if (arena) arena->capacity.fetch_add(capacity, std::memory_order_relaxed);
+
+        arenas_lock.clear(std::memory_order_release);
+        return arena;
+    }
+
+    // Canvases carve their pixels and depths out of the canvas memory directly:
+    ArenaStats *canvas_arena{nullptr};
+
+    // The size to reserve for an allocation with the given alignment, as it may need up to (alignment - 1) of padding:
+    INLINE u64 getAlignedSize(u64 size, u64 alignment = MEMORY_CACHE_LINE_SIZE) {
+        return size + alignment - 1;
+    }
+
     struct MonotonicAllocator {
         u8* address{nullptr};
         u64 capacity{0};
         u64 occupied{0};
+        ArenaStats *stats{nullptr};
 
         MonotonicAllocator() = default;
 
-        explicit MonotonicAllocator(u64 Capacity, u64 starting = 0) {
+        // With large pages, the whole block gets mapped with pages of (at least) MEMORY_LARGE_PAGE_SIZE when the OS
+        // allows it, so big arrays that get accessed all over (like BVH nodes) take far fewer TLB entries:
+        explicit MonotonicAllocator(u64 Capacity, u64 starting = 0, bool large_pages = false) {
             capacity = Capacity;
-            address = (u8*)os::getMemory(Capacity, starting);
+            address = (u8*)os::getMemory(Capacity, starting, large_pages);
+        }
+
+        // Named arenas get tracked in the arena registry:
+        MonotonicAllocator(const char *name, u64 Capacity, u64 starting = 0, bool large_pages = false) :
+            MonotonicAllocator{Capacity, starting, large_pages} {
+            if (address) stats = registerArena(name, capacity);
         }
 
-        void* allocate(u64 size) {
+        // Alignment must be a power of 2. Returns null (allocating nothing) when the allocation does not fit:
+        void* allocate(u64 size, u64 alignment = 1) {
             if (!address) return nullptr;
-            occupied += size;
-            if (occupied > capacity) return nullptr;
+            u64 padding = (alignment - ((u64)address & (alignment - 1))) & (alignment - 1);
+            if (occupied + padding + size > capacity) {
+                if (stats) stats->failed_allocation_count++;
+                return nullptr;
+            }
 
+            occupied += padding + size;
+            if (stats) stats->onAllocation(padding + size);
+            address += padding;
             void* current_address = address;
             address += size;
             return current_address;
         }
 
+        // Arrays start on a cache line by default, so that aligned SIMD loads work on them and threads working on
+        // different arrays never share a line. Reserve getAlignedSize() of the size for each:
+        void* allocateAligned(u64 size, u64 alignment = MEMORY_CACHE_LINE_SIZE) {
+            return allocate(size, alignment);
+        }
+
+        // Aligned like allocateAligned(), with every element default-initialized:
+        template <typename T>
+        T* allocateArray(u64 count) {
+            T* array = (T*)allocate(sizeof(T) * count, Max((u64)alignof(T), (u64)MEMORY_CACHE_LINE_SIZE));
+            if (array) for (u64 i = 0; i < count; i++) array[i] = T{};
+            return array;
+        }
+
+        // Markers: Popping one frees everything that was allocated since it was pushed:
+        u64 push() const { return occupied; }
+        void pop(u64 marker) {
+            if (marker >= occupied) return;
+            address -= occupied - marker;
+            if (stats) stats->onRelease(0, occupied - marker);
+            occupied = marker;
+        }
+        void reset() { pop(0); }
+
         void releaseMemory() {
             address -= occupied;
             os::freeMemory(address);
+            if (stats) stats->onRelease(capacity, occupied);
             capacity = occupied = 0;
             address = nullptr;
+            stats = nullptr;
         }
     };
+
+    // Pops everything that gets allocated from an allocator during the scope:
+    struct ScratchScope {
+        MonotonicAllocator &allocator;
+        u64 marker;
+
+        explicit ScratchScope(MonotonicAllocator &allocator) : allocator{allocator}, marker{allocator.push()} {}
+        ~ScratchScope() { allocator.pop(marker); }
+    };
+
+    // Memory for what lives no longer than a frame. The app allocates it on init and resets it at the start of a frame:
+    MonotonicAllocator frame_arena;
+
+    // Every thread's memory for transient work (like loading a file), meant to be used within a ScratchScope.
+    // Memory stays with the thread to be reused by the next piece of work. It grows to the size asked for, but only
+    // while nothing is allocated from it (as growing moves it), so the outermost scope should ask for all it needs:
+    thread_local MonotonicAllocator scratch_arena;
+
+    MonotonicAllocator& getScratchArena(u64 size = 0) {
+        if (!scratch_arena.occupied && scratch_arena.capacity < size) {
+            if (scratch_arena.address) scratch_arena.releaseMemory();
+            scratch_arena = MonotonicAllocator{"Scratch", Max(size, (u64)SCRATCH_ARENA_MIN_SIZE)};
+        } else if (!scratch_arena.address)
+            scratch_arena = MonotonicAllocator{"Scratch", SCRATCH_ARENA_MIN_SIZE};
+
+        return scratch_arena;
+    }
 }
 
 namespace window {
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "./base.h"
+
+#define PARALLEL_MAX_THREADS 64
+
+// Jobs that do not fit in the queue get run right away by the thread that ran them (must be a power of 2):
+#define JOB_QUEUE_CAPACITY 1024
+
+// Workers that find no job yield this many times before going to sleep until one is queued:
+#define JOB_WORKER_SPIN_COUNT 256
+
+INLINE u32 getThreadCount() {
+    u32 thread_count = (u32)std::thread::hardware_concurrency();
+    return thread_count ? Min(thread_count, (u32)PARALLEL_MAX_THREADS) : 1;
+}
+
+typedef void (*JobFunction)(void *data, u32 first, u32 end);
+
+// Jobs get counted into the group they were run with, so that a thread can fork a bunch of them and then join:
+struct JobGroup {
+    std::atomic<u32> pending_count{0};
+
+    INLINE bool isDone() const { return !pending_count.load(std::memory_order_acquire); }
+};
+
+struct Job {
+    JobFunction function = nullptr;
+    void *data = nullptr;
+    u32 first = 0;
+    u32 end = 0;
+    JobGroup *group = nullptr;
+
+    INLINE void execute() const {
+        function(data, first, end);
+        if (group) group->pending_count.fetch_sub(1, std::memory_order_acq_rel);
+    }
+};
+
+// A bounded multi-producer multi-consumer queue that takes no locks (after Dmitry Vyukov's).
+// Every cell carries a sequence number telling producers and consumers whose turn it is on it,
+// so they only contend on the enqueue and dequeue positions (which are kept on separate cache lines):
+struct JobQueue {
+    struct Cell {
+        std::atomic<u64> sequence;
+        Job job;
+    };
+    Cell cells[JOB_QUEUE_CAPACITY];
+    alignas(MEMORY_CACHE_LINE_SIZE) std::atomic<u64> enqueue_position{0};
+    alignas(MEMORY_CACHE_LINE_SIZE) std::atomic<u64> dequeue_position{0};
+
+    JobQueue() {
+        for (u64 i = 0; i < JOB_QUEUE_CAPACITY; i++) cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // Returns false when the queue is full:
+    bool push(const Job &job) {
+        Cell *cell;
+        u64 position = enqueue_position.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = cells + (position & (JOB_QUEUE_CAPACITY - 1));
+            signed long long difference = (signed long long)(cell->sequence.load(std::memory_order_acquire) - position);
+            if (difference == 0) {
+                if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            } else if (difference < 0)
+                return false;
+            else
+                position = enqueue_position.load(std::memory_order_relaxed);
+        }
+        cell->job = job;
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false when the queue is empty:
+    bool pop(Job &job) {
+        Cell *cell;
+        u64 position = dequeue_position.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = cells + (position & (JOB_QUEUE_CAPACITY - 1));
+            signed long long difference = (signed long long)(cell->sequence.load(std::memory_order_acquire) - (position + 1));
+            if (difference == 0) {
+                if (dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            } else if (difference < 0)
+                return false;
+            else
+                position = dequeue_position.load(std::memory_order_relaxed);
+        }
+        job = cell->job;
+        cell->sequence.store(position + JOB_QUEUE_CAPACITY, std::memory_order_release);
+        return true;
+    }
+
+    INLINE bool isEmpty() const {
+        return dequeue_position.load(std::memory_order_seq_cst) >= enqueue_position.load(std::memory_order_seq_cst);
+    }
+};
+
+// One pool of worker threads (a thread per core, besides the main one) that every subsystem shares.
+// It gets started on first use and stopped at exit. Idle workers sleep, so an unused pool costs nothing:
+namespace jobs {
+    JobQueue queue;
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake_up;
+    std::atomic<u32> sleeping_worker_count{0};
+    std::atomic<bool> stopping{false};
+
+    // 0 for threads that are not workers of the pool (the main thread for one):
+    thread_local u32 worker_index = 0;
+    INLINE u32 getWorkerIndex() { return worker_index; }
+
+    void work(u32 index) {
+        worker_index = index;
+        Job job;
+        u32 spin_count = 0;
+        while (!stopping.load(std::memory_order_acquire)) {
+            if (queue.pop(job)) {
+                job.execute();
+                spin_count = 0;
+            } else if (++spin_count < JOB_WORKER_SPIN_COUNT)
+                std::this_thread::yield();
+            else {
+                spin_count = 0;
+                std::unique_lock<std::mutex> lock{sleep_mutex};
+                sleeping_worker_count.fetch_add(1, std::memory_order_seq_cst);
+                wake_up.wait(lock, []() { return stopping.load(std::memory_order_acquire) || !queue.isEmpty(); });
+                sleeping_worker_count.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    struct Workers {
+        std::thread threads[PARALLEL_MAX_THREADS];
+        u32 count = 0;
+        std::once_flag started;
+
+        void start() {
+            std::call_once(started, [this]() {
+                count = ::getThreadCount() - 1;
+                for (u32 i = 0; i < count; i++) threads[i] = std::thread{work, i + 1};
+            });
+        }
+
+        ~Workers() {
+            {
+                std::lock_guard<std::mutex> lock{sleep_mutex};
+                stopping.store(true, std::memory_order_release);
+            }
+            wake_up.notify_all();
+            for (u32 i = 0; i < count; i++) threads[i].join();
+        }
+    };
+    Workers workers;
+
+    // The number of threads that can work on jobs at the same time (the pool's workers and the thread that waits):
+    INLINE u32 getThreadCount() {
+        workers.start();
+        return workers.count + 1;
+    }
+
+    void wakeUpWorker() {
+        // Pairs with the sleeping worker incrementing the count before checking the queue, so that either the worker
+        // sees the job or this sees the worker:
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping_worker_count.load(std::memory_order_seq_cst)) {
+            { std::lock_guard<std::mutex> lock{sleep_mutex}; }
+            wake_up.notify_one();
+        }
+    }
+
+    // Forks a job calling function(data, first, end) on some worker (or right here, when the queue is full):
+    void run(JobGroup &group, JobFunction function, void *data, u32 first = 0, u32 end = 0) {
+        workers.start();
+        Job job{function, data, first, end, &group};
+        group.pending_count.fetch_add(1, std::memory_order_relaxed);
+        if (workers.count && queue.push(job))
+            wakeUpWorker();
+        else
+            job.execute();
+    }
+
+    // Joins all the jobs of the group, working on queued jobs (of any group) in the meantime:
+    void wait(JobGroup &group) {
+        Job job;
+        while (!group.isDone()) {
+            if (queue.pop(job)) job.execute();
+            else std::this_thread::yield();
+        }
+    }
+}
+
+template <typename Function>
+struct ParallelForJob {
+    const Function &function;
+    std::atomic<u64> next_first{0};
+    u32 count;
+    u32 grain_size;
+
+    ParallelForJob(const Function &function, u32 count, u32 grain_size) :
+        function{function}, count{count}, grain_size{grain_size} {}
+
+    // Keeps taking the next grain off the range until none are left:
+    static void execute(void *data, u32, u32) {
+        ParallelForJob &job = *(ParallelForJob*)data;
+        for (u64 first = job.next_first.fetch_add(job.grain_size, std::memory_order_relaxed); first < job.count;
+                 first = job.next_first.fetch_add(job.grain_size, std::memory_order_relaxed))
+            job.function((u32)first, (u32)Min(first + job.grain_size, (u64)job.count));
+    }
+};
+
+// Calls function(first, end) for contiguous ranges of [0, count) on up to thread_count threads of the pool
+// (this one included), returning once all of them are done.
+// Ranges are grain_size long and handed out to whichever thread gets to them first, so smaller grains balance
+// uneven work better. By default there is one range per thread:
+template <typename Function>
+void parallelFor(u32 count, u32 thread_count, const Function &function, u32 grain_size = 0) {
+    thread_count = Min(Min(thread_count, count), jobs::getThreadCount());
+    if (thread_count <= 1) {
+        if (count) function(0, count);
+        return;
+    }
+
+    if (!grain_size) grain_size = (count + thread_count - 1) / thread_count;
+    thread_count = Min(thread_count, (count + grain_size - 1) / grain_size);
+
+    ParallelForJob<Function> job{function, count, grain_size};
+    JobGroup group;
+    for (u32 i = 1; i < thread_count; i++) jobs::run(group, ParallelForJob<Function>::execute, &job);
+    ParallelForJob<Function>::execute(&job, 0, 0);
+    jobs::wait(group);
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "./base.h"
+#include "./tile_cache.h"
+#include "../math/spherical_harmonics.h"
 
 struct TexelQuadComponent {
     u8 TL, TR, BL, BR;
@@ -10,9 +12,58 @@ struct TexelQuad {
     TexelQuadComponent R, G, B;
 };
 
+// Blocked mips store every texel once (4 bytes) rather than in 12 byte quads that duplicate their 2x2 neighbourhood.
+// Texels are over the same grid the quads span, padded by one texel on every side: quad (x, y) covers texels
+// (x, y) to (x + 1, y + 1). They are laid out in 4x4 blocks of 64 bytes (a cache line), so a bilinear footprint
+// touches 1 to 4 lines regardless of the mip's width, at a third of the memory:
+#define TEXEL_BLOCK_SIZE 4
+
+struct BlockTexel {
+    u8 R, G, B, padding;
+};
+
+struct TexelBlock {
+    BlockTexel texels[TEXEL_BLOCK_SIZE * TEXEL_BLOCK_SIZE];
+};
+
+INLINE_XPU u32 getTexelBlocksPerRow(u32 mip_width) { return (mip_width + 2 + TEXEL_BLOCK_SIZE - 1) / TEXEL_BLOCK_SIZE; }
+INLINE_XPU u32 getTexelBlockCount(u32 mip_width, u32 mip_height) {
+    return getTexelBlocksPerRow(mip_width) * ((mip_height + 2 + TEXEL_BLOCK_SIZE - 1) / TEXEL_BLOCK_SIZE);
+}
+
+#define TEXTURE_TILE_SIZE 32
+#define TEXTURE_TILE_SIZE_IN_BYTES (sizeof(TexelQuad) * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE)
+
+struct TextureMip;
+
+// Streamed mips have no resident texel quads, they are fetched a tile at a time through a tile cache
+// from where the mip's tiles are in its (open) file. Sampling falls back to the next coarser mip
+// while a tile is not resident yet, down to the coarsest mip which is always resident:
+struct TextureMipTiles {
+    TileCache *cache = nullptr;
+    void *file = nullptr;
+    u64 offset = 0;
+    u32 tiles_per_row = 0;
+    const TextureMip *fallback = nullptr;
+
+    INLINE bool fetch(u32 x, u32 y, TexelQuad &texel_quad) const {
+        u32 tile_index  = (y / TEXTURE_TILE_SIZE) * tiles_per_row + x / TEXTURE_TILE_SIZE;
+        u32 texel_index = (y % TEXTURE_TILE_SIZE) * TEXTURE_TILE_SIZE + x % TEXTURE_TILE_SIZE;
+        return cache->fetch(file, offset + (u64)tile_index * TEXTURE_TILE_SIZE_IN_BYTES,
+                            (u32)(texel_index * sizeof(TexelQuad)), &texel_quad, sizeof(TexelQuad));
+    }
+};
+
 struct TextureMip {
     u32 width, height;
     TexelQuad *texel_quads;
+    TextureMipTiles *tiles = nullptr;
+    TexelBlock *texel_blocks = nullptr;
+
+    INLINE_XPU BlockTexel& texel(u32 x, u32 y) const {
+        return texel_blocks[(y / TEXEL_BLOCK_SIZE) * getTexelBlocksPerRow(width) + x / TEXEL_BLOCK_SIZE].texels[
+                (y % TEXEL_BLOCK_SIZE) * TEXEL_BLOCK_SIZE + x % TEXEL_BLOCK_SIZE];
+    }
 
     INLINE_XPU Pixel sample(f32 u, f32 v) const {
         if (u > 1) u -= (f32)((u32)u);
@@ -31,7 +82,24 @@ struct TextureMip {
         const f32 bl = b * l * COLOR_COMPONENT_TO_FLOAT;
         const f32 br = b * r * COLOR_COMPONENT_TO_FLOAT;
 
-        const TexelQuad texel_quad = texel_quads[y * (width + 1) + x];
+        if (texel_blocks) {
+            const BlockTexel &TL = texel(x, y);
+            const BlockTexel &TR = texel(x + 1, y);
+            const BlockTexel &BL = texel(x, y + 1);
+            const BlockTexel &BR = texel(x + 1, y + 1);
+            return {
+                    fast_mul_add((f32)BR.R, br, fast_mul_add((f32)BL.R, bl, fast_mul_add((f32)TR.R, tr, (f32)TL.R * tl))),
+                    fast_mul_add((f32)BR.G, br, fast_mul_add((f32)BL.G, bl, fast_mul_add((f32)TR.G, tr, (f32)TL.G * tl))),
+                    fast_mul_add((f32)BR.B, br, fast_mul_add((f32)BL.B, bl, fast_mul_add((f32)TR.B, tr, (f32)TL.B * tl))),
+                    1.0f
+            };
+        }
+
+        TexelQuad texel_quad;
+        if (texel_quads) texel_quad = texel_quads[y * (width + 1) + x];
+#ifndef __CUDA_ARCH__
+        else if (!tiles->fetch(x, y, texel_quad)) return tiles->fallback->sample(u, v);
+#endif
         return {
                 fast_mul_add((f32)texel_quad.R.BR, br, fast_mul_add((f32)texel_quad.R.BL, bl, fast_mul_add((f32)texel_quad.R.TR, tr, (f32)texel_quad.R.TL * tl))),
                 fast_mul_add((f32)texel_quad.G.BR, br, fast_mul_add((f32)texel_quad.G.BL, bl, fast_mul_add((f32)texel_quad.G.TR, tr, (f32)texel_quad.G.TL * tl))),
@@ -41,6 +109,54 @@ struct TextureMip {
     }
 };
 
+// Converts a mip's texel quads into blocks (which must have room for getTexelBlockCount() blocks).
+// Fails if neighbouring quads disagree on a texel they share, as the blocked layout can only store it once:
+bool convertTexelQuadsToBlocks(const TextureMip &mip, TexelBlock *texel_blocks) {
+    TextureMip blocked_mip = mip;
+    blocked_mip.texel_blocks = texel_blocks;
+
+    const TexelQuad *texel_quad = mip.texel_quads;
+    for (u32 y = 0; y <= mip.height; y++) {
+        for (u32 x = 0; x <= mip.width; x++, texel_quad++) {
+            BlockTexel &TL = blocked_mip.texel(x, y);
+            TL = {texel_quad->R.TL, texel_quad->G.TL, texel_quad->B.TL, 0};
+            if (x == mip.width) {
+                BlockTexel &TR = blocked_mip.texel(x + 1, y);
+                TR = {texel_quad->R.TR, texel_quad->G.TR, texel_quad->B.TR, 0};
+            }
+            if (y == mip.height) {
+                BlockTexel &BL = blocked_mip.texel(x, y + 1);
+                BL = {texel_quad->R.BL, texel_quad->G.BL, texel_quad->B.BL, 0};
+                if (x == mip.width) {
+                    BlockTexel &BR = blocked_mip.texel(x + 1, y + 1);
+                    BR = {texel_quad->R.BR, texel_quad->G.BR, texel_quad->B.BR, 0};
+                }
+            }
+        }
+    }
+
+    // Every other corner of every quad must match the texel it was just given by its neighbour:
+    texel_quad = mip.texel_quads;
+    for (u32 y = 0; y <= mip.height; y++)
+        for (u32 x = 0; x <= mip.width; x++, texel_quad++) {
+            const BlockTexel &TR = blocked_mip.texel(x + 1, y);
+            const BlockTexel &BL = blocked_mip.texel(x, y + 1);
+            const BlockTexel &BR = blocked_mip.texel(x + 1, y + 1);
+            if (TR.R != texel_quad->R.TR || TR.G != texel_quad->G.TR || TR.B != texel_quad->B.TR ||
+                BL.R != texel_quad->R.BL || BL.G != texel_quad->G.BL || BL.B != texel_quad->B.BL ||
+                BR.R != texel_quad->R.BR || BR.G != texel_quad->G.BR || BR.B != texel_quad->B.BR)
+                return false;
+        }
+
+    return true;
+}
+
+// Bilinear filtering samples the one mip closest to the level of detail, trilinear blends the 2 around it:
+enum TextureFilter {
+    TextureFilter_Bilinear,
+    TextureFilter_Trilinear
+};
+
 struct Texture : ImageInfo {
     TextureMip *mips = nullptr;
 
@@ -69,24 +185,61 @@ struct Texture : ImageInfo {
         return mips[flags.mipmap ? GetMipLevel(uv_coverage * (f32)(width * height), mip_count) : 0].sample(u, v);
     }
 
+    // Continuous level of detail: Each mip level quarters the texel area (so it is log4 of the texel area):
+    XPU static f32 GetMipLevelOfDetail(f32 texel_area, u32 mip_count) {
+        if (texel_area <= 1) return 0;
+        f32 level_of_detail = 0.5f * log2f(texel_area);
+        return level_of_detail < (f32)(mip_count - 1) ? level_of_detail : (f32)(mip_count - 1);
+    }
+
+    // Trilinear filtering: Blends bilinear samples of the 2 mips around the continuous level of detail,
+    // avoiding the seams of switching mips abruptly at the cost of a second sample:
+    INLINE_XPU Pixel sampleTrilinear(f32 u, f32 v, f32 uv_coverage) const {
+        if (!flags.mipmap) return mips[0].sample(u, v);
+
+        f32 level_of_detail = GetMipLevelOfDetail(uv_coverage * (f32)(width * height), mip_count);
+        u32 mip_level = (u32)level_of_detail;
+        f32 t = level_of_detail - (f32)mip_level;
+        Pixel pixel = mips[mip_level].sample(u, v);
+        if (t == 0.0f) return pixel;
+
+        Pixel coarser = mips[mip_level + 1].sample(u, v);
+        pixel.color.r = fast_mul_add(coarser.color.r - pixel.color.r, t, pixel.color.r);
+        pixel.color.g = fast_mul_add(coarser.color.g - pixel.color.g, t, pixel.color.g);
+        pixel.color.b = fast_mul_add(coarser.color.b - pixel.color.b, t, pixel.color.b);
+        return pixel;
+    }
+
+    // Where a direction lands on a cube map, as sampleCube() lays out the faces (to within rounding, as this multiplies
+    // by one reciprocal of the major axis rather than dividing by it). Picks the face with selects rather than
+    // branches (ties going to X, then Z, like sampleCube()), returning its mip:
+    INLINE_XPU static u8 GetCubeUV(f32 X, f32 Y, f32 Z, f32 &u, f32 &v) {
+        f32 ax = fabsf(X);
+        f32 ay = fabsf(Y);
+        f32 az = fabsf(Z);
+        bool x_major = ax >= ay && ax >= az;
+        bool y_major = !x_major && az < ay;
+        bool x_negative = signbit(X);
+        bool y_negative = signbit(Y);
+        bool z_negative = signbit(Z);
+
+        f32 rcp = 1.0f / (x_major ? X : (y_major ? Y : Z));
+        f32 u_ratio = (x_major ? Z : X) * rcp;
+        f32 v_ratio = (y_major ? Z : Y) * rcp;
+        f32 u_scale = x_major ? -0.125f : (y_major ? (y_negative ? -0.5f : 0.5f) : 0.125f);
+        f32 u_offset = x_major ? (x_negative ? 0.125f : 0.625f) : (y_major ? 0.5f : (z_negative ? 0.875f : 0.375f));
+        f32 v_scale = y_major ? 0.5f : ((x_major ? x_negative : z_negative) ? 0.5f : -0.5f);
+        u = fast_mul_add(u_ratio, u_scale, u_offset);
+        v = fast_mul_add(v_ratio, v_scale, 0.5f);
+
+        return y_major ? (y_negative ? 2 : 1) : 0;
+    }
+
     INLINE_XPU Pixel sampleCube(f32 X, f32 Y, f32 Z) const {
         f32 u, v;
         u8 mip = 0;
 
         Sides sides{X, Y, Z};
-////        left{signbit(x)},
-////            bottom{signbit(y)},
-////            back{signbit(z)},
-////            right{!signbit(x)},
-////            top{!signbit(y)},
-////            front{!signbit(z)}
-////        {}
-//
-//        f32 ax = abs(X);
-//        f32 ay = abs(Y);
-//        f32 az = abs(Z);
-//
-//        if (ax < Z)
 
         f32 z_over_x = X ? (Z / X) : 2;
         f32 y_over_x = X ? (Y / X) : 2;
@@ -114,59 +267,56 @@ struct Texture : ImageInfo {
 
         return mips[mip].sample(u, v);
     }
+};
+
+// Largest face size that projecting a cube texture goes over (larger faces get sampled in blocks):
+#define TEXTURE_SH_PROJECTION_SIZE 128
+
+// Projects the 6 faces of a cube map onto spherical harmonics, weighting every texel by the solid angle it subtends.
+// Faces go in the left, front, right, back, top, bottom order of cube map textures, and the colors come from calling
+// back with the face, the texel's coordinates on it and its (not normalized) direction:
+template <typename GetColor>
+void projectCubeFaces(u32 size, SphericalHarmonics &projection, const GetColor &getColor) {
+    projection = {};
+    f32 texel_size = 2.0f / (f32)size;
+    f32 texel_area = texel_size * texel_size;
+    for (u32 face = 0; face < 6; face++) {
+        for (u32 y = 0; y < size; y++) {
+            f32 t = ((f32)y + 0.5f) * texel_size - 1.0f;
+            for (u32 x = 0; x < size; x++) {
+                f32 s = ((f32)x + 0.5f) * texel_size - 1.0f;
+                vec3 direction;
+                switch (face) {
+                    case 0:  direction = {-1.0f, -t, s}; break;
+                    case 1:  direction = {s, -t, 1.0f}; break;
+                    case 2:  direction = {1.0f, -t, -s}; break;
+                    case 3:  direction = {-s, -t, -1.0f}; break;
+                    case 4:  direction = {s, 1.0f, t}; break;
+                    default: direction = {s, -1.0f, -t};
+                }
+                f32 squared_length = 1.0f + s * s + t * t;
+                f32 inverse_length = 1.0f / sqrtf(squared_length);
+                projection.add(direction * inverse_length, getColor(face, x, y, direction),
+                               texel_area * inverse_length / squared_length);
+            }
+        }
+    }
+}
+
+// Projects a cube map texture onto spherical harmonics.
+// Projecting an irradiance map gives its band-limited irradiance as is, while projecting a color (radiance) map needs
+// a convolveWithCosineLobe() after that:
+void projectCubeTexture(const Texture &texture, SphericalHarmonics &projection) {
+    u32 face_size = texture.height;
+    u32 step = Max(face_size / TEXTURE_SH_PROJECTION_SIZE, 1u);
+    u32 size = face_size / step;
 
-//    INLINE_XPU Pixel sampleCube(f32 x, f32 y, f32 z) const {
-//        f32 x_rcp = 1.0f / x;
-//        f32 y_rcp = 1.0f / y;
-//        f32 z_rcp = 1.0f / z;
-//
-//        OctantShifts octant_shifts{Sides{x, y, z}};
-//        f32 box[6]{-1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f};
-////        vec3 min_t{
-////            x_rcp * box[octant_shifts.x    ],
-////            y_rcp * box[octant_shifts.y + 1],
-////            z_rcp * box[octant_shifts.z + 2]
-////        };
-//        vec3 max_t{
-//            x_rcp * box[3 - octant_shifts.x],
-//            y_rcp * box[4 - octant_shifts.y],
-//            z_rcp * box[5 - octant_shifts.z]
-//        };
-////        f32 near_distance = Max(0, min_t.maximum());
-//        f32 far_distance = max_t.minimum();
-//
-//
-//
-//
-//        u8 mip = ((u8)side & (u8)BoxSide_Bottom) | (((u8)side & (u8)BoxSide_Top) >> 3);
-//        switch (side) {
-//            case
-//        }
-//        f32 z_over_x = X ? (Z / X) : 2;
-//        f32 y_over_x = X ? (Y / X) : 2;
-//        if (z_over_x <=  1 &&
-//            z_over_x >= -1 &&
-//            y_over_x <=  1 &&
-//            y_over_x >= -1) { // Right or Left
-//            u = fast_mul_add(z_over_x, -0.125f, fast_mul_add(0.5f, !signbit(X), 0.125f));
-//            v = fast_mul_add(y_over_x, signbit(X) - 0.5f, 0.5f);
-//        } else {
-//            f32 x_over_z = Z ? (X / Z) : 2;
-//            f32 y_over_z = Z ? (Y / Z) : 2;
-//            if (x_over_z <=  1 &&
-//                x_over_z >= -1 &&
-//                y_over_z <=  1 &&
-//                y_over_z >= -1) { // Front or Back:
-//                v = fast_mul_add(y_over_z, signbit(Z) - 0.5f, + 0.5f);
-//                u = fast_mul_add(x_over_z, 0.125f, fast_mul_add(signbit(Z), 0.5f, 0.375f));
-//            } else { // Top or Bottom
-//                u = fast_mul_add(X / abs(Y), 0.5f, 0.5f);
-//                v = fast_mul_add(Z / Y, 0.5f, 0.5f);
-//                mip = 2 - !signbit(Y);
-//            }
-//        }
-//
-//        return mips[mip].sample(u, v);
-//    }
-
-};
\ No newline at end of file
+    // The left, front, right and back faces are side by side in the first mip, the top and bottom faces are the others:
+    projectCubeFaces(size, projection, [&](u32 face, u32 x, u32 y, const vec3 &) {
+        u32 mip = face < 4 ? 0 : face - 3;
+        u32 face_count = mip ? 1 : 4;
+        f32 u = ((f32)((mip ? 0 : face) * size + x) + 0.5f) / (f32)(face_count * size);
+        f32 v = ((f32)y + 0.5f) / (f32)size;
+        return texture.mips[mip].sample(u, v).color;
+    });
+}
\ No newline at end of file
@@ -0,0 +1,253 @@
+#pragma once
+
+#include "./texture.h"
+
+#ifndef __CUDACC__
+#include <immintrin.h>
+
+// SSE versions of TextureMip::sample() and Texture::sampleTrilinear() that filter R, G and B at once,
+// with batched variants that also compute the texel coordinates and weights of 4 UVs at a time.
+// Results match the scalar versions (up to floating point rounding) and streamed tiles go through the scalar path.
+// An AVX version would not help much here, as the work per sample is bound by its 4 scattered texel fetches.
+
+#ifndef simd_mul_add
+#ifdef __FMA__
+    #define simd_mul_add(a, b, c) _mm_fmadd_ps(a, b, c)
+#else
+    #define simd_mul_add(a, b, c) _mm_add_ps(_mm_mul_ps(a, b), c)
+#endif
+#endif
+
+// Where and how to sample 4 UVs: Texel quad coordinates, and per UV the (top left, top right, bottom left, bottom right)
+// bilinear weights (also scaling 8-bit components to [0, 1] colors):
+struct TexelFootprints {
+    __m128i x, y;
+    __m128 weights[4];
+
+    INLINE TexelFootprints(const TextureMip &mip, __m128 u, __m128 v) {
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 to_float = _mm_set1_ps(COLOR_COMPONENT_TO_FLOAT);
+
+        // Wrap UVs above 1 like the scalar version does:
+        u = _mm_sub_ps(u, _mm_and_ps(_mm_cmpgt_ps(u, one), _mm_cvtepi32_ps(_mm_cvttps_epi32(u))));
+        v = _mm_sub_ps(v, _mm_and_ps(_mm_cmpgt_ps(v, one), _mm_cvtepi32_ps(_mm_cvttps_epi32(v))));
+
+        __m128 U = simd_mul_add(u, _mm_set1_ps((f32)mip.width), half);
+        __m128 V = simd_mul_add(v, _mm_set1_ps((f32)mip.height), half);
+        x = _mm_cvttps_epi32(U);
+        y = _mm_cvttps_epi32(V);
+        __m128 r = _mm_sub_ps(U, _mm_cvtepi32_ps(x));
+        __m128 b = _mm_sub_ps(V, _mm_cvtepi32_ps(y));
+        __m128 l = _mm_sub_ps(one, r);
+        __m128 t = _mm_mul_ps(_mm_sub_ps(one, b), to_float);
+        b = _mm_mul_ps(b, to_float);
+
+        weights[0] = _mm_mul_ps(t, l);
+        weights[1] = _mm_mul_ps(t, r);
+        weights[2] = _mm_mul_ps(b, l);
+        weights[3] = _mm_mul_ps(b, r);
+        _MM_TRANSPOSE4_PS(weights[0], weights[1], weights[2], weights[3]);
+    }
+};
+
+INLINE __m128 filterTexelQuad(const TexelQuad &texel_quad, __m128 weights) {
+    const __m128i zero = _mm_setzero_si128();
+
+    // 12 bytes: The 4 corners of R, then of G, then of B (loaded as 8 + 4 to not read past the quad):
+    int blue;
+    memcpy(&blue, &texel_quad.B, sizeof(int));
+    __m128i bytes = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)&texel_quad), _mm_cvtsi32_si128(blue));
+    __m128i red_green = _mm_unpacklo_epi8(bytes, zero);
+    __m128 R = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(red_green, zero)), weights);
+    __m128 G = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(red_green, zero)), weights);
+    __m128 B = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpackhi_epi8(bytes, zero), zero)), weights);
+    __m128 A = _mm_setzero_ps();
+
+    // Sum the weighted corners of each channel into one (r, g, b, 0) vector:
+    _MM_TRANSPOSE4_PS(R, G, B, A);
+    return _mm_add_ps(_mm_add_ps(R, G), _mm_add_ps(B, A));
+}
+
+INLINE __m128 filterTexelBlocks(const TextureMip &mip, u32 x, u32 y, __m128 weights) {
+    const __m128i zero = _mm_setzero_si128();
+
+    int texels[4];
+    memcpy(texels + 0, &mip.texel(x, y), sizeof(int));
+    memcpy(texels + 1, &mip.texel(x + 1, y), sizeof(int));
+    memcpy(texels + 2, &mip.texel(x, y + 1), sizeof(int));
+    memcpy(texels + 3, &mip.texel(x + 1, y + 1), sizeof(int));
+
+    // 4 RGBX texels, each widened into an (r, g, b, 0) vector:
+    __m128i bytes = _mm_loadu_si128((const __m128i*)texels);
+    __m128i top = _mm_unpacklo_epi8(bytes, zero);
+    __m128i bottom = _mm_unpackhi_epi8(bytes, zero);
+    __m128 TL = _mm_cvtepi32_ps(_mm_unpacklo_epi16(top, zero));
+    __m128 TR = _mm_cvtepi32_ps(_mm_unpackhi_epi16(top, zero));
+    __m128 BL = _mm_cvtepi32_ps(_mm_unpacklo_epi16(bottom, zero));
+    __m128 BR = _mm_cvtepi32_ps(_mm_unpackhi_epi16(bottom, zero));
+
+    __m128 color = _mm_mul_ps(TL, _mm_shuffle_ps(weights, weights, _MM_SHUFFLE(0, 0, 0, 0)));
+    color = simd_mul_add(TR, _mm_shuffle_ps(weights, weights, _MM_SHUFFLE(1, 1, 1, 1)), color);
+    color = simd_mul_add(BL, _mm_shuffle_ps(weights, weights, _MM_SHUFFLE(2, 2, 2, 2)), color);
+    return  simd_mul_add(BR, _mm_shuffle_ps(weights, weights, _MM_SHUFFLE(3, 3, 3, 3)), color);
+}
+
+INLINE __m128 filterTexels(const TextureMip &mip, u32 x, u32 y, __m128 weights) {
+    return mip.texel_blocks ?
+        filterTexelBlocks(mip, x, y, weights) :
+        filterTexelQuad(mip.texel_quads[y * (mip.width + 1) + x], weights);
+}
+
+static_assert(sizeof(Pixel) == sizeof(__m128), "Pixels are stored as (r, g, b, opacity) vectors");
+
+INLINE Pixel toPixel(__m128 color) {
+    Pixel pixel;
+    _mm_storeu_ps((f32*)&pixel, _mm_add_ps(color, _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f)));
+    return pixel;
+}
+
+// Samples 4 UVs of a mip, returning (r, g, b, 0) vectors:
+INLINE void sampleSIMD(const TextureMip &mip, __m128 u, __m128 v, __m128 *colors) {
+    alignas(16) int x[4], y[4]; // 32-bit lanes (i32 may be wider)
+    TexelFootprints footprints{mip, u, v};
+    _mm_store_si128((__m128i*)x, footprints.x);
+    _mm_store_si128((__m128i*)y, footprints.y);
+    for (u32 i = 0; i < 4; i++) colors[i] = filterTexels(mip, (u32)x[i], (u32)y[i], footprints.weights[i]);
+}
+
+// Samples a single UV of a mip, returning an (r, g, b, 0) vector:
+INLINE __m128 sampleSIMD(const TextureMip &mip, f32 u, f32 v) {
+    TexelFootprints footprint{mip, _mm_set1_ps(u), _mm_set1_ps(v)};
+    return filterTexels(mip, (u32)_mm_cvtsi128_si32(footprint.x), (u32)_mm_cvtsi128_si32(footprint.y), footprint.weights[0]);
+}
+
+INLINE Pixel samplePixelSIMD(const TextureMip &mip, f32 u, f32 v) {
+    if (!mip.texel_quads && !mip.texel_blocks) return mip.sample(u, v);
+
+    return toPixel(sampleSIMD(mip, u, v));
+}
+
+void sampleSIMD(const TextureMip &mip, const f32 *us, const f32 *vs, Pixel *pixels, u32 count) {
+    u32 i = 0;
+    if (mip.texel_quads || mip.texel_blocks) {
+        __m128 colors[4];
+        for (; i + 4 <= count; i += 4) {
+            sampleSIMD(mip, _mm_loadu_ps(us + i), _mm_loadu_ps(vs + i), colors);
+            for (u32 j = 0; j < 4; j++) pixels[i + j] = toPixel(colors[j]);
+        }
+    }
+    for (; i < count; i++) pixels[i] = samplePixelSIMD(mip, us[i], vs[i]);
+}
+
+INLINE Pixel sampleTrilinearSIMD(const Texture &texture, f32 u, f32 v, f32 uv_coverage) {
+    if (!texture.flags.mipmap) return samplePixelSIMD(texture.mips[0], u, v);
+
+    f32 level_of_detail = Texture::GetMipLevelOfDetail(uv_coverage * (f32)(texture.width * texture.height), texture.mip_count);
+    u32 mip_level = (u32)level_of_detail;
+    f32 t = level_of_detail - (f32)mip_level;
+    const TextureMip &mip = texture.mips[mip_level];
+    if (t == 0.0f) return samplePixelSIMD(mip, u, v);
+
+    const TextureMip &coarser_mip = texture.mips[mip_level + 1];
+    if ((!mip.texel_quads && !mip.texel_blocks) || (!coarser_mip.texel_quads && !coarser_mip.texel_blocks))
+        return texture.sampleTrilinear(u, v, uv_coverage);
+
+    __m128 finer = sampleSIMD(mip, u, v);
+    __m128 coarser = sampleSIMD(coarser_mip, u, v);
+    return toPixel(simd_mul_add(_mm_sub_ps(coarser, finer), _mm_set1_ps(t), finer));
+}
+
+INLINE __m128 simd_select(__m128 mask, __m128 if_true, __m128 if_false) {
+    return _mm_or_ps(_mm_and_ps(mask, if_true), _mm_andnot_ps(mask, if_false));
+}
+
+// Texture::GetCubeUV() for 4 directions, picking their major axes with compares.
+// Mips are 0 for the side faces, 1 for the top face and 2 for the bottom face:
+struct CubeFootprints {
+    __m128 u, v;
+    __m128i mip;
+
+    INLINE CubeFootprints(__m128 X, __m128 Y, __m128 Z) {
+        const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+        const __m128 sign_mask = _mm_castsi128_ps(_mm_set1_epi32((int)0x80000000));
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 eighth = _mm_set1_ps(0.125f);
+
+        __m128 ax = _mm_and_ps(X, abs_mask);
+        __m128 ay = _mm_and_ps(Y, abs_mask);
+        __m128 az = _mm_and_ps(Z, abs_mask);
+        __m128 x_major = _mm_and_ps(_mm_cmpge_ps(ax, ay), _mm_cmpge_ps(ax, az));
+        __m128 y_major = _mm_andnot_ps(x_major, _mm_cmplt_ps(az, ay));
+
+        // All lanes set where the sign bit is (matching signbit(), so -0 counts as negative):
+        __m128 x_negative = _mm_castsi128_ps(_mm_srai_epi32(_mm_castps_si128(X), 31));
+        __m128 y_negative = _mm_castsi128_ps(_mm_srai_epi32(_mm_castps_si128(Y), 31));
+        __m128 z_negative = _mm_castsi128_ps(_mm_srai_epi32(_mm_castps_si128(Z), 31));
+
+        // u and v are a scale and an offset away from the ratios of the minor axes to the major one:
+        //  Right/Left: u = -Z/X * 1/8 + (X < 0 ? 1/8 : 5/8), v = Y/X * (X < 0 ? 1/2 : -1/2) + 1/2
+        //  Front/Back: u =  X/Z * 1/8 + (Z < 0 ? 7/8 : 3/8), v = Y/Z * (Z < 0 ? 1/2 : -1/2) + 1/2
+        //  Top/Bottom: u = X/|Y| * 1/2 + 1/2,                v = Z/Y * 1/2 + 1/2
+        __m128 major = simd_select(x_major, X, simd_select(y_major, Y, Z));
+        __m128 rcp = _mm_div_ps(_mm_set1_ps(1.0f), major);
+        __m128 u_ratio = _mm_mul_ps(simd_select(x_major, Z, X), rcp);
+        __m128 v_ratio = _mm_mul_ps(simd_select(y_major, Z, Y), rcp);
+
+        __m128 u_scale = simd_select(x_major, _mm_set1_ps(-0.125f), simd_select(y_major, _mm_xor_ps(half, _mm_and_ps(y_negative, sign_mask)), eighth));
+        __m128 u_offset = simd_select(x_major, _mm_add_ps(eighth, _mm_andnot_ps(x_negative, half)),
+                          simd_select(y_major, half, _mm_add_ps(_mm_set1_ps(0.375f), _mm_and_ps(z_negative, half))));
+        __m128 v_scale = simd_select(y_major, half, _mm_xor_ps(half, _mm_andnot_ps(simd_select(x_major, x_negative, z_negative), sign_mask)));
+
+        u = simd_mul_add(u_ratio, u_scale, u_offset);
+        v = simd_mul_add(v_ratio, v_scale, half);
+        mip = _mm_and_si128(_mm_castps_si128(y_major), _mm_sub_epi32(_mm_set1_epi32(1), _mm_castps_si128(y_negative)));
+    }
+};
+
+// Samples a single UV of a mip, streamed out or not, returning an (r, g, b, 0) vector:
+INLINE __m128 sampleOrFetchSIMD(const TextureMip &mip, f32 u, f32 v) {
+    if (mip.texel_quads || mip.texel_blocks) return sampleSIMD(mip, u, v);
+
+    Pixel pixel = mip.sample(u, v);
+    return _mm_setr_ps(pixel.color.r, pixel.color.g, pixel.color.b, 0.0f);
+}
+
+// Samples 4 directions of a cube map texture, returning (r, g, b, 0) vectors.
+// Directions that all land on the same resident mip (as coherent rays mostly do) are filtered together, while mips
+// that are streamed out (see openTiled()) are sampled one direction at a time:
+INLINE void sampleCubeSIMD(const Texture &texture, __m128 X, __m128 Y, __m128 Z, __m128 *colors) {
+    CubeFootprints footprints{X, Y, Z};
+    alignas(16) int mips[4]; // 32-bit lanes (u32 may be wider)
+    _mm_store_si128((__m128i*)mips, footprints.mip);
+    if (mips[0] == mips[1] && mips[0] == mips[2] && mips[0] == mips[3] &&
+        (texture.mips[mips[0]].texel_quads || texture.mips[mips[0]].texel_blocks)) {
+        sampleSIMD(texture.mips[mips[0]], footprints.u, footprints.v, colors);
+        return;
+    }
+
+    alignas(16) f32 u[4], v[4];
+    _mm_store_ps(u, footprints.u);
+    _mm_store_ps(v, footprints.v);
+    for (u32 i = 0; i < 4; i++) colors[i] = sampleOrFetchSIMD(texture.mips[mips[i]], u[i], v[i]);
+}
+
+// A single direction is faster to address with scalar selects than in one SIMD lane:
+INLINE Pixel sampleCubeSIMD(const Texture &texture, f32 X, f32 Y, f32 Z) {
+    f32 u, v;
+    const TextureMip &mip = texture.mips[Texture::GetCubeUV(X, Y, Z, u, v)];
+    return samplePixelSIMD(mip, u, v);
+}
+
+// Batched sampling of directions given as separate X, Y and Z arrays (as a wavefront of rays would keep them).
+// Residency is checked per mip sampled, as each face group's mip streams on its own:
+void sampleCubeSIMD(const Texture &texture, const f32 *Xs, const f32 *Ys, const f32 *Zs, Pixel *pixels, u32 count) {
+    u32 i = 0;
+    __m128 colors[4];
+    for (; i + 4 <= count; i += 4) {
+        sampleCubeSIMD(texture, _mm_loadu_ps(Xs + i), _mm_loadu_ps(Ys + i), _mm_loadu_ps(Zs + i), colors);
+        for (u32 j = 0; j < 4; j++) pixels[i + j] = toPixel(colors[j]);
+    }
+    for (; i < count; i++) pixels[i] = sampleCubeSIMD(texture, Xs[i], Ys[i], Zs[i]);
+}
+#endif
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <atomic>
+#include <string.h>
+
+#include "./base.h"
+
+#define TILE_CACHE_NONE 0xFFFFFFFF
+#define TILE_CACHE_DEFAULT_BUDGET Megabytes(64)
+
+// Tiles get spread over this many shards by their key, each one with a lock of its own so that threads fetching
+// different tiles rarely contend (must be a power of 2):
+#define TILE_CACHE_SHARD_COUNT 16
+
+// Misses get recorded for streamIn() in this many entries per shard (must be a power of 2):
+#define TILE_CACHE_PENDING_CAPACITY 64
+
+struct SpinLock {
+    std::atomic_flag flag = ATOMIC_FLAG_INIT;
+
+    INLINE void lock() { while (flag.test_and_set(std::memory_order_acquire)) {} }
+    INLINE void unlock() { flag.clear(std::memory_order_release); }
+};
+
+// A fixed-size cache of equally sized tiles of file content, keyed by file handle and file offset.
+// The whole cache (tiles and bookkeeping) is allocated up-front from a single memory budget, split evenly over
+// shards that each evict their least recently used tile to make room for a new one.
+//
+// fetch() copies out of a resident tile while holding the lock of its shard, so a tile can never be evicted from
+// under a reader. On a miss it records a request and returns false (letting the caller fall back to something
+// coarser). streamIn() services recorded requests, doing the file IO outside the locks.
+struct TileCache {
+    struct Key {
+        void *file;
+        u64 offset;
+    };
+
+    struct Slot {
+        Key key;
+        u32 prev, next, next_in_bucket;
+    };
+
+    INLINE static u64 hash(const Key &key) {
+        return ((u64)key.file ^ (key.offset << 7) ^ (key.offset >> 25)) * 0x9E3779B97F4A7C15ull;
+    }
+
+    // Shards sit on cache lines of their own, so that locking one does not slow down fetches from the others:
+    struct alignas(MEMORY_CACHE_LINE_SIZE) Shard {
+        u8 *tiles = nullptr;
+        Slot *slots = nullptr;
+        u32 *buckets = nullptr;
+        Key *pending = nullptr;
+
+        u32 slot_count = 0;
+        u32 used_slot_count = 0;
+        u32 bucket_mask = 0;
+        u32 most_recently_used = TILE_CACHE_NONE;
+        u32 least_recently_used = TILE_CACHE_NONE;
+
+        u64 hits = 0;
+        u64 misses = 0;
+        u64 evictions = 0;
+
+        SpinLock spin_lock;
+
+        INLINE u32 bucketOf(u64 key_hash) const { return (u32)(key_hash >> 32) & bucket_mask; }
+
+        u32 find(const Key &key, u64 key_hash) const {
+            u32 slot = buckets[bucketOf(key_hash)];
+            while (slot != TILE_CACHE_NONE && !(slots[slot].key.file == key.file && slots[slot].key.offset == key.offset))
+                slot = slots[slot].next_in_bucket;
+
+            return slot;
+        }
+
+        void unlinkFromUsage(u32 slot) {
+            Slot &s = slots[slot];
+            if (s.prev != TILE_CACHE_NONE) slots[s.prev].next = s.next; else most_recently_used = s.next;
+            if (s.next != TILE_CACHE_NONE) slots[s.next].prev = s.prev; else least_recently_used = s.prev;
+        }
+
+        void linkAsMostRecentlyUsed(u32 slot) {
+            Slot &s = slots[slot];
+            s.prev = TILE_CACHE_NONE;
+            s.next = most_recently_used;
+            if (most_recently_used != TILE_CACHE_NONE) slots[most_recently_used].prev = slot;
+            else least_recently_used = slot;
+            most_recently_used = slot;
+        }
+
+        void unlinkFromBucket(u32 slot) {
+            u32 *link = buckets + bucketOf(hash(slots[slot].key));
+            while (*link != slot) link = &slots[*link].next_in_bucket;
+            *link = slots[slot].next_in_bucket;
+        }
+    };
+
+    memory::MonotonicAllocator memory;
+    u8 *staging_tile = nullptr;
+    u32 tile_size = 0;
+    u32 slot_count = 0;
+    Shard shards[TILE_CACHE_SHARD_COUNT];
+
+    TileCache() = default;
+    TileCache(u32 tile_size_in_bytes, u64 memory_budget = TILE_CACHE_DEFAULT_BUDGET) {
+        init(tile_size_in_bytes, memory_budget);
+    }
+
+    // Leaves the cache empty (so that every fetch misses) when the budget does not fit a tile per shard:
+    void init(u32 tile_size_in_bytes, u64 memory_budget = TILE_CACHE_DEFAULT_BUDGET) {
+        tile_size = tile_size_in_bytes;
+        u64 fixed_size = memory::getAlignedSize(tile_size) +
+                         memory::getAlignedSize(sizeof(Key) * TILE_CACHE_PENDING_CAPACITY) * TILE_CACHE_SHARD_COUNT;
+        if (memory_budget <= fixed_size) return;
+
+        // Buckets are rounded up to a power of 2, so budget for up to twice as many buckets as slots:
+        u64 slot_size = tile_size + sizeof(Slot) + sizeof(u32) * 2;
+        u32 shard_slot_count = (u32)((memory_budget - fixed_size) / (slot_size * TILE_CACHE_SHARD_COUNT));
+        if (!shard_slot_count) return;
+
+        u32 bucket_count = 1;
+        while (bucket_count < shard_slot_count) bucket_count <<= 1;
+
+        u64 shard_size = memory::getAlignedSize((u64)shard_slot_count * tile_size) +
+                         memory::getAlignedSize(sizeof(Slot) * shard_slot_count) +
+                         memory::getAlignedSize(sizeof(u32) * bucket_count);
+        memory = memory::MonotonicAllocator{"TileCache", fixed_size + shard_size * TILE_CACHE_SHARD_COUNT};
+        if (!memory.address) return;
+
+        staging_tile = (u8*)memory.allocateAligned(tile_size);
+        for (u32 shard_index = 0; shard_index < TILE_CACHE_SHARD_COUNT; shard_index++) {
+            Shard &shard = shards[shard_index];
+            shard.slot_count = shard_slot_count;
+            shard.bucket_mask = bucket_count - 1;
+            shard.tiles   = (u8*)memory.allocateAligned((u64)shard_slot_count * tile_size);
+            shard.slots   = (Slot*)memory.allocateAligned(sizeof(Slot) * shard_slot_count);
+            shard.buckets = (u32*)memory.allocateAligned(sizeof(u32) * bucket_count);
+            shard.pending = (Key*)memory.allocateAligned(sizeof(Key) * TILE_CACHE_PENDING_CAPACITY);
+
+            for (u32 i = 0; i < bucket_count; i++) shard.buckets[i] = TILE_CACHE_NONE;
+            for (u32 i = 0; i < TILE_CACHE_PENDING_CAPACITY; i++) shard.pending[i] = {nullptr, 0};
+        }
+        slot_count = shard_slot_count * TILE_CACHE_SHARD_COUNT;
+    }
+
+    INLINE u64 getSizeInBytes() const { return memory.capacity; }
+
+    INLINE Shard& shardOf(u64 key_hash) { return shards[(key_hash >> 24) & (TILE_CACHE_SHARD_COUNT - 1)]; }
+
+    bool fetch(void *file, u64 offset, u32 offset_in_tile, void *out, u32 size) {
+        if (!slot_count) return false;
+
+        Key key{file, offset};
+        u64 key_hash = hash(key);
+        Shard &shard = shardOf(key_hash);
+        shard.spin_lock.lock();
+        u32 slot = shard.find(key, key_hash);
+        if (slot == TILE_CACHE_NONE) {
+            // A colliding request simply overwrites an older one, which gets requested again on its next miss:
+            shard.pending[(u32)(key_hash >> 48) & (TILE_CACHE_PENDING_CAPACITY - 1)] = key;
+            shard.misses++;
+            shard.spin_lock.unlock();
+            return false;
+        }
+
+        memcpy(out, shard.tiles + (u64)slot * tile_size + offset_in_tile, size);
+        if (slot != shard.most_recently_used) {
+            shard.unlinkFromUsage(slot);
+            shard.linkAsMostRecentlyUsed(slot);
+        }
+        shard.hits++;
+        shard.spin_lock.unlock();
+        return true;
+    }
+
+    // Loads up to max_tiles of the tiles that missed since the last call (never more per shard than fit in it, as
+    // those would only evict each other). Requests beyond that are dropped rather than left to go stale, tiles that
+    // are still needed get requested again on their next miss. Meant to be called from one thread (e.g. once per
+    // frame), but may run while other threads keep fetching. Returns the number of tiles loaded.
+    u32 streamIn(u32 max_tiles = TILE_CACHE_PENDING_CAPACITY * TILE_CACHE_SHARD_COUNT) {
+        u32 loaded = 0;
+        for (u32 shard_index = 0; shard_index < TILE_CACHE_SHARD_COUNT; shard_index++) {
+            Shard &shard = shards[shard_index];
+            u32 loaded_into_shard = 0;
+            for (u32 i = 0; i < TILE_CACHE_PENDING_CAPACITY; i++) {
+                shard.spin_lock.lock();
+                Key key = shard.pending[i];
+                shard.pending[i] = {nullptr, 0};
+                u64 key_hash = hash(key);
+                bool resident = key.file && shard.find(key, key_hash) != TILE_CACHE_NONE;
+                shard.spin_lock.unlock();
+                if (!key.file || resident || loaded == max_tiles || loaded_into_shard == shard.slot_count) continue;
+
+                if (!os::setFilePosition(key.file, key.offset) ||
+                    !os::readFromFile(staging_tile, tile_size, key.file))
+                    continue;
+
+                shard.spin_lock.lock();
+                u32 slot;
+                if (shard.used_slot_count < shard.slot_count) slot = shard.used_slot_count++;
+                else {
+                    slot = shard.least_recently_used;
+                    shard.unlinkFromUsage(slot);
+                    if (shard.slots[slot].key.file) {
+                        shard.unlinkFromBucket(slot);
+                        shard.evictions++;
+                    }
+                }
+                memcpy(shard.tiles + (u64)slot * tile_size, staging_tile, tile_size);
+
+                u32 bucket = shard.bucketOf(key_hash);
+                shard.slots[slot].key = key;
+                shard.slots[slot].next_in_bucket = shard.buckets[bucket];
+                shard.buckets[bucket] = slot;
+                shard.linkAsMostRecentlyUsed(slot);
+                shard.spin_lock.unlock();
+
+                loaded_into_shard++;
+                loaded++;
+            }
+        }
+
+        return loaded;
+    }
+
+    // Drops every tile of the given file (e.g. before closing it, as handles may get reused):
+    void evict(void *file) {
+        if (!file || !slot_count) return;
+
+        for (u32 shard_index = 0; shard_index < TILE_CACHE_SHARD_COUNT; shard_index++) {
+            Shard &shard = shards[shard_index];
+            shard.spin_lock.lock();
+            for (u32 slot = shard.most_recently_used; slot != TILE_CACHE_NONE; ) {
+                u32 next = shard.slots[slot].next;
+                if (shard.slots[slot].key.file == file) {
+                    shard.unlinkFromUsage(slot);
+                    shard.unlinkFromBucket(slot);
+                    shard.evictions++;
+
+                    // Move the freed slot to the cold end so it is the next one to be reused:
+                    Slot &s = shard.slots[slot];
+                    s.key = {nullptr, 0};
+                    s.next = TILE_CACHE_NONE;
+                    s.prev = shard.least_recently_used;
+                    if (shard.least_recently_used != TILE_CACHE_NONE) shard.slots[shard.least_recently_used].next = slot;
+                    else shard.most_recently_used = slot;
+                    shard.least_recently_used = slot;
+                }
+                slot = next;
+            }
+            for (u32 i = 0; i < TILE_CACHE_PENDING_CAPACITY; i++)
+                if (shard.pending[i].file == file) shard.pending[i] = {nullptr, 0};
+            shard.spin_lock.unlock();
+        }
+    }
+};
@@ -61,5 +61,6 @@ struct Geometry {
     GeometryType type{GeometryType_None};
     u32 material_id = 0, id = 0;
     u8 flags = GEOMETRY_IS_VISIBLE | GEOMETRY_IS_SHADOWING;
+    u8 lod = 0; // Of meshes, as selected by Scene::updateLODs() (0 being the full mesh)
     ColorID color{White};
 };
\ No newline at end of file
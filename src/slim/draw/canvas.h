@@ -1,6 +1,10 @@
 #pragma once
 
 #include "../core/base.h"
+#include "../core/parallel.h"
+
+// Clearing is split across the thread pool in runs of this many pixels (or depths):
+#define CANVAS_CLEAR_GRAIN_SIZE 16384
 
 enum AntiAliasing {
     NoAA,
@@ -29,11 +33,14 @@ struct Canvas : CanvasData {
             memory::canvas_memory += CANVAS_DEPTHS_SIZE;
             memory::canvas_memory_capacity -= CANVAS_DEPTHS_SIZE;
 
+            if (memory::canvas_arena) memory::canvas_arena->onAllocation(CANVAS_PIXELS_SIZE + CANVAS_DEPTHS_SIZE);
+
             dimensions.update(MAX_WIDTH, MAX_HEIGHT);
             clear();
         } else {
             pixels = nullptr;
             depths = nullptr;
+            if (memory::canvas_arena) memory::canvas_arena->failed_allocation_count++;
         }
         dimensions.update(width, height);
     }
@@ -58,8 +65,14 @@ struct Canvas : CanvasData {
 
         Pixel pixel{red, green, blue, opacity};
 
-        if (pixels) for (i32 i = 0; i < pixels_count; i++) pixels[i] = pixel;
-        if (depths) for (i32 i = 0; i < depths_count; i++) depths[i] = depth;
+        if (pixels)
+            parallelFor((u32)pixels_count, getThreadCount(), [&](u32 first, u32 end) {
+                for (u32 i = first; i < end; i++) pixels[i] = pixel;
+            }, CANVAS_CLEAR_GRAIN_SIZE);
+        if (depths)
+            parallelFor((u32)depths_count, getThreadCount(), [&](u32 first, u32 end) {
+                for (u32 i = first; i < end; i++) depths[i] = depth;
+            }, CANVAS_CLEAR_GRAIN_SIZE);
     }
 
     void drawFrom(Canvas& source_canvas, const RectI* source_bounds = nullptr, const RectI* target_bounds = nullptr, f32 opacity = 1.0f, bool blend = true, bool include_depths = false) {
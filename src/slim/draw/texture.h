@@ -16,9 +16,16 @@ void drawTextureMip(const TextureMip &texture_mip, const Canvas &canvas, const R
         for (i32 y = 0; y < draw_height; y++, Y++) {
             i32 X = draw_bounds.left;
             for (i32 x = 0; x < draw_width; x++, X++, texel_quad++) {
-                texel_color.r = (f32)texel_quad->R.BR * COLOR_COMPONENT_TO_FLOAT;
-                texel_color.g = (f32)texel_quad->G.BR * COLOR_COMPONENT_TO_FLOAT;
-                texel_color.b = (f32)texel_quad->B.BR * COLOR_COMPONENT_TO_FLOAT;
+                if (texture_mip.texel_blocks) {
+                    const BlockTexel &texel = texture_mip.texel(x + 1, y + 1);
+                    texel_color.r = (f32)texel.R * COLOR_COMPONENT_TO_FLOAT;
+                    texel_color.g = (f32)texel.G * COLOR_COMPONENT_TO_FLOAT;
+                    texel_color.b = (f32)texel.B * COLOR_COMPONENT_TO_FLOAT;
+                } else {
+                    texel_color.r = (f32)texel_quad->R.BR * COLOR_COMPONENT_TO_FLOAT;
+                    texel_color.g = (f32)texel_quad->G.BR * COLOR_COMPONENT_TO_FLOAT;
+                    texel_color.b = (f32)texel_quad->B.BR * COLOR_COMPONENT_TO_FLOAT;
+                }
                 canvas.setPixel(X, Y, texel_color, opacity);
             }
             texel_quad += remainder_x;
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "./vec3.h"
+
+#ifndef __CUDACC__
+#include <immintrin.h>
+
+#ifndef simd_mul_add
+#ifdef __FMA__
+    #define simd_mul_add(a, b, c) _mm_fmadd_ps(a, b, c)
+#else
+    #define simd_mul_add(a, b, c) _mm_add_ps(_mm_mul_ps(a, b), c)
+#endif
+#endif
+#endif
+
+// Real spherical harmonics of the first 3 bands (9 coefficients per color channel).
+// That is enough to represent irradiance: Projecting radiance onto them and convolving it with the clamped cosine lobe
+// gives irradiance to within a few percent on average (Ramamoorthi and Hanrahan, "An Efficient Representation for
+// Irradiance Environment Maps").
+#define SH_COEFFICIENT_COUNT 9
+
+struct SphericalHarmonics {
+    Color coefficients[SH_COEFFICIENT_COUNT];
+
+    INLINE_XPU static void getBasis(const vec3 &direction, f32 *basis) {
+        const f32 x = direction.x;
+        const f32 y = direction.y;
+        const f32 z = direction.z;
+        basis[0] = 0.282095f;
+        basis[1] = 0.488603f * y;
+        basis[2] = 0.488603f * z;
+        basis[3] = 0.488603f * x;
+        basis[4] = 1.092548f * x * y;
+        basis[5] = 1.092548f * y * z;
+        basis[6] = 0.315392f * (3.0f * z * z - 1.0f);
+        basis[7] = 1.092548f * x * z;
+        basis[8] = 0.546274f * (x * x - y * y);
+    }
+
+    // Accumulates radiance coming from a (unit) direction over the given solid angle:
+    INLINE_XPU void add(const vec3 &direction, const Color &radiance, f32 solid_angle) {
+        f32 basis[SH_COEFFICIENT_COUNT];
+        getBasis(direction, basis);
+        for (u32 i = 0; i < SH_COEFFICIENT_COUNT; i++)
+            coefficients[i] = radiance.scaleAdd(basis[i] * solid_angle, coefficients[i]);
+    }
+
+    INLINE_XPU void add(const SphericalHarmonics &other) {
+        for (u32 i = 0; i < SH_COEFFICIENT_COUNT; i++) coefficients[i] += other.coefficients[i];
+    }
+
+    // Turns projected radiance into irradiance over pi (the cosine weighted average of the radiance), which is what a
+    // white diffuse surface reflects and what irradiance maps store. Convolving with the clamped cosine lobe scales
+    // the bands by pi, 2pi/3 and pi/4:
+    INLINE_XPU void convolveWithCosineLobe() {
+        for (u32 i = 1; i < 4; i++) coefficients[i] *= 2.0f / 3.0f;
+        for (u32 i = 4; i < SH_COEFFICIENT_COUNT; i++) coefficients[i] *= 0.25f;
+    }
+
+    INLINE_XPU Color evaluate(const vec3 &direction) const {
+        f32 basis[SH_COEFFICIENT_COUNT];
+        getBasis(direction, basis);
+        Color color{coefficients[0] * basis[0]};
+        for (u32 i = 1; i < SH_COEFFICIENT_COUNT; i++) color = coefficients[i].scaleAdd(basis[i], color);
+        return color;
+    }
+};
+
+// Spherical harmonics folded with their basis constants into a polynomial of the direction's components:
+// c + x*X + y*Y + z*Z + xy*XY + yz*YZ + zz*ZZ + xz*XZ + (xx - yy)*XX_YY
+// Each term is stored as an (r, g, b, 0) vector, so evaluating takes 8 multiply-adds for all 3 channels at once
+// (and no memory traffic beyond these 144 bytes):
+struct IrradianceSH {
+    f32 terms[SH_COEFFICIENT_COUNT][4];
+
+    void init(const SphericalHarmonics &spherical_harmonics) {
+        const Color *c = spherical_harmonics.coefficients;
+        Color folded_terms[SH_COEFFICIENT_COUNT]{
+            c[0] * 0.282095f - c[6] * 0.315392f,
+            c[3] * 0.488603f,
+            c[1] * 0.488603f,
+            c[2] * 0.488603f,
+            c[4] * 1.092548f,
+            c[5] * 1.092548f,
+            c[6] * (3.0f * 0.315392f),
+            c[7] * 1.092548f,
+            c[8] * 0.546274f
+        };
+        for (u32 i = 0; i < SH_COEFFICIENT_COUNT; i++) {
+            terms[i][0] = folded_terms[i].r;
+            terms[i][1] = folded_terms[i].g;
+            terms[i][2] = folded_terms[i].b;
+            terms[i][3] = 0.0f;
+        }
+    }
+
+    // Evaluates at a unit direction, clamping off the negative lobes that ringing can leave:
+    INLINE_XPU Color evaluate(const vec3 &direction) const {
+        const f32 x = direction.x;
+        const f32 y = direction.y;
+        const f32 z = direction.z;
+        const f32 factors[SH_COEFFICIENT_COUNT - 1]{x, y, z, x * y, y * z, z * z, x * z, x * x - y * y};
+#ifdef __CUDACC__
+        Color color{terms[0][0], terms[0][1], terms[0][2]};
+        for (u32 i = 1; i < SH_COEFFICIENT_COUNT; i++) {
+            color.r = fast_mul_add(factors[i - 1], terms[i][0], color.r);
+            color.g = fast_mul_add(factors[i - 1], terms[i][1], color.g);
+            color.b = fast_mul_add(factors[i - 1], terms[i][2], color.b);
+        }
+        return {Max(color.r, 0.0f), Max(color.g, 0.0f), Max(color.b, 0.0f)};
+#else
+        __m128 color = _mm_loadu_ps(terms[0]);
+        for (u32 i = 1; i < SH_COEFFICIENT_COUNT; i++)
+            color = simd_mul_add(_mm_set1_ps(factors[i - 1]), _mm_loadu_ps(terms[i]), color);
+
+        f32 components[4];
+        _mm_storeu_ps(components, _mm_max_ps(color, _mm_setzero_ps()));
+        return {components[0], components[1], components[2]};
+#endif
+    }
+};
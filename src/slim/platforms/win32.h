@@ -169,6 +169,7 @@ int Win32_EntryPoint(HINSTANCE hInstance, int nCmdShow = SW_SHOW) {
 
     window::content = (u32*)window_content_and_canvas_memory;
     memory::canvas_memory = (u8*)window_content_and_canvas_memory + WINDOW_CONTENT_SIZE;
+    memory::canvas_arena = memory::registerArena("Canvas", memory::canvas_memory_capacity);
 
     controls::key_map::ctrl = VK_CONTROL;
     controls::key_map::alt = VK_MENU;
@@ -237,6 +238,8 @@ int Win32_EntryPoint(HINSTANCE hInstance, int nCmdShow = SW_SHOW) {
         return -1;
 
     CURRENT_APP->_init();
+    if (!CURRENT_APP->is_running)
+        return -1;
 
     Win32_window_rect.top = 0;
     Win32_window_rect.left = 0;
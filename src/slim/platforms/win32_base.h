@@ -190,6 +190,114 @@ void* win32_readEntireFile(const char* file_path, u64 *out_size) {
     return out;
 }
 
+const void* win32_mapFileForReading(const char* file_path, u64 *out_size) {
+    HANDLE handle = CreateFileA(file_path,           // file to open
+                                GENERIC_READ,          // open for reading
+                                FILE_SHARE_READ,       // share for reading
+                                nullptr,                  // default security
+                                OPEN_EXISTING,         // existing file only
+                                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                                nullptr);                 // no attr. template
+    if (handle == INVALID_HANDLE_VALUE) {
+#ifndef NDEBUG
+        Win32_DisplayError((LPTSTR)"CreateFile");
+        _tprintf((LPTSTR)"Terminal failure: unable to open file \"%s\" for read.\n", file_path);
+#endif
+        return nullptr;
+    }
+
+    LARGE_INTEGER large_size;
+    if (!GetFileSizeEx(handle, &large_size) || !large_size.QuadPart) {
+        CloseHandle(handle);
+        return nullptr;
+    }
+
+    // The view keeps the mapping (and the file) open until it gets unmapped:
+    HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(handle);
+    if (!mapping) {
+#ifndef NDEBUG
+        Win32_DisplayError((LPTSTR)"CreateFileMapping");
+#endif
+        return nullptr;
+    }
+
+    const void *address = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!address) {
+#ifndef NDEBUG
+        Win32_DisplayError((LPTSTR)"MapViewOfFile");
+#endif
+        return nullptr;
+    }
+
+    *out_size = (u64)large_size.QuadPart;
+    return address;
+}
+
+bool win32_setFilePosition(HANDLE handle, u64 position) {
+    LARGE_INTEGER distance;
+    distance.QuadPart = (LONGLONG)position;
+    BOOL result = SetFilePointerEx(handle, distance, nullptr, FILE_BEGIN);
+#ifndef NDEBUG
+    if (result == FALSE) {
+        Win32_DisplayError((LPTSTR)"SetFilePointerEx");
+        printf("Terminal failure: Unable to set the file position.\n GetLastError=%08x\n", (unsigned int)GetLastError());
+    }
+#endif
+    return result != FALSE;
+}
+
+// Large pages need the process to hold (and enable) the privilege to lock pages in memory.
+// Returns the large page size, or 0 when they can not be used:
+SIZE_T win32_getLargePageSize() {
+    static SIZE_T large_page_size = (SIZE_T)-1;
+    if (large_page_size != (SIZE_T)-1) return large_page_size;
+
+    large_page_size = 0;
+    HANDLE token;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) return 0;
+
+    TOKEN_PRIVILEGES privileges;
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    if (LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid) &&
+        AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) &&
+        GetLastError() == ERROR_SUCCESS)
+        large_page_size = GetLargePageMinimum();
+
+    CloseHandle(token);
+    return large_page_size;
+}
+
+// Calls back with the name of every file (not sub-directory) in the directory that matches the pattern (e.g. "*.bmp"):
+bool win32_forEachFileInDirectory(const char* directory_path, const char* pattern, void (*callback)(const char* file_name, void *data), void *data) {
+    char search_path[MAX_PATH];
+    u32 length = 0;
+    for (const char *c = directory_path; *c && length < MAX_PATH - 1; c++) search_path[length++] = *c;
+    if (length && length < MAX_PATH - 1 && search_path[length - 1] != '\\' && search_path[length - 1] != '/') search_path[length++] = '\\';
+    for (const char *c = pattern; *c && length < MAX_PATH - 1; c++) search_path[length++] = *c;
+    search_path[length] = 0;
+
+    WIN32_FIND_DATAA find_data;
+    HANDLE find_handle = FindFirstFileA(search_path, &find_data);
+    if (find_handle == INVALID_HANDLE_VALUE) return GetLastError() == ERROR_FILE_NOT_FOUND;
+
+    do {
+        if (!(find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) callback(find_data.cFileName, data);
+    } while (FindNextFileA(find_handle, &find_data));
+    FindClose(find_handle);
+
+    return true;
+}
+
+u64 win32_getFilePosition(HANDLE handle) {
+    LARGE_INTEGER distance, position;
+    distance.QuadPart = 0;
+    if (!SetFilePointerEx(handle, distance, &position, FILE_CURRENT)) return 0;
+    return (u64)position.QuadPart;
+}
+
 LARGE_INTEGER performance_counter;
 
 void os::setWindowTitle(char* str) {
@@ -211,7 +319,14 @@ u64 timers::getTicks() {
     return (u64)performance_counter.QuadPart;
 }
 
-void* os::getMemory(u64 size, u64 base) {
+void* os::getMemory(u64 size, u64 base, bool large_pages) {
+    SIZE_T large_page_size = large_pages ? win32_getLargePageSize() : 0;
+    if (large_page_size) {
+        // The size has to be a multiple of the large page size:
+        SIZE_T large_size = ((SIZE_T)size + large_page_size - 1) & ~(large_page_size - 1);
+        void *memory = VirtualAlloc((LPVOID)base, large_size, MEM_RESERVE|MEM_COMMIT|MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (memory) return memory;
+    }
     return VirtualAlloc((LPVOID)base, (SIZE_T)size, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
 }
 
@@ -227,6 +342,13 @@ bool os::writeToFile(LPVOID out, DWORD size, HANDLE handle) { return win32_write
 long long int os::getFileSizeWithoutOpening(const char* path) { return win32_getFileSizeWithoutOpening(path); }
 long long int os::getFileSize(void *handle) { return win32_getFileSize(handle); }
 void*  os::readEntireFile(const char* file_path, u64 *out_size) { return win32_readEntireFile(file_path, out_size); }
+const void* os::mapFileForReading(const char* file_path, u64 *out_size) { return win32_mapFileForReading(file_path, out_size); }
+void os::unmapFile(const void *address) { UnmapViewOfFile(address); }
+bool os::setFilePosition(void *handle, u64 position) { return win32_setFilePosition(handle, position); }
+u64 os::getFilePosition(void *handle) { return win32_getFilePosition(handle); }
+bool os::forEachFileInDirectory(const char* directory_path, const char* pattern, void (*callback)(const char* file_name, void *data), void *data) {
+    return win32_forEachFileInDirectory(directory_path, pattern, callback, data);
+}
 
 void os::print(const char *message, u8 color) {
     HANDLE console_handle = GetStdHandle(STD_OUTPUT_HANDLE);
@@ -134,27 +134,64 @@ void tileImage(u8 *components, ImageInfo &image_info, u8 *tiled) {
     }
 }
 
-u8* loadBitmap(char *filename, ImageInfo &info) {
+bool readBitmapHeader(void *file, ImageInfo &info, BITMAPFILEHEADER &file_header, bool &flipped) {
+    BITMAPINFOHEADER info_header;
+    os::readFromFile(&file_header, sizeof(BITMAPFILEHEADER), file);
+    os::readFromFile(&info_header, sizeof(BITMAPINFOHEADER), file);
+    if (file_header.bfType != 0x4D42) return false;
+
+    flipped = info_header.biHeight > 0;
+    if (info_header.biBitCount == 32) info.flags.alpha = true;
+    info.updateDimensions(info_header.biWidth, flipped ? info_header.biHeight : -info_header.biHeight);
+    return true;
+}
+
+// Reads just the dimensions of a bitmap (and whether it has alpha), to size the memory for loading it:
+bool loadBitmapHeader(char *filename, ImageInfo &info) {
+    void *file = os::openFileForReading(filename);
+    if (!file) return false;
+
+    BITMAPFILEHEADER file_header;
+    bool flipped;
+    bool read = readBitmapHeader(file, info, file_header, flipped);
+    os::closeFile(file);
+    return read;
+}
+
+// Memory that loadBitmap() takes from an allocator (the components, and as much again for flipping or tiling them):
+u64 getBitmapLoadingSize(const ImageInfo &info) {
+    return (u64)(info.flags.alpha ? 4 : 3) * info.size * 2;
+}
+
+// Components are allocated from the given allocator (getBitmapLoadingSize() of it, of which only the components are
+// kept) or with new[] when there is none:
+u8* loadBitmap(char *filename, ImageInfo &info, memory::MonotonicAllocator *memory_allocator = nullptr) {
     void *file = os::openFileForReading(filename);
     if (!file) return nullptr;
 
     BITMAPFILEHEADER file_header;
-    BITMAPINFOHEADER info_header;
-    os::readFromFile(&file_header, sizeof(BITMAPFILEHEADER), file);
-    os::readFromFile(&info_header, sizeof(BITMAPINFOHEADER), file);
-    if (file_header.bfType != 0x4D42) {
+    bool flipped;
+    if (!readBitmapHeader(file, info, file_header, flipped)) {
         os::closeFile(file);
         return nullptr;
     }
 
-    bool flipped = info_header.biHeight > 0;
-    if (info_header.biBitCount == 32) info.flags.alpha = true;
-    info.updateDimensions(info_header.biWidth, flipped ? info_header.biHeight : -info_header.biHeight);
-
     u32 component_count = info.flags.alpha ? 4 : 3;
     u32 size_in_bytes = component_count * info.size;
-    u8 *components = new u8[size_in_bytes];
-    u8 *scratch_components = new u8[size_in_bytes];
+    u8 *components, *scratch_components;
+    u64 scratch_marker = 0;
+    if (memory_allocator) {
+        components = (u8*)memory_allocator->allocate(size_in_bytes);
+        scratch_marker = memory_allocator->push();
+        scratch_components = (u8*)memory_allocator->allocate(size_in_bytes);
+        if (!components || !scratch_components) {
+            os::closeFile(file);
+            return nullptr;
+        }
+    } else {
+        components = new u8[size_in_bytes];
+        scratch_components = new u8[size_in_bytes];
+    }
 
     SetFilePointer(file, (LONG)file_header.bfOffBits, nullptr, FILE_BEGIN);
     os::readFromFile(components, size_in_bytes, file);
@@ -171,7 +208,8 @@ u8* loadBitmap(char *filename, ImageInfo &info) {
         for (u32 i = 0; i < size_in_bytes; i++) components[i] = scratch_components[i];
     }
 
-    delete[] scratch_components;
+    if (memory_allocator) memory_allocator->pop(scratch_marker);
+    else delete[] scratch_components;
 
     return components;
 }
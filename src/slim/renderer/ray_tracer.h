@@ -2,6 +2,7 @@
 
 #include "../viewport/viewport.h"
 #include "./surface_shader.h"
+#include "../core/texture_simd.h"
 
 //#define RAY_TRACER_DEFAULT_SETTINGS_MAX_DEPTH 3
 //#define RAY_TRACER_DEFAULT_SETTINGS_RENDER_MODE RenderMode_Beauty
@@ -9,13 +10,26 @@
 
 struct RayTracerSettings {
     u8 max_depth;
+    u8 light_samples; // Point/spot lights picked per shading point (0 shades from all of them)
     char skybox_color_texture_id;
     char skybox_radiance_texture_id;
     char skybox_irradiance_texture_id;
     RenderMode render_mode;
+    TextureFilter texture_filter;
+    u32 frame_index; // Mixed into the per-pixel random seeds, so that the noise pattern changes every frame
     ColorID mip_level_colors[9];
 };
 
+INLINE_XPU Color sampleSkybox(const Texture &texture, const vec3 &direction) {
+#ifdef __CUDACC__
+    f32 u, v;
+    const TextureMip &mip = texture.mips[Texture::GetCubeUV(direction.x, direction.y, direction.z, u, v)];
+    return mip.sample(u, v).color;
+#else
+    return sampleCubeSIMD(texture, direction.x, direction.y, direction.z).color;
+#endif
+}
+
 INLINE_XPU void renderPixelBeauty(
     const RayTracerSettings &settings,
     const CameraRayProjection &projection,
@@ -37,6 +51,9 @@ INLINE_XPU void renderPixelBeauty(
 
     Color current_color, next_throughput, throughput = 1.0f;
     u32 depth_left = settings.max_depth;
+    u32 random_state = hashRandomState(((u32)ray.pixel_coords.x * 0x9E3779B9 + (u32)ray.pixel_coords.y) ^ hashRandomState(settings.frame_index));
+    u32 light_count = scene.counts.point_lights + scene.counts.spot_lights;
+    f32 light_pdf;
     ray.depth = scene_tracer.aux_ray.depth = 1;
 
     while (depth_left) {
@@ -52,22 +69,38 @@ INLINE_XPU void renderPixelBeauty(
                 surface.prepareForShading(ray, hit, scene.materials, scene.textures);
                 if (depth_left == settings.max_depth) depth = projection.getDepthAt(hit.position);
 
-                // Point / Directional lights:
-                if (scene.lights)
-                    for (u32 i = 0; i < scene.counts.lights; i++)
-                        surface.shadeFromLight(scene.lights[i], scene, scene_tracer, current_color);
+                // Directional lights:
+                for (u32 i = 0; i < scene.counts.directional_lights; i++)
+                    surface.shadeFromLight(scene.directional_lights[i], scene, scene_tracer, current_color);
+
+                // Point / Spot lights (picking only a few of them when there are many):
+                if (settings.light_samples && light_count > settings.light_samples) {
+                    for (u32 i = 0; i < settings.light_samples; i++) {
+                        const PointLight *light = scene.light_bvh.sample(
+                            scene.point_lights, scene.spot_lights, scene.counts.point_lights,
+                            surface.P, surface.N, nextRandom(random_state), light_pdf);
+                        if (light)
+                            surface.shadeFromLight(*light, scene, scene_tracer, current_color,
+                                                   1.0f / (light_pdf * (f32)settings.light_samples));
+                    }
+                } else {
+                    for (u32 i = 0; i < scene.counts.point_lights; i++)
+                        surface.shadeFromLight(scene.point_lights[i], scene, scene_tracer, current_color);
+                    for (u32 i = 0; i < scene.counts.spot_lights; i++)
+                        surface.shadeFromLight(scene.spot_lights[i], scene, scene_tracer, current_color);
+                }
 
                 // Area Lights:
                 if (scene.flags & SCENE_HAD_EMISSIVE_QUADS)
-                    surface.shadeFromEmissiveQuads(scene, current_color);
+                    surface.shadeFromEmissiveQuads(scene, scene_tracer, current_color);
 
                 // Image Based Lighting:
                 if (settings.skybox_irradiance_texture_id >= 0 &&
                     settings.skybox_radiance_texture_id >= 0) {
                     surface.L = surface.N;
                     surface.NdotL = 1.0f;
-                    Color D{scene.textures[settings.skybox_irradiance_texture_id].sampleCube(surface.N.x,surface.N.y,surface.N.z).color};
-                    Color S{scene.textures[settings.skybox_radiance_texture_id  ].sampleCube(surface.R.x,surface.R.y,surface.R.z).color};
+                    Color D{scene.texture_irradiances[settings.skybox_irradiance_texture_id].evaluate(surface.N)};
+                    Color S{sampleSkybox(scene.textures[settings.skybox_radiance_texture_id], surface.R)};
                     surface.radianceFraction();
                     current_color = D.mulAdd(surface.Fd, surface.Fs.mulAdd(S, current_color));
                 }
@@ -88,17 +121,14 @@ INLINE_XPU void renderPixelBeauty(
         } else { // Miss:
             depth_left = 0;
             if (settings.skybox_color_texture_id >= 0)
-                current_color = scene.textures[settings.skybox_color_texture_id].sampleCube(
-                    ray.direction.x,
-                    ray.direction.y,
-                    ray.direction.z
-                ).color;
+                current_color = sampleSkybox(scene.textures[settings.skybox_color_texture_id], ray.direction);
         }
 
-        if (scene.lights)
-            for (u32 i = 0; i < scene.counts.lights; i++)
-                if (scene_tracer.hitLight(scene.lights[i], ray, hit))
-                    current_color = scene.lights[i].color.scaleAdd(pow(scene_tracer.light_tracer.integrateDensity(), 8.0f) * 4, current_color);
+        for (u32 i = 0; i < light_count; i++) {
+            const PointLight *light = LightBVH::getLight(i, scene.point_lights, scene.spot_lights, scene.counts.point_lights);
+            if (scene_tracer.hitLight(light, ray, hit))
+                current_color = light->color.scaleAdd(pow(scene_tracer.sphere_tracer.integrateDensity(), 8.0f) * 4, current_color);
+        }
 
         color = current_color.mulAdd(throughput, color);
         throughput *= next_throughput;
@@ -134,7 +164,7 @@ INLINE_XPU void renderPixelDebugMode(
             case RenderMode_UVs      : color = getColorByUV(hit.uv); break;
             case RenderMode_Depth    : color = getColorByDistance(hit.distance); break;
             case RenderMode_Normals  : color = directionToColor(hit.normal);  break;
-            case RenderMode_NormalMap: color = directionToColor(sampleNormal(*surface.material, hit, scene.textures));  break;
+            case RenderMode_NormalMap: color = directionToColor(sampleNormal(*surface.material, hit, scene.textures, settings.texture_filter));  break;
             case RenderMode_MipLevel : color = scene.counts.textures ? settings.mip_level_colors[scene.textures[0].mipLevel(hit.uv_coverage)] : Grey;
             default: break;
         }
@@ -155,6 +185,7 @@ INLINE_XPU void renderPixel(
     Color &color,
     f32 &depth
 ) {
+    surface.texture_filter = settings.texture_filter;
     if (settings.render_mode == RenderMode_Beauty)
         renderPixelBeauty(settings, projection, scene, scene_tracer, surface, ray, hit, direction, color, depth);
     else
@@ -3,6 +3,8 @@
 #include "../viewport/viewport.h"
 #include "ray_tracer.h"
 #include "surface_shader.h"
+#include "../core/parallel.h"
+#include "../serialization/scene.h"
 
 #ifdef __CUDACC__
 #include "./renderer_GPU.h"
@@ -13,12 +15,19 @@ void uploadLights(const Scene &scene) {}
 void uploadCameras(const Scene &scene) {}
 void uploadGeometries(const Scene &scene) {}
 void uploadMaterials(const Scene &scene) {}
+void uploadEmissiveQuads(const Scene &scene) {}
 void uploadSceneBVH(const Scene &scene) {}
 #endif
 
 #define RAY_TRACER_DEFAULT_SETTINGS_SKYBOX_TEXTURE_ID 1
 #define RAY_TRACER_DEFAULT_SETTINGS_MAX_DEPTH 3
+#define RAY_TRACER_DEFAULT_SETTINGS_LIGHT_SAMPLES 4
 #define RAY_TRACER_DEFAULT_SETTINGS_RENDER_MODE RenderMode_Beauty
+#define RAY_TRACER_DEFAULT_SETTINGS_TEXTURE_FILTER TextureFilter_Bilinear
+
+// Rows get ray traced across the thread pool in runs of this many, small enough for threads to even out
+// rows that are slower to render than others:
+#define RAY_TRACER_CPU_ROWS_GRAIN_SIZE 4
 
 
 struct RayTracingRenderer {
@@ -33,6 +42,13 @@ struct RayTracingRenderer {
     Color color;
     f32 depth;
 
+    // Tracing keeps state (like its stacks), so every worker of the thread pool gets its own tracer.
+    // Their stacks get remade whenever the scene outgrows them (like when a chunked scene gets opened):
+    memory::MonotonicAllocator worker_scene_tracers_memory;
+    SceneTracer *worker_scene_tracers = nullptr;
+    u32 worker_stack_size = 0;
+    u32 worker_mesh_stack_size = 0;
+
     explicit RayTracingRenderer(Scene &scene,
                                 SceneTracer &scene_tracer,
                                 CameraRayProjection &projection,
@@ -46,7 +62,10 @@ struct RayTracingRenderer {
         settings.skybox_radiance_texture_id = skybox_radiance_texture_id;
         settings.skybox_irradiance_texture_id = skybox_irradiance_texture_id;
         settings.max_depth = max_depth;
+        settings.light_samples = RAY_TRACER_DEFAULT_SETTINGS_LIGHT_SAMPLES;
         settings.render_mode = render_mode;
+        settings.texture_filter = RAY_TRACER_DEFAULT_SETTINGS_TEXTURE_FILTER;
+        settings.frame_index = 0;
         settings.mip_level_colors[0] = BrightRed;
         settings.mip_level_colors[1] = BrightYellow;
         settings.mip_level_colors[2] = BrightGreen;
@@ -57,45 +76,93 @@ struct RayTracingRenderer {
         settings.mip_level_colors[7] = Grey;
         settings.mip_level_colors[8] = DarkGrey;
 
+        initWorkerSceneTracers();
         initDataOnGPU(scene);
     }
 
+    void initWorkerSceneTracers() {
+        u32 stack_size = worker_stack_size = scene.counts.geometries;
+        u32 mesh_stack_size = worker_mesh_stack_size = scene.mesh_stack_size;
+        u32 worker_count = jobs::getThreadCount() - 1;
+        if (!worker_count) return;
+
+        if (worker_scene_tracers_memory.address) worker_scene_tracers_memory.releaseMemory();
+        worker_scene_tracers = nullptr;
+        worker_scene_tracers_memory = memory::MonotonicAllocator{"SceneTracers",
+            memory::getAlignedSize(sizeof(SceneTracer) * worker_count) +
+            sizeof(u32) * (stack_size + mesh_stack_size) * worker_count};
+        worker_scene_tracers = (SceneTracer*)worker_scene_tracers_memory.allocateAligned(sizeof(SceneTracer) * worker_count);
+        if (!worker_scene_tracers) return;
+
+        for (u32 i = 0; i < worker_count; i++)
+            worker_scene_tracers[i] = SceneTracer{stack_size, mesh_stack_size, &worker_scene_tracers_memory};
+    }
+
     void render(const Viewport &viewport, bool update_scene = true, bool use_GPU = false) {
         const Camera &camera = *viewport.camera;
         const Canvas &canvas = viewport.canvas;
 
         ray.origin = camera.position;
 
+        // Chunked scenes fetch the meshes and textures in view (evicting ones that went unused when over budget):
+        if (scene.io && scene.io->file_handle) {
+            requireVisibleContent(scene, camera);
+            if (settings.skybox_color_texture_id      >= 0) requireTexture(scene, (u32)settings.skybox_color_texture_id);
+            if (settings.skybox_radiance_texture_id   >= 0) requireTexture(scene, (u32)settings.skybox_radiance_texture_id);
+            if (settings.skybox_irradiance_texture_id >= 0) requireTexture(scene, (u32)settings.skybox_irradiance_texture_id);
+        }
+
+        // Geometries only need uploading for LOD changes when the rest of the scene is not being updated anyway:
+        if (scene.updateLODs(camera, viewport.dimensions.f_height) && use_GPU && !update_scene) uploadGeometries(scene);
+
         if (update_scene) {
+            scene.updateEmissiveQuads();
             scene.updateAABBs();
             scene.updateBVH();
+            scene.updateLightBVH();
             if (use_GPU) {
                 uploadLights(scene);
                 uploadCameras(scene);
                 uploadGeometries(scene);
+                uploadEmissiveQuads(scene);
                 uploadSceneBVH(scene);
             }
         }
+        settings.frame_index++;
 #ifdef __CUDACC__
         if (use_GPU) renderOnGPU(canvas, projection, settings);
         else         renderOnCPU(canvas);
 #else
         renderOnCPU(canvas);
 #endif
+        // Tiles of streamed textures that missed while rendering get loaded for the next frame:
+        if (texture_tile_cache.slot_count) texture_tile_cache.streamIn();
     }
 
     void renderOnCPU(const Canvas &canvas) {
+        if (scene.counts.geometries > worker_stack_size || scene.mesh_stack_size > worker_mesh_stack_size)
+            initWorkerSceneTracers();
+
         i32 width  = canvas.dimensions.width  * (canvas.antialias == SSAA ? 2 : 1);
         i32 height = canvas.dimensions.height * (canvas.antialias == SSAA ? 2 : 1);
-        vec3 C, direction;
-        for (C.y = projection.C_start.y, ray.pixel_coords.y = 0; ray.pixel_coords.y < height;
-             C.y -= projection.sample_size, ray.pixel_coords.y++, projection.start += projection.down) {
-            for (direction = projection.start, C.x = projection.C_start.x, ray.pixel_coords.x = 0;  ray.pixel_coords.x < width;
-                 direction += projection.right, C.x += projection.sample_size, ray.pixel_coords.x++) {
-                hit.scaling_factor = 1.0f / sqrtf(C.squaredLength() + projection.squared_distance_to_projection_plane);
-                renderPixel(settings, projection, scene, scene_tracer, surface, ray, hit, direction, color, depth);
-                canvas.setPixel(ray.pixel_coords.x, ray.pixel_coords.y, color, -1, depth);
+        parallelFor((u32)height, worker_scene_tracers ? getThreadCount() : 1, [&](u32 first_row, u32 end_row) {
+            u32 worker_index = jobs::getWorkerIndex();
+            SceneTracer &tracer = worker_index ? worker_scene_tracers[worker_index - 1] : scene_tracer;
+            SurfaceShader pixel_surface{surface};
+            Ray pixel_ray{ray};
+            RayHit pixel_hit{hit};
+            Color pixel_color;
+            f32 pixel_depth;
+            vec3 C, direction;
+            for (pixel_ray.pixel_coords.y = (i32)first_row; pixel_ray.pixel_coords.y < (i32)end_row; pixel_ray.pixel_coords.y++) {
+                C.y = projection.C_start.y - projection.sample_size * (f32)pixel_ray.pixel_coords.y;
+                for (direction = projection.start + projection.down * (f32)pixel_ray.pixel_coords.y, C.x = projection.C_start.x, pixel_ray.pixel_coords.x = 0;  pixel_ray.pixel_coords.x < width;
+                     direction += projection.right, C.x += projection.sample_size, pixel_ray.pixel_coords.x++) {
+                    pixel_hit.scaling_factor = 1.0f / sqrtf(C.squaredLength() + projection.squared_distance_to_projection_plane);
+                    renderPixel(settings, projection, scene, tracer, pixel_surface, pixel_ray, pixel_hit, direction, pixel_color, pixel_depth);
+                    canvas.setPixel(pixel_ray.pixel_coords.x, pixel_ray.pixel_coords.y, pixel_color, -1, pixel_depth);
+                }
             }
-        }
+        }, RAY_TRACER_CPU_ROWS_GRAIN_SIZE);
     }
 };
\ No newline at end of file
@@ -18,6 +18,7 @@ BVHNode *d_mesh_bvh_nodes;
 Triangle *d_triangles;
 TextureMip *d_texture_mips;
 TexelQuad *d_texel_quads;
+TexelBlock *d_texel_blocks;
 
 __global__ void d_render(const RayTracerSettings settings, const CameraRayProjection projection) {
     u32 s = d_canvas.antialias == SSAA ? 2 : 1;
@@ -70,7 +71,30 @@ void renderOnGPU(const Canvas &canvas, const CameraRayProjection &projection, co
 void uploadGeometries(const Scene &scene) { if (scene.counts.geometries) uploadN(scene.geometries, t_scene.geometries, scene.counts.geometries) }
 void uploadMaterials(const Scene &scene)  { if (scene.counts.materials)  uploadN(scene.materials,  t_scene.materials,  scene.counts.materials) }
 void uploadCameras(const Scene &scene)    { if (scene.counts.cameras)    uploadN(scene.cameras,    t_scene.cameras,    scene.counts.cameras) }
-void uploadLights(const Scene &scene)     { if (scene.counts.lights)     uploadN(scene.lights,     t_scene.lights,     scene.counts.lights) }
+void uploadLights(const Scene &scene) {
+    if (scene.counts.directional_lights) uploadN(scene.directional_lights, t_scene.directional_lights, scene.counts.directional_lights)
+    if (scene.counts.point_lights) uploadN(scene.point_lights, t_scene.point_lights, scene.counts.point_lights)
+    if (scene.counts.spot_lights)  uploadN(scene.spot_lights,  t_scene.spot_lights,  scene.counts.spot_lights)
+    if (scene.light_bvh.light_count) {
+        uploadN(scene.light_bvh.bvh.nodes,   t_scene.light_bvh.bvh.nodes,   scene.light_bvh.bvh.node_count)
+        uploadN(scene.light_bvh.node_powers, t_scene.light_bvh.node_powers, scene.light_bvh.bvh.node_count)
+        uploadN(scene.light_bvh.light_ids,   t_scene.light_bvh.light_ids,   scene.light_bvh.light_count)
+        if (scene.light_bvh.bvh.node_count != t_scene.light_bvh.bvh.node_count) {
+            t_scene.light_bvh.bvh.node_count = scene.light_bvh.bvh.node_count;
+            t_scene.light_bvh.bvh.height = scene.light_bvh.bvh.height;
+            uploadConstant(&t_scene, d_scene)
+        }
+    }
+}
+
+void uploadEmissiveQuads(const Scene &scene) {
+    if (scene.emissive_quad_count) uploadN(scene.emissive_quad_ids, t_scene.emissive_quad_ids, scene.emissive_quad_count)
+    if (scene.emissive_quad_count != t_scene.emissive_quad_count || scene.flags != t_scene.flags) {
+        t_scene.emissive_quad_count = scene.emissive_quad_count;
+        t_scene.flags = scene.flags;
+        uploadConstant(&t_scene, d_scene)
+    }
+}
 
 void uploadSceneBVH(const Scene &scene)   {
     if (scene.bvh.node_count   ) uploadN(scene.bvh.nodes,                 t_scene.bvh.nodes,                 scene.bvh.node_count)
@@ -83,6 +107,7 @@ void initDataOnGPU(const Scene &scene) {
     gpuErrchk(cudaMalloc(&t_canvas.depths, sizeof(f32) * MAX_WINDOW_SIZE * 4))
     gpuErrchk(cudaMalloc(&t_scene.bvh_leaf_geometry_indices, sizeof(u32) * scene.counts.geometries))
     gpuErrchk(cudaMalloc(&t_scene.bvh.nodes,sizeof(BVHNode)  * scene.counts.geometries * 2))
+    gpuErrchk(cudaMalloc(&t_scene.emissive_quad_ids, sizeof(u32) * scene.counts.geometries))
 
     uploadSceneBVH(scene);
 
@@ -91,6 +116,7 @@ void initDataOnGPU(const Scene &scene) {
     if (scene.counts.geometries) {
         gpuErrchk(cudaMalloc(&t_scene.geometries,sizeof(Geometry) * scene.counts.geometries))
         uploadGeometries(scene);
+        if (scene.emissive_quad_count) uploadN(scene.emissive_quad_ids, t_scene.emissive_quad_ids, scene.emissive_quad_count)
     }
 
     if (scene.counts.materials) {
@@ -98,10 +124,16 @@ void initDataOnGPU(const Scene &scene) {
         uploadMaterials(scene);
     }
 
-    if (scene.counts.lights) {
-        gpuErrchk(cudaMalloc(&t_scene.lights,    sizeof(Light)    * scene.counts.lights))
-        uploadLights(scene);
+    u32 light_count = scene.counts.point_lights + scene.counts.spot_lights;
+    if (scene.counts.directional_lights) gpuErrchk(cudaMalloc(&t_scene.directional_lights, sizeof(DirectionalLight) * scene.counts.directional_lights))
+    if (scene.counts.point_lights) gpuErrchk(cudaMalloc(&t_scene.point_lights, sizeof(PointLight) * scene.counts.point_lights))
+    if (scene.counts.spot_lights)  gpuErrchk(cudaMalloc(&t_scene.spot_lights,  sizeof(SpotLight)  * scene.counts.spot_lights))
+    if (light_count) {
+        gpuErrchk(cudaMalloc(&t_scene.light_bvh.bvh.nodes,   sizeof(BVHNode) * light_count * 2))
+        gpuErrchk(cudaMalloc(&t_scene.light_bvh.node_powers, sizeof(f32)     * light_count * 2))
+        gpuErrchk(cudaMalloc(&t_scene.light_bvh.light_ids,   sizeof(u32)     * light_count))
     }
+    uploadLights(scene);
 
     if (scene.counts.cameras) {
         gpuErrchk(cudaMalloc(&t_scene.cameras,    sizeof(Camera)    * scene.counts.cameras))
@@ -111,8 +143,13 @@ void initDataOnGPU(const Scene &scene) {
     if (scene.counts.meshes) {
         u32 total_bvh_nodes = 0;
         for (u32 i = 0; i < scene.counts.meshes; i++) {
-            total_triangles += scene.meshes[i].triangle_count;
-            total_bvh_nodes += scene.meshes[i].bvh.node_count;
+            const Mesh &mesh = scene.meshes[i];
+            total_triangles += mesh.triangle_count;
+            total_bvh_nodes += mesh.bvh.node_count;
+            for (u32 l = 0; l < mesh.lod_count; l++) {
+                total_triangles += mesh.lods[l].triangle_count;
+                total_bvh_nodes += mesh.lods[l].bvh.node_count;
+            }
         }
 
         gpuErrchk(cudaMalloc(&t_scene.meshes,   sizeof(Mesh)     * scene.counts.meshes))
@@ -131,29 +168,44 @@ void initDataOnGPU(const Scene &scene) {
             d_mesh = *mesh;
             d_mesh.triangles = triangles;
             d_mesh.bvh.nodes = nodes;
-            uploadN(&d_mesh, d_mehses, 1)
-            d_mehses++;
-
             nodes     += mesh->bvh.node_count;
             triangles += mesh->triangle_count;
+
+            for (u32 l = 0; l < mesh->lod_count; l++) {
+                const MeshLOD &lod = mesh->lods[l];
+                uploadN(lod.bvh.nodes, nodes, lod.bvh.node_count)
+                uploadN(lod.triangles, triangles, lod.triangle_count)
+                d_mesh.lods[l].triangles = triangles;
+                d_mesh.lods[l].bvh.nodes = nodes;
+                nodes     += lod.bvh.node_count;
+                triangles += lod.triangle_count;
+            }
+            uploadN(&d_mesh, d_mehses, 1)
+            d_mehses++;
         }
     }
 
     if (scene.counts.textures) {
         u32 total_mip_count = 0;
         u32 total_texel_quads_count = 0;
+        u32 total_texel_blocks_count = 0;
         Texture *texture = scene.textures;
         for (u32 i = 0; i < scene.counts.textures; i++, texture++) {
             total_mip_count += texture->mip_count;
             TextureMip *mip = texture->mips;
             for (u32 m = 0; m < texture->mip_count; m++, mip++)
-                total_texel_quads_count += (mip->width + 1) * (mip->height + 1);
+                if (mip->texel_blocks) total_texel_blocks_count += getTexelBlockCount(mip->width, mip->height);
+                else                   total_texel_quads_count += (mip->width + 1) * (mip->height + 1);
         }
         gpuErrchk(cudaMalloc(&t_scene.textures, sizeof(Texture)    * scene.counts.textures))
+        gpuErrchk(cudaMalloc(&t_scene.texture_irradiances, sizeof(IrradianceSH) * scene.counts.textures))
+        uploadN(scene.texture_irradiances, t_scene.texture_irradiances, scene.counts.textures)
         gpuErrchk(cudaMalloc(&d_texture_mips,   sizeof(TextureMip) * total_mip_count))
         gpuErrchk(cudaMalloc(&d_texel_quads,    sizeof(TexelQuad)  * total_texel_quads_count))
+        gpuErrchk(cudaMalloc(&d_texel_blocks,   sizeof(TexelBlock) * total_texel_blocks_count))
 
         TexelQuad *d_quads = d_texel_quads;
+        TexelBlock *d_blocks = d_texel_blocks;
         TextureMip *d_mips = d_texture_mips;
         Texture *d_textures = t_scene.textures;
         Texture d_texture;
@@ -166,12 +218,20 @@ void initDataOnGPU(const Scene &scene) {
 
             for (u32 m = 0; m < texture->mip_count; m++) {
                 TextureMip mip = texture->mips[m];
-                u32 quad_count = (mip.width + 1) * (mip.height + 1);
-                uploadN( mip.texel_quads, d_quads, quad_count)
-
-                mip.texel_quads = d_quads;
+                if (mip.texel_blocks) {
+                    u32 block_count = getTexelBlockCount(mip.width, mip.height);
+                    uploadN( mip.texel_blocks, d_blocks, block_count)
+
+                    mip.texel_blocks = d_blocks;
+                    d_blocks += block_count;
+                } else {
+                    u32 quad_count = (mip.width + 1) * (mip.height + 1);
+                    uploadN( mip.texel_quads, d_quads, quad_count)
+
+                    mip.texel_quads = d_quads;
+                    d_quads += quad_count;
+                }
                 uploadN(&mip, d_mips, 1)
-                d_quads += quad_count;
                 d_mips++;
             }
         }
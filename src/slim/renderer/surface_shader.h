@@ -4,26 +4,40 @@
 #include "../core/texture.h"
 #include "../scene/material.h"
 #include "../scene/scene_tracer.h"
-
-
-INLINE_XPU Color sample(const Material &material, u8 slot, const Texture *textures, vec2 uv, f32 uv_coverage) {
-    return (textures && material.texture_count > slot) ? textures[material.texture_ids[slot]].sample(uv.u, uv.v, uv_coverage).color : Black;
+#include "../core/texture_simd.h"
+
+
+INLINE_XPU Color sample(const Material &material, u8 slot, const Texture *textures, vec2 uv, f32 uv_coverage,
+                        TextureFilter filter = TextureFilter_Bilinear) {
+    if (!textures || material.texture_count <= slot) return Black;
+    const Texture &texture = textures[material.texture_ids[slot]];
+    if (!texture.mips) return Black; // Not resident yet when streamed
+    if (filter == TextureFilter_Trilinear)
+#ifdef __CUDACC__
+        return texture.sampleTrilinear(uv.u, uv.v, uv_coverage).color;
+#else
+        return sampleTrilinearSIMD(texture, uv.u, uv.v, uv_coverage).color;
+#endif
+    return texture.sample(uv.u, uv.v, uv_coverage).color;
 }
 
 INLINE_XPU Color sample(const Texture &texture, const RayHit &hit) {
     return texture.sample(hit.uv.u, hit.uv.v, hit.uv_coverage).color;
 }
 
-INLINE_XPU Color sample(Material &material, const RayHit &hit, u8 texture_slot, const Texture *textures) {
-    return sample(material, texture_slot, textures, hit.uv, hit.uv_coverage);
+INLINE_XPU Color sample(Material &material, const RayHit &hit, u8 texture_slot, const Texture *textures,
+                        TextureFilter filter = TextureFilter_Bilinear) {
+    return sample(material, texture_slot, textures, hit.uv, hit.uv_coverage, filter);
 }
 
-INLINE_XPU Color sampleAlbedo(Material &material, const RayHit &hit, const Texture *textures) {
-    return sample(material, hit, 0, textures);
+INLINE_XPU Color sampleAlbedo(Material &material, const RayHit &hit, const Texture *textures,
+                              TextureFilter filter = TextureFilter_Bilinear) {
+    return sample(material, hit, 0, textures, filter);
 }
 
-INLINE_XPU Color sampleNormal(Material &material, const RayHit &hit, const Texture *textures) {
-    return sample(material, hit, 1, textures);
+INLINE_XPU Color sampleNormal(Material &material, const RayHit &hit, const Texture *textures,
+                              TextureFilter filter = TextureFilter_Bilinear) {
+    return sample(material, hit, 1, textures, filter);
 }
 
 INLINE_XPU vec3 sampleNormal(Material &material, const RayHit &hit, const Texture *textures, const vec3 &normal) {
@@ -37,8 +51,9 @@ struct SurfaceShader {
     Ray shadow_ray;
     RayHit shadow_hit;
     vec3 P, N, V, L, R, RF, H, emissive_quad_vertices[4];
-    f32 Ld, Ld2, NdotL, NdotV, NdotH, HdotL, IOR;
+    f32 Ld, Ld2, NdotL, NdotV, NdotH, HdotL, IOR, light_falloff;
     bool refracted = false;
+    TextureFilter texture_filter = TextureFilter_Bilinear;
 
     INLINE_XPU bool inShadow(const Scene &scene, SceneTracer &scene_tracer, const vec3 &origin, const vec3 &direction, float max_distance = INFINITY) {
         shadow_ray.origin = origin;
@@ -46,15 +61,12 @@ struct SurfaceShader {
         return scene_tracer.trace(shadow_ray, shadow_hit, scene, true, max_distance);
     }
 
-    INLINE_XPU void shadeFromLight(const Light &light, const Scene &scene, SceneTracer &scene_tracer, Color &color) {
-        if (isFacingLight(light) && (
-                !(light.flags & Light_IsShadowing) ||
-                !inShadow(scene, scene_tracer, P, L, Ld)
-            )
-        ) {
+    // The weight scales the light's contribution (e.g. by 1 / pdf when the light was picked stochastically):
+    INLINE_XPU void shadeFromLight(const BaseLight &light, const Scene &scene, SceneTracer &scene_tracer, Color &color, f32 weight = 1.0f) {
+        if (isFacingLight(light) && !inShadow(scene, scene_tracer, P, L, Ld)) {
             // color += fr(p, L, V) * Li(p, L) * cos(w)
             radianceFraction();
-            color = (Fs + Fd).mulAdd(light.color * (NdotL * light.intensity / Ld2), color);
+            color = (Fs + Fd).mulAdd(light.color * (NdotL * light.intensity * light_falloff * weight / Ld2), color);
         }
     }
 
@@ -85,7 +97,7 @@ struct SurfaceShader {
         if (material->hasNormalMap())
             hit.normal = rotateNormal(
                     hit.normal,
-                    sampleNormal(*material, hit, textures),
+                    sampleNormal(*material, hit, textures, texture_filter),
                     material->normal_magnitude
         );
 
@@ -94,7 +106,7 @@ struct SurfaceShader {
         R = RF = ray.direction.reflectedAround(N);
         V = -ray.direction;
         NdotV = clampedValue(N.dot(V));
-        albedo_from_map = material->hasAlbedoMap() ? sampleAlbedo(*material, hit, textures) : White;
+        albedo_from_map = material->hasAlbedoMap() ? sampleAlbedo(*material, hit, textures, texture_filter) : White;
 
         refracted = material->isRefractive();
         if (refracted) {
@@ -144,16 +156,21 @@ struct SurfaceShader {
         }
     }
 
-    INLINE_XPU bool isFacingLight(const Light &light) {
-        if (light.flags & Light_IsDirectional) {
+    INLINE_XPU bool isFacingLight(const BaseLight &light) {
+        light_falloff = 1.0f;
+        if (light.type == LightType::Directional) {
             Ld = INFINITY;
             Ld2 = 1.0f;
-            L = -light.position_or_direction;
+            L = -(((const DirectionalLight&)light).orientation * vec3{0.0f, 0.0f, 1.0f});
         } else {
-            L = light.position_or_direction - P;
+            L = light.position - P;
             Ld2 = L.squaredLength();
             Ld = sqrtf(Ld2);
             L /= Ld;
+            if (light.type == LightType::Spot) {
+                light_falloff = ((const SpotLight&)light).getFalloff(L);
+                if (light_falloff <= 0.0f) return false;
+            }
         }
         NdotL = clampedValue(L.dot(N));
         return NdotL > 0.0f;
@@ -185,18 +202,17 @@ struct SurfaceShader {
         };
     }
 
-    INLINE_XPU bool shadeFromEmissiveQuads(const Scene &scene, Color &color) {
+    INLINE_XPU bool shadeFromEmissiveQuads(const Scene &scene, SceneTracer &scene_tracer, Color &color) {
         bool found = false;
 
         vec3 Ro;
-        f32 Ld_rcp, sphere_squared_distance_To_center;
+        f32 Ld_rcp;
 
         Transform *xform;
-        Geometry *shadowing_geo, *emissive_quad = scene.geometries;
-        for (u32 i = 0; i < scene.counts.geometries; i++, emissive_quad++) {
-            if (emissive_quad == geometry ||
-                emissive_quad->type != GeometryType_Quad ||
-                !(scene.materials[emissive_quad->material_id].isEmissive()))
+        Geometry *emissive_quad;
+        for (u32 i = 0; i < scene.emissive_quad_count; i++) {
+            emissive_quad = scene.geometries + scene.emissive_quad_ids[i];
+            if (emissive_quad == geometry)
                 continue;
 
             xform = &emissive_quad->transform;
@@ -229,30 +245,7 @@ struct SurfaceShader {
                 if (skip)
                     continue;
 
-                f32 shaded_light = 1.0f;
-                shadowing_geo = scene.geometries;
-                for (u32 s = 0; s < scene.counts.geometries; s++, shadowing_geo++) {
-                    if (shadowing_geo == emissive_quad||
-                        shadowing_geo == geometry)
-                        continue;
-
-                    shadow_ray.localize(Ro, L, shadowing_geo->transform);
-                    shadow_hit.distance = INFINITY;
-                    shadow_ray.direction = shadow_ray.direction.normalized();
-                    f32 d = 1.0f;
-                    if (shadowing_geo->type == GeometryType_Sphere) {
-                        if (shadow_ray.hitsDefaultSphere(shadow_hit, shadowing_geo->flags & GEOMETRY_IS_TRANSPARENT, &sphere_squared_distance_To_center)) {
-                            d -= (1.0f - sqrtf(sphere_squared_distance_To_center)) /
-                                 (shadow_hit.distance * emission_intensity * 3.0f);
-                        }
-                    } else if (shadowing_geo->type == GeometryType_Quad) {
-                        if (shadow_ray.hitsDefaultQuad(shadow_hit, shadowing_geo->flags & GEOMETRY_IS_TRANSPARENT))
-                            d -= 3.0f * (1.0f - Max(abs(shadow_hit.position.x), abs(shadow_hit.position.z))) /
-                                (shadow_hit.distance * emission_intensity);
-                    }
-                    shaded_light = Min(shaded_light, d);
-                }
-
+                f32 shaded_light = getAreaLightVisibility(scene, scene_tracer.stack, emissive_quad, Ro, emission_intensity);
                 if (shaded_light > 0.0f) {
                     radianceFraction();
                     color = (Fd + Fs).mulAdd(scene.materials[emissive_quad->material_id].emission * (emission_intensity * shaded_light * 7.0f), color);
@@ -262,4 +255,90 @@ struct SurfaceShader {
 
         return found;
     }
-};
+
+    // Estimates how much of an emissive quad is visible from the current shading point, as the minimum over
+    // its occluders. Only geometry overlapping the frustum spanned by the shading point and the quad (as set by
+    // getAreaLightVector()) can occlude it, so the scene BVH is traversed while culling nodes outside of it.
+    INLINE_XPU f32 getAreaLightVisibility(const Scene &scene, u32 *stack, const Geometry *emissive_quad, const vec3 &Ro, f32 emission_intensity) {
+        // Side planes through the shading point and each edge of the quad, plus the plane of the quad itself
+        // (stored as normals facing inwards and their distances from the origin):
+        vec3 plane_normals[5];
+        f32 plane_distances[5];
+        AABB frustum_bounds{P, P};
+        const vec3 &center = emissive_quad->transform.position;
+        for (u32 i = 0; i < 4; i++) {
+            const vec3 &vertex = emissive_quad_vertices[i];
+            frustum_bounds += AABB{vertex, vertex};
+
+            vec3 &normal = plane_normals[i];
+            normal = (vertex - P).cross(emissive_quad_vertices[(i + 1) & 3] - P);
+            if (normal.dot(center - P) < 0.0f) normal = -normal;
+            plane_distances[i] = normal.dot(P);
+        }
+        plane_normals[4] = emissive_quad->transform.orientation * vec3{0.0f, 1.0f, 0.0f};
+        if (plane_normals[4].dot(P - center) < 0.0f) plane_normals[4] = -plane_normals[4];
+        plane_distances[4] = plane_normals[4].dot(center);
+
+        f32 shaded_light = 1.0f;
+        BVHNode *node = scene.bvh.nodes;
+        u32 top = 0;
+        while (true) {
+            bool overlaps = node->aabb.max.x >= frustum_bounds.min.x && node->aabb.min.x <= frustum_bounds.max.x &&
+                            node->aabb.max.y >= frustum_bounds.min.y && node->aabb.min.y <= frustum_bounds.max.y &&
+                            node->aabb.max.z >= frustum_bounds.min.z && node->aabb.min.z <= frustum_bounds.max.z;
+            for (u32 p = 0; p < 5 && overlaps; p++) {
+                const vec3 &normal = plane_normals[p];
+                vec3 farthest_corner{
+                    normal.x > 0.0f ? node->aabb.max.x : node->aabb.min.x,
+                    normal.y > 0.0f ? node->aabb.max.y : node->aabb.min.y,
+                    normal.z > 0.0f ? node->aabb.max.z : node->aabb.min.z
+                };
+                overlaps = normal.dot(farthest_corner) >= plane_distances[p];
+            }
+
+            if (overlaps) {
+                if (node->leaf_count) {
+                    const u32 *indices = scene.bvh_leaf_geometry_indices + node->first_index;
+                    for (u32 i = 0; i < node->leaf_count; i++) {
+                        shaded_light = Min(shaded_light, getOcclusion(scene.geometries + indices[i], emissive_quad, Ro, emission_intensity));
+                        if (shaded_light <= 0.0f)
+                            return shaded_light;
+                    }
+                } else {
+                    stack[top++] = node->first_index + 1;
+                    node = scene.bvh.nodes + node->first_index;
+                    continue;
+                }
+            }
+
+            if (top == 0) break;
+            node = scene.bvh.nodes + stack[--top];
+        }
+
+        return shaded_light;
+    }
+
+    INLINE_XPU f32 getOcclusion(const Geometry *shadowing_geo, const Geometry *emissive_quad, const vec3 &Ro, f32 emission_intensity) {
+        if (shadowing_geo == emissive_quad ||
+            shadowing_geo == geometry)
+            return 1.0f;
+
+        f32 sphere_squared_distance_To_center;
+        shadow_ray.localize(Ro, L, shadowing_geo->transform);
+        shadow_hit.distance = INFINITY;
+        shadow_ray.direction = shadow_ray.direction.normalized();
+        f32 d = 1.0f;
+        if (shadowing_geo->type == GeometryType_Sphere) {
+            if (shadow_ray.hitsDefaultSphere(shadow_hit, shadowing_geo->flags & GEOMETRY_IS_TRANSPARENT, &sphere_squared_distance_To_center)) {
+                d -= (1.0f - sqrtf(sphere_squared_distance_To_center)) /
+                     (shadow_hit.distance * emission_intensity * 3.0f);
+            }
+        } else if (shadowing_geo->type == GeometryType_Quad) {
+            if (shadow_ray.hitsDefaultQuad(shadow_hit, shadowing_geo->flags & GEOMETRY_IS_TRANSPARENT))
+                d -= 3.0f * (1.0f - Max(abs(shadow_hit.position.x), abs(shadow_hit.position.z))) /
+                    (shadow_hit.distance * emission_intensity);
+        }
+
+        return d;
+    }
+};
\ No newline at end of file
@@ -1,6 +1,10 @@
 #pragma once
 
 #include "./mesh.h"
+#include "../core/parallel.h"
+
+// Nodes get partitioned along the 3 axes at the same time (on the thread pool) when splitting at least this many:
+#define BVH_BUILDER_PARALLEL_MIN_NODE_COUNT 2048
 
 struct BVHPartitionSide {
     AABB *aabbs;
@@ -10,6 +14,7 @@ struct BVHPartitionSide {
 struct BVHPartition {
     BVHPartitionSide left, right;
     u32 left_node_count, *sorted_node_ids;
+    i32 *sort_stack;
     f32 surface_area;
 
     void partition(u8 axis, BVHNode *nodes, i32 *stack, u32 N) {
@@ -123,7 +128,6 @@ struct BVHBuilder {
     BVHPartition partitions[3];
     BVHBuildIteration *iterations;
     u32 *node_ids, *leaf_ids;
-    i32 *sort_stack;
 
     static u32 getSizeInBytes(u32 max_leaf_node_count) {
         u32 memory_size = sizeof(u32) + sizeof(i32) + 2 * (sizeof(AABB) + sizeof(f32));
@@ -131,28 +135,29 @@ struct BVHBuilder {
         memory_size += sizeof(BVHBuildIteration) + sizeof(BVHNode) + sizeof(u32) * 2;
         memory_size *= max_leaf_node_count;
 
-        return memory_size;
+        // Every one of the 22 arrays starts on a cache line:
+        return memory_size + (u32)(memory::getAlignedSize(0) * 22);
     }
 
     BVHBuilder(u32 max_leaf_node_count, memory::MonotonicAllocator *memory_allocator = nullptr) {
         memory::MonotonicAllocator temp_allocator;
         if (!memory_allocator) {
-            temp_allocator = memory::MonotonicAllocator{getSizeInBytes(max_leaf_node_count)};
+            temp_allocator = memory::MonotonicAllocator{"BVHBuilder", getSizeInBytes(max_leaf_node_count)};
             memory_allocator = &temp_allocator;
         }
 
-        iterations = (BVHBuildIteration*)memory_allocator->allocate(sizeof(BVHBuildIteration) * max_leaf_node_count);
-        nodes      = (BVHNode*          )memory_allocator->allocate(sizeof(BVHNode)           * max_leaf_node_count);
-        node_ids   = (u32*              )memory_allocator->allocate(sizeof(u32)                 * max_leaf_node_count);
-        leaf_ids   = (u32*              )memory_allocator->allocate(sizeof(u32)                 * max_leaf_node_count);
-        sort_stack = (i32*              )memory_allocator->allocate(sizeof(i32)                 * max_leaf_node_count);
+        iterations = (BVHBuildIteration*)memory_allocator->allocateAligned(sizeof(BVHBuildIteration) * max_leaf_node_count);
+        nodes      = (BVHNode*          )memory_allocator->allocateAligned(sizeof(BVHNode)           * max_leaf_node_count);
+        node_ids   = (u32*              )memory_allocator->allocateAligned(sizeof(u32)                 * max_leaf_node_count);
+        leaf_ids   = (u32*              )memory_allocator->allocateAligned(sizeof(u32)                 * max_leaf_node_count);
 
         for (u8 i = 0; i < 3; i++) {
-            partitions[i].sorted_node_ids     = (u32* )memory_allocator->allocate(sizeof(u32)  * max_leaf_node_count);
-            partitions[i].left.aabbs          = (AABB*)memory_allocator->allocate(sizeof(AABB) * max_leaf_node_count);
-            partitions[i].right.aabbs         = (AABB*)memory_allocator->allocate(sizeof(AABB) * max_leaf_node_count);
-            partitions[i].left.surface_areas  = (f32* )memory_allocator->allocate(sizeof(f32)  * max_leaf_node_count);
-            partitions[i].right.surface_areas = (f32* )memory_allocator->allocate(sizeof(f32)  * max_leaf_node_count);
+            partitions[i].sorted_node_ids     = (u32* )memory_allocator->allocateAligned(sizeof(u32)  * max_leaf_node_count);
+            partitions[i].sort_stack          = (i32* )memory_allocator->allocateAligned(sizeof(i32)  * max_leaf_node_count);
+            partitions[i].left.aabbs          = (AABB*)memory_allocator->allocateAligned(sizeof(AABB) * max_leaf_node_count);
+            partitions[i].right.aabbs         = (AABB*)memory_allocator->allocateAligned(sizeof(AABB) * max_leaf_node_count);
+            partitions[i].left.surface_areas  = (f32* )memory_allocator->allocateAligned(sizeof(f32)  * max_leaf_node_count);
+            partitions[i].right.surface_areas = (f32* )memory_allocator->allocateAligned(sizeof(f32)  * max_leaf_node_count);
         }
     }
 
@@ -169,16 +174,19 @@ struct BVHBuilder {
         f32 smallest_surface_area = INFINITY;
         u8 chosen_axis = 0;
 
-        for (u8 axis = 0; axis < 3; axis++) {
-            BVHPartition &pa = partitions[axis];
-            for (u32 i = 0; i < N; i++) pa.sorted_node_ids[i] = ids[i];
-
-            // Partition the nodes for the current partition axis:
-            pa.partition(axis, nodes, sort_stack, N);
+        // Partition the nodes for every partition axis (each has its own arrays, so they can go in parallel):
+        parallelFor(3, N < BVH_BUILDER_PARALLEL_MIN_NODE_COUNT ? 1 : 3, [&](u32 first_axis, u32 end_axis) {
+            for (u32 axis = first_axis; axis < end_axis; axis++) {
+                BVHPartition &pa = partitions[axis];
+                for (u32 i = 0; i < N; i++) pa.sorted_node_ids[i] = ids[i];
+                pa.partition((u8)axis, nodes, pa.sort_stack, N);
+            }
+        }, 1);
 
-            // Choose the current partition axis if it's smallest surface area is smallest so far:
-            if (pa.surface_area < smallest_surface_area) {
-                smallest_surface_area = pa.surface_area;
+        // Choose the partition axis whose smallest surface area is the smallest:
+        for (u8 axis = 0; axis < 3; axis++) {
+            if (partitions[axis].surface_area < smallest_surface_area) {
+                smallest_surface_area = partitions[axis].surface_area;
                 chosen_axis = axis;
             }
         }
@@ -157,6 +157,19 @@ struct SpotLight : PointLight {
         type = LightType::Spot;
     }
 
+    // How much of the light reaches along the given direction to the light, where edge is the cone's half-angle
+    // in degrees (fading out over its outer quarter):
+    INLINE_XPU f32 getFalloff(const vec3 &direction_to_light) const {
+        f32 cos_angle = -(orientation * vec3{0.0f, 0.0f, 1.0f}).dot(direction_to_light);
+        f32 cos_edge = cosf(edge * DEG_TO_RAD);
+        f32 cos_inner_edge = cosf(edge * (0.75f * DEG_TO_RAD));
+        if (cos_angle <= cos_edge) return 0.0f;
+        if (cos_angle >= cos_inner_edge) return 1.0f;
+
+        f32 t = (cos_angle - cos_edge) / (cos_inner_edge - cos_edge);
+        return t * t * (3.0f - 2.0f * t);
+    }
+
     void setShadowMatrices(mat4 *matrices) {
         return shadow_bounds.setMatrices(position, matrices);
     }
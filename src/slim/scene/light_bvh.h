@@ -0,0 +1,154 @@
+#pragma once
+
+#include "./light.h"
+#include "./bvh_builder.h"
+
+// Bounds of a light in the light BVH (the same sphere that rays hit when drawing lights):
+#define LIGHT_BVH_LIGHT_RADIUS 1.0f
+
+// A BVH over the point and spot lights of a scene (spot lights being indexed after the point lights),
+// along with the total power of the lights under every node.
+// sample() picks a light for a shading point by walking down from the root, choosing either child with a probability
+// proportional to its estimated contribution. So the cost of a sample grows with the height of the BVH rather than
+// with the number of lights, and weighting each sample by 1 / pdf keeps the estimate unbiased.
+struct LightBVH {
+    BVH bvh;
+    u32 *light_ids;
+    f32 *node_powers;
+    u32 light_count;
+
+    INLINE_XPU static f32 getPower(const BaseLight &light) {
+        return light.intensity * (light.color.r + light.color.g + light.color.b) * (1.0f / 3.0f);
+    }
+
+    INLINE_XPU static const PointLight* getLight(u32 light_id, const PointLight *point_lights, const SpotLight *spot_lights, u32 point_light_count) {
+        return light_id < point_light_count ? point_lights + light_id : spot_lights + (light_id - point_light_count);
+    }
+
+    // An upper bound of how much the lights under a node could contribute to a shading point, using the largest
+    // cosine between the normal and any direction into the node's bounds (the bounding sphere of the bounds):
+    INLINE_XPU static f32 getImportance(const AABB &bounds, f32 power, const vec3 &P, const vec3 &N) {
+        vec3 L{(bounds.min + bounds.max) * 0.5f - P};
+        f32 squared_radius = ((bounds.max - bounds.min) * 0.5f).squaredLength();
+        f32 squared_distance = L.squaredLength();
+        if (squared_distance <= squared_radius) return power / squared_radius; // Inside the bounds
+
+        f32 cos_angle = N.dot(L) / sqrtf(squared_distance);
+        f32 sin_bounds_angle_squared = squared_radius / squared_distance;
+        f32 cos_bounds_angle = sqrtf(1.0f - sin_bounds_angle_squared);
+        if (cos_angle < cos_bounds_angle) {
+            // cos(angle - bounds_angle), or 0 when all of the bounds are behind the surface:
+            f32 sin_angle = sqrtf(Max(1.0f - cos_angle * cos_angle, 0.0f));
+            cos_angle = cos_angle * cos_bounds_angle + sin_angle * sqrtf(sin_bounds_angle_squared);
+            if (cos_angle <= 0.0f) return 0.0f;
+        } else cos_angle = 1.0f;
+
+        return power * cos_angle / squared_distance;
+    }
+
+    // A closer estimate for a single light, accounting for its angle to the surface and its spot cone:
+    INLINE_XPU static f32 getImportance(const PointLight &light, const vec3 &P, const vec3 &N) {
+        vec3 L{light.position - P};
+        f32 squared_distance = L.squaredLength();
+        f32 distance = sqrtf(squared_distance);
+        if (distance == 0.0f) return getPower(light) / (LIGHT_BVH_LIGHT_RADIUS * LIGHT_BVH_LIGHT_RADIUS);
+
+        L /= distance;
+        f32 NdotL = N.dot(L);
+        if (distance > LIGHT_BVH_LIGHT_RADIUS) {
+            if (NdotL <= 0.0f) return 0.0f;
+        } else NdotL = 1.0f; // The light's bounds straddle the surface
+
+        f32 falloff = light.type == LightType::Spot ? ((const SpotLight&)light).getFalloff(L) : 1.0f;
+        return getPower(light) * NdotL * falloff / Max(squared_distance, LIGHT_BVH_LIGHT_RADIUS * LIGHT_BVH_LIGHT_RADIUS);
+    }
+
+    INLINE_XPU f32 getImportance(const BVHNode &node, const PointLight *point_lights, const SpotLight *spot_lights, u32 point_light_count, const vec3 &P, const vec3 &N) const {
+        return node.leaf_count == 1 ?
+            getImportance(*getLight(light_ids[node.first_index], point_lights, spot_lights, point_light_count), P, N) :
+            getImportance(node.aabb, node_powers[&node - bvh.nodes], P, N);
+    }
+
+    // Picks a light for the given shading point using a uniform random number u in [0, 1), setting the probability
+    // of having picked it. Returns null when no light can contribute.
+    INLINE_XPU const PointLight* sample(const PointLight *point_lights, const SpotLight *spot_lights, u32 point_light_count,
+                                        const vec3 &P, const vec3 &N, f32 u, f32 &pdf) const {
+        pdf = 1.0f;
+        if (!light_count) return nullptr;
+
+        const BVHNode *node = bvh.nodes;
+        while (!node->leaf_count) {
+            const BVHNode *left_node = bvh.nodes + node->first_index;
+            const BVHNode *right_node = left_node + 1;
+            f32 left_importance  = getImportance(*left_node,  point_lights, spot_lights, point_light_count, P, N);
+            f32 right_importance = getImportance(*right_node, point_lights, spot_lights, point_light_count, P, N);
+            f32 total_importance = left_importance + right_importance;
+            if (total_importance <= 0.0f) return nullptr;
+
+            f32 p = left_importance / total_importance;
+            if (u < p) {
+                u /= p;
+                pdf *= p;
+                node = left_node;
+            } else {
+                u = (u - p) / (1.0f - p);
+                pdf *= 1.0f - p;
+                node = right_node;
+            }
+            u = Min(u, 0.99999994f);
+        }
+
+        // Leaves hold a single light, unless it is the root of a BVH that was built with larger leaves:
+        u32 index = (u32)(u * (f32)node->leaf_count);
+        pdf /= (f32)node->leaf_count;
+        return getLight(light_ids[node->first_index + index], point_lights, spot_lights, point_light_count);
+    }
+
+    void build(BVHBuilder &builder, const PointLight *point_lights, u32 point_light_count, const SpotLight *spot_lights, u32 spot_light_count) {
+        light_count = point_light_count + spot_light_count;
+        for (u32 i = 0; i < light_count; i++) {
+            const PointLight &light = *getLight(i, point_lights, spot_lights, point_light_count);
+            BVHNode &node = builder.nodes[i];
+            node.aabb.min = light.position - LIGHT_BVH_LIGHT_RADIUS;
+            node.aabb.max = light.position + LIGHT_BVH_LIGHT_RADIUS;
+            node.first_index = builder.node_ids[i] = i;
+        }
+
+        builder.build(bvh, light_count, 1);
+
+        for (u32 i = 0; i < light_count; i++)
+            light_ids[i] = builder.leaf_ids[i];
+
+        // Children are always added after their parent, so going backwards sums up the powers bottom-up:
+        for (u32 i = bvh.node_count; i > 0; i--) {
+            const BVHNode &node = bvh.nodes[i - 1];
+            f32 &power = node_powers[i - 1];
+            if (node.leaf_count) {
+                power = 0.0f;
+                for (u32 l = 0; l < node.leaf_count; l++)
+                    power += getPower(*getLight(light_ids[node.first_index + l], point_lights, spot_lights, point_light_count));
+            } else
+                power = node_powers[node.first_index] + node_powers[node.first_index + 1];
+        }
+    }
+};
+
+// A small hash-based random number generator for stochastic shading, seeded per pixel
+// (masked to 32 bits, as u32 may be wider):
+INLINE_XPU u32 hashRandomState(u32 x) {
+    x &= 0xFFFFFFFF;
+    x ^= x >> 16;
+    x = (x * 0x7FEB352Du) & 0xFFFFFFFF;
+    x ^= x >> 15;
+    x = (x * 0x846CA68Bu) & 0xFFFFFFFF;
+    x ^= x >> 16;
+    return x ? x : 1;
+}
+
+// Returns a uniform random number in [0, 1) and advances the state (xorshift32):
+INLINE_XPU f32 nextRandom(u32 &state) {
+    state ^= (state << 13) & 0xFFFFFFFF;
+    state ^= state >> 17;
+    state ^= (state << 5) & 0xFFFFFFFF;
+    return (f32)(state >> 8) * (1.0f / 16777216.0f);
+}
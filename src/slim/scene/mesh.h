@@ -16,6 +16,38 @@ union TriangleVertexIndices {
     };
 };
 
+// A welded vertex: One distinct combination of position, uv, normal (and tangent handedness) of a mesh, with all
+// of its attributes interleaved (the layout the rasterizer's vertices have):
+struct MeshVertex {
+    vec3 position, normal, tangent;
+    vec2 uv;
+};
+
+// Meshes get split into clusters of up to this many consecutive triangles (of their index order), using up to this
+// many vertices, to be culled as a whole:
+#define MESH_CLUSTER_MAX_VERTICES 64
+#define MESH_CLUSTER_MAX_TRIANGLES 124
+
+struct MeshCluster {
+    AABB aabb;
+    vec3 center;
+    f32 radius;
+
+    // Every face normal is within the cone around the axis (the cutoff being the sine of its half-angle, or 1 when
+    // it is too wide for the cluster to ever face away):
+    vec3 cone_axis;
+    f32 cone_cutoff;
+
+    u32 first_triangle;
+    u32 triangle_count;
+
+    // Whether all the triangles face away from a position (in the space of the mesh) for its whole bounding sphere:
+    INLINE_XPU bool isBackFacing(const vec3 &view_position) const {
+        vec3 to_center = center - view_position;
+        return to_center.dot(cone_axis) >= cone_cutoff * to_center.length() + radius;
+    }
+};
+
 struct Triangle {
     mat3 local_to_tangent;
     vec3 position, normal, n1, n2, n3;
@@ -23,6 +55,19 @@ struct Triangle {
     f32 uv_coverage, padding;
 };
 
+// Meshes can carry this many simplified versions of themselves (LODs 1 and up, LOD 0 being the mesh itself):
+#define MESH_MAX_LOD_COUNT 5
+
+struct MeshLOD {
+    BVH bvh;
+    Triangle *triangles;                    // For the tracer, in the order of its BVH leaves
+    TriangleVertexIndices *vertex_indices;  // Into the welded vertices, for the rasterizer
+    u32 triangle_count;
+
+    // How far off its surface may be from the full mesh's (in the space of the mesh):
+    f32 error;
+};
+
 Triangle CUBE_TRIANGLES[] = { // Triangles:
     {
         {0.000000f, -0.000000f, 1.000000f, 0.500000f, -0.500000f, -0.000000f, 0.000000f, 0.500000f, 0.000000f},
@@ -546,6 +591,23 @@ struct Mesh {
 
     EdgeVertexIndices *edge_vertex_indices{nullptr};
 
+    // Welded vertices and the triangles indexing them (optional, see obj2mesh):
+    MeshVertex *vertices{nullptr};
+    TriangleVertexIndices *vertex_indices{nullptr};
+    u32 welded_vertex_count{0};
+
+    // Whether the position, normal, uv and tangent streams (and the edges) index the welded vertices, having been
+    // derived from them (see deriveVertexStreams()):
+    bool derived_vertex_streams{false};
+
+    // Clusters of triangles with their bounds (optional, see buildClusters()):
+    MeshCluster *clusters{nullptr};
+    u32 cluster_count{0};
+
+    // Simplified versions, from the finest to the coarsest (optional, see simplify()):
+    MeshLOD lods[MESH_MAX_LOD_COUNT];
+    u32 lod_count{0};
+
     u32 triangle_count{0};
     u32 vertex_count{0};
     u32 edge_count{0};
@@ -596,6 +658,37 @@ struct Mesh {
             aabb{aabb}
     {}
 
+    // The height of the deepest BVH (of the mesh or of any of its LODs), which the mesh tracer's stack needs to fit:
+    INLINE u32 getMaxBVHHeight() const {
+        u32 height = bvh.height;
+        for (u32 l = 0; l < lod_count; l++) height = Max(height, (u32)lods[l].bvh.height);
+        return height;
+    }
+
+    // Files only store the welded vertices of meshes that have them, so the other streams get filled from those,
+    // taking their indices. The streams need room for the welded vertices, and the edges must already index them:
+    void deriveVertexStreams() {
+        vertex_count = welded_vertex_count;
+        if (normals_count)  normals_count  = welded_vertex_count;
+        if (uvs_count)      uvs_count      = welded_vertex_count;
+        if (tangents_count) tangents_count = welded_vertex_count;
+        for (u32 v = 0; v < welded_vertex_count; v++) {
+            const MeshVertex &vertex = vertices[v];
+            vertex_positions[v] = vertex.position;
+            if (normals_count)  vertex_normals[v]  = vertex.normal;
+            if (uvs_count)      vertex_uvs[v]      = vertex.uv;
+            if (tangents_count) vertex_tangents[v] = vertex.tangent;
+        }
+        for (u32 t = 0; t < triangle_count; t++) {
+            const TriangleVertexIndices &indices = vertex_indices[t];
+            vertex_position_indices[t] = indices;
+            if (normals_count)  vertex_normal_indices[t]  = indices;
+            if (uvs_count)      vertex_uvs_indices[t]     = indices;
+            if (tangents_count) vertex_tangent_indices[t] = indices;
+        }
+        derived_vertex_streams = true;
+    }
+
     void loadEdges(Edge *edges) const {
         EdgeVertexIndices *ids = edge_vertex_indices;
         for (u32 edge_index = 0; edge_index < edge_count; edge_index++, ids++)
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "./mesh.h"
+
+// Clusters are runs of consecutive triangles, so an index order that is local (see optimizeMesh()) makes them tight.
+// A run gets cut wherever the next triangle would take it past the maximum vertex or triangle count.
+// Vertices are the welded ones when the mesh has them (or else its positions):
+namespace mesh_clusters {
+    INLINE const TriangleVertexIndices* getIndices(const Mesh &mesh) {
+        return mesh.welded_vertex_count ? mesh.vertex_indices : mesh.vertex_position_indices;
+    }
+
+    INLINE u32 getVertexCount(const Mesh &mesh) {
+        return mesh.welded_vertex_count ? mesh.welded_vertex_count : mesh.vertex_count;
+    }
+
+    // Calls on_cluster(first_triangle, end_triangle) for every cluster, in order.
+    // Stamps must hold a value per vertex, to tell the vertices that the current cluster already uses:
+    template <typename Function>
+    void forEachCluster(const Mesh &mesh, u32 *stamps, const Function &on_cluster) {
+        const TriangleVertexIndices *indices = getIndices(mesh);
+        for (u32 v = 0, vertex_count = getVertexCount(mesh); v < vertex_count; v++) stamps[v] = 0;
+
+        u32 stamp = 1;
+        u32 first_triangle = 0;
+        u32 cluster_vertex_count = 0;
+        for (u32 t = 0; t < mesh.triangle_count; t++) {
+            u32 new_vertex_count = 0;
+            for (u32 i = 0; i < 3; i++) {
+                u32 v = indices[t].ids[i];
+                if (stamps[v] != stamp) new_vertex_count++;
+            }
+            if (cluster_vertex_count + new_vertex_count > MESH_CLUSTER_MAX_VERTICES ||
+                t - first_triangle == MESH_CLUSTER_MAX_TRIANGLES) {
+                on_cluster(first_triangle, t);
+                first_triangle = t;
+                cluster_vertex_count = 0;
+                stamp++;
+            }
+            for (u32 i = 0; i < 3; i++) {
+                u32 v = indices[t].ids[i];
+                if (stamps[v] != stamp) {
+                    stamps[v] = stamp;
+                    cluster_vertex_count++;
+                }
+            }
+        }
+        if (first_triangle < mesh.triangle_count) on_cluster(first_triangle, mesh.triangle_count);
+    }
+
+    // Face normals follow the winding order the way the ones of the tracer's triangles do:
+    INLINE vec3 getFaceNormal(const Mesh &mesh, u32 triangle) {
+        const TriangleVertexIndices &p = mesh.vertex_position_indices[triangle];
+        vec3 v1 = mesh.vertex_positions[p.v1];
+        return (mesh.vertex_positions[p.v3] - v1).cross(mesh.vertex_positions[p.v2] - v1);
+    }
+
+    void computeBounds(const Mesh &mesh, MeshCluster &cluster) {
+        u32 end_triangle = cluster.first_triangle + cluster.triangle_count;
+        cluster.aabb.min = INFINITY;
+        cluster.aabb.max = -INFINITY;
+        for (u32 t = cluster.first_triangle; t < end_triangle; t++)
+            for (u32 i = 0; i < 3; i++) {
+                vec3 position = mesh.vertex_positions[mesh.vertex_position_indices[t].ids[i]];
+                cluster.aabb.min = minimum(cluster.aabb.min, position);
+                cluster.aabb.max = maximum(cluster.aabb.max, position);
+            }
+
+        cluster.center = (cluster.aabb.min + cluster.aabb.max) * 0.5f;
+        f32 squared_radius = 0;
+        for (u32 t = cluster.first_triangle; t < end_triangle; t++)
+            for (u32 i = 0; i < 3; i++) {
+                vec3 position = mesh.vertex_positions[mesh.vertex_position_indices[t].ids[i]];
+                squared_radius = Max(squared_radius, (position - cluster.center).squaredLength());
+            }
+        cluster.radius = sqrtf(squared_radius);
+
+        // The axis is the average direction of the faces, the cone reaching out to the one furthest from it:
+        vec3 axis{0.0f};
+        for (u32 t = cluster.first_triangle; t < end_triangle; t++) {
+            vec3 normal = getFaceNormal(mesh, t);
+            f32 length = normal.length();
+            if (length > 0) axis += normal / length;
+        }
+        f32 axis_length = axis.length();
+        cluster.cone_axis = axis_length > 0 ? axis / axis_length : vec3{0.0f, 1.0f, 0.0f};
+        cluster.cone_cutoff = 1;
+        if (axis_length == 0) return;
+
+        f32 min_cosine = 1;
+        for (u32 t = cluster.first_triangle; t < end_triangle; t++) {
+            vec3 normal = getFaceNormal(mesh, t);
+            f32 length = normal.length();
+            if (length > 0) min_cosine = Min(min_cosine, cluster.cone_axis.dot(normal / length));
+        }
+
+        // Cones spreading past 90 degrees never face away entirely:
+        if (min_cosine > 0) cluster.cone_cutoff = sqrtf(1 - min_cosine * min_cosine);
+    }
+}
+
+u32 countClusters(const Mesh &mesh, u32 *stamps) {
+    u32 cluster_count = 0;
+    mesh_clusters::forEachCluster(mesh, stamps, [&](u32, u32) { cluster_count++; });
+    return cluster_count;
+}
+
+// Fills the mesh's clusters (allocated for countClusters() of them, the index order having stayed the same since):
+void buildClusters(Mesh &mesh, u32 *stamps) {
+    u32 cluster_count = 0;
+    mesh_clusters::forEachCluster(mesh, stamps, [&](u32 first_triangle, u32 end_triangle) {
+        MeshCluster &cluster = mesh.clusters[cluster_count++];
+        cluster.first_triangle = first_triangle;
+        cluster.triangle_count = end_triangle - first_triangle;
+        mesh_clusters::computeBounds(mesh, cluster);
+    });
+    mesh.cluster_count = cluster_count;
+}
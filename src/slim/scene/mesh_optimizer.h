@@ -0,0 +1,391 @@
+#pragma once
+
+#include "./mesh.h"
+
+// Reorders the triangles of a mesh for the GPU (the CPU tracer is unaffected: its triangles are kept in BVH order):
+// 1. Triangles get ordered for the post-transform vertex cache (Tipsify: Sander, Nehab and Barczak 2007).
+// 2. Optionally, clusters of that order get sorted for less overdraw (front-most facing clusters first).
+// 3. Welded vertices get renumbered by first use, so vertex fetches walk memory in order.
+// Cache behaviour is measured as the ACMR (average cache miss ratio: transformed vertices per triangle, 0.5 to 3).
+
+// Vertex cache size that triangles get ordered for (and that the ACMR is simulated with, as a FIFO):
+#define MESH_OPTIMIZER_CACHE_SIZE 16
+
+// Clusters get split wherever the ACMR so far gets within this factor of the one of the whole cluster, so overdraw
+// sorting costs at most this much in cache efficiency:
+#define MESH_OPTIMIZER_OVERDRAW_THRESHOLD 1.05f
+
+struct MeshOptimizationReport {
+    f32 acmr_before = 0;
+    f32 acmr_after = 0;
+    u32 cluster_count = 0;
+};
+
+namespace mesh_optimizer {
+    // Timestamps must hold a value per vertex:
+    f32 getACMR(const TriangleVertexIndices *indices, u32 triangle_count, u32 vertex_count, u32 *timestamps) {
+        if (!triangle_count) return 0;
+
+        for (u32 v = 0; v < vertex_count; v++) timestamps[v] = 0;
+        u32 time = MESH_OPTIMIZER_CACHE_SIZE + 1;
+        u32 miss_count = 0;
+        for (u32 t = 0; t < triangle_count; t++)
+            for (u32 i = 0; i < 3; i++) {
+                u32 v = indices[t].ids[i];
+                if (time - timestamps[v] > MESH_OPTIMIZER_CACHE_SIZE) {
+                    timestamps[v] = time++;
+                    miss_count++;
+                }
+            }
+        return (f32)miss_count / (f32)triangle_count;
+    }
+
+    struct Cluster {
+        u32 first, end;
+        f32 sort_key;
+    };
+
+    struct Optimizer {
+        const TriangleVertexIndices *indices;
+        u32 triangle_count, vertex_count;
+
+        u32 *adjacency_offsets;  // Per vertex (plus one), into the adjacency
+        u32 *adjacency;          // Triangles using every vertex
+        u32 *live_counts;        // Per vertex, of triangles yet to be emitted
+        u32 *timestamps;         // Per vertex
+        u32 *dead_ends;          // Stack of vertices of emitted triangles
+        u32 *candidates;         // Vertices of the triangles emitted around the current vertex
+        u8 *emitted;             // Per triangle
+        u32 *order;              // The new order of the triangles
+        bool *hard_boundaries;   // Per triangle of the new order, for the ones starting after a jump
+        Cluster *clusters;
+        Cluster *sorted_clusters;
+        u32 cursor = 0;
+        u32 dead_end_count = 0;
+
+        static u64 getSizeInBytes(u32 triangle_count, u32 vertex_count) {
+            u64 size = memory::getAlignedSize(sizeof(u32) * (vertex_count + 1));
+            size += memory::getAlignedSize(sizeof(u32) * triangle_count * 3) * 3;
+            size += memory::getAlignedSize(sizeof(u32) * vertex_count) * 2;
+            size += memory::getAlignedSize(sizeof(u8) * triangle_count);
+            size += memory::getAlignedSize(sizeof(u32) * triangle_count);
+            size += memory::getAlignedSize(sizeof(bool) * triangle_count);
+            size += memory::getAlignedSize(sizeof(Cluster) * triangle_count) * 2;
+            return size;
+        }
+
+        Optimizer(const TriangleVertexIndices *indices, u32 triangle_count, u32 vertex_count,
+                  memory::MonotonicAllocator *memory_allocator) :
+                indices{indices}, triangle_count{triangle_count}, vertex_count{vertex_count} {
+            adjacency_offsets = (u32*    )memory_allocator->allocateAligned(sizeof(u32)     * (vertex_count + 1));
+            adjacency         = (u32*    )memory_allocator->allocateAligned(sizeof(u32)     * triangle_count * 3);
+            dead_ends         = (u32*    )memory_allocator->allocateAligned(sizeof(u32)     * triangle_count * 3);
+            live_counts       = (u32*    )memory_allocator->allocateAligned(sizeof(u32)     * vertex_count);
+            timestamps        = (u32*    )memory_allocator->allocateAligned(sizeof(u32)     * vertex_count);
+            candidates        = (u32*    )memory_allocator->allocateAligned(sizeof(u32)     * triangle_count * 3);
+            emitted           = (u8*     )memory_allocator->allocateAligned(sizeof(u8)      * triangle_count);
+            order             = (u32*    )memory_allocator->allocateAligned(sizeof(u32)     * triangle_count);
+            hard_boundaries   = (bool*   )memory_allocator->allocateAligned(sizeof(bool)    * triangle_count);
+            clusters          = (Cluster*)memory_allocator->allocateAligned(sizeof(Cluster) * triangle_count);
+            sorted_clusters   = (Cluster*)memory_allocator->allocateAligned(sizeof(Cluster) * triangle_count);
+        }
+
+        void buildAdjacency() {
+            for (u32 v = 0; v <= vertex_count; v++) adjacency_offsets[v] = 0;
+            for (u32 t = 0; t < triangle_count; t++)
+                for (u32 i = 0; i < 3; i++) adjacency_offsets[indices[t].ids[i] + 1]++;
+            for (u32 v = 0; v < vertex_count; v++) {
+                live_counts[v] = adjacency_offsets[v + 1];
+                adjacency_offsets[v + 1] += adjacency_offsets[v];
+            }
+
+            // Filled through the live counts (counting back down), then restored:
+            for (u32 t = 0; t < triangle_count; t++)
+                for (u32 i = 0; i < 3; i++) {
+                    u32 v = indices[t].ids[i];
+                    adjacency[adjacency_offsets[v] + --live_counts[v]] = t;
+                }
+            for (u32 v = 0; v < vertex_count; v++) live_counts[v] = adjacency_offsets[v + 1] - adjacency_offsets[v];
+        }
+
+        // The most recent vertex of an emitted triangle still having triangles left, or else the next one that has:
+        i32 skipDeadEnd() {
+            while (dead_end_count) {
+                u32 v = dead_ends[--dead_end_count];
+                if (live_counts[v]) return (i32)v;
+            }
+            for (; cursor < vertex_count; cursor++)
+                if (live_counts[cursor]) return (i32)cursor;
+
+            return -1;
+        }
+
+        // Picks the candidate that would still be in the cache once all of its triangles got emitted, the oldest
+        // one of those (it is the first to get evicted). Returns -1 when there is none, so the fan has to jump:
+        i32 getNextVertex(u32 candidate_count, u32 time) const {
+            i32 next_vertex = -1;
+            i32 best_priority = -1;
+            for (u32 i = 0; i < candidate_count; i++) {
+                u32 v = candidates[i];
+                if (!live_counts[v]) continue;
+
+                i32 priority = 0;
+                if (time - timestamps[v] + 2 * live_counts[v] <= MESH_OPTIMIZER_CACHE_SIZE)
+                    priority = (i32)(time - timestamps[v]);
+                if (priority > best_priority) {
+                    best_priority = priority;
+                    next_vertex = (i32)v;
+                }
+            }
+            return next_vertex;
+        }
+
+        void orderForVertexCache() {
+            buildAdjacency();
+            for (u32 v = 0; v < vertex_count; v++) timestamps[v] = 0;
+            for (u32 t = 0; t < triangle_count; t++) emitted[t] = false;
+
+            u32 time = MESH_OPTIMIZER_CACHE_SIZE + 1;
+            u32 order_count = 0;
+            bool jumped = true;
+            cursor = 0;
+            dead_end_count = 0;
+            for (i32 fan_vertex = 0; fan_vertex >= 0;) {
+                u32 candidate_count = 0;
+                for (u32 a = adjacency_offsets[fan_vertex]; a < adjacency_offsets[fan_vertex + 1]; a++) {
+                    u32 t = adjacency[a];
+                    if (emitted[t]) continue;
+
+                    for (u32 i = 0; i < 3; i++) {
+                        u32 v = indices[t].ids[i];
+                        dead_ends[dead_end_count++] = v;
+                        candidates[candidate_count++] = v;
+                        live_counts[v]--;
+                        if (time - timestamps[v] > MESH_OPTIMIZER_CACHE_SIZE) timestamps[v] = time++;
+                    }
+                    emitted[t] = true;
+                    hard_boundaries[order_count] = jumped;
+                    order[order_count++] = t;
+                    jumped = false;
+                }
+
+                fan_vertex = getNextVertex(candidate_count, time);
+                if (fan_vertex < 0) {
+                    fan_vertex = skipDeadEnd();
+                    jumped = true;
+                }
+            }
+        }
+
+        // Splits the order at its jumps, then within those wherever the ACMR so far is good enough.
+        // Clusters may end up drawn in any order, so each is measured from a cold cache (flushed by moving time past
+        // its size):
+        u32 findClusters() {
+            for (u32 v = 0; v < vertex_count; v++) timestamps[v] = 0;
+            u32 time = 0;
+            u32 cluster_count = 0;
+            for (u32 first = 0, end; first < triangle_count; first = end) {
+                for (end = first + 1; end < triangle_count && !hard_boundaries[end];) end++;
+
+                time += MESH_OPTIMIZER_CACHE_SIZE + 1;
+                u32 miss_count = 0;
+                for (u32 i = first; i < end; i++)
+                    for (u32 c = 0; c < 3; c++) {
+                        u32 v = indices[order[i]].ids[c];
+                        if (time - timestamps[v] > MESH_OPTIMIZER_CACHE_SIZE) {
+                            timestamps[v] = time++;
+                            miss_count++;
+                        }
+                    }
+                f32 target_acmr = MESH_OPTIMIZER_OVERDRAW_THRESHOLD * (f32)miss_count / (f32)(end - first);
+
+                time += MESH_OPTIMIZER_CACHE_SIZE + 1;
+                u32 cluster_first = first;
+                miss_count = 0;
+                for (u32 i = first; i < end; i++) {
+                    for (u32 c = 0; c < 3; c++) {
+                        u32 v = indices[order[i]].ids[c];
+                        if (time - timestamps[v] > MESH_OPTIMIZER_CACHE_SIZE) {
+                            timestamps[v] = time++;
+                            miss_count++;
+                        }
+                    }
+                    if (i + 1 < end && (f32)miss_count <= target_acmr * (f32)(i + 1 - cluster_first)) {
+                        clusters[cluster_count++] = {cluster_first, i + 1, 0};
+                        cluster_first = i + 1;
+                        miss_count = 0;
+                        time += MESH_OPTIMIZER_CACHE_SIZE + 1;
+                    }
+                }
+                clusters[cluster_count++] = {cluster_first, end, 0};
+            }
+            return cluster_count;
+        }
+
+        // Clusters that face away from the center of the mesh are more likely to occlude others, so go first.
+        // Their sort key is how far out their (area weighted) centroid is along their (area weighted) normal:
+        void sortClustersForOverdraw(const Mesh &mesh, u32 cluster_count) {
+            vec3 mesh_centroid{0.0f};
+            f32 mesh_area = 0;
+            for (u32 t = 0; t < triangle_count; t++) {
+                const TriangleVertexIndices &p = mesh.vertex_position_indices[t];
+                vec3 v1 = mesh.vertex_positions[p.v1];
+                vec3 v2 = mesh.vertex_positions[p.v2];
+                vec3 v3 = mesh.vertex_positions[p.v3];
+                f32 area = (v2 - v1).cross(v3 - v1).length();
+                mesh_centroid += (v1 + v2 + v3) * area;
+                mesh_area += area;
+            }
+            if (mesh_area > 0) mesh_centroid /= 3 * mesh_area;
+
+            for (u32 c = 0; c < cluster_count; c++) {
+                Cluster &cluster = clusters[c];
+                vec3 centroid{0.0f}, normal{0.0f};
+                f32 area_sum = 0;
+                for (u32 i = cluster.first; i < cluster.end; i++) {
+                    const TriangleVertexIndices &p = mesh.vertex_position_indices[order[i]];
+                    vec3 v1 = mesh.vertex_positions[p.v1];
+                    vec3 v2 = mesh.vertex_positions[p.v2];
+                    vec3 v3 = mesh.vertex_positions[p.v3];
+                    vec3 area_normal = (v2 - v1).cross(v3 - v1);
+                    f32 area = area_normal.length();
+                    centroid += (v1 + v2 + v3) * area;
+                    normal += area_normal;
+                    area_sum += area;
+                }
+                f32 normal_length = normal.length();
+                cluster.sort_key = area_sum > 0 && normal_length > 0 ?
+                                   (centroid / (3 * area_sum) - mesh_centroid).dot(normal / normal_length) : 0;
+            }
+
+            // Merge sort (stable, by descending key), ping-ponging between the 2 arrays:
+            Cluster *from = clusters;
+            Cluster *to = sorted_clusters;
+            for (u32 width = 1; width < cluster_count; width *= 2) {
+                for (u32 left = 0; left < cluster_count; left += width * 2) {
+                    u32 middle = Min(left + width, cluster_count);
+                    u32 right = Min(left + width * 2, cluster_count);
+                    u32 l = left, r = middle, o = left;
+                    while (l < middle && r < right) to[o++] = from[r].sort_key > from[l].sort_key ? from[r++] : from[l++];
+                    while (l < middle) to[o++] = from[l++];
+                    while (r < right) to[o++] = from[r++];
+                }
+                Cluster *swap = from;
+                from = to;
+                to = swap;
+            }
+
+            // The emitted order of the triangles of the sorted clusters goes into the (now free) dead end stack:
+            u32 *sorted_order = dead_ends;
+            for (u32 c = 0, o = 0; c < cluster_count; c++)
+                for (u32 i = from[c].first; i < from[c].end; i++) sorted_order[o++] = order[i];
+            for (u32 t = 0; t < triangle_count; t++) order[t] = sorted_order[t];
+        }
+    };
+
+    // Puts the triangles of the given index arrays in the given order (skipping arrays that are null or repeated):
+    void reorderTriangles(TriangleVertexIndices **arrays, u32 array_count, const u32 *order, u32 triangle_count,
+                          TriangleVertexIndices *temp) {
+        for (u32 a = 0; a < array_count; a++) {
+            TriangleVertexIndices *array = arrays[a];
+            bool repeated = false;
+            for (u32 b = 0; b < a; b++) repeated = repeated || arrays[b] == array;
+            if (!array || repeated) continue;
+
+            for (u32 t = 0; t < triangle_count; t++) temp[t] = array[order[t]];
+            for (u32 t = 0; t < triangle_count; t++) array[t] = temp[t];
+        }
+    }
+
+    // Renumbers welded vertices in the order they are first used, moving them there:
+    void reorderVertices(Mesh &mesh, u32 *remap, MeshVertex *temp) {
+        for (u32 v = 0; v < mesh.welded_vertex_count; v++) remap[v] = (u32)-1;
+
+        u32 vertex_count = 0;
+        for (u32 t = 0; t < mesh.triangle_count; t++)
+            for (u32 i = 0; i < 3; i++) {
+                u32 &v = mesh.vertex_indices[t].ids[i];
+                if (remap[v] == (u32)-1) {
+                    remap[v] = vertex_count;
+                    temp[vertex_count++] = mesh.vertices[v];
+                }
+                v = remap[v];
+            }
+
+        // Vertices no triangle uses get dropped:
+        for (u32 v = 0; v < vertex_count; v++) mesh.vertices[v] = temp[v];
+        mesh.welded_vertex_count = vertex_count;
+
+        // Streams that were derived from the welded vertices follow them, as do the edges indexing them:
+        if (mesh.derived_vertex_streams) {
+            for (u32 e = 0; e < mesh.edge_count; e++) {
+                EdgeVertexIndices &edge = mesh.edge_vertex_indices[e];
+                edge.from = remap[edge.from];
+                edge.to = remap[edge.to];
+            }
+            mesh.deriveVertexStreams();
+        }
+    }
+}
+
+// Optimizes the mesh in place, using its welded vertices when it has any (or else its positions).
+// Works on the index arrays and welded vertices only, so can also be run on a loaded mesh (the BVH and triangles
+// of the CPU tracer are unaffected). Scratch memory comes from the thread's scratch arena:
+MeshOptimizationReport optimizeMesh(Mesh &mesh, bool sort_for_overdraw = true) {
+    MeshOptimizationReport report;
+    if (!mesh.triangle_count) return report;
+
+    bool welded = mesh.welded_vertex_count && mesh.vertex_indices;
+    TriangleVertexIndices *indices = welded ? mesh.vertex_indices : mesh.vertex_position_indices;
+    u32 vertex_count = welded ? mesh.welded_vertex_count : mesh.vertex_count;
+
+    u64 memory_size = mesh_optimizer::Optimizer::getSizeInBytes(mesh.triangle_count, vertex_count);
+    memory_size += memory::getAlignedSize(sizeof(TriangleVertexIndices) * mesh.triangle_count);
+    if (welded) memory_size += memory::getAlignedSize(sizeof(MeshVertex) * vertex_count);
+    memory::MonotonicAllocator &scratch = memory::getScratchArena(memory_size);
+    memory::ScratchScope scratch_scope{scratch};
+
+    mesh_optimizer::Optimizer optimizer{indices, mesh.triangle_count, vertex_count, &scratch};
+    report.acmr_before = mesh_optimizer::getACMR(indices, mesh.triangle_count, vertex_count, optimizer.timestamps);
+    optimizer.orderForVertexCache();
+    if (sort_for_overdraw) {
+        report.cluster_count = optimizer.findClusters();
+        optimizer.sortClustersForOverdraw(mesh, report.cluster_count);
+    }
+
+    TriangleVertexIndices *index_arrays[] = {
+        mesh.vertex_position_indices,
+        mesh.normals_count  ? mesh.vertex_normal_indices  : nullptr,
+        mesh.uvs_count      ? mesh.vertex_uvs_indices     : nullptr,
+        mesh.tangents_count ? mesh.vertex_tangent_indices : nullptr,
+        welded ? mesh.vertex_indices : nullptr
+    };
+    TriangleVertexIndices *temp_indices = (TriangleVertexIndices*)scratch.allocateAligned(sizeof(TriangleVertexIndices) * mesh.triangle_count);
+    mesh_optimizer::reorderTriangles(index_arrays, 5, optimizer.order, mesh.triangle_count, temp_indices);
+
+    if (welded) {
+        MeshVertex *temp_vertices = (MeshVertex*)scratch.allocateAligned(sizeof(MeshVertex) * vertex_count);
+        mesh_optimizer::reorderVertices(mesh, optimizer.live_counts, temp_vertices);
+        vertex_count = mesh.welded_vertex_count;
+    }
+
+    report.acmr_after = mesh_optimizer::getACMR(indices, mesh.triangle_count, vertex_count, optimizer.timestamps);
+    return report;
+}
+
+// Orders the triangles of a standalone index array for the vertex cache (as for the LODs of a mesh, which share its
+// vertices and so leave them in place). Scratch memory comes from the thread's scratch arena:
+void optimizeVertexCache(TriangleVertexIndices *indices, u32 triangle_count, u32 vertex_count) {
+    if (!triangle_count) return;
+
+    u64 memory_size = mesh_optimizer::Optimizer::getSizeInBytes(triangle_count, vertex_count);
+    memory_size += memory::getAlignedSize(sizeof(TriangleVertexIndices) * triangle_count);
+    memory::MonotonicAllocator &scratch = memory::getScratchArena(memory_size);
+    memory::ScratchScope scratch_scope{scratch};
+
+    mesh_optimizer::Optimizer optimizer{indices, triangle_count, vertex_count, &scratch};
+    optimizer.orderForVertexCache();
+
+    TriangleVertexIndices *temp_indices = (TriangleVertexIndices*)scratch.allocateAligned(sizeof(TriangleVertexIndices) * triangle_count);
+    mesh_optimizer::reorderTriangles(&indices, 1, optimizer.order, triangle_count, temp_indices);
+}
@@ -0,0 +1,344 @@
+#pragma once
+
+#include <string.h>
+#include "./mesh.h"
+
+// Simplifies triangles over welded vertices by collapsing edges (Garland and Heckbert's quadric error metric).
+// A collapse moves a vertex onto a neighbour of it, so simplified triangles keep using the same welded vertices and
+// a LOD is just another index buffer.
+// Vertices on open borders or on attribute seams (sharing their position with other welded vertices) never move,
+// so LODs never crack open or tear their uv/normal seams, at the cost of keeping those parts at full detail.
+// Collapses go in passes: every vertex picks its cheapest collapse, then the cheapest of those get done as long
+// as they do not touch the neighbourhood of one already done in the pass (which keeps the checks valid):
+
+// Collapses that would flip a triangle or shrink it to a sliver of this much of its area get rejected:
+#define MESH_SIMPLIFIER_MIN_AREA_RATIO 0.01f
+
+// Every pass picks from the cheapest collapses up to this many times as many as are needed to reach the target:
+#define MESH_SIMPLIFIER_PASS_CANDIDATE_FACTOR 1.5f
+
+namespace mesh_simplifier {
+    // Sum of squared distances to planes (weighted by the area of the triangles they come from):
+    struct Quadric {
+        f64 a00, a01, a02, a11, a12, a22, b0, b1, b2, c, weight;
+
+        void setPlane(const vec3 &normal, f32 distance, f32 area) {
+            f64 x = normal.x, y = normal.y, z = normal.z, d = distance, w = area;
+            a00 = w*x*x; a01 = w*x*y; a02 = w*x*z;
+            a11 = w*y*y; a12 = w*y*z; a22 = w*z*z;
+            b0 = w*x*d;  b1 = w*y*d;  b2 = w*z*d;
+            c = w*d*d;
+            weight = w;
+        }
+
+        void add(const Quadric &other) {
+            a00 += other.a00; a01 += other.a01; a02 += other.a02;
+            a11 += other.a11; a12 += other.a12; a22 += other.a22;
+            b0 += other.b0; b1 += other.b1; b2 += other.b2;
+            c += other.c;
+            weight += other.weight;
+        }
+
+        f64 evaluate(const vec3 &p) const {
+            f64 x = p.x, y = p.y, z = p.z;
+            f64 result = a00*x*x + a11*y*y + a22*z*z + 2*(a01*x*y + a02*x*z + a12*y*z) + 2*(b0*x + b1*y + b2*z) + c;
+            return result > 0 ? result : 0;
+        }
+    };
+
+    // The squared (area weighted, mean) distance that collapsing moves the surface by:
+    INLINE f32 getCollapseError(const Quadric &from, const Quadric &to, const vec3 &position) {
+        f64 weight = from.weight + to.weight;
+        return weight > 0 ? (f32)((from.evaluate(position) + to.evaluate(position)) / weight) : 0;
+    }
+
+    struct Collapse {
+        u32 from, to;
+        f32 error;
+    };
+
+    struct Simplifier {
+        const MeshVertex *vertices;
+        TriangleVertexIndices *indices;
+        u32 vertex_count, triangle_count;
+
+        Quadric *quadrics;       // Per vertex
+        u32 *adjacency_offsets;  // Per vertex (plus one), into the adjacency
+        u32 *adjacency;          // Triangles using every vertex
+        u32 *stamps;             // Per vertex, for marking the neighbours of a vertex
+        u8 *locked;              // Per vertex: on a border or seam
+        u8 *touched;             // Per vertex: in the neighbourhood of a collapse done in this pass
+        Collapse *collapses;     // Per vertex at most
+        Collapse *sorted_collapses;
+        u32 stamp = 0;
+
+        // Slots of the position hash table (see lockBordersAndSeams()), keeping it at most half full:
+        static u32 getPositionTableCapacity(u32 vertex_count) {
+            u32 capacity = 1;
+            while (capacity < vertex_count * 2) capacity <<= 1;
+            return capacity;
+        }
+
+        static u64 getSizeInBytes(u32 vertex_count, u32 triangle_count) {
+            u64 size = memory::getAlignedSize(sizeof(Quadric) * vertex_count);
+            size += memory::getAlignedSize(sizeof(u32) * (vertex_count + 1));
+            size += memory::getAlignedSize(sizeof(u32) * triangle_count * 3);
+            size += memory::getAlignedSize(sizeof(u32) * vertex_count);
+            size += memory::getAlignedSize(sizeof(u8) * vertex_count) * 2;
+            size += memory::getAlignedSize(sizeof(Collapse) * vertex_count) * 2;
+            size += memory::getAlignedSize(sizeof(u32) * getPositionTableCapacity(vertex_count));
+            return size;
+        }
+
+        Simplifier(const MeshVertex *vertices, u32 vertex_count, TriangleVertexIndices *indices, u32 triangle_count,
+                   memory::MonotonicAllocator *memory_allocator) :
+                vertices{vertices}, indices{indices}, vertex_count{vertex_count}, triangle_count{triangle_count} {
+            quadrics          = (Quadric* )memory_allocator->allocateAligned(sizeof(Quadric)  * vertex_count);
+            adjacency_offsets = (u32*     )memory_allocator->allocateAligned(sizeof(u32)      * (vertex_count + 1));
+            adjacency         = (u32*     )memory_allocator->allocateAligned(sizeof(u32)      * triangle_count * 3);
+            stamps            = (u32*     )memory_allocator->allocateAligned(sizeof(u32)      * vertex_count);
+            locked            = (u8*      )memory_allocator->allocateAligned(sizeof(u8)       * vertex_count);
+            touched           = (u8*      )memory_allocator->allocateAligned(sizeof(u8)       * vertex_count);
+            collapses         = (Collapse*)memory_allocator->allocateAligned(sizeof(Collapse) * vertex_count);
+            sorted_collapses  = (Collapse*)memory_allocator->allocateAligned(sizeof(Collapse) * vertex_count);
+        }
+
+        void buildAdjacency() {
+            for (u32 v = 0; v <= vertex_count; v++) adjacency_offsets[v] = 0;
+            for (u32 t = 0; t < triangle_count; t++)
+                for (u32 i = 0; i < 3; i++) adjacency_offsets[indices[t].ids[i] + 1]++;
+            for (u32 v = 0; v < vertex_count; v++) adjacency_offsets[v + 1] += adjacency_offsets[v];
+
+            // Filled through the stamps (counting up from every vertex's offset):
+            for (u32 v = 0; v < vertex_count; v++) stamps[v] = adjacency_offsets[v];
+            for (u32 t = 0; t < triangle_count; t++)
+                for (u32 i = 0; i < 3; i++) adjacency[stamps[indices[t].ids[i]]++] = t;
+            for (u32 v = 0; v < vertex_count; v++) stamps[v] = 0;
+            stamp = 0;
+        }
+
+        // Whether some triangle around the vertex goes from 'to' to 'from' (so that the edge is shared):
+        bool hasEdge(u32 from, u32 to) const {
+            for (u32 a = adjacency_offsets[from]; a < adjacency_offsets[from + 1]; a++) {
+                const TriangleVertexIndices &triangle = indices[adjacency[a]];
+                for (u32 i = 0; i < 3; i++)
+                    if (triangle.ids[i] == from && triangle.ids[(i + 1) % 3] == to) return true;
+            }
+            return false;
+        }
+
+        void lockBordersAndSeams(u32 *position_table) {
+            for (u32 v = 0; v < vertex_count; v++) locked[v] = false;
+
+            // Edges that no other triangle runs the other way along are on a border:
+            for (u32 t = 0; t < triangle_count; t++)
+                for (u32 i = 0; i < 3; i++) {
+                    u32 from = indices[t].ids[i];
+                    u32 to = indices[t].ids[(i + 1) % 3];
+                    if (!hasEdge(to, from)) locked[from] = locked[to] = true;
+                }
+
+            // Welded vertices that share their position are on a seam:
+            u32 capacity = getPositionTableCapacity(vertex_count);
+            u32 mask = capacity - 1;
+            for (u32 slot = 0; slot < capacity; slot++) position_table[slot] = (u32)-1;
+            for (u32 v = 0; v < vertex_count; v++) {
+                const vec3 &position = vertices[v].position;
+                unsigned int bits[3]; // As 32 bits, whatever the width of u32
+                memcpy(bits, &position.x, sizeof(bits));
+                u32 hash = (u32)(bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u);
+                for (u32 slot = hash & mask;; slot = (slot + 1) & mask) {
+                    u32 other = position_table[slot];
+                    if (other == (u32)-1) {
+                        position_table[slot] = v;
+                        break;
+                    }
+                    const vec3 &other_position = vertices[other].position;
+                    if (other_position.x == position.x && other_position.y == position.y && other_position.z == position.z) {
+                        locked[v] = locked[other] = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        void computeQuadrics() {
+            for (u32 v = 0; v < vertex_count; v++) quadrics[v] = {};
+            for (u32 t = 0; t < triangle_count; t++) {
+                const TriangleVertexIndices &triangle = indices[t];
+                const vec3 &p1 = vertices[triangle.v1].position;
+                vec3 normal = (vertices[triangle.v2].position - p1).cross(vertices[triangle.v3].position - p1);
+                f32 length = normal.length();
+                if (length == 0) continue;
+
+                normal /= length;
+                Quadric quadric;
+                quadric.setPlane(normal, -normal.dot(p1), length * 0.5f);
+                for (u32 i = 0; i < 3; i++) quadrics[triangle.ids[i]].add(quadric);
+            }
+        }
+
+        // The link condition: The 2 vertices may only share the neighbours of the 2 triangles along their edge,
+        // or else collapsing would pinch the surface:
+        bool keepsManifold(u32 from, u32 to) {
+            stamp++;
+            for (u32 a = adjacency_offsets[from]; a < adjacency_offsets[from + 1]; a++)
+                for (u32 i = 0; i < 3; i++) stamps[indices[adjacency[a]].ids[i]] = stamp;
+
+            u32 shared_count = 0;
+            stamp++;
+            for (u32 a = adjacency_offsets[to]; a < adjacency_offsets[to + 1]; a++)
+                for (u32 i = 0; i < 3; i++) {
+                    u32 v = indices[adjacency[a]].ids[i];
+                    if (v != from && v != to && stamps[v] == stamp - 1) {
+                        stamps[v] = stamp;
+                        shared_count++;
+                    }
+                }
+            return shared_count <= 2;
+        }
+
+        bool keepsOrientation(u32 from, u32 to) const {
+            const vec3 &new_position = vertices[to].position;
+            for (u32 a = adjacency_offsets[from]; a < adjacency_offsets[from + 1]; a++) {
+                const TriangleVertexIndices &triangle = indices[adjacency[a]];
+                if (triangle.v1 == to || triangle.v2 == to || triangle.v3 == to) continue;
+
+                vec3 p[3], q[3];
+                for (u32 i = 0; i < 3; i++) {
+                    p[i] = vertices[triangle.ids[i]].position;
+                    q[i] = triangle.ids[i] == from ? new_position : p[i];
+                }
+                vec3 old_normal = (p[1] - p[0]).cross(p[2] - p[0]);
+                vec3 new_normal = (q[1] - q[0]).cross(q[2] - q[0]);
+                f32 old_area = old_normal.length();
+                f32 new_area = new_normal.length();
+                if (new_area <= MESH_SIMPLIFIER_MIN_AREA_RATIO * old_area ||
+                    old_normal.dot(new_normal) <= MESH_SIMPLIFIER_MIN_AREA_RATIO * old_area * new_area)
+                    return false;
+            }
+            return true;
+        }
+
+        u32 findCollapses() {
+            u32 collapse_count = 0;
+            for (u32 from = 0; from < vertex_count; from++) {
+                if (locked[from] || adjacency_offsets[from] == adjacency_offsets[from + 1]) continue;
+
+                Collapse best{from, from, INFINITY};
+                for (u32 a = adjacency_offsets[from]; a < adjacency_offsets[from + 1]; a++)
+                    for (u32 i = 0; i < 3; i++) {
+                        u32 to = indices[adjacency[a]].ids[i];
+                        if (to == from) continue;
+
+                        f32 error = getCollapseError(quadrics[from], quadrics[to], vertices[to].position);
+                        if (error < best.error) best = {from, to, error};
+                    }
+                if (best.to != from) collapses[collapse_count++] = best;
+            }
+            return collapse_count;
+        }
+
+        // Merge sort (by ascending error), ping-ponging between the 2 arrays. Returns the sorted one:
+        Collapse* sortCollapses(u32 collapse_count) {
+            Collapse *from = collapses;
+            Collapse *to = sorted_collapses;
+            for (u32 width = 1; width < collapse_count; width *= 2) {
+                for (u32 left = 0; left < collapse_count; left += width * 2) {
+                    u32 middle = Min(left + width, collapse_count);
+                    u32 right = Min(left + width * 2, collapse_count);
+                    u32 l = left, r = middle, o = left;
+                    while (l < middle && r < right) to[o++] = from[r].error < from[l].error ? from[r++] : from[l++];
+                    while (l < middle) to[o++] = from[l++];
+                    while (r < right) to[o++] = from[r++];
+                }
+                Collapse *swap = from;
+                from = to;
+                to = swap;
+            }
+            return from;
+        }
+
+        // Returns the number of collapses done (none when nothing more can be collapsed within the max error):
+        u32 runPass(u32 target_triangle_count, f32 max_squared_error, f32 &squared_error) {
+            buildAdjacency();
+            u32 collapse_count = findCollapses();
+            if (!collapse_count) return 0;
+
+            Collapse *sorted = sortCollapses(collapse_count);
+            u32 needed_count = (triangle_count - target_triangle_count) / 2 + 1;
+            u32 candidate_count = Min(collapse_count, (u32)((f32)needed_count * MESH_SIMPLIFIER_PASS_CANDIDATE_FACTOR) + 1);
+            f32 error_limit = Min(max_squared_error, sorted[candidate_count - 1].error);
+
+            for (u32 v = 0; v < vertex_count; v++) touched[v] = false;
+            u32 done_count = 0;
+            u32 removed_count = 0;
+            for (u32 c = 0; c < collapse_count && triangle_count - removed_count > target_triangle_count; c++) {
+                const Collapse &collapse = sorted[c];
+                if (collapse.error > error_limit) break;
+                if (touched[collapse.from] || touched[collapse.to] ||
+                    !keepsManifold(collapse.from, collapse.to) ||
+                    !keepsOrientation(collapse.from, collapse.to))
+                    continue;
+
+                for (u32 a = adjacency_offsets[collapse.from]; a < adjacency_offsets[collapse.from + 1]; a++) {
+                    TriangleVertexIndices &triangle = indices[adjacency[a]];
+                    bool degenerates = false;
+                    for (u32 i = 0; i < 3; i++) {
+                        touched[triangle.ids[i]] = true;
+                        degenerates = degenerates || triangle.ids[i] == collapse.to;
+                    }
+                    if (degenerates) removed_count++;
+                }
+                // Moving the vertex now is safe, as nothing touched gets looked at again during the pass:
+                for (u32 a = adjacency_offsets[collapse.from]; a < adjacency_offsets[collapse.from + 1]; a++) {
+                    TriangleVertexIndices &triangle = indices[adjacency[a]];
+                    for (u32 i = 0; i < 3; i++)
+                        if (triangle.ids[i] == collapse.from) triangle.ids[i] = collapse.to;
+                }
+                quadrics[collapse.to].add(quadrics[collapse.from]);
+                squared_error = Max(squared_error, collapse.error);
+                done_count++;
+            }
+
+            // Drop the triangles that collapsed:
+            u32 kept_count = 0;
+            for (u32 t = 0; t < triangle_count; t++) {
+                const TriangleVertexIndices &triangle = indices[t];
+                if (triangle.v1 != triangle.v2 && triangle.v2 != triangle.v3 && triangle.v3 != triangle.v1)
+                    indices[kept_count++] = triangle;
+            }
+            triangle_count = kept_count;
+            return done_count;
+        }
+    };
+}
+
+// Simplifies the triangles (indexing the given welded vertices) in place, down to the target triangle count or as far
+// as it gets without moving the surface by more than the max error. The error it did move it by gets written out
+// (as an object-space distance). Returns the new triangle count.
+// Scratch memory comes from the thread's scratch arena:
+u32 simplify(const MeshVertex *vertices, u32 vertex_count, TriangleVertexIndices *indices, u32 triangle_count,
+             u32 target_triangle_count, f32 max_error = INFINITY, f32 *error = nullptr) {
+    if (error) *error = 0;
+    if (triangle_count <= target_triangle_count) return triangle_count;
+
+    u64 memory_size = mesh_simplifier::Simplifier::getSizeInBytes(vertex_count, triangle_count);
+    memory::MonotonicAllocator &scratch = memory::getScratchArena(memory_size);
+    memory::ScratchScope scratch_scope{scratch};
+
+    mesh_simplifier::Simplifier simplifier{vertices, vertex_count, indices, triangle_count, &scratch};
+    u32 *position_table = (u32*)scratch.allocateAligned(sizeof(u32) * mesh_simplifier::Simplifier::getPositionTableCapacity(vertex_count));
+    if (!position_table) return triangle_count;
+    simplifier.buildAdjacency();
+    simplifier.lockBordersAndSeams(position_table);
+    simplifier.computeQuadrics();
+
+    f32 squared_error = 0;
+    f32 max_squared_error = max_error * max_error;
+    while (simplifier.triangle_count > target_triangle_count &&
+           simplifier.runPass(target_triangle_count, max_squared_error, squared_error));
+
+    if (error) *error = sqrtf(squared_error);
+    return simplifier.triangle_count;
+}
@@ -13,7 +13,7 @@ struct MeshTracer {
     explicit MeshTracer(u32 stack_size, memory::MonotonicAllocator *memory_allocator = nullptr) {
         memory::MonotonicAllocator temp_allocator;
         if (!memory_allocator) {
-            temp_allocator = memory::MonotonicAllocator{sizeof(u32) * stack_size};
+            temp_allocator = memory::MonotonicAllocator{"MeshTracer", sizeof(u32) * stack_size};
             memory_allocator = &temp_allocator;
         }
 
@@ -48,17 +48,23 @@ struct MeshTracer {
         return found_triangle;
     }
 
-    INLINE_XPU bool trace(const Mesh &mesh, Ray &ray, RayHit &hit, bool any_hit) {
+    // LOD 0 is the mesh itself (LODs the mesh does not have fall back to its coarsest one):
+    INLINE_XPU bool trace(const Mesh &mesh, Ray &ray, RayHit &hit, bool any_hit, u8 lod = 0) {
         bool hit_left, hit_right, found = false;
         f32 left_near_distance, right_near_distance, left_far_distance, right_far_distance;
 
-        if (!(ray.hitsAABB(mesh.bvh.nodes->aabb, left_near_distance, left_far_distance) && left_near_distance < hit.distance))
+        lod = (u8)Min((u32)lod, mesh.lod_count);
+        const BVH &bvh = lod ? mesh.lods[lod - 1].bvh : mesh.bvh;
+        Triangle *triangles = lod ? mesh.lods[lod - 1].triangles : mesh.triangles;
+        u32 triangle_count = lod ? mesh.lods[lod - 1].triangle_count : mesh.triangle_count;
+
+        if (!(ray.hitsAABB(bvh.nodes->aabb, left_near_distance, left_far_distance) && left_near_distance < hit.distance))
             return false;
 
-        if (unlikely(mesh.bvh.nodes->leaf_count))
-            return hitTriangles(mesh.triangles, mesh.triangle_count, left_far_distance, ray, hit, any_hit);
+        if (unlikely(bvh.nodes->leaf_count))
+            return hitTriangles(triangles, triangle_count, left_far_distance, ray, hit, any_hit);
 
-        BVHNode *left_node = mesh.bvh.nodes + mesh.bvh.nodes->first_index;
+        BVHNode *left_node = bvh.nodes + bvh.nodes->first_index;
         BVHNode *right_node, *tmp_node;
         u32 top = 0;
 
@@ -70,7 +76,7 @@ struct MeshTracer {
 
             if (hit_left) {
                 if (unlikely(left_node->leaf_count)) {
-                    if (hitTriangles(mesh.triangles + left_node->first_index, left_node->leaf_count, left_far_distance, ray, hit, any_hit)) {
+                    if (hitTriangles(triangles + left_node->first_index, left_node->leaf_count, left_far_distance, ray, hit, any_hit)) {
                         hit.id += left_node->first_index;
                         found = true;
                         if (any_hit)
@@ -84,7 +90,7 @@ struct MeshTracer {
 
             if (hit_right) {
                 if (unlikely(right_node->leaf_count)) {
-                    if (hitTriangles(mesh.triangles + right_node->first_index, right_node->leaf_count, right_far_distance, ray, hit, any_hit)) {
+                    if (hitTriangles(triangles + right_node->first_index, right_node->leaf_count, right_far_distance, ray, hit, any_hit)) {
                         hit.id += right_node->first_index;
                         found = true;
                         if (any_hit)
@@ -105,17 +111,17 @@ struct MeshTracer {
                     }
                     stack[top++] = right_node->first_index;
                 }
-                left_node = mesh.bvh.nodes + left_node->first_index;
+                left_node = bvh.nodes + left_node->first_index;
             } else if (right_node) {
-                left_node = mesh.bvh.nodes + right_node->first_index;
+                left_node = bvh.nodes + right_node->first_index;
             } else {
                 if (top == 0) break;
-                left_node = mesh.bvh.nodes + stack[--top];
+                left_node = bvh.nodes + stack[--top];
             }
         }
 
         if (found && !any_hit && mesh.normals_count | mesh.uvs_count) {
-            Triangle &triangle = mesh.triangles[hit.id];
+            Triangle &triangle = triangles[hit.id];
             f32 a = hit.uv.u;
             f32 b = hit.uv.v;
             f32 c = 1 - a - b;
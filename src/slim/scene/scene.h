@@ -7,12 +7,40 @@
 #include "./light.h"
 #include "./material.h"
 #include "./bvh_builder.h"
+#include "./light_bvh.h"
 #include "../core/texture.h"
 #include "../core/ray.h"
 #include "../core/transform.h"
 #include "../serialization/texture.h"
 #include "../serialization/mesh.h"
 
+// Scenes that allocate their own memory ask for large pages once it is at least this big, as rays hit their BVH nodes,
+// triangles and texels all over (falling back to regular pages when large pages are not available):
+#define SCENE_LARGE_PAGES_MIN_SIZE Megabytes(64)
+
+// LODs get selected for their error to project to at most this many pixels on screen (by default):
+#define SCENE_LOD_MAX_PIXEL_ERROR 1.0f
+
+// Picks the coarsest LOD of the mesh whose error projects to at most the given number of pixels, for a screen of the
+// given height (in pixels). The error gets projected from the nearest point of the mesh's bounding sphere, scaled the
+// way the transform scales the mesh the most (in world units, a pixel spans distance / (focal length * half height)):
+INLINE_XPU u8 selectLOD(const Mesh &mesh, const Transform &transform, const Camera &camera, f32 screen_height,
+                        f32 max_pixel_error = SCENE_LOD_MAX_PIXEL_ERROR) {
+    if (!mesh.lod_count) return 0;
+
+    vec3 center = transform.externPos((mesh.aabb.min + mesh.aabb.max) * 0.5f);
+    f32 scale = transform.scale.maximum();
+    f32 radius = (mesh.aabb.max - mesh.aabb.min).length() * 0.5f * scale;
+    f32 distance = (center - camera.position).length() - radius;
+    if (distance <= 0) return 0;
+
+    f32 pixels_per_unit = camera.focal_length * screen_height * 0.5f / distance;
+    u8 lod = 0;
+    for (u32 l = 0; l < mesh.lod_count; l++)
+        if (mesh.lods[l].error * scale * pixels_per_unit <= max_pixel_error) lod = (u8)(l + 1);
+    return lod;
+}
+
 struct SceneCountsData {
     u32 geometries;
     u32 cameras;
@@ -64,10 +92,28 @@ struct SceneCounts : SceneCountsData {
 
 #define SCENE_HAD_EMISSIVE_QUADS 1
 
+// Chunked scenes evict payloads to stay under this many bytes of resident meshes and textures (by default):
+#define SCENE_PAYLOAD_BUDGET Gigabytes(1)
+
 struct SceneIO {
     String file_path;
     u64 last_io_ticks = 0;
     bool last_io_is_save{false};
+
+    // Chunked scenes keep their file open and fetch mesh and texture payloads on first use, each into memory of its
+    // own. Payloads are indexed meshes first, then textures. Once the resident ones would add up to more than the
+    // budget (0 for none), the ones that went unused for the most frames get evicted back to their headers:
+    void *file_handle = nullptr;
+    void *table_memory = nullptr;
+    u64 *payload_offsets = nullptr;
+    u64 *payload_sizes = nullptr;
+    u64 *payload_last_used_frames = nullptr;
+    void **payload_memory = nullptr;
+    Mesh *mesh_headers = nullptr;
+    Texture *texture_headers = nullptr;
+    u64 payload_budget = SCENE_PAYLOAD_BUDGET;
+    u64 resident_payload_size = 0;
+    u64 frame = 0;
 };
 
 struct SceneData {
@@ -91,6 +137,16 @@ struct SceneData {
     BVHBuilder *bvh_builder;
     u32 *bvh_leaf_geometry_indices;
     BVH bvh;
+
+    // Indices of the geometries that are emissive quads (area lights), kept in sync by updateEmissiveQuads():
+    u32 *emissive_quad_ids;
+    u32 emissive_quad_count;
+
+    // Point and spot lights, for picking a few of them per shading point (kept in sync by updateLightBVH()):
+    LightBVH light_bvh;
+
+    // Irradiance of every cube map texture, as spherical harmonics (kept in sync by updateTextureIrradiance()):
+    IrradianceSH *texture_irradiances;
 };
 
 struct Scene : SceneData {
@@ -126,100 +182,154 @@ struct Scene : SceneData {
         boxes, 
         curves
     } {
+        io = scene_io;
         bvh.node_count = counts.geometries * 2;
         bvh.height = (u8)counts.geometries;
 
         memory::MonotonicAllocator temp_allocator;
-        u32 capacity = sizeof(BVHBuilder) + (sizeof(u32) + sizeof(AABB) + sizeof(RectI)) * counts.geometries;
-        u32 bvh_nodes_capacity = sizeof(BVHNode) * bvh.node_count;
 
-        if (counts.directional_lights && !directional_lights) capacity += sizeof(DirectionalLight) * counts.point_lights;
-        if (counts.point_lights && !point_lights) capacity += sizeof(PointLight) * counts.point_lights;
-        if (counts.spot_lights && !spot_lights) capacity += sizeof(SpotLight) * counts.spot_lights;
-        if (counts.materials && !materials) capacity += sizeof(Material) * counts.materials;
-        if (counts.geometries && !geometries) capacity += sizeof(Geometry) * counts.geometries;
-        if (counts.boxes && !boxes) capacity += sizeof(Box) * counts.boxes;
-        if (counts.curves && !curves) capacity += sizeof(Curve) * counts.curves;
+        // Arrays start on cache lines, so each one reserves room for its padding:
+        u32 capacity = (u32)(memory::getAlignedSize(sizeof(BVHBuilder)) +
+                             memory::getAlignedSize(sizeof(u32) * counts.geometries) * 2 +
+                             memory::getAlignedSize(sizeof(AABB) * counts.geometries) +
+                             memory::getAlignedSize(sizeof(RectI) * counts.geometries));
+        u32 bvh_nodes_capacity = (u32)memory::getAlignedSize(sizeof(BVHNode) * bvh.node_count);
+
+        if (counts.directional_lights && !directional_lights) capacity += (u32)memory::getAlignedSize(sizeof(DirectionalLight) * counts.directional_lights);
+        if (counts.point_lights && !point_lights) capacity += (u32)memory::getAlignedSize(sizeof(PointLight) * counts.point_lights);
+        if (counts.spot_lights && !spot_lights) capacity += (u32)memory::getAlignedSize(sizeof(SpotLight) * counts.spot_lights);
+        u32 light_count = counts.point_lights + counts.spot_lights;
+        capacity += (u32)(memory::getAlignedSize(sizeof(BVHNode) * 2 * light_count) +
+                          memory::getAlignedSize(sizeof(f32) * 2 * light_count) +
+                          memory::getAlignedSize(sizeof(u32) * light_count));
+        if (counts.materials && !materials) capacity += (u32)memory::getAlignedSize(sizeof(Material) * counts.materials);
+        if (counts.geometries && !geometries) capacity += (u32)memory::getAlignedSize(sizeof(Geometry) * counts.geometries);
+        if (counts.boxes && !boxes) capacity += (u32)memory::getAlignedSize(sizeof(Box) * counts.boxes);
+        if (counts.curves && !curves) capacity += (u32)memory::getAlignedSize(sizeof(Curve) * counts.curves);
 
         if (counts.textures) {
-            if (!textures) capacity += sizeof(Texture) * counts.textures;
-            capacity += getTotalMemoryForTextures(texture_files, counts.textures);
+            if (!textures) capacity += (u32)memory::getAlignedSize(sizeof(Texture) * counts.textures);
+            capacity += (u32)memory::getAlignedSize(sizeof(IrradianceSH) * counts.textures);
+            if (texture_files) capacity += getTotalMemoryForTextures(texture_files, counts.textures);
         }
         u32 max_triangle_count = 0;
         if (counts.meshes) {
-            if (!meshes) capacity += sizeof(Mesh) * counts.meshes;
-            capacity += getTotalMemoryForMeshes(mesh_files, counts.meshes, &max_triangle_count, &bvh_nodes_capacity);
+            if (!meshes) capacity += (u32)memory::getAlignedSize(sizeof(Mesh) * counts.meshes);
+            if (mesh_files) capacity += getTotalMemoryForMeshes(mesh_files, counts.meshes, &max_triangle_count, &bvh_nodes_capacity);
             capacity += sizeof(u32) * (2 * counts.meshes);
         }
-        u32 max_leaf_node_count = Max(max_triangle_count, counts.geometries);
+        u32 max_leaf_node_count = Max(max_triangle_count, Max(counts.geometries, light_count));
         capacity += BVHBuilder::getSizeInBytes(max_leaf_node_count);
 
         if (!memory_allocator) {
-            temp_allocator = memory::MonotonicAllocator{bvh_nodes_capacity + capacity};
+            // The nodes get carved out of it as one block, so that block reserves room for its own padding too:
+            bvh_nodes_capacity = (u32)memory::getAlignedSize(bvh_nodes_capacity);
+            u64 total_capacity = (u64)bvh_nodes_capacity + capacity;
+            temp_allocator = memory::MonotonicAllocator{"Scene", total_capacity, 0, total_capacity >= SCENE_LARGE_PAGES_MIN_SIZE};
             memory_allocator = &temp_allocator;
         }
+        // The scene's and its meshes' BVH nodes get tracked on their own line, as part of the scene's memory:
         memory::MonotonicAllocator bvh_nodes_allocator;
-        bvh_nodes_allocator.address = (u8*)memory_allocator->allocate(bvh_nodes_capacity);
+        bvh_nodes_allocator.address = (u8*)memory_allocator->allocateAligned(bvh_nodes_capacity);
         bvh_nodes_allocator.capacity = (u64)bvh_nodes_capacity;
+        if (bvh_nodes_allocator.address) bvh_nodes_allocator.stats = memory::registerArena("SceneBVHNodes", bvh_nodes_allocator.capacity);
 
-        bvh.nodes = (BVHNode*)bvh_nodes_allocator.allocate(sizeof(BVHNode) * bvh.node_count);
-        bvh_leaf_geometry_indices = (u32*)memory_allocator->allocate(sizeof(u32) * counts.geometries);
-        bvh_builder = (BVHBuilder*)memory_allocator->allocate(sizeof(BVHBuilder));
+        bvh.nodes = (BVHNode*)bvh_nodes_allocator.allocateAligned(sizeof(BVHNode) * bvh.node_count);
+        bvh_leaf_geometry_indices = (u32*)memory_allocator->allocateAligned(sizeof(u32) * counts.geometries);
+        bvh_builder = (BVHBuilder*)memory_allocator->allocateAligned(sizeof(BVHBuilder));
         *bvh_builder = BVHBuilder{max_leaf_node_count, memory_allocator};
 
-        aabbs = (AABB*)memory_allocator->allocate(sizeof(AABB) * counts.geometries);
+        aabbs = (AABB*)memory_allocator->allocateAligned(sizeof(AABB) * counts.geometries);
+        emissive_quad_ids = (u32*)memory_allocator->allocateAligned(sizeof(u32) * counts.geometries);
+        emissive_quad_count = 0;
+
+        light_bvh.bvh.node_count = light_count * 2;
+        light_bvh.bvh.nodes = (BVHNode*)memory_allocator->allocateAligned(sizeof(BVHNode) * light_bvh.bvh.node_count);
+        light_bvh.node_powers = (f32*)memory_allocator->allocateAligned(sizeof(f32) * light_bvh.bvh.node_count);
+        light_bvh.light_ids = (u32*)memory_allocator->allocateAligned(sizeof(u32) * light_count);
+        light_bvh.light_count = 0;
+
+        texture_irradiances = counts.textures ? (IrradianceSH*)memory_allocator->allocateAligned(sizeof(IrradianceSH) * counts.textures) : nullptr;
 
         if (counts.geometries && !geometries) {
-            geometries = (Geometry*)memory_allocator->allocate(sizeof(Geometry) * counts.geometries);
+            this->geometries = geometries = (Geometry*)memory_allocator->allocateAligned(sizeof(Geometry) * counts.geometries);
             for (u32 i = 0; i < counts.geometries; i++) geometries[i] = Geometry{};
         }
         if (counts.boxes && !boxes) {
-            boxes = (Box*)memory_allocator->allocate(sizeof(Box) * counts.boxes);
+            this->boxes = boxes = (Box*)memory_allocator->allocateAligned(sizeof(Box) * counts.boxes);
             for (u32 i = 0; i < counts.boxes; i++) boxes[i] = Box{};
         }
         if (counts.curves && !curves) {
-            curves = (Curve*)memory_allocator->allocate(sizeof(Curve) * counts.curves);
+            this->curves = curves = (Curve*)memory_allocator->allocateAligned(sizeof(Curve) * counts.curves);
             for (u32 i = 0; i < counts.curves; i++) curves[i] = Curve{};
         }
         if (counts.directional_lights && !directional_lights) {
-            directional_lights = (DirectionalLight*)memory_allocator->allocate(sizeof(DirectionalLight) * counts.directional_lights);
+            this->directional_lights = directional_lights = (DirectionalLight*)memory_allocator->allocateAligned(sizeof(DirectionalLight) * counts.directional_lights);
             for (u32 i = 0; i < counts.directional_lights; i++) directional_lights[i] = DirectionalLight{};
         }
         if (counts.point_lights && !point_lights) {
-            point_lights = (PointLight*)memory_allocator->allocate(sizeof(PointLight) * counts.point_lights);
+            this->point_lights = point_lights = (PointLight*)memory_allocator->allocateAligned(sizeof(PointLight) * counts.point_lights);
             for (u32 i = 0; i < counts.point_lights; i++) point_lights[i] = PointLight{};
         }
         if (counts.spot_lights && !spot_lights) {
-            spot_lights = (SpotLight*)memory_allocator->allocate(sizeof(SpotLight) * counts.spot_lights);
+            this->spot_lights = spot_lights = (SpotLight*)memory_allocator->allocateAligned(sizeof(SpotLight) * counts.spot_lights);
             for (u32 i = 0; i < counts.spot_lights; i++) spot_lights[i] = SpotLight{};
         }
         if (counts.materials && !materials) {
-            materials = (Material*)memory_allocator->allocate(sizeof(Material) * counts.materials);
+            this->materials = materials = (Material*)memory_allocator->allocateAligned(sizeof(Material) * counts.materials);
             for (u32 i = 0; i < counts.materials; i++) materials[i] = Material{};
         }
         if (counts.textures && texture_files) {
-            if (!textures) textures = (Texture*)memory_allocator->allocate(sizeof(Texture) * counts.textures);
+            if (!textures) this->textures = textures = (Texture*)memory_allocator->allocateAligned(sizeof(Texture) * counts.textures);
             for (u32 i = 0; i < counts.textures; i++)
                 load(textures[i], texture_files[i].char_ptr, memory_allocator);
         }
+        if (counts.textures && textures)
+            for (u32 i = 0; i < counts.textures; i++)
+                updateTextureIrradiance(i);
         if (counts.meshes && mesh_files) {
-            if (!meshes) meshes = (Mesh*)memory_allocator->allocate(sizeof(Mesh) * counts.meshes);
+            if (!meshes) this->meshes = meshes = (Mesh*)memory_allocator->allocateAligned(sizeof(Mesh) * counts.meshes);
             for (u32 i = 0; i < counts.meshes; i++) meshes[i] = Mesh{};
 
             for (u32 i = 0; i < counts.meshes; i++) {
                 load(meshes[i], mesh_files[i].char_ptr, memory_allocator, &bvh_nodes_allocator);
-                mesh_stack_size = Max(mesh_stack_size, meshes[i].bvh.height);
+                mesh_stack_size = (u16)Max((u32)mesh_stack_size, meshes[i].getMaxBVHHeight());
             }
             mesh_stack_size += 2;
         }
 
-        for (u32 i = 0; i < counts.geometries; i++)
-            if (geometries[i].type == GeometryType_Quad && materials[geometries[i].material_id].isEmissive()) {
-                flags = SCENE_HAD_EMISSIVE_QUADS;
-            }
-
+        updateEmissiveQuads();
         updateAABBs();
         updateBVH();
+        updateLightBVH();
+    }
+
+    // Call when geometry types or material assignments change, or when materials become (or stop being) emissive:
+    void updateEmissiveQuads() {
+        emissive_quad_count = 0;
+        for (u32 i = 0; i < counts.geometries; i++)
+            if (geometries[i].type == GeometryType_Quad && materials[geometries[i].material_id].isEmissive())
+                emissive_quad_ids[emissive_quad_count++] = i;
+
+        if (emissive_quad_count) flags |= SCENE_HAD_EMISSIVE_QUADS;
+    }
+
+    // Call when point or spot lights move or change their intensity or color:
+    void updateLightBVH() {
+        if ((counts.point_lights || counts.spot_lights) &&
+            (point_lights || !counts.point_lights) &&
+            (spot_lights || !counts.spot_lights))
+            light_bvh.build(*bvh_builder, point_lights, counts.point_lights, spot_lights, counts.spot_lights);
+    }
+
+    // Call when the content of a cube map texture changes (it is a no-op for other textures):
+    void updateTextureIrradiance(u32 texture_id) {
+        const Texture &texture = textures[texture_id];
+        if (!texture.flags.cubemap || !texture.mips) return;
+
+        SphericalHarmonics projection;
+        projectCubeTexture(texture, projection);
+        texture_irradiances[texture_id].init(projection);
     }
 
     void updateAABB(AABB &aabb, const Geometry &geo, u8 sphere_steps = 255) {
@@ -233,6 +343,19 @@ struct Scene : SceneData {
         aabb = geo.transform.externAABB(aabb);
     }
 
+    // Call when the camera moves (or the view gets resized), to have every mesh geometry traced and drawn at the LOD
+    // that is just detailed enough for the screen (see selectLOD()). Returns whether any geometry's LOD changed:
+    bool updateLODs(const Camera &camera, f32 screen_height, f32 max_pixel_error = SCENE_LOD_MAX_PIXEL_ERROR) {
+        bool changed = false;
+        for (u32 i = 0; i < counts.geometries; i++) {
+            Geometry &geo = geometries[i];
+            u8 lod = geo.type == GeometryType_Mesh ? selectLOD(meshes[geo.id], geo.transform, camera, screen_height, max_pixel_error) : 0;
+            changed = changed || lod != geo.lod;
+            geo.lod = lod;
+        }
+        return changed;
+    }
+
     void updateAABBs() {
         for (u32 i = 0; i < counts.geometries; i++)
             updateAABB(aabbs[i], geometries[i]);
@@ -15,7 +15,7 @@ struct SceneTracer {
     explicit SceneTracer(u32 stack_size, u32 mesh_stack_size, memory::MonotonicAllocator *memory_allocator = nullptr) {
         memory::MonotonicAllocator temp_allocator;
         if (!memory_allocator) {
-            temp_allocator = memory::MonotonicAllocator{sizeof(u32) * (mesh_stack_size + stack_size)};
+            temp_allocator = memory::MonotonicAllocator{"SceneTracer", sizeof(u32) * (mesh_stack_size + stack_size)};
             memory_allocator = &temp_allocator;
         }
 
@@ -158,7 +158,7 @@ struct SceneTracer {
             case GeometryType_Box: return aux_ray.hitsDefaultBox(hit, geo.flags & GEOMETRY_IS_TRANSPARENT);
             case GeometryType_Sphere: return aux_ray.hitsDefaultSphere(hit, geo.flags & GEOMETRY_IS_TRANSPARENT);
             case GeometryType_Tet   : return aux_ray.hitsDefaultTetrahedron(hit, geo.flags & GEOMETRY_IS_TRANSPARENT);
-            case GeometryType_Mesh  : return mesh_tracer.trace(meshes[geo.id], aux_ray, hit, any_hit);
+            case GeometryType_Mesh  : return meshes[geo.id].triangles && mesh_tracer.trace(meshes[geo.id], aux_ray, hit, any_hit, geo.lod);
             default: return false;
         }
     }
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <string.h>
+#include "./mesh.h"
+
+// Encodings of compact vertices (as uploaded by gpu::QuantizedVertex), along with the decodings the default vertex
+// shader does, so they can be checked on the CPU.
+// Positions are 16-bit fractions of the bounds of their mesh, normals and tangents are octahedral-encoded into
+// 2 8-bit components each, and uvs are half floats:
+
+INLINE u16 quantizeUnorm16(f32 value) {
+    value = value < 0 ? 0 : (value > 1 ? 1 : value);
+    return (u16)(value * 65535.0f + 0.5f);
+}
+
+INLINE f32 dequantizeUnorm16(u16 value) {
+    return (f32)value / 65535.0f;
+}
+
+// Positions are fractions of the bounds (offset by their min, scaled by their extent), axes that the bounds are flat
+// along quantizing to 0:
+INLINE void quantizePosition(const vec3 &position, const vec3 &offset, const vec3 &scale, u16 *quantized) {
+    vec3 fraction = position - offset;
+    quantized[0] = quantizeUnorm16(scale.x > 0 ? fraction.x / scale.x : 0);
+    quantized[1] = quantizeUnorm16(scale.y > 0 ? fraction.y / scale.y : 0);
+    quantized[2] = quantizeUnorm16(scale.z > 0 ? fraction.z / scale.z : 0);
+}
+
+INLINE vec3 dequantizePosition(const u16 *quantized, const vec3 &offset, const vec3 &scale) {
+    return vec3{dequantizeUnorm16(quantized[0]), dequantizeUnorm16(quantized[1]), dequantizeUnorm16(quantized[2])} * scale + offset;
+}
+
+// The bounds of the positions that get quantized (of the welded vertices, or else of the position stream).
+// Quantization goes by these rather than by the mesh's AABB, which is not always set (like for meshes made in code)
+// and leaves every position at its min when it is empty:
+AABB getVertexBounds(const Mesh &mesh) {
+    const MeshVertex *welded_vertices = mesh.welded_vertex_count ? mesh.vertices : nullptr;
+    u32 vertex_count = welded_vertices ? mesh.welded_vertex_count : mesh.vertex_count;
+    if (!vertex_count) return AABB{};
+
+    AABB bounds{INFINITY, -INFINITY};
+    for (u32 v = 0; v < vertex_count; v++) {
+        const vec3 &position = welded_vertices ? welded_vertices[v].position : mesh.vertex_positions[v];
+        bounds.min = minimum(bounds.min, position);
+        bounds.max = maximum(bounds.max, position);
+    }
+    return bounds;
+}
+
+INLINE i8 quantizeSnorm8(f32 value) {
+    value = value < -1 ? -1 : (value > 1 ? 1 : value);
+    return (i8)(value < 0 ? value * 127.0f - 0.5f : value * 127.0f + 0.5f);
+}
+
+INLINE f32 dequantizeSnorm8(i8 value) {
+    f32 result = (f32)value / 127.0f;
+    return result < -1 ? -1 : result;
+}
+
+// Rounds to the nearest half (values too large for one become infinite, too small ones become 0):
+INLINE u16 quantizeHalf(f32 value) {
+    unsigned int bits;
+    memcpy(&bits, &value, sizeof(bits));
+    unsigned int sign = (bits >> 16) & 0x8000;
+    int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+    unsigned int mantissa = bits & 0x7FFFFF;
+    if (exponent >= 31) return (u16)(sign | 0x7C00);
+    if (exponent <= 0) {
+        if (exponent < -10) return (u16)sign;
+
+        // Denormal:
+        mantissa |= 0x800000;
+        unsigned int shift = 14 - exponent;
+        return (u16)(sign | ((mantissa + (1 << (shift - 1))) >> shift));
+    }
+
+    // Rounding may carry into the exponent, which is what it should do:
+    return (u16)((sign | (exponent << 10) | (mantissa >> 13)) + ((mantissa >> 12) & 1));
+}
+
+INLINE f32 dequantizeHalf(u16 value) {
+    unsigned int sign = (unsigned int)(value & 0x8000) << 16;
+    unsigned int exponent = (value >> 10) & 0x1F;
+    unsigned int mantissa = value & 0x3FF;
+    unsigned int bits;
+    if (exponent == 31)
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    else if (exponent)
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    else {
+        f32 denormal = (f32)mantissa / (f32)(1 << 24);
+        return sign ? -denormal : denormal;
+    }
+
+    f32 result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+INLINE vec3 decodeOctahedral(f32 x, f32 y) {
+    vec3 direction{x, y, 1.0f - fabsf(x) - fabsf(y)};
+    f32 fold = direction.z < 0 ? -direction.z : 0;
+    direction.x += direction.x >= 0 ? -fold : fold;
+    direction.y += direction.y >= 0 ? -fold : fold;
+    return direction.normalized();
+}
+
+INLINE vec3 dequantizeOctahedral(const i8 *quantized) {
+    return decodeOctahedral(dequantizeSnorm8(quantized[0]), dequantizeSnorm8(quantized[1]));
+}
+
+// Of the 4 ways to round the projection onto the octahedron, keeps the one that decodes the closest:
+INLINE void quantizeOctahedral(const vec3 &direction, i8 *quantized) {
+    f32 length = fabsf(direction.x) + fabsf(direction.y) + fabsf(direction.z);
+    if (length == 0) {
+        quantized[0] = quantized[1] = 0;
+        return;
+    }
+
+    f32 x = direction.x / length;
+    f32 y = direction.y / length;
+    if (direction.z < 0) {
+        f32 folded_x = (1.0f - fabsf(y)) * (x >= 0 ? 1.0f : -1.0f);
+        f32 folded_y = (1.0f - fabsf(x)) * (y >= 0 ? 1.0f : -1.0f);
+        x = folded_x;
+        y = folded_y;
+    }
+
+    vec3 unit_direction = direction / direction.length();
+    f32 best_dot = -2;
+    for (u32 i = 0; i < 4; i++) {
+        f32 qx = (i & 1 ? ceilf(x * 127.0f) : floorf(x * 127.0f)) / 127.0f;
+        f32 qy = (i & 2 ? ceilf(y * 127.0f) : floorf(y * 127.0f)) / 127.0f;
+        f32 dot = decodeOctahedral(qx, qy).dot(unit_direction);
+        if (dot > best_dot) {
+            best_dot = dot;
+            quantized[0] = quantizeSnorm8(qx);
+            quantized[1] = quantizeSnorm8(qy);
+        }
+    }
+}
@@ -4,13 +4,13 @@
 #include "../scene/bvh.h"
 
 u32 getSizeInBytes(const BVH &bvh) {
-    return sizeof(BVHNode) * bvh.node_count;
+    return (u32)memory::getAlignedSize(sizeof(BVHNode) * bvh.node_count);
 }
 
 bool allocateMemory(BVH &bvh, memory::MonotonicAllocator *memory_allocator) {
     if (getSizeInBytes(bvh) > (memory_allocator->capacity - memory_allocator->occupied)) return false;
 
-    bvh.nodes = (BVHNode*)memory_allocator->allocate(sizeof(BVHNode) * bvh.node_count);
+    bvh.nodes = (BVHNode*)memory_allocator->allocateAligned(sizeof(BVHNode) * bvh.node_count);
 
     return true;
 }
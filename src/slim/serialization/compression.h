@@ -0,0 +1,390 @@
+#pragma once
+
+#include <string.h>
+
+#include "../math/vec3.h"
+#include "../core/parallel.h"
+
+// Block-compressed content sections for the '.mesh' and '.texture' formats.
+// A section is a run of independent blocks, each one filtered and then LZ-compressed on its own,
+// so any subset of blocks can be decoded without touching the rest (and therefore concurrently).
+//
+// Section layout (written right after the content magic):
+//   u32 element_size    : Size of one un-filtered element (e.g. 12 for a vec3)
+//   u32 filtered_size   : Total size of the filtered data (smaller than the raw size for lossy filters)
+//   u32 block_count
+//   u32 filter
+//   u32 block_sizes[block_count] : Compressed size of each block, high bit set if the block is stored raw
+//   blocks...
+
+#define COMPRESSED_CONTENT_MAGIC 0x5A4D4C53
+#define COMPRESSION_BLOCK_SIZE Kilobytes(64)
+#define COMPRESSION_BLOCK_IS_RAW 0x80000000
+#define COMPRESSION_HASH_BITS 12
+#define COMPRESSION_MIN_MATCH 4
+
+namespace compression {
+    enum Filter {
+        Filter_None,
+
+        // Transpose the bytes of every element into planes, so that equal-significance bytes sit together:
+        Filter_Shuffle,
+
+        // Shuffle, then replace every byte with its difference from the previous byte of the same plane:
+        Filter_Delta,
+
+        // Lossy: Quantize unit vectors to 3 x 16-bit signed normalized values, then Delta them:
+        Filter_QuantizedNormals
+    };
+
+    INLINE u32 read32(const u8 *ptr) {
+        return ((u32)ptr[0] | ((u32)ptr[1] << 8) | ((u32)ptr[2] << 16) | ((u32)ptr[3] << 24)) & 0xFFFFFFFF;
+    }
+
+    INLINE u32 hash32(const u8 *ptr) {
+        return ((read32(ptr) * 2654435761U) & 0xFFFFFFFF) >> (32 - COMPRESSION_HASH_BITS);
+    }
+
+    INLINE u8* writeLength(u8 *out, u32 length) {
+        for (; length >= 255; length -= 255) *out++ = 255;
+        *out++ = (u8)length;
+        return out;
+    }
+
+    INLINE u32 getFilteredElementSize(Filter filter, u32 element_size) {
+        return filter == Filter_QuantizedNormals ? (sizeof(i16) * 3) : element_size;
+    }
+
+    INLINE u32 getBlockSize(u32 element_size) {
+        return element_size ? ((COMPRESSION_BLOCK_SIZE / element_size) * element_size) : COMPRESSION_BLOCK_SIZE;
+    }
+
+    INLINE u64 getCompressBound(u64 size) {
+        return size + size / 255 + 16;
+    }
+
+    // LZ77 with LZ4-style sequences: [token][literal length extension][literals][u16 offset][match length extension]
+    // The token's high nibble is the literal count and its low nibble is the match length minus the minimum match.
+    // The last sequence of a block carries literals only. Returns 0 if the output would not fit in the given capacity.
+    u32 compressBlock(const u8 *in, u32 in_size, u8 *out, u32 out_capacity) {
+        u16 hash_table[1 << COMPRESSION_HASH_BITS];
+        for (u16 &entry : hash_table) entry = 0xFFFF;
+
+        const u8 *in_end = in + in_size;
+        const u8 *match_limit = in_size > COMPRESSION_MIN_MATCH ? in_end - COMPRESSION_MIN_MATCH : in;
+        const u8 *out_end = out + out_capacity;
+        const u8 *anchor = in;
+        const u8 *ip = in;
+        u8 *op = out;
+
+        while (ip < match_limit) {
+            u32 hash = hash32(ip);
+            u16 candidate_offset = hash_table[hash];
+            hash_table[hash] = (u16)(ip - in);
+
+            const u8 *candidate = in + candidate_offset;
+            if (candidate_offset == 0xFFFF || read32(candidate) != read32(ip)) {
+                ip++;
+                continue;
+            }
+
+            u32 match_length = COMPRESSION_MIN_MATCH;
+            while (ip + match_length < in_end && candidate[match_length] == ip[match_length]) match_length++;
+
+            u32 literal_count = (u32)(ip - anchor);
+            if (op + 1 + literal_count / 255 + 1 + literal_count + 2 + match_length / 255 + 1 > out_end) return 0;
+
+            u32 match_code = match_length - COMPRESSION_MIN_MATCH;
+            u8 *token = op++;
+            *token = (u8)(((literal_count < 15 ? literal_count : 15) << 4) | (match_code < 15 ? match_code : 15));
+            if (literal_count >= 15) op = writeLength(op, literal_count - 15);
+            for (u32 i = 0; i < literal_count; i++) *op++ = anchor[i];
+
+            u16 offset = (u16)(ip - candidate);
+            *op++ = (u8)(offset & 0xFF);
+            *op++ = (u8)(offset >> 8);
+            if (match_code >= 15) op = writeLength(op, match_code - 15);
+
+            ip += match_length;
+            anchor = ip;
+        }
+
+        u32 literal_count = (u32)(in_end - anchor);
+        if (op + 1 + literal_count / 255 + 1 + literal_count > out_end) return 0;
+
+        u8 *token = op++;
+        *token = (u8)((literal_count < 15 ? literal_count : 15) << 4);
+        if (literal_count >= 15) op = writeLength(op, literal_count - 15);
+        for (u32 i = 0; i < literal_count; i++) *op++ = anchor[i];
+
+        return (u32)(op - out);
+    }
+
+    bool decompressBlock(const u8 *in, u32 in_size, u8 *out, u32 out_size) {
+        const u8 *in_end = in + in_size;
+        u8 *out_end = out + out_size;
+        u8 *op = out;
+        const u8 *ip = in;
+
+        while (ip < in_end) {
+            u8 token = *ip++;
+
+            u32 literal_count = token >> 4;
+            if (literal_count == 15) {
+                u8 extra;
+                do {
+                    if (ip >= in_end) return false;
+                    extra = *ip++;
+                    literal_count += extra;
+                } while (extra == 255);
+            }
+            if (ip + literal_count > in_end || op + literal_count > out_end) return false;
+            memcpy(op, ip, literal_count);
+            op += literal_count;
+            ip += literal_count;
+
+            if (ip == in_end) break; // The last sequence has no match
+
+            if (ip + 2 > in_end) return false;
+            u32 offset = (u32)ip[0] | ((u32)ip[1] << 8);
+            ip += 2;
+
+            u32 match_length = token & 15;
+            if (match_length == 15) {
+                u8 extra;
+                do {
+                    if (ip >= in_end) return false;
+                    extra = *ip++;
+                    match_length += extra;
+                } while (extra == 255);
+            }
+            match_length += COMPRESSION_MIN_MATCH;
+
+            if (!offset || offset > (u32)(op - out) || op + match_length > out_end) return false;
+            const u8 *match = op - offset;
+            if (offset >= match_length)
+                memcpy(op, match, match_length);
+            else // Overlapping (repeating) match has to be copied forward byte by byte
+                for (u32 i = 0; i < match_length; i++) op[i] = op[i - offset];
+            op += match_length;
+        }
+
+        return op == out_end;
+    }
+
+    void encodeFilter(Filter filter, u32 element_size, const u8 *in, u8 *out, u32 size) {
+        if (filter == Filter_None || element_size < 2) {
+            for (u32 i = 0; i < size; i++) out[i] = in[i];
+            return;
+        }
+
+        u32 element_count = size / element_size;
+        u32 tail = element_count * element_size;
+        for (u32 b = 0; b < element_size; b++) {
+            u8 *plane = out + b * element_count;
+            const u8 *byte = in + b;
+            u8 previous = 0;
+            for (u32 i = 0; i < element_count; i++, byte += element_size) {
+                plane[i] = filter == Filter_Shuffle ? *byte : (u8)(*byte - previous);
+                previous = *byte;
+            }
+        }
+        for (u32 i = tail; i < size; i++) out[i] = in[i];
+    }
+
+    void decodeFilter(Filter filter, u32 element_size, const u8 *in, u8 *out, u32 size) {
+        if (filter == Filter_None || element_size < 2) {
+            for (u32 i = 0; i < size; i++) out[i] = in[i];
+            return;
+        }
+
+        u32 element_count = size / element_size;
+        u32 tail = element_count * element_size;
+        for (u32 b = 0; b < element_size; b++) {
+            const u8 *plane = in + b * element_count;
+            u8 *byte = out + b;
+            u8 previous = 0;
+            for (u32 i = 0; i < element_count; i++, byte += element_size) {
+                *byte = filter == Filter_Shuffle ? plane[i] : (u8)(plane[i] + previous);
+                previous = *byte;
+            }
+        }
+        for (u32 i = tail; i < size; i++) out[i] = in[i];
+    }
+
+    void quantizeNormals(const vec3 *normals, i16 *quantized, u32 count) {
+        for (u32 i = 0; i < count; i++, normals++, quantized += 3) {
+            quantized[0] = (i16)(clampedValue(normals->x, -1.0f, 1.0f) * 32767.0f + (normals->x < 0 ? -0.5f : 0.5f));
+            quantized[1] = (i16)(clampedValue(normals->y, -1.0f, 1.0f) * 32767.0f + (normals->y < 0 ? -0.5f : 0.5f));
+            quantized[2] = (i16)(clampedValue(normals->z, -1.0f, 1.0f) * 32767.0f + (normals->z < 0 ? -0.5f : 0.5f));
+        }
+    }
+
+    void dequantizeNormals(const i16 *quantized, vec3 *normals, u32 count) {
+        for (u32 i = 0; i < count; i++, normals++, quantized += 3)
+            *normals = vec3{
+                (f32)quantized[0] / 32767.0f,
+                (f32)quantized[1] / 32767.0f,
+                (f32)quantized[2] / 32767.0f
+            }.normalized();
+    }
+
+    struct Section {
+        u8 *compressed_data = nullptr;
+        u64 *block_offsets = nullptr;
+        u32 *block_sizes = nullptr;
+        u32 element_size = 0;
+        u32 filtered_size = 0;
+        u32 block_count = 0;
+        Filter filter = Filter_None;
+
+        INLINE u32 blockSize() const { return getBlockSize(getFilteredElementSize(filter, element_size)); }
+
+        // Decodes a range of blocks into 'out', which points at the start of the whole section's raw data.
+        // Blocks do not depend on each other, so disjoint ranges can be decoded concurrently.
+        bool decodeBlocks(u8 *out, u32 first_block, u32 count, u8 *scratch) const {
+            const u32 block_size = blockSize();
+            const u32 filtered_element_size = getFilteredElementSize(filter, element_size);
+            const Filter block_filter = filter == Filter_QuantizedNormals ? Filter_Delta : filter;
+
+            for (u32 b = first_block; b < first_block + count; b++) {
+                const u64 start = (u64)b * block_size;
+                const u32 size = (u32)Min((u64)block_size, filtered_size - start);
+                const u8 *block = compressed_data + block_offsets[b];
+                u8 *filtered = filter == Filter_QuantizedNormals ? scratch + block_size : out + start;
+
+                if (block_sizes[b] & COMPRESSION_BLOCK_IS_RAW) {
+                    // Stored blocks are as long as the data they hold (else the file is truncated or corrupt):
+                    if ((block_sizes[b] & ~COMPRESSION_BLOCK_IS_RAW) != size) return false;
+                    for (u32 i = 0; i < size; i++) scratch[i] = block[i];
+                } else if (!decompressBlock(block, block_sizes[b], scratch, size))
+                    return false;
+
+                decodeFilter(block_filter, filtered_element_size, scratch, filtered, size);
+
+                if (filter == Filter_QuantizedNormals)
+                    dequantizeNormals((i16*)filtered, (vec3*)(out + (start / filtered_element_size) * element_size), size / filtered_element_size);
+            }
+
+            return true;
+        }
+    };
+
+    // Scratch needed by Section::decodeBlocks (per concurrent caller, so per range of blocks when decoding in parallel)
+    INLINE u32 getDecodeScratchSize() { return COMPRESSION_BLOCK_SIZE * 2; }
+
+    bool writeSection(const void *data, u64 size, u32 element_size, Filter filter, void *file) {
+        const u32 filtered_element_size = getFilteredElementSize(filter, element_size);
+        const u32 element_count = element_size ? (u32)(size / element_size) : 0;
+        const u32 filtered_size = filter == Filter_QuantizedNormals ? element_count * filtered_element_size : (u32)size;
+        const u32 block_size = getBlockSize(filtered_element_size);
+        const u32 block_count = (filtered_size + block_size - 1) / block_size;
+        const u32 filter_id = (u32)filter;
+
+        os::writeToFile((void*)&element_size,  sizeof(u32), file);
+        os::writeToFile((void*)&filtered_size, sizeof(u32), file);
+        os::writeToFile((void*)&block_count,   sizeof(u32), file);
+        os::writeToFile((void*)&filter_id,     sizeof(u32), file);
+        if (!block_count) return true;
+
+        const u64 compress_bound = getCompressBound(block_size);
+        u64 scratch_size = block_size + sizeof(u32) * block_count + compress_bound * block_count;
+        if (filter == Filter_QuantizedNormals) scratch_size += filtered_size;
+        u8 *scratch = (u8*)os::getMemory(scratch_size);
+        if (!scratch) return false;
+
+        u8 *filtered = scratch;
+        u32 *block_sizes = (u32*)(filtered + block_size);
+        u8 *compressed = (u8*)(block_sizes + block_count);
+        const u8 *source = (const u8*)data;
+        Filter block_filter = filter;
+        if (filter == Filter_QuantizedNormals) {
+            i16 *quantized = (i16*)(compressed + compress_bound * block_count);
+            quantizeNormals((const vec3*)data, quantized, element_count);
+            source = (const u8*)quantized;
+            block_filter = Filter_Delta;
+        }
+
+        u8 *block = compressed;
+        for (u32 b = 0; b < block_count; b++) {
+            const u64 start = (u64)b * block_size;
+            const u32 size_of_block = (u32)Min((u64)block_size, filtered_size - start);
+            encodeFilter(block_filter, filtered_element_size, source + start, filtered, size_of_block);
+
+            u32 compressed_size = compressBlock(filtered, size_of_block, block, size_of_block);
+            if (compressed_size) {
+                block_sizes[b] = compressed_size;
+            } else {
+                for (u32 i = 0; i < size_of_block; i++) block[i] = filtered[i];
+                block_sizes[b] = size_of_block | COMPRESSION_BLOCK_IS_RAW;
+                compressed_size = size_of_block;
+            }
+            block += compressed_size;
+        }
+
+        for (u32 b = 0; b < block_count; b++) os::writeToFile(block_sizes + b, sizeof(u32), file);
+        os::writeToFile(compressed, (unsigned long)(block - compressed), file);
+        os::freeMemory(scratch);
+
+        return true;
+    }
+
+    bool readSection(void *data, u64 size, void *file) {
+        Section section;
+        u32 filter_id;
+        os::readFromFile(&section.element_size,  sizeof(u32), file);
+        os::readFromFile(&section.filtered_size, sizeof(u32), file);
+        os::readFromFile(&section.block_count,   sizeof(u32), file);
+        os::readFromFile(&filter_id,             sizeof(u32), file);
+        section.filter = (Filter)filter_id;
+
+        u64 raw_size = section.filtered_size;
+        if (section.filter == Filter_QuantizedNormals)
+            raw_size = (raw_size / getFilteredElementSize(section.filter, section.element_size)) * section.element_size;
+        if (raw_size != size) return false;
+        if (!section.block_count) return !section.filtered_size;
+
+        // Blocks all decode to full blocks except for the last one, so there must be as many as that takes:
+        const u32 block_size = section.blockSize();
+        if (!block_size || section.block_count != (section.filtered_size + block_size - 1) / block_size) return false;
+
+        // Blocks get split into a range per thread, each decoding into a scratch of its own (picked by the range, as
+        // worker indices are only unique within the pool, and ranges may run on whichever thread is waiting):
+        const u32 thread_count = Min(jobs::getThreadCount(), section.block_count);
+        const u32 range_size = (section.block_count + thread_count - 1) / thread_count;
+        const u32 range_count = (section.block_count + range_size - 1) / range_size;
+        u64 header_size = (sizeof(u32) + sizeof(u64)) * section.block_count;
+        u8 *header = (u8*)os::getMemory(header_size + (u64)getDecodeScratchSize() * range_count);
+        if (!header) return false;
+
+        section.block_offsets = (u64*)header;
+        section.block_sizes = (u32*)(section.block_offsets + section.block_count);
+        u8 *scratch = (u8*)(section.block_sizes + section.block_count);
+
+        u64 compressed_size = 0;
+        for (u32 b = 0; b < section.block_count; b++) {
+            os::readFromFile(section.block_sizes + b, sizeof(u32), file);
+            section.block_offsets[b] = compressed_size;
+            compressed_size += section.block_sizes[b] & ~COMPRESSION_BLOCK_IS_RAW;
+        }
+
+        section.compressed_data = (u8*)os::getMemory(compressed_size);
+        bool decoded = section.compressed_data &&
+                       os::readFromFile(section.compressed_data, (unsigned long)compressed_size, file);
+        if (decoded) {
+            // Blocks are independent, so the ranges can be decoded by whichever threads are free:
+            std::atomic<bool> failed{false};
+            parallelFor(section.block_count, thread_count, [&](u32 first, u32 end) {
+                u8 *range_scratch = scratch + (u64)getDecodeScratchSize() * (first / range_size);
+                if (!section.decodeBlocks((u8*)data, first, end - first, range_scratch))
+                    failed.store(true, std::memory_order_relaxed);
+            }, range_size);
+            decoded = !failed.load(std::memory_order_relaxed);
+        }
+
+        if (section.compressed_data) os::freeMemory(section.compressed_data);
+        os::freeMemory(header);
+
+        return decoded;
+    }
+}
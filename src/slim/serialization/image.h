@@ -47,7 +47,7 @@ struct ImagePack {
             loadHeader(*image, string.char_ptr);
             memory_size += getSizeInBytes(*image);
         }
-        memory::MonotonicAllocator memory_allocator{memory_size, memory_base};
+        memory::MonotonicAllocator memory_allocator{"Images", memory_size, memory_base};
 
         image = images;
         for (u32 i = 0; i < count; i++, image++) {
@@ -3,6 +3,16 @@
 #include "../core/string.h"
 #include "../scene/mesh.h"
 #include "./bvh.h"
+#include "./compression.h"
+
+// Files of meshes with welded vertices, clusters or LODs start with a magic number (where older files start with the
+// vertex count, which never gets anywhere near it) followed by a version, the welded vertex count, (as of version 2)
+// the cluster count and (as of version 3) the LOD count. The headers of the LODs follow the one of the BVH.
+// As of version 4, meshes with welded vertices store those instead of the position, normal, uv and tangent streams,
+// which get derived from them on load (see Mesh::deriveVertexStreams()). Their counts are then of the welded vertices,
+// and their edges index the welded vertices:
+#define MESH_FILE_MAGIC 0x48534D53
+#define MESH_FILE_VERSION 4
 
 
 u32 getSizeInBytes(const Mesh &mesh, u32 *bvh_nodes_size = nullptr) {
@@ -12,22 +22,37 @@ u32 getSizeInBytes(const Mesh &mesh, u32 *bvh_nodes_size = nullptr) {
         memory_size = 0;
     }
 
-    memory_size += sizeof(Triangle) * mesh.triangle_count;
-    memory_size += sizeof(vec3) * mesh.vertex_count;
-    memory_size += sizeof(TriangleVertexIndices) * mesh.triangle_count;
-    memory_size += sizeof(EdgeVertexIndices) * mesh.edge_count;
+    memory_size += (u32)memory::getAlignedSize(sizeof(Triangle) * mesh.triangle_count);
+    memory_size += (u32)memory::getAlignedSize(sizeof(vec3) * mesh.vertex_count);
+    memory_size += (u32)memory::getAlignedSize(sizeof(TriangleVertexIndices) * mesh.triangle_count);
+    memory_size += (u32)memory::getAlignedSize(sizeof(EdgeVertexIndices) * mesh.edge_count);
 
     if (mesh.uvs_count) {
-        memory_size += sizeof(vec2) * mesh.uvs_count;
-        memory_size += sizeof(TriangleVertexIndices) * mesh.triangle_count;
+        memory_size += (u32)memory::getAlignedSize(sizeof(vec2) * mesh.uvs_count);
+        memory_size += (u32)memory::getAlignedSize(sizeof(TriangleVertexIndices) * mesh.triangle_count);
     }
     if (mesh.normals_count) {
-        memory_size += sizeof(vec3) * mesh.normals_count;
-        memory_size += sizeof(TriangleVertexIndices) * mesh.triangle_count;
+        memory_size += (u32)memory::getAlignedSize(sizeof(vec3) * mesh.normals_count);
+        memory_size += (u32)memory::getAlignedSize(sizeof(TriangleVertexIndices) * mesh.triangle_count);
     }
     if (mesh.tangents_count) {
-        memory_size += sizeof(vec3) * mesh.tangents_count;
-        memory_size += sizeof(TriangleVertexIndices) * mesh.triangle_count;
+        memory_size += (u32)memory::getAlignedSize(sizeof(vec3) * mesh.tangents_count);
+        memory_size += (u32)memory::getAlignedSize(sizeof(TriangleVertexIndices) * mesh.triangle_count);
+    }
+    if (mesh.welded_vertex_count) {
+        memory_size += (u32)memory::getAlignedSize(sizeof(MeshVertex) * mesh.welded_vertex_count);
+        memory_size += (u32)memory::getAlignedSize(sizeof(TriangleVertexIndices) * mesh.triangle_count);
+    }
+    if (mesh.cluster_count)
+        memory_size += (u32)memory::getAlignedSize(sizeof(MeshCluster) * mesh.cluster_count);
+    for (u32 l = 0; l < mesh.lod_count; l++) {
+        const MeshLOD &lod = mesh.lods[l];
+        memory_size += (u32)memory::getAlignedSize(sizeof(Triangle)              * lod.triangle_count);
+        memory_size += (u32)memory::getAlignedSize(sizeof(TriangleVertexIndices) * lod.triangle_count);
+        if (bvh_nodes_size)
+            *bvh_nodes_size += getSizeInBytes(lod.bvh);
+        else
+            memory_size += getSizeInBytes(lod.bvh);
     }
     return memory_size;
 }
@@ -41,42 +66,107 @@ bool allocateMemory(Mesh &mesh, memory::MonotonicAllocator *memory_allocator, me
         if (getSizeInBytes(mesh) > (memory_allocator->capacity - memory_allocator->occupied)) return false;
         allocateMemory(mesh.bvh, memory_allocator);
     }
-    mesh.triangles               = (Triangle*             )memory_allocator->allocate(sizeof(Triangle)              * mesh.triangle_count);
-    mesh.vertex_positions        = (vec3*                 )memory_allocator->allocate(sizeof(vec3)                  * mesh.vertex_count);
-    mesh.vertex_position_indices = (TriangleVertexIndices*)memory_allocator->allocate(sizeof(TriangleVertexIndices) * mesh.triangle_count);
-    mesh.edge_vertex_indices     = (EdgeVertexIndices*    )memory_allocator->allocate(sizeof(EdgeVertexIndices)     * mesh.edge_count);
+    mesh.triangles               = (Triangle*             )memory_allocator->allocateAligned(sizeof(Triangle)              * mesh.triangle_count);
+    mesh.vertex_positions        = (vec3*                 )memory_allocator->allocateAligned(sizeof(vec3)                  * mesh.vertex_count);
+    mesh.vertex_position_indices = (TriangleVertexIndices*)memory_allocator->allocateAligned(sizeof(TriangleVertexIndices) * mesh.triangle_count);
+    mesh.edge_vertex_indices     = (EdgeVertexIndices*    )memory_allocator->allocateAligned(sizeof(EdgeVertexIndices)     * mesh.edge_count);
     if (mesh.uvs_count) {
-        mesh.vertex_uvs         = (vec2*                 )memory_allocator->allocate(sizeof(vec2)                  * mesh.uvs_count);
-        mesh.vertex_uvs_indices = (TriangleVertexIndices*)memory_allocator->allocate(sizeof(TriangleVertexIndices) * mesh.triangle_count);
+        mesh.vertex_uvs         = (vec2*                 )memory_allocator->allocateAligned(sizeof(vec2)                  * mesh.uvs_count);
+        mesh.vertex_uvs_indices = (TriangleVertexIndices*)memory_allocator->allocateAligned(sizeof(TriangleVertexIndices) * mesh.triangle_count);
     }
     if (mesh.normals_count) {
-        mesh.vertex_normals          = (vec3*                 )memory_allocator->allocate(sizeof(vec3)                  * mesh.normals_count);
-        mesh.vertex_normal_indices   = (TriangleVertexIndices*)memory_allocator->allocate(sizeof(TriangleVertexIndices) * mesh.triangle_count);
+        mesh.vertex_normals          = (vec3*                 )memory_allocator->allocateAligned(sizeof(vec3)                  * mesh.normals_count);
+        mesh.vertex_normal_indices   = (TriangleVertexIndices*)memory_allocator->allocateAligned(sizeof(TriangleVertexIndices) * mesh.triangle_count);
     }
     if (mesh.tangents_count) {
-        mesh.vertex_tangents          = (vec3*                 )memory_allocator->allocate(sizeof(vec3)                  * mesh.tangents_count);
-        mesh.vertex_tangent_indices   = (TriangleVertexIndices*)memory_allocator->allocate(sizeof(TriangleVertexIndices) * mesh.triangle_count);
+        mesh.vertex_tangents          = (vec3*                 )memory_allocator->allocateAligned(sizeof(vec3)                  * mesh.tangents_count);
+        mesh.vertex_tangent_indices   = (TriangleVertexIndices*)memory_allocator->allocateAligned(sizeof(TriangleVertexIndices) * mesh.triangle_count);
+    }
+    if (mesh.welded_vertex_count) {
+        mesh.vertices       = (MeshVertex*           )memory_allocator->allocateAligned(sizeof(MeshVertex)            * mesh.welded_vertex_count);
+        mesh.vertex_indices = (TriangleVertexIndices*)memory_allocator->allocateAligned(sizeof(TriangleVertexIndices) * mesh.triangle_count);
+    }
+    if (mesh.cluster_count)
+        mesh.clusters = (MeshCluster*)memory_allocator->allocateAligned(sizeof(MeshCluster) * mesh.cluster_count);
+    for (u32 l = 0; l < mesh.lod_count; l++) {
+        MeshLOD &lod = mesh.lods[l];
+        lod.triangles      = (Triangle*             )memory_allocator->allocateAligned(sizeof(Triangle)              * lod.triangle_count);
+        lod.vertex_indices = (TriangleVertexIndices*)memory_allocator->allocateAligned(sizeof(TriangleVertexIndices) * lod.triangle_count);
+        allocateMemory(lod.bvh, memory_allocator_for_bvh_nodes ? memory_allocator_for_bvh_nodes : memory_allocator);
     }
     return true;
 }
 
 void writeHeader(const Mesh &mesh, void *file) {
-    os::writeToFile((void*)&mesh.vertex_count,   sizeof(u32),  file);
+    u32 vertex_count   = mesh.vertex_count;
+    u32 uvs_count      = mesh.uvs_count;
+    u32 normals_count  = mesh.normals_count;
+    u32 tangents_count = mesh.tangents_count;
+    if (mesh.welded_vertex_count) {
+        vertex_count = mesh.welded_vertex_count;
+        if (uvs_count)      uvs_count      = mesh.welded_vertex_count;
+        if (normals_count)  normals_count  = mesh.welded_vertex_count;
+        if (tangents_count) tangents_count = mesh.welded_vertex_count;
+    }
+    if (mesh.welded_vertex_count || mesh.cluster_count || mesh.lod_count) {
+        u32 magic = MESH_FILE_MAGIC;
+        u32 version = MESH_FILE_VERSION;
+        os::writeToFile(&magic,                           sizeof(u32),  file);
+        os::writeToFile(&version,                         sizeof(u32),  file);
+        os::writeToFile((void*)&mesh.welded_vertex_count, sizeof(u32),  file);
+        os::writeToFile((void*)&mesh.cluster_count,       sizeof(u32),  file);
+        os::writeToFile((void*)&mesh.lod_count,           sizeof(u32),  file);
+    }
+    os::writeToFile(&vertex_count,                   sizeof(u32),  file);
     os::writeToFile((void*)&mesh.triangle_count, sizeof(u32),  file);
     os::writeToFile((void*)&mesh.edge_count,     sizeof(u32),  file);
-    os::writeToFile((void*)&mesh.uvs_count,      sizeof(u32),  file);
-    os::writeToFile((void*)&mesh.normals_count,  sizeof(u32),  file);
-    os::writeToFile((void*)&mesh.tangents_count, sizeof(u32),  file);
+    os::writeToFile(&uvs_count,                      sizeof(u32),  file);
+    os::writeToFile(&normals_count,                  sizeof(u32),  file);
+    os::writeToFile(&tangents_count,                 sizeof(u32),  file);
     writeHeader(mesh.bvh, file);
+    for (u32 l = 0; l < mesh.lod_count; l++) {
+        const MeshLOD &lod = mesh.lods[l];
+        os::writeToFile((void*)&lod.triangle_count, sizeof(u32), file);
+        os::writeToFile((void*)&lod.error,          sizeof(f32), file);
+        writeHeader(lod.bvh, file);
+    }
 }
-void readHeader(Mesh &mesh, void *file) {
+// Rejects files of a newer version, or with more LODs than a mesh can hold (leaving the mesh empty):
+bool readHeader(Mesh &mesh, void *file) {
+    mesh.welded_vertex_count = 0;
+    mesh.derived_vertex_streams = false;
+    mesh.cluster_count = 0;
+    mesh.lod_count = 0;
     os::readFromFile(&mesh.vertex_count,   sizeof(u32),  file);
+    if (mesh.vertex_count == MESH_FILE_MAGIC) {
+        u32 version;
+        os::readFromFile(&version,                  sizeof(u32),  file);
+        os::readFromFile(&mesh.welded_vertex_count, sizeof(u32),  file);
+        if (version >= 2)
+            os::readFromFile(&mesh.cluster_count,   sizeof(u32),  file);
+        if (version >= 3)
+            os::readFromFile(&mesh.lod_count,       sizeof(u32),  file);
+        if (version > MESH_FILE_VERSION || mesh.lod_count > MESH_MAX_LOD_COUNT) {
+            mesh.vertex_count = mesh.welded_vertex_count = mesh.cluster_count = mesh.lod_count = 0;
+            mesh.triangle_count = mesh.edge_count = mesh.uvs_count = mesh.normals_count = mesh.tangents_count = 0;
+            return false;
+        }
+        os::readFromFile(&mesh.vertex_count,        sizeof(u32),  file);
+        mesh.derived_vertex_streams = version >= 4 && mesh.welded_vertex_count;
+    }
     os::readFromFile(&mesh.triangle_count, sizeof(u32),  file);
     os::readFromFile(&mesh.edge_count,     sizeof(u32),  file);
     os::readFromFile(&mesh.uvs_count,      sizeof(u32),  file);
     os::readFromFile(&mesh.normals_count,  sizeof(u32),  file);
     os::readFromFile(&mesh.tangents_count, sizeof(u32),  file);
     readHeader(mesh.bvh, file);
+    for (u32 l = 0; l < mesh.lod_count; l++) {
+        MeshLOD &lod = mesh.lods[l];
+        os::readFromFile(&lod.triangle_count, sizeof(u32), file);
+        os::readFromFile(&lod.error,          sizeof(f32), file);
+        readHeader(lod.bvh, file);
+    }
+    return true;
 }
 
 bool saveHeader(const Mesh &mesh, char *file_path) {
@@ -90,60 +180,213 @@ bool saveHeader(const Mesh &mesh, char *file_path) {
 bool loadHeader(Mesh &mesh, char *file_path) {
     void *file = os::openFileForReading(file_path);
     if (!file) return false;
-    readHeader(mesh, file);
+    bool read = readHeader(mesh, file);
     os::closeFile(file);
+    return read;
+}
+
+// The edges to store for a mesh, which index its welded vertices when it has any (any of the ones at their positions).
+// When the edges index positions, the remapped ones go to the scratch memory given. Returns null if it has no room:
+const EdgeVertexIndices* getEdgesToWrite(const Mesh &mesh, memory::MonotonicAllocator &scratch) {
+    if (!mesh.welded_vertex_count || mesh.derived_vertex_streams) return mesh.edge_vertex_indices;
+
+    u32 *welded_vertex_ids = (u32*)scratch.allocateAligned(sizeof(u32) * mesh.vertex_count);
+    EdgeVertexIndices *edges = (EdgeVertexIndices*)scratch.allocateAligned(sizeof(EdgeVertexIndices) * mesh.edge_count);
+    if (!welded_vertex_ids || !edges) return nullptr;
+
+    for (u32 t = 0; t < mesh.triangle_count; t++)
+        for (u32 i = 0; i < 3; i++)
+            welded_vertex_ids[mesh.vertex_position_indices[t].ids[i]] = mesh.vertex_indices[t].ids[i];
+    for (u32 e = 0; e < mesh.edge_count; e++) {
+        edges[e].from = welded_vertex_ids[mesh.edge_vertex_indices[e].from];
+        edges[e].to   = welded_vertex_ids[mesh.edge_vertex_indices[e].to];
+    }
+    return edges;
+}
+
+INLINE u64 getEdgesToWriteScratchSize(const Mesh &mesh) {
+    return memory::getAlignedSize(sizeof(u32) * mesh.vertex_count) +
+           memory::getAlignedSize(sizeof(EdgeVertexIndices) * mesh.edge_count);
+}
+
+void readCompressedContent(Mesh &mesh, void *file) {
+    using namespace compression;
+    os::readFromFile(&mesh.aabb.min,       sizeof(vec3), file);
+    os::readFromFile(&mesh.aabb.max,       sizeof(vec3), file);
+    bool streams = !mesh.derived_vertex_streams;
+    readSection(mesh.triangles,               sizeof(Triangle)              * mesh.triangle_count, file);
+    if (streams) {
+        readSection(mesh.vertex_positions,        sizeof(vec3)                  * mesh.vertex_count,   file);
+        readSection(mesh.vertex_position_indices, sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
+    }
+    readSection(mesh.edge_vertex_indices,     sizeof(EdgeVertexIndices)     * mesh.edge_count,     file);
+    if (streams && mesh.uvs_count) {
+        readSection(mesh.vertex_uvs,          sizeof(vec2)                  * mesh.uvs_count,      file);
+        readSection(mesh.vertex_uvs_indices,  sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
+    }
+    if (streams && mesh.normals_count) {
+        readSection(mesh.vertex_normals,        sizeof(vec3)                  * mesh.normals_count,  file);
+        readSection(mesh.vertex_normal_indices, sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
+    }
+    if (streams && mesh.tangents_count) {
+        readSection(mesh.vertex_tangents,        sizeof(vec3)                  * mesh.tangents_count, file);
+        readSection(mesh.vertex_tangent_indices, sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
+    }
+    if (mesh.welded_vertex_count) {
+        readSection(mesh.vertices,       sizeof(MeshVertex)            * mesh.welded_vertex_count, file);
+        readSection(mesh.vertex_indices, sizeof(TriangleVertexIndices) * mesh.triangle_count,      file);
+        if (!streams) mesh.deriveVertexStreams();
+    }
+    if (mesh.cluster_count) readSection(mesh.clusters, sizeof(MeshCluster) * mesh.cluster_count, file);
+    for (u32 l = 0; l < mesh.lod_count; l++) {
+        MeshLOD &lod = mesh.lods[l];
+        readSection(lod.vertex_indices, sizeof(TriangleVertexIndices) * lod.triangle_count,   file);
+        readSection(lod.triangles,      sizeof(Triangle)              * lod.triangle_count,   file);
+        readSection(lod.bvh.nodes,      sizeof(BVHNode)               * lod.bvh.node_count,   file);
+    }
+    readSection(mesh.bvh.nodes, sizeof(BVHNode) * mesh.bvh.node_count, file);
+}
+
+bool writeCompressedContent(const Mesh &mesh, void *file, bool quantize_normals = false) {
+    using namespace compression;
+    memory::MonotonicAllocator &scratch = memory::getScratchArena(getEdgesToWriteScratchSize(mesh));
+    memory::ScratchScope scratch_scope{scratch};
+    const EdgeVertexIndices *edges = getEdgesToWrite(mesh, scratch);
+    if (!edges && mesh.edge_count) return false;
+
+    // Meshes with welded vertices only store those (see MESH_FILE_VERSION):
+    bool streams = !mesh.welded_vertex_count;
+    unsigned int magic = COMPRESSED_CONTENT_MAGIC; // Same size as the f32 it stands in for
+    os::writeToFile(&magic, sizeof(magic), file);
+    os::writeToFile((void*)&mesh.aabb.min, sizeof(vec3), file);
+    os::writeToFile((void*)&mesh.aabb.max, sizeof(vec3), file);
+    writeSection(mesh.triangles,               sizeof(Triangle)              * mesh.triangle_count, sizeof(f32),                   Filter_Shuffle, file);
+    if (streams) {
+        writeSection(mesh.vertex_positions,        sizeof(vec3)                  * mesh.vertex_count,   sizeof(vec3),                  Filter_Delta,   file);
+        writeSection(mesh.vertex_position_indices, sizeof(TriangleVertexIndices) * mesh.triangle_count, sizeof(TriangleVertexIndices), Filter_Delta,   file);
+    }
+    writeSection(edges,                        sizeof(EdgeVertexIndices)     * mesh.edge_count,     sizeof(EdgeVertexIndices),     Filter_Delta,   file);
+    if (streams && mesh.uvs_count) {
+        writeSection(mesh.vertex_uvs,          sizeof(vec2)                  * mesh.uvs_count,      sizeof(vec2),                  Filter_Delta,   file);
+        writeSection(mesh.vertex_uvs_indices,  sizeof(TriangleVertexIndices) * mesh.triangle_count, sizeof(TriangleVertexIndices), Filter_Delta,   file);
+    }
+    if (streams && mesh.normals_count) {
+        writeSection(mesh.vertex_normals,        sizeof(vec3)                  * mesh.normals_count,  sizeof(vec3),                  quantize_normals ? Filter_QuantizedNormals : Filter_Delta, file);
+        writeSection(mesh.vertex_normal_indices, sizeof(TriangleVertexIndices) * mesh.triangle_count, sizeof(TriangleVertexIndices), Filter_Delta, file);
+    }
+    if (streams && mesh.tangents_count) {
+        writeSection(mesh.vertex_tangents,        sizeof(vec3)                  * mesh.tangents_count, sizeof(vec3),                  Filter_Delta, file);
+        writeSection(mesh.vertex_tangent_indices, sizeof(TriangleVertexIndices) * mesh.triangle_count, sizeof(TriangleVertexIndices), Filter_Delta, file);
+    }
+    if (mesh.welded_vertex_count) {
+        writeSection(mesh.vertices,       sizeof(MeshVertex)            * mesh.welded_vertex_count, sizeof(f32),                   Filter_Shuffle, file);
+        writeSection(mesh.vertex_indices, sizeof(TriangleVertexIndices) * mesh.triangle_count,      sizeof(TriangleVertexIndices), Filter_Delta,   file);
+    }
+    if (mesh.cluster_count)
+        writeSection(mesh.clusters, sizeof(MeshCluster) * mesh.cluster_count, sizeof(f32), Filter_Shuffle, file);
+    for (u32 l = 0; l < mesh.lod_count; l++) {
+        const MeshLOD &lod = mesh.lods[l];
+        writeSection(lod.vertex_indices, sizeof(TriangleVertexIndices) * lod.triangle_count, sizeof(TriangleVertexIndices), Filter_Delta,   file);
+        writeSection(lod.triangles,      sizeof(Triangle)              * lod.triangle_count, sizeof(f32),                   Filter_Shuffle, file);
+        writeSection(lod.bvh.nodes,      sizeof(BVHNode)               * lod.bvh.node_count, sizeof(BVHNode),               Filter_Delta,   file);
+    }
+    writeSection(mesh.bvh.nodes, sizeof(BVHNode) * mesh.bvh.node_count, sizeof(BVHNode), Filter_Delta, file);
     return true;
 }
 
 void readContent(Mesh &mesh, void *file) {
-    os::readFromFile(&mesh.aabb.min,       sizeof(vec3), file);
+    // Compressed content starts with a magic number, raw content starts straight away with the AABB:
+    os::readFromFile(&mesh.aabb.min.x,     sizeof(f32), file);
+    if (*((unsigned int*)&mesh.aabb.min.x) == COMPRESSED_CONTENT_MAGIC) {
+        readCompressedContent(mesh, file);
+        return;
+    }
+    os::readFromFile(&mesh.aabb.min.y,     sizeof(f32) * 2, file);
     os::readFromFile(&mesh.aabb.max,       sizeof(vec3), file);
+    bool streams = !mesh.derived_vertex_streams;
     os::readFromFile(mesh.triangles,       sizeof(Triangle) * mesh.triangle_count, file);
-    os::readFromFile(mesh.vertex_positions,             sizeof(vec3)                  * mesh.vertex_count,   file);
-    os::readFromFile(mesh.vertex_position_indices,      sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
+    if (streams) {
+        os::readFromFile(mesh.vertex_positions,         sizeof(vec3)                  * mesh.vertex_count,   file);
+        os::readFromFile(mesh.vertex_position_indices,  sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
+    }
     os::readFromFile(mesh.edge_vertex_indices,          sizeof(EdgeVertexIndices)     * mesh.edge_count,     file);
-    if (mesh.uvs_count) {
+    if (streams && mesh.uvs_count) {
         os::readFromFile(mesh.vertex_uvs,               sizeof(vec2)                  * mesh.uvs_count,      file);
         os::readFromFile(mesh.vertex_uvs_indices,       sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
     }
-    if (mesh.normals_count) {
+    if (streams && mesh.normals_count) {
         os::readFromFile(mesh.vertex_normals,                sizeof(vec3)                  * mesh.normals_count,  file);
         os::readFromFile(mesh.vertex_normal_indices,         sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
     }
-    if (mesh.tangents_count) {
+    if (streams && mesh.tangents_count) {
         os::readFromFile(mesh.vertex_tangents,                sizeof(vec3)                  * mesh.tangents_count, file);
         os::readFromFile(mesh.vertex_tangent_indices,         sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
     }
+    if (mesh.welded_vertex_count) {
+        os::readFromFile(mesh.vertices,                       sizeof(MeshVertex)            * mesh.welded_vertex_count, file);
+        os::readFromFile(mesh.vertex_indices,                 sizeof(TriangleVertexIndices) * mesh.triangle_count,      file);
+        if (!streams) mesh.deriveVertexStreams();
+    }
+    if (mesh.cluster_count)
+        os::readFromFile(mesh.clusters,                       sizeof(MeshCluster)           * mesh.cluster_count,       file);
+    for (u32 l = 0; l < mesh.lod_count; l++) {
+        MeshLOD &lod = mesh.lods[l];
+        os::readFromFile(lod.vertex_indices,                  sizeof(TriangleVertexIndices) * lod.triangle_count,       file);
+        os::readFromFile(lod.triangles,                       sizeof(Triangle)              * lod.triangle_count,       file);
+        readContent(lod.bvh, file);
+    }
     readContent(mesh.bvh, file);
 }
-void writeContent(const Mesh &mesh, void *file) {
+bool writeContent(const Mesh &mesh, void *file) {
+    memory::MonotonicAllocator &scratch = memory::getScratchArena(getEdgesToWriteScratchSize(mesh));
+    memory::ScratchScope scratch_scope{scratch};
+    const EdgeVertexIndices *edges = getEdgesToWrite(mesh, scratch);
+    if (!edges && mesh.edge_count) return false;
+
+    // Meshes with welded vertices only store those (see MESH_FILE_VERSION):
+    bool streams = !mesh.welded_vertex_count;
     os::writeToFile((void*)&mesh.aabb.min,       sizeof(vec3), file);
     os::writeToFile((void*)&mesh.aabb.max,       sizeof(vec3), file);
     os::writeToFile((void*)mesh.triangles,               sizeof(Triangle)              * mesh.triangle_count, file);
-    os::writeToFile((void*)mesh.vertex_positions,        sizeof(vec3)                  * mesh.vertex_count,   file);
-    os::writeToFile((void*)mesh.vertex_position_indices, sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
-    os::writeToFile((void*)mesh.edge_vertex_indices,     sizeof(EdgeVertexIndices)     * mesh.edge_count,     file);
-    if (mesh.uvs_count) {
+    if (streams) {
+        os::writeToFile((void*)mesh.vertex_positions,        sizeof(vec3)                  * mesh.vertex_count,   file);
+        os::writeToFile((void*)mesh.vertex_position_indices, sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
+    }
+    os::writeToFile((void*)edges,                        sizeof(EdgeVertexIndices)     * mesh.edge_count,     file);
+    if (streams && mesh.uvs_count) {
         os::writeToFile(mesh.vertex_uvs,          sizeof(vec2)                  * mesh.uvs_count,      file);
         os::writeToFile(mesh.vertex_uvs_indices,  sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
     }
-    if (mesh.normals_count) {
+    if (streams && mesh.normals_count) {
         os::writeToFile(mesh.vertex_normals,        sizeof(vec3)                  * mesh.normals_count,  file);
         os::writeToFile(mesh.vertex_normal_indices, sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
     }
-    if (mesh.tangents_count) {
+    if (streams && mesh.tangents_count) {
         os::writeToFile(mesh.vertex_tangents,        sizeof(vec3)                  * mesh.tangents_count,  file);
         os::writeToFile(mesh.vertex_tangent_indices, sizeof(TriangleVertexIndices) * mesh.triangle_count, file);
     }
+    if (mesh.welded_vertex_count) {
+        os::writeToFile(mesh.vertices,       sizeof(MeshVertex)            * mesh.welded_vertex_count, file);
+        os::writeToFile(mesh.vertex_indices, sizeof(TriangleVertexIndices) * mesh.triangle_count,      file);
+    }
+    if (mesh.cluster_count)
+        os::writeToFile(mesh.clusters,       sizeof(MeshCluster)           * mesh.cluster_count,       file);
+    for (u32 l = 0; l < mesh.lod_count; l++) {
+        const MeshLOD &lod = mesh.lods[l];
+        os::writeToFile(lod.vertex_indices, sizeof(TriangleVertexIndices) * lod.triangle_count, file);
+        os::writeToFile(lod.triangles,      sizeof(Triangle)              * lod.triangle_count, file);
+        writeContent(lod.bvh, file);
+    }
     writeContent(mesh.bvh, file);
+    return true;
 }
 
 bool saveContent(const Mesh &mesh, char *file_path) {
     void *file = os::openFileForWriting(file_path);
     if (!file) return false;
-    writeContent(mesh, file);
+    bool written = writeContent(mesh, file);
     os::closeFile(file);
-    return true;
+    return written;
 }
 
 bool loadContent(Mesh &mesh, char *file_path) {
@@ -158,9 +401,18 @@ bool save(const Mesh &mesh, char* file_path) {
     void *file = os::openFileForWriting(file_path);
     if (!file) return false;
     writeHeader(mesh, file);
-    writeContent(mesh, file);
+    bool written = writeContent(mesh, file);
     os::closeFile(file);
-    return true;
+    return written;
+}
+
+bool saveCompressed(const Mesh &mesh, char* file_path, bool quantize_normals = false) {
+    void *file = os::openFileForWriting(file_path);
+    if (!file) return false;
+    writeHeader(mesh, file);
+    bool written = writeCompressedContent(mesh, file, quantize_normals);
+    os::closeFile(file);
+    return written;
 }
 
 bool load(Mesh &mesh, char *file_path,
@@ -171,9 +423,14 @@ bool load(Mesh &mesh, char *file_path,
 
     if (memory_allocator) {
         mesh = Mesh{};
-        readHeader(mesh, file);
-        if (!allocateMemory(mesh, memory_allocator, memory_allocator_for_bvh_nodes)) return false;
-    } else if (!mesh.vertex_positions) return false;
+        if (!readHeader(mesh, file) || !allocateMemory(mesh, memory_allocator, memory_allocator_for_bvh_nodes)) {
+            os::closeFile(file);
+            return false;
+        }
+    } else if (!mesh.vertex_positions) {
+        os::closeFile(file);
+        return false;
+    }
     readContent(mesh, file);
     os::closeFile(file);
     return true;
@@ -2,19 +2,13 @@
 
 #include "../scene/scene.h"
 
-void load(Scene &scene, SceneIO &scene_io) {
-    void *file_handle = os::openFileForReading(scene_io.file_path.char_ptr);
-
-    os::readFromFile(&scene.counts, sizeof(SceneCounts), file_handle);
-
-    if (scene.counts.meshes)
-        for (u32 i = 0; i < scene.counts.meshes; i++)
-            readHeader(scene.meshes[i], file_handle);
-
-    if (scene.counts.textures)
-        for (u32 i = 0; i < scene.counts.textures; i++)
-            readHeader(scene.textures[i], file_handle);
+// Chunked scene files start with a magic number and a version, followed by everything that is small and always
+// needed (counts, mesh/texture headers, mesh AABBs, cameras and geometry), then a table of contents holding the
+// file offset of every mesh and texture payload, and then the payloads themselves (raw or block-compressed).
+#define SCENE_CHUNKED_MAGIC 0x43534C53
+#define SCENE_CHUNKED_VERSION 1
 
+void readSceneObjects(Scene &scene, void *file_handle) {
     if (scene.counts.cameras) {
         Camera *camera = scene.cameras;
         for (u32 i = 0; i < scene.counts.cameras; i++, camera++) {
@@ -29,8 +23,10 @@ void load(Scene &scene, SceneIO &scene_io) {
     }
 
     if (scene.counts.geometries)
-        for (u32 i = 0; i < scene.counts.geometries; i++)
+        for (u32 i = 0; i < scene.counts.geometries; i++) {
             os::readFromFile(scene.geometries + i, sizeof(Geometry), file_handle);
+            scene.geometries[i].lod = 0; // Selected at runtime (and padding in older files)
+        }
 
     if (scene.counts.grids)
         for (u32 i = 0; i < scene.counts.grids; i++)
@@ -43,31 +39,9 @@ void load(Scene &scene, SceneIO &scene_io) {
     if (scene.counts.curves)
         for (u32 i = 0; i < scene.counts.curves; i++)
             os::readFromFile(scene.curves + i, sizeof(Curve), file_handle);
-
-    if (scene.counts.meshes)
-        for (u32 i = 0; i < scene.counts.meshes; i++)
-            readContent(scene.meshes[i], file_handle);
-
-    if (scene.counts.textures)
-        for (u32 i = 0; i < scene.counts.textures; i++)
-            readContent(scene.textures[i], file_handle);
-
-    os::closeFile(file_handle);
 }
 
-void save(Scene &scene, SceneIO &scene_io) {
-    void *file_handle = os::openFileForWriting(scene_io.file_path.char_ptr);
-
-    os::writeToFile(&scene.counts, sizeof(SceneCounts), file_handle);
-
-    if (scene.counts.meshes)
-        for (u32 i = 0; i < scene.counts.meshes; i++)
-            writeHeader(scene.meshes[i], file_handle);
-
-    if (scene.counts.textures)
-        for (u32 i = 0; i < scene.counts.textures; i++)
-            writeHeader(scene.textures[i], file_handle);
-
+void writeSceneObjects(Scene &scene, void *file_handle) {
     if (scene.counts.cameras) {
         Camera *camera = scene.cameras;
         for (u32 i = 0; i < scene.counts.cameras; i++, camera++) {
@@ -96,6 +70,68 @@ void save(Scene &scene, SceneIO &scene_io) {
     if (scene.counts.curves)
         for (u32 i = 0; i < scene.counts.curves; i++)
             os::writeToFile(scene.curves + i, sizeof(Curve), file_handle);
+}
+
+bool openChunked(Scene &scene, SceneIO &scene_io);
+
+// Loads a scene file, fully or (for chunked ones) as a stream that fetches payloads on first use:
+bool load(Scene &scene, SceneIO &scene_io) {
+    void *file_handle = os::openFileForReading(scene_io.file_path.char_ptr);
+    if (!file_handle) return false;
+
+    u32 magic = 0;
+    os::readFromFile(&magic, sizeof(u32), file_handle);
+    if (magic == SCENE_CHUNKED_MAGIC) {
+        os::closeFile(file_handle);
+        return openChunked(scene, scene_io);
+    }
+    os::setFilePosition(file_handle, 0);
+
+    os::readFromFile(&scene.counts, sizeof(SceneCounts), file_handle);
+
+    if (scene.counts.meshes)
+        for (u32 i = 0; i < scene.counts.meshes; i++)
+            if (!readHeader(scene.meshes[i], file_handle)) {
+                os::closeFile(file_handle);
+                return false;
+            }
+
+    if (scene.counts.textures)
+        for (u32 i = 0; i < scene.counts.textures; i++)
+            readHeader(scene.textures[i], file_handle);
+
+    readSceneObjects(scene, file_handle);
+
+    if (scene.counts.meshes)
+        for (u32 i = 0; i < scene.counts.meshes; i++)
+            readContent(scene.meshes[i], file_handle);
+
+    if (scene.counts.textures)
+        for (u32 i = 0; i < scene.counts.textures; i++) {
+            readContent(scene.textures[i], file_handle);
+            scene.updateTextureIrradiance(i);
+        }
+
+    os::closeFile(file_handle);
+
+    scene.updateEmissiveQuads();
+    return true;
+}
+
+void save(Scene &scene, SceneIO &scene_io) {
+    void *file_handle = os::openFileForWriting(scene_io.file_path.char_ptr);
+
+    os::writeToFile(&scene.counts, sizeof(SceneCounts), file_handle);
+
+    if (scene.counts.meshes)
+        for (u32 i = 0; i < scene.counts.meshes; i++)
+            writeHeader(scene.meshes[i], file_handle);
+
+    if (scene.counts.textures)
+        for (u32 i = 0; i < scene.counts.textures; i++)
+            writeHeader(scene.textures[i], file_handle);
+
+    writeSceneObjects(scene, file_handle);
 
     if (scene.counts.meshes)
         for (u32 i = 0; i < scene.counts.meshes; i++)
@@ -106,4 +142,252 @@ void save(Scene &scene, SceneIO &scene_io) {
             writeContent(scene.textures[i], file_handle);
 
     os::closeFile(file_handle);
-}
\ No newline at end of file
+}
+
+bool saveChunked(Scene &scene, SceneIO &scene_io, bool compress = false) {
+    void *file_handle = os::openFileForWriting(scene_io.file_path.char_ptr);
+    if (!file_handle) return false;
+
+    u32 magic = SCENE_CHUNKED_MAGIC;
+    u32 version = SCENE_CHUNKED_VERSION;
+    os::writeToFile(&magic, sizeof(u32), file_handle);
+    os::writeToFile(&version, sizeof(u32), file_handle);
+    os::writeToFile(&scene.counts, sizeof(SceneCounts), file_handle);
+
+    for (u32 i = 0; i < scene.counts.meshes; i++) {
+        writeHeader(scene.meshes[i], file_handle);
+        os::writeToFile(&scene.meshes[i].aabb, sizeof(AABB), file_handle);
+    }
+
+    for (u32 i = 0; i < scene.counts.textures; i++) {
+        ImageInfo header = scene.textures[i];
+        header.flags.compressed = compress;
+        writeHeader(header, file_handle);
+    }
+
+    writeSceneObjects(scene, file_handle);
+
+    // Reserve the table of contents, fill it in once the payload offsets are known:
+    u32 payload_count = scene.counts.meshes + scene.counts.textures;
+    u64 table_of_contents_position = os::getFilePosition(file_handle);
+    u64 offset = 0;
+    for (u32 i = 0; i < payload_count; i++) os::writeToFile(&offset, sizeof(u64), file_handle);
+
+    u64 *offsets = payload_count ? (u64*)os::getMemory(sizeof(u64) * payload_count) : nullptr;
+    bool written = true;
+    for (u32 i = 0; i < scene.counts.meshes && written; i++) {
+        offsets[i] = os::getFilePosition(file_handle);
+        written = compress ? writeCompressedContent(scene.meshes[i], file_handle) : writeContent(scene.meshes[i], file_handle);
+    }
+    for (u32 i = 0; i < scene.counts.textures && written; i++) {
+        offsets[scene.counts.meshes + i] = os::getFilePosition(file_handle);
+        if (compress) writeCompressedContent(scene.textures[i], file_handle);
+        else          writeContent(scene.textures[i], file_handle);
+    }
+
+    if (payload_count) {
+        os::setFilePosition(file_handle, table_of_contents_position);
+        os::writeToFile(offsets, (unsigned long)(sizeof(u64) * payload_count), file_handle);
+        os::freeMemory(offsets);
+    }
+
+    os::closeFile(file_handle);
+    return written;
+}
+
+// Frees the memory of a fetched payload, putting its mesh or texture back to just its header:
+void evictPayload(Scene &scene, u32 payload_id) {
+    SceneIO &io = *scene.io;
+    if (!io.payload_memory[payload_id]) return;
+
+    os::freeMemory(io.payload_memory[payload_id]);
+    io.payload_memory[payload_id] = nullptr;
+    io.resident_payload_size -= io.payload_sizes[payload_id];
+    if (payload_id < scene.counts.meshes)
+        scene.meshes[payload_id] = io.mesh_headers[payload_id];
+    else
+        scene.textures[payload_id - scene.counts.meshes] = io.texture_headers[payload_id - scene.counts.meshes];
+}
+
+// Evicts the payloads that went unused for the most frames (but never ones used in the current frame) until one of
+// the given size fits in the budget. When everything resident is in use, the budget gets exceeded instead:
+void makeRoomForPayload(Scene &scene, u64 size) {
+    SceneIO &io = *scene.io;
+    if (!io.payload_budget) return;
+
+    u32 payload_count = scene.counts.meshes + scene.counts.textures;
+    while (io.resident_payload_size + size > io.payload_budget) {
+        u32 least_recently_used = payload_count;
+        for (u32 i = 0; i < payload_count; i++)
+            if (io.payload_memory[i] && io.payload_last_used_frames[i] < io.frame &&
+                (least_recently_used == payload_count ||
+                 io.payload_last_used_frames[i] < io.payload_last_used_frames[least_recently_used]))
+                least_recently_used = i;
+        if (least_recently_used == payload_count) return;
+
+        evictPayload(scene, least_recently_used);
+    }
+}
+
+// Seeks to a payload that got allocated into memory of its own, keeping track of that memory for evicting it:
+void* beginFetchingPayload(SceneIO &io, u32 payload_id, memory::MonotonicAllocator &payload_allocator) {
+    io.payload_memory[payload_id] = payload_allocator.address - payload_allocator.occupied;
+    io.payload_sizes[payload_id] = payload_allocator.capacity;
+    io.resident_payload_size += payload_allocator.capacity;
+    os::setFilePosition(io.file_handle, io.payload_offsets[payload_id]);
+    return io.file_handle;
+}
+
+void closeChunked(Scene &scene) {
+    SceneIO *io = scene.io;
+    if (!io || !io->file_handle) return;
+
+    for (u32 i = 0; i < scene.counts.meshes + scene.counts.textures; i++) evictPayload(scene, i);
+    os::closeFile(io->file_handle);
+    if (io->table_memory) os::freeMemory(io->table_memory);
+    io->file_handle = io->table_memory = nullptr;
+    io->payload_offsets = io->payload_sizes = io->payload_last_used_frames = nullptr;
+    io->payload_memory = nullptr;
+    io->mesh_headers = nullptr;
+    io->texture_headers = nullptr;
+    io->resident_payload_size = 0;
+}
+
+// Opens a chunked scene: Everything but the mesh and texture payloads is read right away (so the scene BVH can be
+// built and cameras used immediately) while the file stays open for payloads to be fetched on first use.
+// The scene's arrays must already be allocated for the counts in the file (the same contract as load()).
+bool openChunked(Scene &scene, SceneIO &scene_io) {
+    if (scene.io) closeChunked(scene);
+
+    void *file_handle = os::openFileForReading(scene_io.file_path.char_ptr);
+    if (!file_handle) return false;
+
+    u32 magic = 0, version = 0;
+    os::readFromFile(&magic, sizeof(u32), file_handle);
+    os::readFromFile(&version, sizeof(u32), file_handle);
+    if (magic != SCENE_CHUNKED_MAGIC || version != SCENE_CHUNKED_VERSION) {
+        os::closeFile(file_handle);
+        return false;
+    }
+
+    os::readFromFile(&scene.counts, sizeof(SceneCounts), file_handle);
+
+    // The headers of the meshes and textures get kept around, to put them back to when their payloads get evicted:
+    u32 payload_count = scene.counts.meshes + scene.counts.textures;
+    u64 table_size = sizeof(Mesh) * scene.counts.meshes + sizeof(Texture) * scene.counts.textures +
+                     (sizeof(u64) * 3 + sizeof(void*)) * payload_count;
+    u8 *table_memory = payload_count ? (u8*)os::getMemory(table_size) : nullptr;
+    if (payload_count && !table_memory) {
+        os::closeFile(file_handle);
+        return false;
+    }
+    scene_io.mesh_headers = (Mesh*)table_memory;
+    scene_io.texture_headers = (Texture*)(scene_io.mesh_headers + scene.counts.meshes);
+    scene_io.payload_offsets = (u64*)(scene_io.texture_headers + scene.counts.textures);
+    scene_io.payload_sizes = scene_io.payload_offsets + payload_count;
+    scene_io.payload_last_used_frames = scene_io.payload_sizes + payload_count;
+    scene_io.payload_memory = (void**)(scene_io.payload_last_used_frames + payload_count);
+    for (u32 i = 0; i < payload_count; i++) {
+        scene_io.payload_sizes[i] = scene_io.payload_last_used_frames[i] = 0;
+        scene_io.payload_memory[i] = nullptr;
+    }
+
+    scene.mesh_stack_size = 0;
+    for (u32 i = 0; i < scene.counts.meshes; i++) {
+        Mesh &mesh = scene.meshes[i];
+        mesh = Mesh{};
+        if (!readHeader(mesh, file_handle)) {
+            os::closeFile(file_handle);
+            os::freeMemory(table_memory);
+            return false;
+        }
+        os::readFromFile(&mesh.aabb, sizeof(AABB), file_handle);
+        scene.mesh_stack_size = (u16)Max((u32)scene.mesh_stack_size, mesh.getMaxBVHHeight());
+        scene_io.mesh_headers[i] = mesh;
+    }
+    if (scene.counts.meshes) scene.mesh_stack_size += 2;
+
+    for (u32 i = 0; i < scene.counts.textures; i++) {
+        Texture &texture = scene.textures[i];
+        texture = Texture{};
+        readHeader(texture, file_handle);
+        scene_io.texture_headers[i] = texture;
+    }
+
+    readSceneObjects(scene, file_handle);
+
+    for (u32 i = 0; i < payload_count; i++) os::readFromFile(scene_io.payload_offsets + i, sizeof(u64), file_handle);
+
+    scene_io.file_handle = file_handle;
+    scene_io.table_memory = table_memory;
+    scene_io.resident_payload_size = 0;
+    scene_io.frame = 0;
+    scene.io = &scene_io;
+
+    scene.updateEmissiveQuads();
+    scene.updateAABBs();
+    scene.updateBVH();
+
+    return true;
+}
+
+bool requireMesh(Scene &scene, u32 mesh_id) {
+    SceneIO *io = scene.io;
+    if (io && io->file_handle) io->payload_last_used_frames[mesh_id] = io->frame;
+
+    Mesh &mesh = scene.meshes[mesh_id];
+    if (mesh.triangles) return true;
+    if (!io || !io->file_handle) return false;
+
+    u64 size = getSizeInBytes(mesh);
+    makeRoomForPayload(scene, size);
+    memory::MonotonicAllocator payload_allocator{size};
+    if (!payload_allocator.address) return false;
+    allocateMemory(mesh, &payload_allocator);
+
+    readContent(mesh, beginFetchingPayload(*io, mesh_id, payload_allocator));
+    return true;
+}
+
+bool requireTexture(Scene &scene, u32 texture_id) {
+    SceneIO *io = scene.io;
+    u32 payload_id = scene.counts.meshes + texture_id;
+    if (io && io->file_handle) io->payload_last_used_frames[payload_id] = io->frame;
+
+    Texture &texture = scene.textures[texture_id];
+    if (texture.mips) return true;
+    if (!io || !io->file_handle) return false;
+
+    u64 size = getSizeInBytes(texture);
+    makeRoomForPayload(scene, size);
+    memory::MonotonicAllocator payload_allocator{size};
+    if (!payload_allocator.address) return false;
+    allocateMemory(texture, &payload_allocator);
+
+    readContent(texture, beginFetchingPayload(*io, payload_id, payload_allocator));
+    scene.updateTextureIrradiance(texture_id);
+    return true;
+}
+
+// Starts a new frame of a chunked scene, fetching the payloads of visible geometry that is (at least partially) in
+// front of the camera, along with the textures of their materials. Anything else stays on disk until it is needed,
+// and gets evicted again once it went unused for long enough to be the first to go when over budget:
+void requireVisibleContent(Scene &scene, const Camera &camera) {
+    if (!scene.io || !scene.io->file_handle) return;
+    scene.io->frame++;
+
+    for (u32 i = 0; i < scene.counts.geometries; i++) {
+        const Geometry &geo = scene.geometries[i];
+        if (!(geo.flags & GEOMETRY_IS_VISIBLE)) continue;
+
+        const AABB &aabb = scene.aabbs[i];
+        vec3 center = (aabb.min + aabb.max) * 0.5f;
+        f32 radius = (aabb.max - aabb.min).length() * 0.5f;
+        if (camera.internPos(center).z + radius < 0.0f) continue;
+
+        if (geo.type == GeometryType_Mesh) requireMesh(scene, geo.id);
+
+        const Material &material = scene.materials[geo.material_id];
+        for (u8 t = 0; t < material.texture_count; t++) requireTexture(scene, material.texture_ids[t]);
+    }
+}
@@ -2,21 +2,35 @@
 
 #include "../core/string.h"
 #include "../core/texture.h"
+#include "./compression.h"
 
 
+INLINE u32 getMipContentSize(const Texture &texture, u32 mip_width, u32 mip_height) {
+    return texture.flags.blocked ?
+        sizeof(TexelBlock) * getTexelBlockCount(mip_width, mip_height) :
+        sizeof(TexelQuad) * (mip_width + 1) * (mip_height + 1);
+}
+
+INLINE void* getMipContent(const Texture &texture, const TextureMip &mip) {
+    return texture.flags.blocked ? (void*)mip.texel_blocks : (void*)mip.texel_quads;
+}
+
+u32 getSizeInBytesWhenStreamed(const Texture &texture);
+
 u32 getSizeInBytes(const Texture &texture) {
+    if (texture.flags.streamed) return getSizeInBytesWhenStreamed(texture);
+
     u32 mip_width  = texture.width;
     u32 mip_height = texture.height;
-    u32 memory_size = 0;
+    u32 memory_size = (u32)memory::getAlignedSize(sizeof(TextureMip) * texture.mip_count);
 
+    // Every mip's content starts on a cache line:
     if (texture.flags.cubemap) {
-        mip_height = texture.height + 1;
-        mip_width = texture.height * 4 + 1;
-        memory_size = sizeof(TextureMip) * 3 + sizeof(TexelQuad) * (mip_height * (mip_width + 2 * mip_height));
+        memory_size += (u32)memory::getAlignedSize(getMipContentSize(texture, mip_height * 4, mip_height)) +
+                       (u32)memory::getAlignedSize(getMipContentSize(texture, mip_height, mip_height)) * 2;
     } else {
         do {
-            memory_size += sizeof(TextureMip);
-            memory_size += (mip_width + 1) * (mip_height + 1) * sizeof(TexelQuad);
+            memory_size += (u32)memory::getAlignedSize(getMipContentSize(texture, mip_width, mip_height));
 
             mip_width /= 2;
             mip_height /= 2;
@@ -29,24 +43,29 @@ u32 getSizeInBytes(const Texture &texture) {
 bool allocateMemory(Texture &texture, memory::MonotonicAllocator *memory_allocator) {
     u32 size = getSizeInBytes(texture);
     if (size > (memory_allocator->capacity - memory_allocator->occupied)) return false;
-    texture.mips = (TextureMip*)memory_allocator->allocate(sizeof(TextureMip) * texture.mip_count);
-    TextureMip *texture_mip = texture.mips;
-    u32 mip_width  = texture.width;
+    texture.mips = (TextureMip*)memory_allocator->allocateAligned(sizeof(TextureMip) * texture.mip_count);
+
+    // Cube maps have their 4 main faces side by side in the first mip, and the top and bottom faces in the other 2:
+    u32 mip_width  = texture.flags.cubemap ? texture.height * 4 : texture.width;
     u32 mip_height = texture.height;
+    TextureMip *texture_mip = texture.mips;
+    for (u8 mip_index = 0; mip_index < texture.mip_count; mip_index++, texture_mip++) {
+        texture_mip->texel_quads = nullptr;
+        texture_mip->texel_blocks = nullptr;
+        texture_mip->tiles = nullptr;
 
-    if (texture.flags.cubemap) {
-        mip_height = texture.height + 1;
-        mip_width = texture.height * 4 + 1;
-        (texture_mip++)->texel_quads = (TexelQuad*)memory_allocator->allocate(sizeof(TexelQuad) * mip_width * mip_height);
-        (texture_mip++)->texel_quads = (TexelQuad*)memory_allocator->allocate(sizeof(TexelQuad) * mip_height * mip_height);
-        (texture_mip++)->texel_quads = (TexelQuad*)memory_allocator->allocate(sizeof(TexelQuad) * mip_height * mip_height);
-    } else {
-        do {
-            texture_mip->texel_quads = (TexelQuad*)memory_allocator->allocate(sizeof(TexelQuad) * (mip_height + 1) * (mip_width + 1));
+        void *content = memory_allocator->allocateAligned(getMipContentSize(texture, mip_width, mip_height));
+        if (texture.flags.blocked)
+            texture_mip->texel_blocks = (TexelBlock*)content;
+        else
+            texture_mip->texel_quads = (TexelQuad*)content;
+
+        if (texture.flags.cubemap)
+            mip_width = mip_height;
+        else {
             mip_width /= 2;
             mip_height /= 2;
-            texture_mip++;
-        } while (texture.flags.mipmap && mip_width > 2 && mip_height > 2);
+        }
     }
 
     return true;
@@ -57,16 +76,193 @@ void readContent(Texture &texture, void *file) {
     for (u8 mip_index = 0; mip_index < texture.mip_count; mip_index++, texture_mip++) {
         os::readFromFile(&texture_mip->width,  sizeof(u32), file);
         os::readFromFile(&texture_mip->height, sizeof(u32), file);
-        os::readFromFile(texture_mip->texel_quads, sizeof(TexelQuad) * (texture_mip->width + 1) * (texture_mip->height + 1), file);
+        u32 content_size = getMipContentSize(texture, texture_mip->width, texture_mip->height);
+        if (texture.flags.compressed)
+            compression::readSection(getMipContent(texture, *texture_mip), content_size, file);
+        else
+            os::readFromFile(getMipContent(texture, *texture_mip), content_size, file);
     }
+
+    // Content is now resident in its raw form, so saving it back out should not claim otherwise:
+    texture.flags.compressed = false;
 }
 void writeContent(const Texture &texture, void *file) {
     TextureMip *texture_mip = texture.mips;
     for (u8 mip_index = 0; mip_index < texture.mip_count; mip_index++, texture_mip++) {
         os::writeToFile(&texture_mip->width,  sizeof(u32), file);
         os::writeToFile(&texture_mip->height, sizeof(u32), file);
-        os::writeToFile(texture_mip->texel_quads, sizeof(TexelQuad) * (texture_mip->width + 1) * (texture_mip->height + 1), file);
+        os::writeToFile(getMipContent(texture, *texture_mip), getMipContentSize(texture, texture_mip->width, texture_mip->height), file);
+    }
+}
+
+void writeCompressedContent(const Texture &texture, void *file) {
+    u32 element_size = texture.flags.blocked ? sizeof(BlockTexel) : sizeof(TexelQuad);
+    TextureMip *texture_mip = texture.mips;
+    for (u8 mip_index = 0; mip_index < texture.mip_count; mip_index++, texture_mip++) {
+        os::writeToFile(&texture_mip->width,  sizeof(u32), file);
+        os::writeToFile(&texture_mip->height, sizeof(u32), file);
+        compression::writeSection(getMipContent(texture, *texture_mip), getMipContentSize(texture, texture_mip->width, texture_mip->height),
+                                  element_size, compression::Filter_Delta, file);
+    }
+}
+
+bool saveCompressed(const Texture &texture, char* file_path) {
+    void *file = os::openFileForWriting(file_path);
+    if (!file) return false;
+    ImageInfo header = texture;
+    header.flags.compressed = true;
+    writeHeader(header, file);
+    writeCompressedContent(texture, file);
+    os::closeFile(file);
+    return true;
+}
+
+// Tiled texture files have the usual header, followed by each mip's dimensions and content.
+// Mips small enough to fit in a single tile (and always the coarsest mip) are stored as usual and kept resident,
+// the rest are stored as square tiles of TEXTURE_TILE_SIZE texel quads (padded at the right and bottom edges)
+// that get streamed in on demand through a tile cache:
+INLINE bool isResidentWhenStreamed(u32 mip_width, u32 mip_height, bool is_coarsest_mip) {
+    return is_coarsest_mip || ((mip_width + 1) <= TEXTURE_TILE_SIZE && (mip_height + 1) <= TEXTURE_TILE_SIZE);
+}
+
+void writeTiledContent(const Texture &texture, void *file) {
+    TexelQuad *tile = new TexelQuad[TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE];
+    TextureMip *texture_mip = texture.mips;
+    for (u8 mip_index = 0; mip_index < texture.mip_count; mip_index++, texture_mip++) {
+        u32 stride = texture_mip->width + 1;
+        u32 rows = texture_mip->height + 1;
+        os::writeToFile(&texture_mip->width,  sizeof(u32), file);
+        os::writeToFile(&texture_mip->height, sizeof(u32), file);
+        if (isResidentWhenStreamed(texture_mip->width, texture_mip->height, mip_index + 1 == texture.mip_count)) {
+            os::writeToFile(texture_mip->texel_quads, sizeof(TexelQuad) * stride * rows, file);
+            continue;
+        }
+
+        for (u32 tile_y = 0; tile_y < rows; tile_y += TEXTURE_TILE_SIZE)
+            for (u32 tile_x = 0; tile_x < stride; tile_x += TEXTURE_TILE_SIZE) {
+                TexelQuad *tile_texel_quad = tile;
+                for (u32 y = tile_y; y < tile_y + TEXTURE_TILE_SIZE; y++)
+                    for (u32 x = tile_x; x < tile_x + TEXTURE_TILE_SIZE; x++, tile_texel_quad++)
+                        *tile_texel_quad = texture_mip->texel_quads[Min(y, rows - 1) * stride + Min(x, stride - 1)];
+
+                os::writeToFile(tile, TEXTURE_TILE_SIZE_IN_BYTES, file);
+            }
+    }
+    delete[] tile;
+}
+
+bool saveTiled(const Texture &texture, char* file_path) {
+    if (texture.flags.cubemap) return false; // Cube map mips are faces rather than levels of detail
+    if (texture.flags.blocked) return false; // Tiles are made of texel quads
+
+    void *file = os::openFileForWriting(file_path);
+    if (!file) return false;
+    ImageInfo header = texture;
+    header.flags.compressed = false;
+    header.flags.streamed = true;
+    writeHeader(header, file);
+    writeTiledContent(texture, file);
+    os::closeFile(file);
+    return true;
+}
+
+u32 getSizeInBytesWhenStreamed(const Texture &texture) {
+    u32 memory_size = (u32)(memory::getAlignedSize(sizeof(TextureMip) * texture.mip_count) +
+                            memory::getAlignedSize(sizeof(TextureMipTiles) * texture.mip_count));
+    u32 mip_width  = texture.width;
+    u32 mip_height = texture.height;
+    for (u8 mip_index = 0; mip_index < texture.mip_count; mip_index++) {
+        if (isResidentWhenStreamed(mip_width, mip_height, mip_index + 1 == texture.mip_count))
+            memory_size += (u32)memory::getAlignedSize(sizeof(TexelQuad) * (mip_width + 1) * (mip_height + 1));
+
+        mip_width /= 2;
+        mip_height /= 2;
+    }
+
+    return memory_size;
+}
+
+// Opens a tiled texture file for streaming: Only the mip table and the resident mips are loaded,
+// the file is kept open for the tile cache to read tiles from (until closeTiled() is called).
+bool openTiled(Texture &texture, char *file_path, TileCache *tile_cache, memory::MonotonicAllocator *memory_allocator) {
+    void *file = os::openFileForReading(file_path);
+    if (!file) return false;
+
+    readHeader(texture, file);
+    texture.mips = (TextureMip*)memory_allocator->allocateAligned(sizeof(TextureMip) * texture.mip_count);
+    TextureMipTiles *mip_tiles = (TextureMipTiles*)memory_allocator->allocateAligned(sizeof(TextureMipTiles) * texture.mip_count);
+    if (!texture.mips || !mip_tiles) {
+        os::closeFile(file);
+        return false;
     }
+
+    bool keep_file_open = false;
+    TextureMip *texture_mip = texture.mips;
+    for (u8 mip_index = 0; mip_index < texture.mip_count; mip_index++, texture_mip++, mip_tiles++) {
+        os::readFromFile(&texture_mip->width,  sizeof(u32), file);
+        os::readFromFile(&texture_mip->height, sizeof(u32), file);
+        texture_mip->texel_quads = nullptr;
+        texture_mip->texel_blocks = nullptr;
+        texture_mip->tiles = nullptr;
+
+        u32 stride = texture_mip->width + 1;
+        u32 rows = texture_mip->height + 1;
+        if (isResidentWhenStreamed(texture_mip->width, texture_mip->height, mip_index + 1 == texture.mip_count)) {
+            texture_mip->texel_quads = (TexelQuad*)memory_allocator->allocateAligned(sizeof(TexelQuad) * stride * rows);
+            if (!texture_mip->texel_quads) {
+                os::closeFile(file);
+                return false;
+            }
+            os::readFromFile(texture_mip->texel_quads, sizeof(TexelQuad) * stride * rows, file);
+            continue;
+        }
+
+        *mip_tiles = TextureMipTiles{};
+        mip_tiles->cache = tile_cache;
+        mip_tiles->file = file;
+        mip_tiles->offset = os::getFilePosition(file);
+        mip_tiles->tiles_per_row = (stride + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+        mip_tiles->fallback = texture_mip + 1;
+        texture_mip->tiles = mip_tiles;
+        keep_file_open = true;
+
+        u32 tile_rows = (rows + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+        os::setFilePosition(file, mip_tiles->offset + (u64)tile_rows * mip_tiles->tiles_per_row * TEXTURE_TILE_SIZE_IN_BYTES);
+    }
+
+    if (!keep_file_open) os::closeFile(file);
+    return true;
+}
+
+void closeTiled(Texture &texture) {
+    for (u8 mip_index = 0; mip_index < texture.mip_count; mip_index++)
+        if (texture.mips[mip_index].tiles) {
+            TextureMipTiles &tiles = *texture.mips[mip_index].tiles;
+            tiles.cache->evict(tiles.file);
+            os::closeFile(tiles.file);
+            break;
+        }
+
+    for (u8 mip_index = 0; mip_index < texture.mip_count; mip_index++)
+        texture.mips[mip_index].tiles = nullptr;
+}
+
+// Textures that get loaded for streaming share one tile cache, made on first use with the budget given then:
+#define TEXTURE_TILE_CACHE_BUDGET Megabytes(256)
+
+TileCache texture_tile_cache;
+
+TileCache& getTextureTileCache(u64 memory_budget = TEXTURE_TILE_CACHE_BUDGET) {
+    if (!texture_tile_cache.tile_size) texture_tile_cache.init(TEXTURE_TILE_SIZE_IN_BYTES, memory_budget);
+    return texture_tile_cache;
+}
+
+// Textures saved tiled get opened for streaming through the shared tile cache, others get loaded whole:
+bool load(Texture &texture, char *file_path, memory::MonotonicAllocator *memory_allocator = nullptr) {
+    if (memory_allocator && loadHeader(texture, file_path) && texture.flags.streamed)
+        return openTiled(texture, file_path, &getTextureTileCache(), memory_allocator);
+
+    return load<Texture>(texture, file_path, memory_allocator);
 }
 
 u32 getTotalMemoryForTextures(String *texture_files, u32 texture_count) {
@@ -89,7 +285,7 @@ struct TexturePack {
             loadHeader(*texture, texture_file->char_ptr);
             memory_size += getSizeInBytes(*texture);
         }
-        memory::MonotonicAllocator memory_allocator{memory_size, memory_base};
+        memory::MonotonicAllocator memory_allocator{"Textures", memory_size, memory_base};
 
         texture = textures;
         texture_file = texture_files;
@@ -106,7 +302,7 @@ struct TexturePack {
             loadHeader(*texture, texture_file.char_ptr);
             memory_size += getSizeInBytes(*texture);
         }
-        memory::MonotonicAllocator memory_allocator{memory_size, memory_base};
+        memory::MonotonicAllocator memory_allocator{"Textures", memory_size, memory_base};
 
         texture = textures;
         for (u32 i = 0; i < count; i++, texture++) {
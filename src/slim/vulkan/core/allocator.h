@@ -0,0 +1,325 @@
+#pragma once
+
+#include "./base.h"
+#include "./device.h"
+
+// Device memory gets allocated in blocks of up to this size (per memory type) that resources then get placed in,
+// instead of every resource getting an allocation of its own (which devices may allow as few as 4096 of):
+#define VULKAN_MEMORY_BLOCK_SIZE Megabytes(64)
+
+// Resources at least this large get a block of their own:
+#define VULKAN_MEMORY_DEDICATED_MIN_SIZE (VULKAN_MEMORY_BLOCK_SIZE / 2)
+
+#define VULKAN_MEMORY_MAX_BLOCKS 1024
+
+// The most free ranges a block keeps track of, which bounds the number of resources it can hold (free ranges are
+// never adjacent, so there is at most one more of them than there are allocations in between):
+#define VULKAN_MEMORY_MAX_FREE_RANGES 512
+
+namespace gpu {
+    struct MemoryAllocation {
+        VkDeviceMemory memory = nullptr;
+        u64 offset = 0;
+        u64 size = 0;
+        void *mapped = nullptr; // Where the allocation is in host memory (for host-visible memory only)
+        u32 block = 0;
+    };
+
+    struct MemoryStats {
+        u32 block_count = 0;
+        u32 dedicated_block_count = 0;
+        u32 allocation_count = 0;
+        u32 free_range_count = 0;
+        u64 total_size = 0; // Of all blocks
+        u64 used_size = 0;
+        u64 largest_free_range_size = 0;
+        u64 fragmented_size = 0; // Free memory outside of the largest free range of its block
+
+        INLINE u64 freeSize() const { return total_size - used_size; }
+
+        // The share of the free memory that only resources smaller than the largest one that fits can still use
+        // (0 while every block has its free memory in one piece):
+        INLINE f32 fragmentation() const {
+            u64 free_size = freeSize();
+            return free_size ? (f32)((f64)fragmented_size / (f64)free_size) : 0.0f;
+        }
+    };
+
+    namespace _allocator {
+        struct MemoryRange {
+            u64 offset;
+            u64 size;
+        };
+
+        struct MemoryBlock {
+            VkDeviceMemory memory;
+            void *mapped; // Host-visible blocks stay mapped for as long as they live
+            u64 size;
+            u64 used_size;
+            u32 memory_type;
+            u32 allocation_count;
+            u32 free_range_count;
+            bool is_dedicated;
+            bool holds_optimal_images; // See getsOwnBlocks()
+            MemoryRange free_ranges[VULKAN_MEMORY_MAX_FREE_RANGES]; // In the order of their offsets
+
+            void reset(u64 block_size) {
+                size = block_size;
+                used_size = 0;
+                allocation_count = 0;
+                free_range_count = 1;
+                free_ranges[0] = {0, block_size};
+            }
+
+            // Places the allocation in the first free range it fits in. Returns its offset, or (u64)-1 if none:
+            u64 allocate(u64 allocation_size, u64 alignment) {
+                if (allocation_count == VULKAN_MEMORY_MAX_FREE_RANGES - 1) return (u64)-1;
+
+                for (u32 r = 0; r < free_range_count; r++) {
+                    MemoryRange &range = free_ranges[r];
+                    u64 offset = (range.offset + alignment - 1) & ~(alignment - 1);
+                    u64 end = range.offset + range.size;
+                    if (offset + allocation_size > end) continue;
+
+                    // What the alignment skips over stays free, in front of the allocation:
+                    bool keeps_front = offset > range.offset;
+                    bool keeps_back = offset + allocation_size < end;
+                    if (keeps_front && keeps_back) {
+                        for (u32 i = free_range_count; i > r + 1; i--) free_ranges[i] = free_ranges[i - 1];
+                        free_range_count++;
+                        free_ranges[r + 1] = {offset + allocation_size, end - offset - allocation_size};
+                        range.size = offset - range.offset;
+                    } else if (keeps_front)
+                        range.size = offset - range.offset;
+                    else if (keeps_back)
+                        range = {offset + allocation_size, end - offset - allocation_size};
+                    else {
+                        for (u32 i = r + 1; i < free_range_count; i++) free_ranges[i - 1] = free_ranges[i];
+                        free_range_count--;
+                    }
+
+                    used_size += allocation_size;
+                    allocation_count++;
+                    return offset;
+                }
+
+                return (u64)-1;
+            }
+
+            // Merges the range back in with the free ranges around it:
+            void free(u64 offset, u64 allocation_size) {
+                u32 next = 0;
+                while (next < free_range_count && free_ranges[next].offset < offset) next++;
+
+                bool joins_previous = next > 0 && free_ranges[next - 1].offset + free_ranges[next - 1].size == offset;
+                bool joins_next = next < free_range_count && offset + allocation_size == free_ranges[next].offset;
+                if (joins_previous && joins_next) {
+                    free_ranges[next - 1].size += allocation_size + free_ranges[next].size;
+                    for (u32 i = next + 1; i < free_range_count; i++) free_ranges[i - 1] = free_ranges[i];
+                    free_range_count--;
+                } else if (joins_previous)
+                    free_ranges[next - 1].size += allocation_size;
+                else if (joins_next) {
+                    free_ranges[next].offset = offset;
+                    free_ranges[next].size += allocation_size;
+                } else {
+                    for (u32 i = free_range_count; i > next; i--) free_ranges[i] = free_ranges[i - 1];
+                    free_range_count++;
+                    free_ranges[next] = {offset, allocation_size};
+                }
+
+                used_size -= allocation_size;
+                allocation_count--;
+            }
+        };
+
+        MemoryBlock *blocks[VULKAN_MEMORY_MAX_BLOCKS]{};
+        u32 block_count = 0; // Of the block slots, freed ones getting reused
+
+        INLINE u64 alignUp(u64 value, u64 alignment) { return (value + alignment - 1) & ~(alignment - 1); }
+
+        INLINE bool isHostVisible(u32 memory_type) {
+            return _device::memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        }
+
+        INLINE bool isHostCoherent(u32 memory_type) {
+            return _device::memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        }
+
+        // Linear resources (buffers and linearly tiled images) may not share a page of bufferImageGranularity bytes
+        // with optimally tiled images, which devices with a granularity above 1 get kept apart in blocks of their own:
+        INLINE bool getsOwnBlocks(bool is_optimal_image) {
+            return is_optimal_image && _device::properties.limits.bufferImageGranularity > 1;
+        }
+
+        // Smaller heaps (like the host-visible part of device memory) get blocks of up to an 8th of their size:
+        INLINE u64 getBlockSize(u32 memory_type) {
+            u32 heap = _device::memory_properties.memoryTypes[memory_type].heapIndex;
+            return Min((u64)VULKAN_MEMORY_BLOCK_SIZE, (u64)_device::memory_properties.memoryHeaps[heap].size / 8);
+        }
+
+        MemoryBlock* createBlock(u64 size, u32 memory_type, bool is_dedicated, bool holds_optimal_images, u32 &slot) {
+            u32 allocated_block_count = 0;
+            for (u32 b = 0; b < block_count; b++) if (blocks[b]) allocated_block_count++;
+            if (allocated_block_count >= _device::properties.limits.maxMemoryAllocationCount) {
+                SLIM_LOG_ERROR("Unable to allocate device memory: The device allows no more than %u allocations", _device::properties.limits.maxMemoryAllocationCount)
+                return nullptr;
+            }
+
+            slot = 0;
+            while (slot < block_count && blocks[slot]) slot++;
+            if (slot == VULKAN_MEMORY_MAX_BLOCKS) {
+                SLIM_LOG_ERROR("Unable to allocate device memory: All %u blocks are in use", VULKAN_MEMORY_MAX_BLOCKS)
+                return nullptr;
+            }
+
+            VkMemoryAllocateInfo allocate_info = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+            allocate_info.allocationSize = size;
+            allocate_info.memoryTypeIndex = memory_type;
+            VkDeviceMemory memory;
+            VkResult result = vkAllocateMemory(device, &allocate_info, nullptr, &memory);
+            if (result != VK_SUCCESS) {
+                SLIM_LOG_ERROR("Unable to allocate device memory. Error: %i", result)
+                return nullptr;
+            }
+
+            void *mapped = nullptr;
+            if (isHostVisible(memory_type))
+                VK_CHECK(vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &mapped))
+
+            MemoryBlock *block = new MemoryBlock;
+            block->memory = memory;
+            block->mapped = mapped;
+            block->memory_type = memory_type;
+            block->is_dedicated = is_dedicated;
+            block->holds_optimal_images = holds_optimal_images;
+            block->reset(size);
+
+            blocks[slot] = block;
+            if (slot == block_count) block_count++;
+            return block;
+        }
+
+        void destroyBlock(u32 slot) {
+            MemoryBlock *block = blocks[slot];
+            if (block->mapped) vkUnmapMemory(device, block->memory);
+            vkFreeMemory(device, block->memory, nullptr);
+            delete block;
+
+            blocks[slot] = nullptr;
+            while (block_count && !blocks[block_count - 1]) block_count--;
+        }
+    }
+
+    // Places a resource with the given requirements in memory of the given type:
+    bool allocateMemory(const VkMemoryRequirements &requirements, u32 memory_type, bool is_optimal_image, MemoryAllocation &allocation) {
+        using namespace _allocator;
+        allocation = {};
+
+        // Host-visible memory that is not coherent gets flushed in whole atoms, so resources do not share any:
+        u64 size = requirements.size;
+        u64 alignment = requirements.alignment ? requirements.alignment : 1;
+        if (isHostVisible(memory_type) && !isHostCoherent(memory_type)) {
+            u64 atom_size = _device::properties.limits.nonCoherentAtomSize;
+            alignment = Max(alignment, atom_size);
+            size = alignUp(size, atom_size);
+        }
+
+        bool holds_optimal_images = getsOwnBlocks(is_optimal_image);
+        u64 block_size = getBlockSize(memory_type);
+        MemoryBlock *block = nullptr;
+        u32 slot = 0;
+        u64 offset = (u64)-1;
+        if (size < VULKAN_MEMORY_DEDICATED_MIN_SIZE && size <= block_size) {
+            for (slot = 0; slot < block_count; slot++) {
+                block = blocks[slot];
+                if (!block || block->is_dedicated || block->memory_type != memory_type || block->holds_optimal_images != holds_optimal_images) continue;
+
+                offset = block->allocate(size, alignment);
+                if (offset != (u64)-1) break;
+            }
+
+            if (offset == (u64)-1) {
+                block = createBlock(block_size, memory_type, false, holds_optimal_images, slot);
+                if (!block) return false;
+
+                offset = block->allocate(size, alignment);
+            }
+        } else {
+            block = createBlock(size, memory_type, true, holds_optimal_images, slot);
+            if (!block) return false;
+
+            offset = block->allocate(size, 1);
+        }
+
+        allocation.memory = block->memory;
+        allocation.offset = offset;
+        allocation.size = size;
+        allocation.mapped = block->mapped ? (u8*)block->mapped + offset : nullptr;
+        allocation.block = slot;
+        return true;
+    }
+
+    // Empty blocks get freed, except for one spare per kind of block (to not reallocate it on every load):
+    void freeMemory(MemoryAllocation &allocation) {
+        using namespace _allocator;
+        if (!allocation.memory) return;
+
+        u32 slot = allocation.block;
+        MemoryBlock *block = blocks[slot];
+        block->free(allocation.offset, allocation.size);
+        allocation = {};
+        if (block->allocation_count) return;
+
+        bool has_spare = block->is_dedicated;
+        for (u32 other_slot = 0; other_slot < block_count && !has_spare; other_slot++) {
+            MemoryBlock *other = blocks[other_slot];
+            has_spare = other && other != block && !other->is_dedicated && !other->allocation_count &&
+                        other->memory_type == block->memory_type &&
+                        other->holds_optimal_images == block->holds_optimal_images;
+        }
+        if (has_spare) destroyBlock(slot);
+    }
+
+    MemoryStats getMemoryStats() {
+        using namespace _allocator;
+        MemoryStats stats;
+        for (u32 slot = 0; slot < block_count; slot++) {
+            const MemoryBlock *block = blocks[slot];
+            if (!block) continue;
+
+            stats.block_count++;
+            if (block->is_dedicated) stats.dedicated_block_count++;
+            stats.allocation_count += block->allocation_count;
+            stats.free_range_count += block->free_range_count;
+            stats.total_size += block->size;
+            stats.used_size += block->used_size;
+            u64 largest_free_range_size = 0;
+            for (u32 r = 0; r < block->free_range_count; r++)
+                largest_free_range_size = Max(largest_free_range_size, block->free_ranges[r].size);
+            stats.largest_free_range_size = Max(stats.largest_free_range_size, largest_free_range_size);
+            stats.fragmented_size += block->size - block->used_size - largest_free_range_size;
+        }
+
+        return stats;
+    }
+
+    void logMemoryStats() {
+        MemoryStats stats = getMemoryStats();
+        SLIM_LOG_INFO("Device memory: %u allocations in %u blocks (%u dedicated), %llu of %llu KB used, "
+                      "%u free ranges (largest: %llu KB, fragmentation: %.2f)",
+                      (unsigned)stats.allocation_count, (unsigned)stats.block_count, (unsigned)stats.dedicated_block_count,
+                      (unsigned long long)(stats.used_size / 1024), (unsigned long long)(stats.total_size / 1024),
+                      (unsigned)stats.free_range_count, (unsigned long long)(stats.largest_free_range_size / 1024),
+                      stats.fragmentation())
+    }
+
+    void destroyMemory() {
+        using namespace _allocator;
+        MemoryStats stats = getMemoryStats();
+        if (stats.allocation_count)
+            SLIM_LOG_WARNING("Freeing device memory that %u resources are still in", (unsigned)stats.allocation_count)
+
+        while (block_count) destroyBlock(block_count - 1);
+    }
+}
@@ -96,6 +96,11 @@ namespace gpu {
     VertexAttributeType _i32{VK_FORMAT_R32_SINT, 4};
     VertexAttributeType _u32{VK_FORMAT_R32_UINT, 4};
 
+    // Normalized and half-float types, for quantized vertices (read in shaders as floats):
+    VertexAttributeType _unorm16x4{VK_FORMAT_R16G16B16A16_UNORM, 8};
+    VertexAttributeType _snorm8x2{VK_FORMAT_R8G8_SNORM, 2};
+    VertexAttributeType _half2{VK_FORMAT_R16G16_SFLOAT, 4};
+
     struct VertexDescriptor {
         u32 vertex_input_stride;
         u32 attribute_count;
@@ -3,19 +3,29 @@
 #include "./base.h"
 #include "./command.h"
 #include "./device.h"
+#include "./allocator.h"
 
 namespace gpu {
+    struct Buffer;
+
+    // See staging.h
+    namespace staging {
+        bool upload(const Buffer &to_buffer, const void *data, u64 size, u64 to_offset);
+        void submit();
+    }
+
     struct Buffer {
         BufferType type;
 
         VkBuffer handle;
         VkBufferUsageFlagBits usage;
 
-        VkDeviceMemory memory;
+        MemoryAllocation allocation;
         VkMemoryRequirements memory_requirements;
         i32 memory_index;
         u32 memory_property_flags;
         u64 total_size;
+        mutable bool has_contents; // Set by the first upload or copy into it (see staging::upload())
 
         INLINE bool isDeviceLocal() const { return (memory_property_flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) == VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT; }
         INLINE bool isHostVisible() const { return (memory_property_flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT; }
@@ -71,37 +81,18 @@ namespace gpu {
                 return false;
             }
 
-            // Allocate memory info
-            VkMemoryAllocateInfo allocate_info = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
-            allocate_info.allocationSize = memory_requirements.size;
-            allocate_info.memoryTypeIndex = (u32)memory_index;
-
-            VkResult result = vkAllocateMemory(device, &allocate_info, nullptr, &memory);
-
-            if (result != VK_SUCCESS) {
-                SLIM_LOG_ERROR("Unable to create vulkan buffer because the required memory allocation failed. Error: %i", result)
+            if (!allocateMemory(memory_requirements, (u32)memory_index, false, allocation)) {
+                SLIM_LOG_ERROR("Unable to create vulkan buffer because the required memory allocation failed.")
                 return false;
             }
 
-            VK_CHECK(vkBindBufferMemory(device, handle, memory, 0))
+            VK_CHECK(vkBindBufferMemory(device, handle, allocation.memory, allocation.offset))
 
             return true;
         }
 
-        bool createAsStaging(u64 size, const void *data) {
-            if (!Buffer::create(BufferType::Staging, size)) {
-                SLIM_LOG_ERROR("Failed to create staging buffer")
-                return false;
-            }
-            write(data, size);
-            return true;
-        }
-
         void destroy() {
-            if (memory) {
-                vkFreeMemory(device, memory, nullptr);
-                memory = nullptr;
-            }
+            freeMemory(allocation);
             if (handle) {
                 vkDestroyBuffer(device, handle, nullptr);
                 handle = nullptr;
@@ -115,10 +106,15 @@ namespace gpu {
             if (!isHostCoherent()) {
                 if (size == 0) size = total_size;
 
+                // The range has to be in whole atoms of the block the buffer is in (which it owns whole ones of):
+                u64 atom_size = _device::properties.limits.nonCoherentAtomSize;
+                u64 start = (allocation.offset + offset) / atom_size * atom_size;
+                u64 end = Min(allocation.offset + offset + size + atom_size - 1, allocation.offset + allocation.size) / atom_size * atom_size;
+
                 VkMappedMemoryRange range = {VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE};
-                range.memory = memory;
-                range.offset = offset;
-                range.size = size;
+                range.memory = allocation.memory;
+                range.offset = start;
+                range.size = end - start;
                 VK_CHECK(vkFlushMappedMemoryRanges(device, 1, &range))
             }
 
@@ -128,7 +124,8 @@ namespace gpu {
         bool copyTo(const Buffer &to_buffer, const CommandBuffer &temp_command_buffer, u64 size = 0, u64 from_offset = 0, u64 to_offset = 0) const {
             if (size == 0) size = total_size;
 
-            vkQueueWaitIdle(temp_command_buffer.queue);
+            // Staged uploads recorded before this copy have to happen before it:
+            staging::submit();
 
             temp_command_buffer.beginSingleUse();
 
@@ -138,6 +135,7 @@ namespace gpu {
             copy_region.dstOffset = to_offset;
             copy_region.size = size;
             vkCmdCopyBuffer(temp_command_buffer.handle, handle, to_buffer.handle, 1, &copy_region);
+            to_buffer.has_contents = true;
 
             temp_command_buffer.endSingleUse();
 
@@ -156,18 +154,17 @@ namespace gpu {
             vkDeviceWaitIdle(device);
 
             // Destroy the old
-            if (memory) {
-                vkFreeMemory(device, memory, nullptr);
-                memory = nullptr;
-            }
+            freeMemory(allocation);
             if (handle) {
                 vkDestroyBuffer(device, handle, nullptr);
                 handle = nullptr;
             }
 
             // Set new properties
-            memory = new_buffer.memory;
+            allocation = new_buffer.allocation;
             handle = new_buffer.handle;
+            total_size = new_size;
+            has_contents = true;
 
             return true;
         }
@@ -196,38 +193,30 @@ namespace gpu {
             return true;
         }
 
-        bool upload(const void* from_data, const CommandBuffer &command_buffer, u64 size = 0, u64 to_offset = 0) const {
+        bool upload(const void* from_data, u64 size = 0, u64 to_offset = 0) const {
             if (size == 0) size = total_size;
 
-            if (isDeviceLocal() && !isHostVisible()) {
-                // NOTE: If a staging buffer is needed (i.e.) the target buffer's memory is not host visible but is device-local,
-                // create a staging buffer to load the data into first. Then copy from it to the target buffer.
-
-                Buffer staging{};
-                staging.createAsStaging(size, from_data);
-                staging.copyTo(*this, command_buffer, size, 0, to_offset);
-                staging.destroy();
-            } else
-                write(from_data, size, to_offset);
+            // NOTE: If the target buffer's memory is device-local but not host visible, the data gets written to the
+            // staging ring first, to be copied from there to the target buffer when the staged copies get submitted.
+            if (isDeviceLocal() && !isHostVisible())
+                return staging::upload(*this, from_data, size, to_offset);
 
+            write(from_data, size, to_offset);
             return true;
         }
 
     protected:
-        void* data(u64 size, u64 offset = 0) const {
-            void* data_ptr;
-            VK_CHECK(vkMapMemory(device, memory, offset, size, 0, &data_ptr))
-            return data_ptr;
+        // Host-visible memory stays mapped, so there is no mapping and unmapping around every read and write:
+        void* data(u64 offset = 0) const {
+            return (u8*)allocation.mapped + offset;
         }
 
         void read(void* to, u64 size, u64 from_offset = 0) const {
-            memcpy(to, data(size, from_offset), size);
-            vkUnmapMemory(device, memory);
+            memcpy(to, data(from_offset), size);
         }
 
         void write(const void* from, u64 size, u64 to_offset = 0) const {
-            memcpy(data(size, to_offset), from, size);
-            vkUnmapMemory(device, memory);
+            memcpy(data(to_offset), from, size);
         }
     };
 }
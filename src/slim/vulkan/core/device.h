@@ -17,6 +17,7 @@ namespace gpu {
 
         bool present_shares_graphics_queue;
         bool transfer_shares_graphics_queue;
+        bool supports_timeline_semaphores;
 
         VkPhysicalDeviceProperties properties;
         VkPhysicalDeviceMemoryProperties memory_properties;
@@ -304,6 +305,16 @@ namespace gpu {
 
             SLIM_LOG_INFO("Found a suitable physical device");
 
+            // Timeline semaphores are core since 1.2 (used for syncing uploads on the transfer queue with rendering):
+            VkPhysicalDeviceTimelineSemaphoreFeatures timeline_semaphore_features = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES};
+            supports_timeline_semaphores = false;
+            if (properties.apiVersion >= VK_API_VERSION_1_2) {
+                VkPhysicalDeviceFeatures2 features2 = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2};
+                features2.pNext = &timeline_semaphore_features;
+                vkGetPhysicalDeviceFeatures2(physical_device, &features2);
+                supports_timeline_semaphores = timeline_semaphore_features.timelineSemaphore;
+            }
+
             SLIM_LOG_INFO("Creating logical device...");
             // NOTE: Do not create additional queues for shared indices.
             present_shares_graphics_queue = graphics_queue_family_index == present_queue_family_index;
@@ -352,6 +363,10 @@ namespace gpu {
                 "VK_KHR_portability_subset"
             };
             VkDeviceCreateInfo device_create_info = {VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO};
+            if (supports_timeline_semaphores) {
+                timeline_semaphore_features.pNext = nullptr;
+                device_create_info.pNext = &timeline_semaphore_features;
+            }
             device_create_info.queueCreateInfoCount = index_count;
             device_create_info.pQueueCreateInfos = queue_create_infos;
             device_create_info.pEnabledFeatures = &device_features;
@@ -5,6 +5,7 @@
 #include "./device.h"
 #include "./present.h"
 #include "./command.h"
+#include "./allocator.h"
 #include "./transfer.h"
 #include "./compute.h"
 #include "./render_target.h"
@@ -13,6 +14,7 @@
 #include "./shader.h"
 #include "./pipeline.h"
 #include "./buffer.h"
+#include "./staging.h"
 #include "./graphics.h"
 
 
@@ -49,6 +51,8 @@ namespace gpu {
         transient_graphics_command_pool.create(true);
         transient_graphics_command_pool.allocate(transient_graphics_command_buffer);
 
+        staging::init();
+
         present::swapchain_rect = {{}, {width, height}};
 
         _device::querySupportForSurfaceFormatsAndPresentModes();
@@ -104,6 +108,7 @@ namespace gpu {
     }
 
     void waitForGPU() {
+        staging::submit();
         vkDeviceWaitIdle(device);
     }
 
@@ -139,6 +144,10 @@ namespace gpu {
             graphics_command_pool.destroy();
 
         transient_graphics_command_pool.destroy();
+        staging::destroy();
+
+        SLIM_LOG_DEBUG("Freeing device memory...");
+        destroyMemory();
 
         SLIM_LOG_DEBUG("Destroying Vulkan device...");
         _device::destroy();
@@ -235,6 +244,10 @@ namespace gpu {
 
         graphics_command_buffer->end();
 
+        // Uploads staged during the frame get submitted ahead of it (for it to see them), and done ones free their staging memory:
+        staging::submit();
+        staging::reclaim();
+
         // Make sure the previous frame is not using this image (i.e. its fence is being waited on)
         if (present::images_in_flight[present::current_image_index] != VK_NULL_HANDLE) {
 //            SLIM_LOG_DEBUG("images_in_flight[current_image_index = %d] != VK_NULL_HANDLE : vkWaitForFences(images_in_flight[%d])", present::current_image_index, present::current_image_index)
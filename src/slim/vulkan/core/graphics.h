@@ -1,6 +1,7 @@
 #pragma once
 
 #include "./buffer.h"
+#include "./staging.h"
 #include "./command.h"
 #include "./framebuffer.h"
 #include "./render_pass.h"
@@ -123,7 +124,7 @@ namespace gpu {
         }
 
         bool upload(const void *from, u64 size = 0, u64 to_offset = 0) const {
-            return Buffer::upload(from, transient_graphics_command_buffer, size, to_offset);
+            return Buffer::upload(from, size, to_offset);
         }
 
         bool copyTo(const Buffer &to_buffer, u64 size, u64 from_offset, u64 to_offset) const {
@@ -167,8 +168,10 @@ namespace gpu {
             vkCmdBindIndexBuffer(command_buffer.handle, handle, offset, index_type);
         }
 
-        void draw(const GraphicsCommandBuffer &command_buffer, u32 instance_count = 1, u32 first_index = 0, i32 first_vertex = 0, u32 first_instance = 0) const {
-            vkCmdDrawIndexed(command_buffer.handle, index_count, instance_count, first_index, first_vertex, first_instance);
+        // The first vertex gets added to every index (for buffers holding the indices of several vertex ranges):
+        void draw(const GraphicsCommandBuffer &command_buffer, u32 count = 0, u32 first_index = 0, i32 first_vertex = 0, u32 instance_count = 1, u32 first_instance = 0) const {
+            if (count == 0) count = index_count;
+            vkCmdDrawIndexed(command_buffer.handle, count, instance_count, first_index, first_vertex, first_instance);
         }
     };
 
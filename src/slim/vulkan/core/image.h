@@ -1,8 +1,10 @@
 #pragma once
 
 #include "./base.h"
+#include "./allocator.h"
 #include "./buffer.h"
 #include "./command.h"
+#include "./staging.h"
 
 namespace gpu {
     enum class GPUImageFlag {
@@ -37,7 +39,7 @@ namespace gpu {
 
     struct GPUImage {
         VkImage handle;
-        VkDeviceMemory memory;
+        MemoryAllocation allocation;
         VkImageView view;
         VkSampler sampler;
         VkMemoryRequirements memory_requirements;
@@ -57,10 +59,7 @@ namespace gpu {
                 vkDestroyImageView(device, view, nullptr);
                 view = nullptr;
             }
-            if (memory) {
-                vkFreeMemory(device, memory, nullptr);
-                memory = nullptr;
-            }
+            freeMemory(allocation);
             if (handle) {
                 vkDestroyImage(device, handle, nullptr);
                 handle = nullptr;
@@ -116,13 +115,11 @@ namespace gpu {
             if (memory_type == -1) SLIM_LOG_ERROR("Required memory type not found. Image not valid.");
 
             // Allocate memory
-            VkMemoryAllocateInfo memory_allocate_info = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
-            memory_allocate_info.allocationSize = memory_requirements.size;
-            memory_allocate_info.memoryTypeIndex = memory_type;
-            VK_CHECK(vkAllocateMemory(device, &memory_allocate_info, nullptr, &memory));
+            if (!allocateMemory(memory_requirements, (u32)memory_type, tiling == VK_IMAGE_TILING_OPTIMAL, allocation))
+                SLIM_LOG_ERROR("Unable to allocate memory. Image not valid.");
 
             // Bind the memory
-            VK_CHECK(vkBindImageMemory(device, handle, memory, 0))  // TODO: configurable memory offset.
+            VK_CHECK(vkBindImageMemory(device, handle, allocation.memory, allocation.offset))
 
             // Create view
             if (flags.view) {
@@ -255,8 +252,9 @@ namespace gpu {
             transitionLayout(old_layout, new_layout, source_stage, dest_stage, source_access_mask, dest_access_mask, command_buffer, 0, mip_map ? mip_count : 1);
         }
 
-        void copyFromBuffer(const Buffer &from_buffer, const CommandBuffer &command_buffer, u32 x = -1, u32 y = -1) const {
+        void copyFromBuffer(const Buffer &from_buffer, const CommandBuffer &command_buffer, u32 x = -1, u32 y = -1, u64 from_offset = 0) const {
             VkBufferImageCopy region = getCopyRegion(x, y);
+            region.bufferOffset = from_offset;
             vkCmdCopyBufferToImage(command_buffer.handle, from_buffer.handle, handle,
                                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                                    1,&region);
@@ -295,11 +293,18 @@ namespace gpu {
             VkMemoryPropertyFlags image_memory_flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
             CommandBuffer *command_buffer = nullptr
         ) {
-            if (!command_buffer) command_buffer = &transient_graphics_command_buffer;
-
-            Buffer staging{};
-            if (!staging.createAsStaging(texel_size * image_width * image_height * (view_type == VK_IMAGE_VIEW_TYPE_CUBE ? 6 : 1), data))
+            // Without a command buffer given, the upload gets recorded into the current staging batch instead of
+            // being submitted and waited for right away:
+            const bool is_staged = !command_buffer;
+            if (!is_staged) staging::submit();
+
+            // Copy offsets have to be multiples of both the texel size and 4:
+            staging::Region staging_region;
+            u64 size = (u64)texel_size * image_width * image_height * (view_type == VK_IMAGE_VIEW_TYPE_CUBE ? 6 : 1);
+            if (!staging::allocate(size, texel_size * 4, staging_region))
                 return false;
+
+            memcpy(staging_region.data, data, size);
             
             VkImageUsageFlags usage_flags = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
             if (flags.mipmap)
@@ -318,9 +323,17 @@ namespace gpu {
                 view_type
             );
 
-            command_buffer->beginSingleUse();
-            transitionLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, *command_buffer);
-            copyFromBuffer(staging, *command_buffer);
+            // The copy may get done on the transfer queue, with the image then changing hands to the graphics one
+            // (that the mip-mapping blits and the transition for shaders to read it in get done on):
+            const CommandBuffer &copy_command_buffer = is_staged ? staging::beginTransfer() : *command_buffer;
+            if (!is_staged) copy_command_buffer.beginSingleUse();
+            transitionLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, copy_command_buffer);
+            copyFromBuffer(*staging_region.buffer, copy_command_buffer, -1, -1, staging_region.offset);
+
+            VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, mip_count, 0, (u32)(type == VK_IMAGE_VIEW_TYPE_CUBE ? 6 : 1)};
+            const CommandBuffer &graphics_command_buffer = is_staged ?
+                staging::releaseImage(handle, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) :
+                copy_command_buffer;
             if (flags.mipmap) {
                 // Check if image format supports linear blitting
 //                VkFormatProperties formatProperties;
@@ -338,7 +351,7 @@ namespace gpu {
                     transitionLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
                                      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
                                      VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
-                                     *command_buffer, src_mip_level);
+                                     graphics_command_buffer, src_mip_level);
 
                     VkImageBlit blit{};
                     blit.srcOffsets[0] = {0, 0, 0};
@@ -359,7 +372,7 @@ namespace gpu {
                                            mipHeight > 1 ? mipHeight / 2 : 1,
                                            1 };
 
-                    vkCmdBlitImage(command_buffer->handle,
+                    vkCmdBlitImage(graphics_command_buffer.handle,
                                    handle, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
                                    handle, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                                    1, &blit, VK_FILTER_LINEAR);
@@ -367,7 +380,7 @@ namespace gpu {
                     transitionLayout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
                                      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
                                      VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
-                                     *command_buffer, blit.srcSubresource.mipLevel);
+                                     graphics_command_buffer, blit.srcSubresource.mipLevel);
 
                     if (mipWidth > 1) mipWidth /= 2;
                     if (mipHeight > 1) mipHeight /= 2;
@@ -376,13 +389,11 @@ namespace gpu {
                 transitionLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
                                  VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
                                  VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
-                                 *command_buffer, mip_count - 1);
+                                 graphics_command_buffer, mip_count - 1);
             } else
-                transitionLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, *command_buffer);
-
-            command_buffer->endSingleUse();
+                transitionLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, graphics_command_buffer);
 
-            staging.destroy();
+            if (!is_staged) copy_command_buffer.endSingleUse();
 
             return true;
         }
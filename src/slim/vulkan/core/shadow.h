@@ -12,7 +12,7 @@ namespace gpu {
 		const char* vertex_shader_string = R"VERTEX_SHADER(#version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(location = 0) in vec3 in_position;
+layout(location = 0) in vec4 in_position;
 
 layout(push_constant) uniform PushConstant {
 	mat4 mvp;
@@ -23,7 +23,7 @@ out gl_PerVertex
     vec4 gl_Position;   
 };
 void main() {
-	gl_Position = push_constant.mvp * vec4(in_position, 1.0);
+	gl_Position = push_constant.mvp * vec4(in_position.xyz, 1.0);
 })VERTEX_SHADER";
 
 		struct PushConstant {
@@ -32,16 +32,18 @@ void main() {
 		PushConstant push_constant;
 		PushConstantSpec push_constant_spec{{PushConstantRangeForVertex(sizeof(PushConstant))}};
 
-		struct TriangleVertex {
-			vec3 position{};
-			vec3 normal;
-			vec3 tangent;
-			vec2 uv;
+		// The layout of gpu::QuantizedVertex, of which only the position gets read (the mvp having to map it from
+		// the bounds of the mesh, see VertexQuantization::transform()):
+		struct QuantizedVertex {
+			u16 position[4];
+			i8 normal[2];
+			i8 tangent[2];
+			u16 uv[2];
 		};
 		VertexDescriptor vertex_descriptor{
-			sizeof(TriangleVertex),
+			sizeof(QuantizedVertex),
 			1, {
-				_vec3,
+				_unorm16x4,
 			}
 		};
 		VertexShader vertex_shader{};
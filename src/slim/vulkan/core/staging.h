@@ -0,0 +1,331 @@
+#pragma once
+
+#include "./buffer.h"
+#include "./command.h"
+#include "./fence.h"
+#include "./transfer.h"
+
+// Uploads to device-local memory get staged in a persistently mapped ring buffer of this size:
+#define VULKAN_STAGING_RING_SIZE Megabytes(32)
+
+// Copies out of the ring get recorded into batches, each submitted with a fence that frees its part of the ring:
+#define VULKAN_STAGING_BATCH_COUNT 4
+
+// Uploads larger than this get a staging buffer of their own (freed along with their batch):
+#define VULKAN_STAGING_MAX_RING_UPLOAD_SIZE (VULKAN_STAGING_RING_SIZE / 2)
+
+namespace gpu {
+    namespace staging {
+        struct StagingCommandBuffer : CommandBuffer {
+            StagingCommandBuffer(VkCommandBuffer command_buffer_handle = nullptr, VkCommandPool command_pool = nullptr) :
+                CommandBuffer(command_buffer_handle, command_pool, graphics_queue, graphics_queue_family_index) {}
+        };
+
+        struct StagingCommandPool : CommandPool<StagingCommandBuffer> {
+            void create() {
+                _create(graphics_queue_family_index, true);
+            }
+        };
+
+        // On devices with a transfer queue (family) of their own, copies into new resources get done on it while
+        // the graphics queue keeps rendering. The resources then get released by the transfer queue family and
+        // acquired by the graphics one, in a submission waiting for the transfer (through a timeline semaphore).
+        // Resources that may be in use already get their uploads copied on the graphics queue (in order with it).
+        struct Batch {
+            TransferCommandBuffer transfer_command_buffer;
+            StagingCommandBuffer command_buffer; // Graphics: Acquires, copies into resources in use, mip-mapping
+            Fence fence; // Of the graphics submission (which follows the transfer one)
+            Buffer dedicated_buffer; // For an upload too large for the ring
+            u64 ring_end; // Where the staging data of the batch ends (the ring gets freed up to here once it is done)
+            bool is_recording;
+            bool is_transferring;
+            bool is_pending;
+        };
+
+        // Where an upload's data gets written to, for the current batch to copy it from:
+        struct Region {
+            const Buffer *buffer;
+            u64 offset;
+            void *data;
+        };
+
+        Buffer ring;
+        StagingCommandPool command_pool;
+        Batch batches[VULKAN_STAGING_BATCH_COUNT];
+        u32 current_batch = 0;
+        u32 oldest_pending_batch = 0;
+
+        // Both only ever grow, their difference being the size of the ring that is in use:
+        u64 ring_head = 0;
+        u64 ring_tail = 0;
+
+        bool uses_transfer_queue = false;
+        VkSemaphore transfer_semaphore = nullptr; // Timeline, signaled with the count of transfer submissions
+        u64 transfer_count = 0;
+
+        void init() {
+            uses_transfer_queue = !_device::transfer_shares_graphics_queue && _device::supports_timeline_semaphores;
+            if (uses_transfer_queue) {
+                transient_transfer_command_pool.create(true);
+
+                VkSemaphoreTypeCreateInfo semaphore_type_info = {VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+                semaphore_type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+                semaphore_type_info.initialValue = 0;
+                VkSemaphoreCreateInfo semaphore_create_info = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+                semaphore_create_info.pNext = &semaphore_type_info;
+                VK_CHECK(vkCreateSemaphore(device, &semaphore_create_info, nullptr, &transfer_semaphore))
+            }
+
+            ring.create(BufferType::Staging, VULKAN_STAGING_RING_SIZE);
+            command_pool.create();
+            for (Batch &batch : batches) {
+                command_pool.allocate(batch.command_buffer);
+                if (uses_transfer_queue) transient_transfer_command_pool.allocate(batch.transfer_command_buffer);
+                batch.fence.create();
+                batch.dedicated_buffer = {};
+                batch.is_recording = batch.is_transferring = batch.is_pending = false;
+            }
+            current_batch = oldest_pending_batch = 0;
+            ring_head = ring_tail = 0;
+            transfer_count = 0;
+        }
+
+        // Frees the ring space of batches the device is done with (waiting for the oldest one when asked to):
+        void reclaim(bool wait_for_oldest = false) {
+            while (batches[oldest_pending_batch].is_pending) {
+                Batch &batch = batches[oldest_pending_batch];
+                if (wait_for_oldest) {
+                    VK_CHECK(vkWaitForFences(device, 1, &batch.fence.handle, true, UINT64_MAX))
+                    wait_for_oldest = false;
+                } else if (vkGetFenceStatus(device, batch.fence.handle) != VK_SUCCESS)
+                    break;
+
+                ring_tail = batch.ring_end;
+                batch.dedicated_buffer.destroy();
+                batch.is_pending = false;
+                oldest_pending_batch = (oldest_pending_batch + 1) % VULKAN_STAGING_BATCH_COUNT;
+            }
+        }
+
+        // Submits the copies recorded so far, to be done before anything that gets submitted after them:
+        void submit() {
+            Batch &batch = batches[current_batch];
+            if (!batch.is_recording) return;
+
+            VkTimelineSemaphoreSubmitInfo timeline_info = {VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+            VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+            VkSubmitInfo submit_info = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+            submit_info.commandBufferCount = 1;
+
+            u64 signal_value = 0;
+            if (batch.is_transferring) {
+                batch.transfer_command_buffer.end();
+
+                signal_value = ++transfer_count;
+                timeline_info.signalSemaphoreValueCount = 1;
+                timeline_info.pSignalSemaphoreValues = &signal_value;
+                submit_info.pNext = &timeline_info;
+                submit_info.signalSemaphoreCount = 1;
+                submit_info.pSignalSemaphores = &transfer_semaphore;
+                submit_info.pCommandBuffers = &batch.transfer_command_buffer.handle;
+                VK_CHECK(vkQueueSubmit(batch.transfer_command_buffer.queue, 1, &submit_info, nullptr))
+                batch.transfer_command_buffer.state = State::Submitted;
+
+                // The graphics submission (acquiring what got transferred) waits for the transfer one:
+                timeline_info = {VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+                timeline_info.waitSemaphoreValueCount = 1;
+                timeline_info.pWaitSemaphoreValues = &signal_value;
+                submit_info.signalSemaphoreCount = 0;
+                submit_info.waitSemaphoreCount = 1;
+                submit_info.pWaitSemaphores = &transfer_semaphore;
+                submit_info.pWaitDstStageMask = &wait_stage;
+            }
+
+            // Make the copies visible to whatever reads the uploaded resources next:
+            VkMemoryBarrier barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+            vkCmdPipelineBarrier(batch.command_buffer.handle, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                                 1, &barrier, 0, nullptr, 0, nullptr);
+            batch.command_buffer.end();
+
+            VK_CHECK(vkResetFences(device, 1, &batch.fence.handle))
+            submit_info.pCommandBuffers = &batch.command_buffer.handle;
+            VK_CHECK(vkQueueSubmit(batch.command_buffer.queue, 1, &submit_info, batch.fence.handle))
+            batch.command_buffer.state = State::Submitted;
+
+            batch.ring_end = ring_head;
+            batch.is_recording = false;
+            batch.is_transferring = false;
+            batch.is_pending = true;
+            current_batch = (current_batch + 1) % VULKAN_STAGING_BATCH_COUNT;
+        }
+
+        // The graphics command buffer of the current batch, to record copies out of the staging memory into:
+        const CommandBuffer& begin() {
+            Batch &batch = batches[current_batch];
+            if (batch.is_recording) return batch.command_buffer;
+
+            // With every batch submitted and still pending, wait for the oldest one (the one to be reused):
+            reclaim(batch.is_pending);
+
+            batch.command_buffer.reset();
+            batch.command_buffer.begin(true, false, false);
+            batch.is_recording = true;
+
+            // Resources may still be in use by work submitted earlier, which the copies must not overwrite:
+            vkCmdPipelineBarrier(batch.command_buffer.handle, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                                 0, nullptr, 0, nullptr, 0, nullptr);
+
+            return batch.command_buffer;
+        }
+
+        // The command buffer to record copies into new resources into (the graphics one without a transfer queue).
+        // Resources written to by it have to be released afterwards (see releaseBuffer() and releaseImage()):
+        const CommandBuffer& beginTransfer() {
+            const CommandBuffer &command_buffer = begin();
+            if (!uses_transfer_queue) return command_buffer;
+
+            Batch &batch = batches[current_batch];
+            if (!batch.is_transferring) {
+                batch.transfer_command_buffer.reset();
+                batch.transfer_command_buffer.begin(true, false, false);
+                batch.is_transferring = true;
+            }
+
+            return batch.transfer_command_buffer;
+        }
+
+        // Hands the buffer over from the transfer queue family to the graphics one:
+        void releaseBuffer(const Buffer &buffer) {
+            if (!uses_transfer_queue) return;
+
+            Batch &batch = batches[current_batch];
+            VkBufferMemoryBarrier barrier = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.srcQueueFamilyIndex = transfer_queue_family_index;
+            barrier.dstQueueFamilyIndex = graphics_queue_family_index;
+            barrier.buffer = buffer.handle;
+            barrier.offset = 0;
+            barrier.size = VK_WHOLE_SIZE;
+            vkCmdPipelineBarrier(batch.transfer_command_buffer.handle, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                                 0, nullptr, 1, &barrier, 0, nullptr);
+
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+            vkCmdPipelineBarrier(batch.command_buffer.handle, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                                 0, nullptr, 1, &barrier, 0, nullptr);
+        }
+
+        // Hands the image over (in the given layout) from the transfer queue family to the graphics one.
+        // Returns the command buffer to record anything that follows into (like blits, for mip-mapping):
+        const CommandBuffer& releaseImage(VkImage image, const VkImageSubresourceRange &range, VkImageLayout layout) {
+            Batch &batch = batches[current_batch];
+            if (!uses_transfer_queue) return batch.command_buffer;
+
+            VkImageMemoryBarrier barrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.oldLayout = layout;
+            barrier.newLayout = layout;
+            barrier.srcQueueFamilyIndex = transfer_queue_family_index;
+            barrier.dstQueueFamilyIndex = graphics_queue_family_index;
+            barrier.image = image;
+            barrier.subresourceRange = range;
+            vkCmdPipelineBarrier(batch.transfer_command_buffer.handle, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                                 0, nullptr, 0, nullptr, 1, &barrier);
+
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+            vkCmdPipelineBarrier(batch.command_buffer.handle, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                                 0, nullptr, 0, nullptr, 1, &barrier);
+
+            return batch.command_buffer;
+        }
+
+        // Reserves staging memory for the current batch to copy from. It stays reserved until the batch is done:
+        bool allocate(u64 size, u64 alignment, Region &region) {
+            begin();
+
+            if (size > VULKAN_STAGING_MAX_RING_UPLOAD_SIZE) {
+                if (batches[current_batch].dedicated_buffer.handle) {
+                    submit();
+                    begin();
+                }
+
+                Buffer &buffer = batches[current_batch].dedicated_buffer;
+                if (!buffer.create(BufferType::Staging, size)) {
+                    SLIM_LOG_ERROR("Failed to create staging buffer")
+                    return false;
+                }
+
+                region = {&buffer, 0, buffer.allocation.mapped};
+                return true;
+            }
+
+            for (;;) {
+                u64 offset = (ring_head + alignment - 1) / alignment * alignment;
+
+                // Staging data does not wrap around the end of the ring, but starts over at its beginning:
+                if (offset % VULKAN_STAGING_RING_SIZE + size > VULKAN_STAGING_RING_SIZE)
+                    offset = (offset / VULKAN_STAGING_RING_SIZE + 1) * VULKAN_STAGING_RING_SIZE;
+
+                if (offset + size - ring_tail <= VULKAN_STAGING_RING_SIZE) {
+                    ring_head = offset + size;
+                    offset %= VULKAN_STAGING_RING_SIZE;
+                    region = {&ring, offset, (u8*)ring.allocation.mapped + offset};
+                    return true;
+                }
+
+                // Wait for the oldest batch to free up its part of the ring (submitting the current one if it is all):
+                if (!batches[oldest_pending_batch].is_pending) {
+                    submit();
+                    begin();
+                }
+                reclaim(true);
+            }
+        }
+
+        bool upload(const Buffer &to_buffer, const void *data, u64 size, u64 to_offset) {
+            Region region;
+            if (!allocate(size, 4, region)) return false;
+
+            memcpy(region.data, data, size);
+
+            // Buffers holding contents already may be in use by the graphics queue (which owns them by now):
+            const CommandBuffer &command_buffer = to_buffer.has_contents ? begin() : beginTransfer();
+
+            VkBufferCopy copy_region;
+            copy_region.srcOffset = region.offset;
+            copy_region.dstOffset = to_offset;
+            copy_region.size = size;
+            vkCmdCopyBuffer(command_buffer.handle, region.buffer->handle, to_buffer.handle, 1, &copy_region);
+
+            if (!to_buffer.has_contents) {
+                releaseBuffer(to_buffer);
+                to_buffer.has_contents = true;
+            }
+
+            return true;
+        }
+
+        void destroy() {
+            submit();
+            for (Batch &batch : batches) {
+                if (batch.is_pending) VK_CHECK(vkWaitForFences(device, 1, &batch.fence.handle, true, UINT64_MAX))
+                batch.dedicated_buffer.destroy();
+                batch.fence.destroy();
+                batch.command_buffer.free();
+                if (uses_transfer_queue) batch.transfer_command_buffer.free();
+                batch.is_pending = false;
+            }
+            command_pool.destroy();
+            ring.destroy();
+
+            if (uses_transfer_queue) {
+                transient_transfer_command_pool.destroy();
+                vkDestroySemaphore(device, transfer_semaphore, nullptr);
+                transfer_semaphore = nullptr;
+            }
+        }
+    }
+}
@@ -5,6 +5,7 @@
 #include "../../math/mat4.h"
 
 #include "./pipeline.h"
+#include "../scene/mesh.h"
 
 namespace default_material {
     using namespace gpu;
@@ -45,6 +46,7 @@ namespace default_material {
     struct PushConstant {
         alignas(16) ModelTransform transform;
         alignas(16) MaterialParams material_params;
+        alignas(16) VertexQuantization quantization; // Read by the vertex shader only
     };
     PushConstant push_constant{};
     PushConstantSpec push_constant_spec{{PushConstantRangeForVertexAndFragment(sizeof(PushConstant))}};
@@ -87,7 +89,7 @@ namespace default_material {
         if (pipeline.handle)
             return true;
 
-        if (!vertex_shader.createFromSourceFile(default_vertex_shader_file, &vertex_descriptor))
+        if (!vertex_shader.createFromSourceFile(default_vertex_shader_file, &quantized_vertex_descriptor))
             return false;
 
         if (!fragment_shader.createFromSourceFile(default_fragment_shader_file))
@@ -187,9 +189,12 @@ namespace default_material {
         pipeline_layout.bind(directional_shadow_map_descriptor_sets[present::current_frame], command_buffer, 3);
     }
 
-    void setModel(const GraphicsCommandBuffer &command_buffer, const Transform &transform, const MaterialParams &material_params, u32 flags = 0) {
+    // Meshes get drawn with quantized vertices, so come with the quantization of their vertices:
+    void setModel(const GraphicsCommandBuffer &command_buffer, const Transform &transform, const MaterialParams &material_params, u32 flags = 0,
+                  const VertexQuantization &quantization = {}) {
         push_constant.transform = transform;
         push_constant.material_params = material_params;
+        push_constant.quantization = quantization;
         if (flags) push_constant.material_params.flags = flags;
         pipeline_layout.pushConstants(command_buffer, default_material::push_constant_spec.ranges[0], &default_material::push_constant);
     }
@@ -11,9 +11,11 @@
 #define DRAW_IBL 128
 #define DRAW_SHADOW_MAP 256
 
-layout(location = 0) in vec3 in_position;
-layout(location = 1) in vec3 in_normal;
-layout(location = 2) in vec3 in_tangent;
+// Quantized vertices (see gpu::QuantizedVertex): Positions are fractions of the bounds of the mesh, normals and
+// tangents are octahedral-encoded and uvs are half floats (the latter 2 get converted by the vertex input):
+layout(location = 0) in vec4 in_position;
+layout(location = 1) in vec2 in_normal;
+layout(location = 2) in vec2 in_tangent;
 layout(location = 3) in vec2 in_uv;
 
 layout(location = 0) out vec3 out_position;
@@ -41,9 +43,15 @@ struct ModelTransform {
     vec3 scale;
 };
 
+struct VertexQuantization {
+    vec3 offset;
+    vec3 scale;
+};
+
 layout(push_constant) uniform Model {
     ModelTransform transform;
     ModelMaterialParams material_params;
+    VertexQuantization quantization;
 } model;
 
 vec3 Cross(vec3 lhs, vec3 rhs) {
@@ -63,11 +71,22 @@ vec3 rotate(vec3 v, vec4 q) {
     return result;
 }
 
+vec3 decodeOctahedral(vec2 encoded) {
+    vec3 direction = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float fold = max(-direction.z, 0.0);
+    direction.x += direction.x >= 0.0 ? -fold : fold;
+    direction.y += direction.y >= 0.0 ? -fold : fold;
+    return normalize(direction);
+}
+
 void main() {
     if ((model.material_params.flags & DRAW_SHADOW_MAP) == 0) {
-        out_position = rotate(in_position * model.transform.scale, model.transform.rotation) + model.transform.position;
-        out_normal = rotate(in_normal * model.transform.scale, model.transform.rotation);
-        out_tangent = rotate(in_tangent * model.transform.scale, model.transform.rotation);
+        vec3 position = model.quantization.offset + in_position.xyz * model.quantization.scale;
+        vec3 normal = decodeOctahedral(in_normal);
+        vec3 tangent = decodeOctahedral(in_tangent);
+        out_position = rotate(position * model.transform.scale, model.transform.rotation) + model.transform.position;
+        out_normal = rotate(normal * model.transform.scale, model.transform.rotation);
+        out_tangent = rotate(tangent * model.transform.scale, model.transform.rotation);
         out_uv = in_uv;
         gl_Position = camera.projection * camera.view * vec4(out_position, 1.0);
     } else {
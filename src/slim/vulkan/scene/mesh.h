@@ -1,10 +1,16 @@
 #pragma once
 
 #include "../../scene/mesh.h"
+#include "../../scene/vertex_quantization.h"
 #include "../../serialization/mesh.h"
+#include "../../core/parallel.h"
+#include "../../core/transform.h"
 
 #include "../core/graphics.h"
 
+// Vertices get loaded across the thread pool in runs of this many:
+#define GPU_LOAD_VERTICES_GRAIN_SIZE 4096
+
 namespace gpu {
 
     struct TriangleVertex {
@@ -23,143 +29,518 @@ namespace gpu {
         }
     };
 
-    template <typename Vertex = TriangleVertex>
-    void loadVertices(Mesh &mesh, Vertex *vertices, bool flip_winding_order = false) {
-        for (u32 triangle_index = 0; triangle_index < mesh.triangle_count; triangle_index++) {
-            for (u32 vertex_num = 0; vertex_num < 3; vertex_num++, vertices++) {
-                u32 v = vertex_num == 0 || !flip_winding_order ? vertex_num : (vertex_num == 2 ? 1 : 2);
-                                         vertices->position = mesh.vertex_positions[mesh.vertex_position_indices[triangle_index].ids[v]];
-                if (mesh.uvs_count)      vertices->uv       = mesh.vertex_uvs[      mesh.vertex_uvs_indices[     triangle_index].ids[v]];
-                if (mesh.normals_count)  vertices->normal   = mesh.vertex_normals[  mesh.vertex_normal_indices[  triangle_index].ids[v]];
-                if (mesh.tangents_count) vertices->tangent  = mesh.vertex_tangents[ mesh.vertex_tangent_indices[ triangle_index].ids[v]];
+    // A compact TriangleVertex (16 bytes instead of 44), decoded by the default vertex shader:
+    // Positions are 16-bit fractions of the mesh's bounds (see VertexQuantization), normals and tangents are
+    // octahedral-encoded into 2 8-bit components each, and uvs are half floats (see scene/vertex_quantization.h).
+    struct QuantizedVertex {
+        u16 position[4]; // The 4th one pads
+        i8 normal[2];
+        i8 tangent[2];
+        u16 uv[2];
+    };
+    VertexDescriptor quantized_vertex_descriptor{
+        sizeof(QuantizedVertex),
+        4, {
+            _unorm16x4,
+            _snorm8x2,
+            _snorm8x2,
+            _half2
+        }
+    };
+
+    // Maps quantized positions (0 to 1 across the bounds of their mesh) back to the space of the mesh:
+    struct VertexQuantization {
+        alignas(16) vec3 offset{0.0f};
+        alignas(16) vec3 scale{1.0f};
+
+        VertexQuantization() = default;
+        explicit VertexQuantization(const AABB &aabb) : offset{aabb.min}, scale{aabb.max - aabb.min} {}
+
+        // As a transform (to go before the one of the model, for shaders that only take a matrix):
+        Transform transform() const {
+            Transform result;
+            result.position = offset;
+            result.scale = scale;
+            return result;
+        }
+    };
+
+    INLINE void setVertex(TriangleVertex &vertex, const vec3 &position, const vec3 &normal, const vec3 &tangent, const vec2 &uv,
+                          const VertexQuantization &) {
+        vertex.position = position;
+        vertex.normal = normal;
+        vertex.tangent = tangent;
+        vertex.uv = uv;
+    }
+
+    INLINE void setVertex(QuantizedVertex &vertex, const vec3 &position, const vec3 &normal, const vec3 &tangent, const vec2 &uv,
+                          const VertexQuantization &quantization) {
+        quantizePosition(position, quantization.offset, quantization.scale, vertex.position);
+        vertex.position[3] = 0;
+        quantizeOctahedral(normal, vertex.normal);
+        quantizeOctahedral(tangent, vertex.tangent);
+        vertex.uv[0] = quantizeHalf(uv.u);
+        vertex.uv[1] = quantizeHalf(uv.v);
+    }
+
+    // Meshes without welded vertices (like the ones made in code, or older mesh files) get their triangle corners
+    // welded on load instead, corners with the same position, normal, tangent and uv becoming one vertex:
+    INLINE u32 getCornerTableCapacity(u32 triangle_count) {
+        u32 capacity = 1;
+        while (capacity < triangle_count * 6) capacity <<= 1;
+        return capacity;
+    }
+
+    INLINE u64 getCornerWeldingSize(u32 triangle_count) {
+        return memory::getAlignedSize(sizeof(u32) * getCornerTableCapacity(triangle_count)) +
+               memory::getAlignedSize(sizeof(u32) * triangle_count * 3);
+    }
+
+    // An upper bound, for meshes that would get their corners welded:
+    INLINE u32 getMaxVertexCount(const Mesh &mesh) {
+        return mesh.welded_vertex_count ? mesh.welded_vertex_count : mesh.triangle_count * 3;
+    }
+
+    INLINE MeshVertex getCornerVertex(const Mesh &mesh, u32 corner) {
+        u32 t = corner / 3;
+        u32 i = corner % 3;
+        MeshVertex vertex;
+        vertex.position =                        mesh.vertex_positions[mesh.vertex_position_indices[t].ids[i]];
+        vertex.normal   = mesh.normals_count  ? mesh.vertex_normals[  mesh.vertex_normal_indices[  t].ids[i]] : vec3{0.0f};
+        vertex.tangent  = mesh.tangents_count ? mesh.vertex_tangents[ mesh.vertex_tangent_indices[ t].ids[i]] : vec3{0.0f};
+        vertex.uv       = mesh.uvs_count      ? mesh.vertex_uvs[      mesh.vertex_uvs_indices[     t].ids[i]] : vec2{0.0f};
+        return vertex;
+    }
+
+    INLINE bool isSameVertex(const MeshVertex &a, const MeshVertex &b) {
+        return a.position.x == b.position.x && a.position.y == b.position.y && a.position.z == b.position.z &&
+               a.normal.x   == b.normal.x   && a.normal.y   == b.normal.y   && a.normal.z   == b.normal.z &&
+               a.tangent.x  == b.tangent.x  && a.tangent.y  == b.tangent.y  && a.tangent.z  == b.tangent.z &&
+               a.uv.u       == b.uv.u       && a.uv.v       == b.uv.v;
+    }
+
+    // The bits of a float, for hashing (as 32 bits whatever the width of u32, and with -0 hashing like 0 as the 2
+    // compare equal):
+    INLINE unsigned int getHashBits(f32 value) {
+        value += 0.0f;
+        unsigned int bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    // Writes the vertex of every corner (3 per triangle) into indices, numbering vertices in the order they are first
+    // used, and the first corner of every vertex into first_corners. The table needs getCornerTableCapacity() slots.
+    // Returns the vertex count:
+    u32 weldCorners(const Mesh &mesh, u32 *indices, u32 *first_corners, u32 *table) {
+        u32 capacity = getCornerTableCapacity(mesh.triangle_count);
+        u32 mask = capacity - 1;
+        for (u32 slot = 0; slot < capacity; slot++) table[slot] = (u32)-1;
+
+        u32 vertex_count = 0;
+        for (u32 corner = 0; corner < mesh.triangle_count * 3; corner++) {
+            MeshVertex vertex = getCornerVertex(mesh, corner);
+            u32 hash = (u32)(getHashBits(vertex.position.x) * 73856093u ^
+                             getHashBits(vertex.position.y) * 19349663u ^
+                             getHashBits(vertex.position.z) * 83492791u ^
+                             getHashBits(vertex.normal.x) * 2654435761u ^
+                             getHashBits(vertex.uv.u) * 40503u ^
+                             getHashBits(vertex.uv.v));
+            for (u32 slot = hash & mask;; slot = (slot + 1) & mask) {
+                u32 v = table[slot];
+                if (v == (u32)-1) {
+                    v = table[slot] = vertex_count++;
+                    first_corners[v] = corner;
+                } else if (!isSameVertex(vertex, getCornerVertex(mesh, first_corners[v])))
+                    continue;
+
+                indices[corner] = v;
+                break;
             }
         }
+
+        return vertex_count;
+    }
+
+    // Loads the distinct vertices of a mesh along with the indices of its triangles (3 per triangle, in the order of
+    // the mesh's triangles), quantizing them by the given bounds (see getVertexBounds()) when the vertices are
+    // quantized. Vertex memory needs getMaxVertexCount() of them, and when the mesh has no welded vertices this
+    // thread's scratch arena needs room for getCornerWeldingSize(). Returns the vertex count:
+    template <typename Vertex = QuantizedVertex>
+    u32 loadIndexedVertices(const Mesh &mesh, Vertex *vertices, u32 *indices, const VertexQuantization &quantization,
+                            bool flip_winding_order = false) {
+        u32 vertex_count = mesh.welded_vertex_count;
+        if (vertex_count) {
+            for (u32 t = 0; t < mesh.triangle_count; t++)
+                for (u32 i = 0; i < 3; i++)
+                    indices[t * 3 + i] = mesh.vertex_indices[t].ids[i];
+
+            parallelFor(vertex_count, getThreadCount(), [&](u32 first_vertex, u32 end_vertex) {
+                for (u32 v = first_vertex; v < end_vertex; v++) {
+                    const MeshVertex &vertex = mesh.vertices[v];
+                    setVertex(vertices[v], vertex.position, vertex.normal, vertex.tangent, vertex.uv, quantization);
+                }
+            }, GPU_LOAD_VERTICES_GRAIN_SIZE);
+        } else {
+            memory::MonotonicAllocator &scratch = memory::getScratchArena();
+            memory::ScratchScope scratch_scope{scratch};
+            auto *table = scratch.allocateArray<u32>(getCornerTableCapacity(mesh.triangle_count));
+            auto *first_corners = scratch.allocateArray<u32>(mesh.triangle_count * 3);
+            if (!table || !first_corners) return 0;
+
+            vertex_count = weldCorners(mesh, indices, first_corners, table);
+            parallelFor(vertex_count, getThreadCount(), [&](u32 first_vertex, u32 end_vertex) {
+                for (u32 v = first_vertex; v < end_vertex; v++) {
+                    MeshVertex vertex = getCornerVertex(mesh, first_corners[v]);
+                    setVertex(vertices[v], vertex.position, vertex.normal, vertex.tangent, vertex.uv, quantization);
+                }
+            }, GPU_LOAD_VERTICES_GRAIN_SIZE);
+        }
+
+        if (flip_winding_order)
+            for (u32 t = 0; t < mesh.triangle_count; t++) {
+                u32 index = indices[t * 3 + 1];
+                indices[t * 3 + 1] = indices[t * 3 + 2];
+                indices[t * 3 + 2] = index;
+            }
+
+        return vertex_count;
+    }
+
+    // LODs index the welded vertices of their mesh:
+    void loadLODIndices(const MeshLOD &lod, u32 *indices) {
+        for (u32 t = 0; t < lod.triangle_count; t++)
+            for (u32 i = 0; i < 3; i++)
+                indices[t * 3 + i] = lod.vertex_indices[t].ids[i];
+    }
+
+    // Indices of meshes of up to 65536 vertices fit in 16 bits:
+    INLINE u8 getIndexSize(u32 max_vertex_count) {
+        return max_vertex_count <= 0x10000 ? 2 : 4;
+    }
+
+    // Narrows indices in place to the given size (each narrowed one landing where no unread one remains):
+    void packIndices(u32 *indices, u32 index_count, u8 index_size) {
+        if (index_size != 2) return;
+
+        u16 *packed_indices = (u16*)indices;
+        for (u32 i = 0; i < index_count; i++) packed_indices[i] = (u16)indices[i];
     }
 
     struct GPUMesh {
         VertexBuffer vertex_buffer{};
+        IndexBuffer index_buffer{};
         VertexBuffer edge_buffer{};
+        VertexQuantization quantization{}; // Of the vertices, when quantized
 
-        template <typename Vertex = TriangleVertex>
+        template <typename Vertex = QuantizedVertex>
         bool create(Mesh &mesh) {
-            u32 vertex_count = mesh.triangle_count * 3;
+            quantization = VertexQuantization{getVertexBounds(mesh)};
+
+            u32 max_vertex_count = getMaxVertexCount(mesh);
+            u32 index_count = mesh.triangle_count * 3;
             u32 edge_vertex_count = mesh.edge_count * 2;
 
-            auto *vertices = new Vertex[vertex_count];
-            auto *edges = new Edge[mesh.edge_count];
-            loadVertices<Vertex>(mesh, vertices);
+            // Staged in this thread's scratch memory until uploaded:
+            memory::MonotonicAllocator &scratch = memory::getScratchArena(
+                memory::getAlignedSize(sizeof(Vertex) * max_vertex_count) +
+                memory::getAlignedSize(sizeof(u32) * index_count) +
+                memory::getAlignedSize(sizeof(Edge) * mesh.edge_count) +
+                (mesh.welded_vertex_count ? 0 : getCornerWeldingSize(mesh.triangle_count)));
+            memory::ScratchScope scratch_scope{scratch};
+            auto *vertices = scratch.allocateArray<Vertex>(max_vertex_count);
+            auto *indices = scratch.allocateArray<u32>(index_count);
+            auto *edges = scratch.allocateArray<Edge>(mesh.edge_count);
+            if (!vertices || !indices || !edges) return false;
+
+            u32 vertex_count = loadIndexedVertices<Vertex>(mesh, vertices, indices, quantization);
+            if (!vertex_count && mesh.triangle_count) return false;
+            u8 index_size = getIndexSize(vertex_count);
+            packIndices(indices, index_count, index_size);
             mesh.loadEdges(edges);
 
-            bool result = false;
-            if (vertex_buffer.create(vertex_count, sizeof(Vertex)) &&
-                vertex_buffer.upload(vertices) &&
-                edge_buffer.create(edge_vertex_count, sizeof(vec3)) &&
-                edge_buffer.upload(edges))
-                result = true;
+            return vertex_buffer.create(vertex_count, sizeof(Vertex)) &&
+                   vertex_buffer.upload(vertices) &&
+                   index_buffer.create(index_count, index_size) &&
+                   index_buffer.upload(indices) &&
+                   edge_buffer.create(edge_vertex_count, sizeof(vec3)) &&
+                   edge_buffer.upload(edges);
+        }
 
-            delete[] vertices;
-            delete[] edges;
-            return result;
+        void bind(const GraphicsCommandBuffer &command_buffer) const {
+            vertex_buffer.bind(command_buffer);
+            index_buffer.bind(command_buffer);
+        }
+
+        void draw(const GraphicsCommandBuffer &command_buffer) const {
+            index_buffer.draw(command_buffer);
         }
 
         void destroy() {
             vertex_buffer.destroy();
+            index_buffer.destroy();
             edge_buffer.destroy();
         }
     };
 
     struct GPUMeshGroup {
         VertexBuffer vertex_buffer;
+        IndexBuffer index_buffer;
         VertexBuffer edge_buffer;
         u32 mesh_count = 0;
         u32 total_triangle_count = 0;
+        u32 total_vertex_count = 0;
         u32 *mesh_triangle_counts = nullptr;
 
-        template <typename Vertex = TriangleVertex>
-        void create(String *mesh_files, u32 count) {
+        // Meshes index their own vertices, so their draws offset indices by where their vertices start:
+        u32 *mesh_first_vertices = nullptr;
+        u32 *mesh_first_indices = nullptr;
+
+        // The clusters of all meshes (see drawMesh()), and where each mesh's start:
+        MeshCluster *clusters = nullptr;
+        u32 *mesh_first_clusters = nullptr;
+        u32 *mesh_cluster_counts = nullptr;
+        u32 total_cluster_count = 0;
+
+        // The indices of the LODs of all meshes follow the ones of the meshes (MESH_MAX_LOD_COUNT slots per mesh),
+        // LODs indexing the vertices of their mesh:
+        u32 *mesh_lod_counts = nullptr;
+        u32 *lod_first_indices = nullptr;
+        u32 *lod_triangle_counts = nullptr;
+
+        // Per mesh, of its vertices when quantized:
+        VertexQuantization *mesh_quantizations = nullptr;
+
+        // Returns false when a mesh file can not be read, scratch memory runs out, or the buffers fail to get made:
+        template <typename Vertex = QuantizedVertex>
+        bool create(String *mesh_files, u32 count) {
             mesh_count = count;
 
-            if (mesh_triangle_counts) delete mesh_triangle_counts;
+            if (mesh_triangle_counts) delete[] mesh_triangle_counts;
+            if (mesh_first_vertices) delete[] mesh_first_vertices;
+            if (mesh_first_indices) delete[] mesh_first_indices;
+            if (mesh_first_clusters) delete[] mesh_first_clusters;
+            if (mesh_cluster_counts) delete[] mesh_cluster_counts;
+            if (mesh_lod_counts) delete[] mesh_lod_counts;
+            if (lod_first_indices) delete[] lod_first_indices;
+            if (lod_triangle_counts) delete[] lod_triangle_counts;
+            if (mesh_quantizations) delete[] mesh_quantizations;
             mesh_triangle_counts = new u32[mesh_count];
+            mesh_first_vertices = new u32[mesh_count];
+            mesh_first_indices = new u32[mesh_count];
+            mesh_first_clusters = new u32[mesh_count];
+            mesh_cluster_counts = new u32[mesh_count];
+            mesh_lod_counts = new u32[mesh_count];
+            lod_first_indices = new u32[mesh_count * MESH_MAX_LOD_COUNT];
+            lod_triangle_counts = new u32[mesh_count * MESH_MAX_LOD_COUNT];
+            mesh_quantizations = new VertexQuantization[mesh_count];
 
             total_triangle_count = 0;
+            total_vertex_count = 0;
+            total_cluster_count = 0;
+            u32 total_max_vertex_count = 0;
+            u32 total_lod_triangle_count = 0;
+            u32 max_lod_triangle_count = 0; // Of all the LODs of a mesh together
 
             u32 max_triangle_count = 0;
+            u32 max_unwelded_triangle_count = 0;
             u32 max_position_count = 0;
             u32 max_normal_count = 0;
             u32 max_tangent_count = 0;
             u32 max_uv_count = 0;
+            u32 max_welded_vertex_count = 0;
 
             Mesh mesh;
             void *file;
             for (u32 m = 0; m < mesh_count; m++) {
                 file = os::openFileForReading(mesh_files[m].char_ptr);
-                readHeader(mesh, file);
+                if (!file) return false;
+                bool header_read = readHeader(mesh, file);
                 os::closeFile(file);
+                if (!header_read) return false;
 
+                mesh_first_indices[m] = total_triangle_count * 3;
                 total_triangle_count += mesh.triangle_count;
+                total_max_vertex_count += getMaxVertexCount(mesh);
 
                 if (mesh.triangle_count > max_triangle_count) max_triangle_count = mesh.triangle_count;
                 if (mesh.vertex_count > max_position_count) max_position_count = mesh.vertex_count;
                 if (mesh.normals_count > max_normal_count) max_normal_count = mesh.normals_count;
                 if (mesh.tangents_count > max_tangent_count) max_tangent_count = mesh.tangents_count;
                 if (mesh.uvs_count > max_uv_count) max_uv_count = mesh.uvs_count;
+                if (mesh.welded_vertex_count > max_welded_vertex_count) max_welded_vertex_count = mesh.welded_vertex_count;
+                if (!mesh.welded_vertex_count && mesh.triangle_count > max_unwelded_triangle_count) max_unwelded_triangle_count = mesh.triangle_count;
                 mesh_triangle_counts[m] = mesh.triangle_count;
+                mesh_first_clusters[m] = total_cluster_count;
+                mesh_cluster_counts[m] = mesh.cluster_count;
+                total_cluster_count += mesh.cluster_count;
+
+                u32 lod_triangle_count = 0;
+                mesh_lod_counts[m] = mesh.lod_count;
+                for (u32 l = 0; l < mesh.lod_count; l++) {
+                    lod_triangle_counts[m * MESH_MAX_LOD_COUNT + l] = mesh.lods[l].triangle_count;
+                    lod_triangle_count += mesh.lods[l].triangle_count;
+                }
+                total_lod_triangle_count += lod_triangle_count;
+                if (lod_triangle_count > max_lod_triangle_count) max_lod_triangle_count = lod_triangle_count;
             }
 
-            // Allocate temporary loading-memory with upper-bounded sizes:
-            mesh.triangles = new Triangle[max_triangle_count];
-            mesh.vertex_positions = new vec3[max_position_count];
-            mesh.vertex_normals = new vec3[max_normal_count];
-            mesh.vertex_tangents = new vec3[max_tangent_count];
-            mesh.vertex_uvs = new vec2[max_uv_count];
-            mesh.vertex_position_indices = new TriangleVertexIndices[max_triangle_count];
-            mesh.vertex_normal_indices = new TriangleVertexIndices[max_triangle_count];
-            mesh.vertex_tangent_indices = new TriangleVertexIndices[max_triangle_count];
-            mesh.vertex_uvs_indices = new TriangleVertexIndices[max_triangle_count];
-            mesh.edge_vertex_indices = new EdgeVertexIndices[max_triangle_count * 3];
-            mesh.bvh.nodes = new BVHNode[max_triangle_count * 2];
-            auto *vertices = new Vertex[total_triangle_count * 3];
-            auto *edges = new Edge[total_triangle_count * 3];
+            u32 first_index = total_triangle_count * 3;
+            for (u32 m = 0; m < mesh_count; m++)
+                for (u32 l = 0; l < mesh_lod_counts[m]; l++) {
+                    lod_first_indices[m * MESH_MAX_LOD_COUNT + l] = first_index;
+                    first_index += lod_triangle_counts[m * MESH_MAX_LOD_COUNT + l] * 3;
+                }
+            u32 index_count = first_index;
+
+            // Clusters get read in place, straight into where they are kept:
+            if (clusters) delete[] clusters;
+            clusters = total_cluster_count ? new MeshCluster[total_cluster_count] : nullptr;
+
+            // Temporary loading-memory with upper-bounded sizes, in this thread's scratch memory:
+            u64 scratch_size = max_triangle_count * (sizeof(Triangle) + sizeof(TriangleVertexIndices) * 5 +
+                                                     sizeof(EdgeVertexIndices) * 3 + sizeof(BVHNode) * 2) +
+                               max_position_count * sizeof(vec3) +
+                               max_normal_count * sizeof(vec3) +
+                               max_tangent_count * sizeof(vec3) +
+                               max_uv_count * sizeof(vec2) +
+                               max_welded_vertex_count * sizeof(MeshVertex) +
+                               max_lod_triangle_count * (sizeof(Triangle) + sizeof(TriangleVertexIndices) + sizeof(BVHNode) * 2) +
+                               total_max_vertex_count * sizeof(Vertex) +
+                               index_count * sizeof(u32) +
+                               total_triangle_count * 3 * sizeof(Edge) +
+                               (max_unwelded_triangle_count ? getCornerWeldingSize(max_unwelded_triangle_count) : 0) +
+                               memory::getAlignedSize(0) * 19; // Padding to align each of the 19 arrays
+            memory::MonotonicAllocator &scratch = memory::getScratchArena(scratch_size);
+            memory::ScratchScope scratch_scope{scratch};
+            mesh.triangles = scratch.allocateArray<Triangle>(max_triangle_count);
+            mesh.vertex_positions = scratch.allocateArray<vec3>(max_position_count);
+            mesh.vertex_normals = scratch.allocateArray<vec3>(max_normal_count);
+            mesh.vertex_tangents = scratch.allocateArray<vec3>(max_tangent_count);
+            mesh.vertex_uvs = scratch.allocateArray<vec2>(max_uv_count);
+            mesh.vertex_position_indices = scratch.allocateArray<TriangleVertexIndices>(max_triangle_count);
+            mesh.vertex_normal_indices = scratch.allocateArray<TriangleVertexIndices>(max_triangle_count);
+            mesh.vertex_tangent_indices = scratch.allocateArray<TriangleVertexIndices>(max_triangle_count);
+            mesh.vertex_uvs_indices = scratch.allocateArray<TriangleVertexIndices>(max_triangle_count);
+            mesh.vertices = scratch.allocateArray<MeshVertex>(max_welded_vertex_count);
+            mesh.vertex_indices = scratch.allocateArray<TriangleVertexIndices>(max_triangle_count);
+            mesh.edge_vertex_indices = scratch.allocateArray<EdgeVertexIndices>(max_triangle_count * 3);
+            mesh.bvh.nodes = scratch.allocateArray<BVHNode>(max_triangle_count * 2);
+            auto *lod_triangles = scratch.allocateArray<Triangle>(max_lod_triangle_count);
+            auto *lod_indices = scratch.allocateArray<TriangleVertexIndices>(max_lod_triangle_count);
+            auto *lod_nodes = scratch.allocateArray<BVHNode>(max_lod_triangle_count * 2);
+            auto *vertices = scratch.allocateArray<Vertex>(total_max_vertex_count);
+            auto *indices = scratch.allocateArray<u32>(index_count);
+            auto *edges = scratch.allocateArray<Edge>(total_triangle_count * 3);
+            if (!vertices || !indices || !edges) return false;
 
+            u32 max_vertex_count = 0;
             for (u32 m = 0; m < mesh_count; m++) {
                 file = os::openFileForReading(mesh_files[m].char_ptr);
-                readHeader(mesh, file);
+                if (!file) return false;
+                if (!readHeader(mesh, file)) {
+                    os::closeFile(file);
+                    return false;
+                }
+                mesh.clusters = clusters + mesh_first_clusters[m];
+                for (u32 l = 0, lod_triangle_offset = 0; l < mesh.lod_count; l++) {
+                    MeshLOD &lod = mesh.lods[l];
+                    lod.triangles = lod_triangles + lod_triangle_offset;
+                    lod.vertex_indices = lod_indices + lod_triangle_offset;
+                    lod.bvh.nodes = lod_nodes + lod_triangle_offset * 2;
+                    lod_triangle_offset += lod.triangle_count;
+                }
                 readContent(mesh, file);
                 os::closeFile(file);
 
-                loadVertices(mesh, vertices);
+                mesh_quantizations[m] = VertexQuantization{getVertexBounds(mesh)};
+                mesh_first_vertices[m] = total_vertex_count;
+                u32 vertex_count = loadIndexedVertices(mesh, vertices + total_vertex_count, indices + mesh_first_indices[m],
+                                                       mesh_quantizations[m]);
+                if (!vertex_count && mesh.triangle_count) return false;
+                for (u32 l = 0; l < mesh.lod_count; l++)
+                    loadLODIndices(mesh.lods[l], indices + lod_first_indices[m * MESH_MAX_LOD_COUNT + l]);
+                total_vertex_count += vertex_count;
+                if (vertex_count > max_vertex_count) max_vertex_count = vertex_count;
+
                 mesh.loadEdges(edges);
-                vertices += mesh.triangle_count * 3;
                 edges += mesh.triangle_count * 3;
             }
-            vertices -= total_triangle_count * 3;
             edges -= total_triangle_count * 3;
 
-            vertex_buffer.create(total_triangle_count * 3, sizeof(Vertex));
-            vertex_buffer.upload(vertices);
-
-            edge_buffer.create(total_triangle_count * 3 * 2, sizeof(vec3));
-            edge_buffer.upload(edges);
-
-            // Cleanup temporary loading-memory:
-            delete[] mesh.triangles;
-            delete[] mesh.vertex_positions;
-            delete[] mesh.vertex_normals;
-            delete[] mesh.vertex_tangents;
-            delete[] mesh.vertex_uvs;
-            delete[] mesh.vertex_position_indices;
-            delete[] mesh.vertex_normal_indices;
-            delete[] mesh.vertex_tangent_indices;
-            delete[] mesh.vertex_uvs_indices;
-            delete[] mesh.edge_vertex_indices;
-            delete[] mesh.bvh.nodes;
-            delete[] vertices;
-            delete[] edges;
+            u8 index_size = getIndexSize(max_vertex_count);
+            packIndices(indices, index_count, index_size);
+
+            return vertex_buffer.create(total_vertex_count, sizeof(Vertex)) &&
+                   vertex_buffer.upload(vertices) &&
+                   index_buffer.create(index_count, index_size) &&
+                   index_buffer.upload(indices) &&
+                   edge_buffer.create(total_triangle_count * 3 * 2, sizeof(vec3)) &&
+                   edge_buffer.upload(edges);
+        }
+
+        void bind(const GraphicsCommandBuffer &command_buffer) const {
+            vertex_buffer.bind(command_buffer);
+            index_buffer.bind(command_buffer);
+        }
+
+        // Draws all of a mesh, or of one of its LODs (see selectLOD(), LODs the mesh does not have falling back to
+        // its coarsest one). Returns the number of triangles drawn:
+        u32 draw(const GraphicsCommandBuffer &command_buffer, u32 mesh_index, u8 lod = 0) const {
+            lod = (u8)Min((u32)lod, mesh_lod_counts[mesh_index]);
+            i32 first_vertex = (i32)mesh_first_vertices[mesh_index];
+            if (lod) {
+                u32 slot = mesh_index * MESH_MAX_LOD_COUNT + lod - 1;
+                index_buffer.draw(command_buffer, lod_triangle_counts[slot] * 3, lod_first_indices[slot], first_vertex);
+                return lod_triangle_counts[slot];
+            }
+
+            index_buffer.draw(command_buffer, mesh_triangle_counts[mesh_index] * 3, mesh_first_indices[mesh_index], first_vertex);
+            return mesh_triangle_counts[mesh_index];
+        }
+
+        // Draws the clusters of a mesh that do not face away from the camera position, merging runs of visible ones
+        // into a draw each. Meshes without clusters get drawn whole, as do LODs (see draw()). The cones of the clusters
+        // only hold under transforms that scale uniformly (and don't mirror), so meshes with other scales get drawn
+        // whole as well. Returns the number of triangles drawn:
+        u32 drawMesh(const GraphicsCommandBuffer &command_buffer, u32 mesh_index, const Transform &transform,
+                     const vec3 &camera_position, u8 lod = 0) const {
+            lod = (u8)Min((u32)lod, mesh_lod_counts[mesh_index]);
+            u32 cluster_count = mesh_cluster_counts[mesh_index];
+            const vec3 &scale = transform.scale;
+            bool uniform_scale = scale.x == scale.y && scale.y == scale.z && scale.x > 0.0f;
+            if (lod || !cluster_count || !uniform_scale) return draw(command_buffer, mesh_index, lod);
+
+            vec3 view_position = transform.internPos(camera_position);
+
+            u32 first_index = mesh_first_indices[mesh_index];
+            i32 first_vertex = (i32)mesh_first_vertices[mesh_index];
+            const MeshCluster *mesh_clusters = clusters + mesh_first_clusters[mesh_index];
+            u32 run_first_triangle = 0;
+            u32 run_triangle_count = 0;
+            u32 drawn_triangle_count = 0;
+            for (u32 c = 0; c < cluster_count; c++) {
+                const MeshCluster &cluster = mesh_clusters[c];
+                if (cluster.isBackFacing(view_position)) continue;
+
+                if (run_triangle_count && run_first_triangle + run_triangle_count == cluster.first_triangle)
+                    run_triangle_count += cluster.triangle_count;
+                else {
+                    if (run_triangle_count)
+                        index_buffer.draw(command_buffer, run_triangle_count * 3, first_index + run_first_triangle * 3, first_vertex);
+                    run_first_triangle = cluster.first_triangle;
+                    run_triangle_count = cluster.triangle_count;
+                }
+                drawn_triangle_count += cluster.triangle_count;
+            }
+            if (run_triangle_count)
+                index_buffer.draw(command_buffer, run_triangle_count * 3, first_index + run_first_triangle * 3, first_vertex);
+
+            return drawn_triangle_count;
         }
 
         void destroy() {
             vertex_buffer.destroy();
+            index_buffer.destroy();
             edge_buffer.destroy();
         }
     };